@@ -0,0 +1,193 @@
+// Microbenchmark for JSON string escaping of SSL payloads.
+//
+// Compares the old per-byte escaper (branch per character, mbrtowc for every
+// non-ASCII byte) with jw_escaped_utf8() on SSE streams shaped like LLM API
+// responses. Run with: make bench
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+
+#include "json_writer.h"
+
+#define PAYLOAD_SIZE 8192
+#define MIN_BENCH_NS 200000000ULL
+
+// Old sslsniff validate_utf8_char(), kept here as the baseline
+static int legacy_utf8_len(const unsigned char *str, size_t remaining) {
+    unsigned char c = str[0];
+    int expected_len;
+
+    if ((c & 0xE0) == 0xC0) expected_len = 2;
+    else if ((c & 0xF0) == 0xE0) expected_len = 3;
+    else if ((c & 0xF8) == 0xF0) expected_len = 4;
+    else return 0;
+    if (remaining < (size_t)expected_len) return 0;
+
+    char temp[5] = {0};
+    memcpy(temp, str, expected_len);
+    wchar_t wc;
+    mbstate_t state;
+    memset(&state, 0, sizeof(state));
+    size_t result = mbrtowc(&wc, temp, expected_len, &state);
+    if (result == (size_t)-1 || result == (size_t)-2 || result == 0)
+        return 0;
+    return expected_len;
+}
+
+// Old print_event() data loop, writing into the buffer instead of stdout
+static void legacy_escape(struct json_writer *w, const unsigned char *buf, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = buf[i];
+        if (c == '"' || c == '\\') {
+            jw_char(w, '\\');
+            jw_char(w, c);
+        } else if (c == '\n') {
+            jw_raw(w, "\\n", 2);
+        } else if (c == '\r') {
+            jw_raw(w, "\\r", 2);
+        } else if (c == '\t') {
+            jw_raw(w, "\\t", 2);
+        } else if (c == '\b') {
+            jw_raw(w, "\\b", 2);
+        } else if (c == '\f') {
+            jw_raw(w, "\\f", 2);
+        } else if (c >= 32 && c <= 126) {
+            jw_char(w, c);
+        } else if (c >= 128) {
+            int len = legacy_utf8_len(&buf[i], n - i);
+            if (len > 0) {
+                for (int j = 0; j < len; j++)
+                    jw_char(w, buf[i + j]);
+                i += len - 1;
+            } else {
+                jw_printf(w, "\\u%04x", c);
+            }
+        } else {
+            jw_printf(w, "\\u%04x", c);
+        }
+    }
+}
+
+struct payload {
+    const char *name;
+    const char *frame;   // printf format taking the text chunk
+    const char *text;
+};
+
+static const struct payload payloads[] = {
+    {
+        "anthropic-sse-english",
+        "event: content_block_delta\r\ndata: {\"type\":\"content_block_delta\",\"index\":0,"
+        "\"delta\":{\"type\":\"text_delta\",\"text\":\"%s\"}}\r\n\r\n",
+        "Sure! Here is a function that parses the config file and returns a map.",
+    },
+    {
+        "anthropic-sse-cjk",
+        "event: content_block_delta\r\ndata: {\"type\":\"content_block_delta\",\"index\":0,"
+        "\"delta\":{\"type\":\"text_delta\",\"text\":\"%s\"}}\r\n\r\n",
+        "\xe5\xbd\x93\xe7\x84\xb6\xef\xbc\x81\xe8\xbf\x99\xe6\x98\xaf\xe4\xb8\x80\xe4\xb8\xaa"
+        "\xe8\xa7\xa3\xe6\x9e\x90\xe9\x85\x8d\xe7\xbd\xae\xe6\x96\x87\xe4\xbb\xb6\xe7\x9a\x84"
+        "\xe5\x87\xbd\xe6\x95\xb0\xe3\x80\x82",
+    },
+    {
+        "openai-sse-emoji",
+        "data: {\"id\":\"chatcmpl-9x\",\"object\":\"chat.completion.chunk\",\"choices\":"
+        "[{\"index\":0,\"delta\":{\"content\":\"%s\"},\"finish_reason\":null}]}\n\n",
+        "Done \xf0\x9f\x8e\x89 the build passes \xe2\x9c\x85 and tests are green \xf0\x9f\x9f\xa2",
+    },
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Repeat SSE frames until the buffer holds PAYLOAD_SIZE bytes
+static size_t build_payload(const struct payload *p, unsigned char *buf) {
+    size_t len = 0;
+    char frame[1024];
+
+    while (len < PAYLOAD_SIZE) {
+        int n = snprintf(frame, sizeof(frame), p->frame, p->text);
+        if (n <= 0)
+            break;
+        size_t take = (size_t)n < PAYLOAD_SIZE - len ? (size_t)n : PAYLOAD_SIZE - len;
+        memcpy(buf + len, frame, take);
+        len += take;
+    }
+    return len;
+}
+
+typedef void (*escape_fn)(struct json_writer *w, const unsigned char *buf, size_t n);
+
+static void fast_escape(struct json_writer *w, const unsigned char *buf, size_t n) {
+    jw_escaped_utf8(w, (const char *)buf, n);
+}
+
+// Returns MB/s of input escaped
+static double run(escape_fn fn, struct json_writer *w, const unsigned char *buf, size_t n) {
+    uint64_t start = now_ns(), elapsed;
+    uint64_t iters = 0;
+
+    do {
+        for (int i = 0; i < 64; i++) {
+            w->len = 0;
+            fn(w, buf, n);
+        }
+        iters += 64;
+        elapsed = now_ns() - start;
+    } while (elapsed < MIN_BENCH_NS);
+
+    return (double)n * iters / (elapsed / 1e9) / (1024 * 1024);
+}
+
+int main(void) {
+    static unsigned char buf[PAYLOAD_SIZE];
+    struct json_writer legacy, fast;
+
+    // The legacy path needs a UTF-8 locale for mbrtowc
+    if (!setlocale(LC_ALL, "C.UTF-8"))
+        setlocale(LC_ALL, "");
+
+    if (jw_init(&legacy, -1, 0) || jw_init(&fast, -1, 0)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+#if defined(__AVX2__)
+    printf("vector path: AVX2\n");
+#elif defined(__SSE2__)
+    printf("vector path: SSE2\n");
+#elif defined(__ARM_NEON)
+    printf("vector path: NEON\n");
+#else
+    printf("vector path: scalar\n");
+#endif
+    printf("%-24s %12s %12s %8s\n", "payload", "legacy MB/s", "new MB/s", "speedup");
+
+    for (size_t i = 0; i < sizeof(payloads) / sizeof(payloads[0]); i++) {
+        size_t n = build_payload(&payloads[i], buf);
+
+        // Both must produce the same JSON before timing means anything
+        legacy.len = fast.len = 0;
+        legacy_escape(&legacy, buf, n);
+        fast_escape(&fast, buf, n);
+        if (legacy.len != fast.len || memcmp(legacy.buf, fast.buf, fast.len)) {
+            fprintf(stderr, "%s: output mismatch\n", payloads[i].name);
+            return 1;
+        }
+
+        double old_mbs = run(legacy_escape, &legacy, buf, n);
+        double new_mbs = run(fast_escape, &fast, buf, n);
+        printf("%-24s %12.1f %12.1f %7.1fx\n", payloads[i].name, old_mbs, new_mbs, new_mbs / old_mbs);
+    }
+
+    legacy.len = fast.len = 0;
+    jw_free(&legacy);
+    jw_free(&fast);
+    return 0;
+}
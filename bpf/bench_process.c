@@ -0,0 +1,330 @@
+// Replay benchmark for the process tracer's userspace pipeline.
+//
+// Builds ring buffer streams shaped like busy hosts (build fork storms, file
+// open storms, interactive shells) and feeds every record to process.c's own
+// handle_event(), with the output going to a memory writer. Run with:
+// make bench-replay, or ./bench_process -h for the options.
+#define main process_main
+#include "process.c"
+#undef main
+
+#include <fcntl.h>
+#include <getopt.h>
+
+#include "bench_replay.h"
+
+#define BENCH_BASE_NS 1000000000000ULL
+#define BENCH_PID_BASE 100000
+
+static const char *const bench_tools[] = { "cc1", "as", "ld", "sh", "make", "python3", "node", "git" };
+static const char *const bench_dirs[] = { "/usr/include", "/usr/lib/gcc/x86_64-linux-gnu/12/include",
+                                          "/home/dev/src/app/include", "/proc/self", "/tmp" };
+
+static uint64_t bench_ts = BENCH_BASE_NS;
+
+static void bench_header(struct event_header *hdr, enum event_type type, int pid, const char *comm,
+                         uint64_t gap_ns) {
+    bench_ts += gap_ns;
+    hdr->type = type;
+    hdr->pid = pid;
+    hdr->timestamp_ns = bench_ts;
+    strncpy(hdr->comm, comm, TASK_COMM_LEN - 1);
+}
+
+// Records are cut after their last string, like the kernel sends them
+static int add_exec(struct replay_stream *s, int pid, int ppid, const char *comm, const char *args) {
+    struct exec_event *e = replay_add(s, sizeof(*e));
+    char filename[64];
+
+    if (!e)
+        return -ENOMEM;
+    bench_header(&e->hdr, EVENT_TYPE_EXEC, pid, comm, 3000);
+    e->ppid = ppid;
+    snprintf(filename, sizeof(filename), "/usr/bin/%s", comm);
+    e->filename_len = strlen(filename) + 1;
+    e->args_len = strnlen(args, MAX_ARGS_LEN - 1) + 1;
+    e->args_total = e->args_len;
+    memcpy(e->data, filename, e->filename_len);
+    memcpy(e->data + e->filename_len, args, e->args_len - 1);
+    replay_trim(s, e, offsetof(struct exec_event, data) + e->filename_len + e->args_len);
+    return 0;
+}
+
+static int add_exit(struct replay_stream *s, int pid, int ppid, const char *comm) {
+    struct exit_event *e = replay_add(s, sizeof(*e));
+
+    if (!e)
+        return -ENOMEM;
+    bench_header(&e->hdr, EVENT_TYPE_EXIT, pid, comm, 2000);
+    e->ppid = ppid;
+    e->duration_ns = 15000000;
+    return 0;
+}
+
+static int add_open(struct replay_stream *s, int pid, const char *comm, const char *path) {
+    struct file_op_event *e = replay_add(s, sizeof(*e));
+    size_t len = strnlen(path, MAX_FILENAME_LEN - 1);
+
+    if (!e)
+        return -ENOMEM;
+    bench_header(&e->hdr, EVENT_TYPE_FILE_OPERATION, pid, comm, 1500);
+    e->fd = 3;
+    e->flags = O_RDONLY | O_CLOEXEC;
+    e->is_open = true;
+    memcpy(e->filepath, path, len);
+    replay_trim(s, e, offsetof(struct file_op_event, filepath) + len + 1);
+    return 0;
+}
+
+static int add_readline(struct replay_stream *s, int pid, const char *command) {
+    struct bash_readline_event *e = replay_add(s, sizeof(*e));
+    size_t len = strnlen(command, MAX_COMMAND_LEN - 1);
+
+    if (!e)
+        return -ENOMEM;
+    bench_header(&e->hdr, EVENT_TYPE_BASH_READLINE, pid, "bash", 400000000);
+    memcpy(e->command, command, len);
+    replay_trim(s, e, offsetof(struct bash_readline_event, command) + len + 1);
+    return 0;
+}
+
+// make -j64: waves of short-lived compilers, each reading a few headers
+static int gen_fork_storm(struct replay_stream *s, uint64_t *rng, int scale) {
+    int pid = BENCH_PID_BASE, err = 0;
+    char args[128], path[128];
+
+    for (int wave = 0; wave < 40 * scale && !err; wave++) {
+        int first = pid;
+
+        for (int i = 0; i < 64 && !err; i++, pid++) {
+            const char *tool = bench_tools[replay_range(rng, 0, 7)];
+
+            snprintf(args, sizeof(args), "%s -O2 -c src/module_%d.c -o build/module_%d.o", tool, pid, pid);
+            err = add_exec(s, pid, BENCH_PID_BASE - 1, tool, args);
+            for (int f = 0; f < 4 && !err; f++) {
+                snprintf(path, sizeof(path), "%s/header_%u.h", bench_dirs[replay_range(rng, 0, 2)],
+                         replay_range(rng, 0, 200));
+                err = add_open(s, pid, tool, path);
+            }
+        }
+        for (int p = first; p < pid && !err; p++)
+            err = add_exit(s, p, BENCH_PID_BASE - 1, "cc1");
+    }
+    return err;
+}
+
+// A few processes opening files as fast as they can: mostly repeats of a hot
+// set (dedup), plus a stream of distinct paths
+static int gen_open_storm(struct replay_stream *s, uint64_t *rng, int scale) {
+    char path[128];
+    int err = 0;
+
+    for (int p = 0; p < 16 && !err; p++)
+        err = add_exec(s, BENCH_PID_BASE + p, 1, "node", "node server.js");
+    for (int i = 0; i < 20000 * scale && !err; i++) {
+        int pid = BENCH_PID_BASE + replay_range(rng, 0, 15);
+
+        if (replay_range(rng, 0, 9) < 6)
+            snprintf(path, sizeof(path), "/home/dev/src/app/node_modules/lib_%u/index.js",
+                     replay_range(rng, 0, 63));
+        else
+            snprintf(path, sizeof(path), "/proc/%u/stat", replay_range(rng, 1, 4000000));
+        err = add_open(s, pid, "node", path);
+    }
+    for (int p = 0; p < 16 && !err; p++)
+        err = add_exit(s, BENCH_PID_BASE + p, 1, "node");
+    return err;
+}
+
+// Interactive shells: commands, each spawning a child that opens a file or two
+static int gen_shell(struct replay_stream *s, uint64_t *rng, int scale) {
+    static const char *const commands[] = { "git status", "ls -la src", "make test",
+                                            "grep -rn TODO src | head", "python3 -m pytest -x" };
+    int pid = BENCH_PID_BASE, err = 0;
+    char path[128];
+
+    for (int i = 0; i < 4000 * scale && !err; i++, pid++) {
+        const char *cmd = commands[replay_range(rng, 0, 4)];
+
+        err = add_readline(s, BENCH_PID_BASE - 2, cmd);
+        if (!err)
+            err = add_exec(s, pid, BENCH_PID_BASE - 2, "git", cmd);
+        snprintf(path, sizeof(path), "/home/dev/src/app/.git/objects/%02x", replay_range(rng, 0, 255));
+        if (!err)
+            err = add_open(s, pid, "git", path);
+        if (!err)
+            err = add_exit(s, pid, BENCH_PID_BASE - 2, "git");
+    }
+    return err;
+}
+
+static int gen_mixed(struct replay_stream *s, uint64_t *rng, int scale) {
+    int err = gen_fork_storm(s, rng, scale);
+
+    if (!err)
+        err = gen_open_storm(s, rng, scale);
+    if (!err)
+        err = gen_shell(s, rng, scale);
+    return err;
+}
+
+struct bench_workload {
+    const char *name;
+    int (*gen)(struct replay_stream *s, uint64_t *rng, int scale);
+};
+
+static const struct bench_workload workloads[] = {
+    { "fork-storm", gen_fork_storm },
+    { "file-open-storm", gen_open_storm },
+    { "shell", gen_shell },
+    { "mixed", gen_mixed },
+};
+
+// Hand out what one record added to the memory writer
+static size_t bench_take_output(void) {
+    size_t n = out.len;
+
+    out.len = 0;
+    return n;
+}
+
+static size_t bench_handle(void *data, size_t size) {
+    handle_event(&pid_tracker, data, size);
+    return bench_take_output();
+}
+
+static void bench_reset(void) {
+    file_dedup_free(&file_dedup);
+    pid_tracker_free(&pid_tracker);
+    if (file_dedup_init(&file_dedup, env.dedup_entries, FILE_DEDUP_WINDOW_NS) ||
+        pid_tracker_init(&pid_tracker, NULL, 0, env.filter_mode, 0)) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    out.len = 0;
+}
+
+// Aggregated FILE_OPENs still waiting for their window
+static size_t bench_finish(void) {
+    file_dedup_expire(&file_dedup, UINT64_MAX, emit_file_open_aggregate, NULL);
+    return bench_take_output();
+}
+
+static const struct replay_target target = {
+    .handle = bench_handle,
+    .reset = bench_reset,
+    .finish = bench_finish,
+};
+
+static int bench_one(const char *name, const struct replay_stream *s) {
+    struct replay_result r;
+    int err = replay_run(s, &target, &r);
+
+    if (err) {
+        fprintf(stderr, "%s: %s\n", name, strerror(-err));
+        return err;
+    }
+    replay_print(name, s, &r);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-b] [-m mode] [-n scale] [-w workload] [-s file] [-r file]\n"
+            "  -b           binary output instead of JSON\n"
+            "  -m mode      filter mode, 0 (all) or 1 (proc, default)\n"
+            "  -n scale     multiply the synthetic stream sizes (default 1)\n"
+            "  -w workload  run one of: fork-storm file-open-storm shell mixed\n"
+            "  -s file      save the workload's stream to file\n"
+            "  -r file      replay a saved stream instead\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    const char *workload = NULL, *save = NULL, *replay = NULL;
+    int scale = 1, opt, err = 0;
+
+    env.filter_mode = FILTER_MODE_PROC;
+    while ((opt = getopt(argc, argv, "bm:n:w:s:r:h")) != -1) {
+        switch (opt) {
+        case 'b':
+            env.format = OUTPUT_FORMAT_BINARY;
+            break;
+        case 'm':
+            env.filter_mode = atoi(optarg) == 0 ? FILTER_MODE_ALL : FILTER_MODE_PROC;
+            break;
+        case 'n':
+            scale = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 'w':
+            workload = optarg;
+            break;
+        case 's':
+            save = optarg;
+            break;
+        case 'r':
+            replay = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    for (size_t i = 0; workload && i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        if (!strcmp(workload, workloads[i].name))
+            break;
+        if (i == sizeof(workloads) / sizeof(workloads[0]) - 1) {
+            fprintf(stderr, "unknown workload %s\n", workload);
+            return 1;
+        }
+    }
+    if (save && !workload) {
+        fprintf(stderr, "-s needs -w\n");
+        return 1;
+    }
+
+    if (jw_init(&out, -1, 0) || file_dedup_init(&file_dedup, env.dedup_entries, FILE_DEDUP_WINDOW_NS) ||
+        pid_tracker_init(&pid_tracker, NULL, 0, env.filter_mode, 0)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    out.binary = env.format == OUTPUT_FORMAT_BINARY;
+
+    printf("process: %s output, filter mode %d\n", out.binary ? "binary" : "JSON", env.filter_mode);
+    replay_print_header();
+
+    if (replay) {
+        struct replay_stream s;
+
+        err = replay_load(&s, replay);
+        if (err) {
+            fprintf(stderr, "%s: %s\n", replay, strerror(-err));
+            return 1;
+        }
+        err = bench_one(replay, &s);
+        replay_free(&s);
+    }
+
+    for (size_t i = 0; !replay && !err && i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        struct replay_stream s = {};
+        uint64_t rng = 0x9e3779b97f4a7c15ULL;
+
+        if (workload && strcmp(workload, workloads[i].name))
+            continue;
+        bench_ts = BENCH_BASE_NS;
+        err = workloads[i].gen(&s, &rng, scale);
+        if (!err && save)
+            err = replay_save(&s, save);
+        if (!err)
+            err = bench_one(workloads[i].name, &s);
+        else
+            fprintf(stderr, "%s: %s\n", workloads[i].name, strerror(-err));
+        replay_free(&s);
+    }
+
+    file_dedup_free(&file_dedup);
+    pid_tracker_free(&pid_tracker);
+    out.len = 0;
+    jw_free(&out);
+    return err ? 1 : 0;
+}
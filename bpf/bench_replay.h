@@ -0,0 +1,287 @@
+// Replay harness for the tracers' userspace pipelines.
+//
+// A stream is a run of ring buffer records laid out the way the kernel hands
+// them to handle_event(): each record 8-byte aligned behind a small header.
+// bench_process.c and bench_sslsniff.c build synthetic streams, or load one
+// saved earlier, and push every record through the tool's own handler,
+// timing each call and counting heap allocations.
+//
+// Include from exactly one file: it defines malloc() and friends.
+#ifndef __BENCH_REPLAY_H
+#define __BENCH_REPLAY_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define REPLAY_MAGIC "AGRP\x01\0\0\0"
+#define REPLAY_MAGIC_LEN 8
+#define REPLAY_ALIGN 8
+#define REPLAY_MIN_NS 500000000ULL  // throughput passes run at least this long
+
+// Record header in memory and in saved files
+struct replay_rec {
+    uint32_t size;      // bytes of the ring record that follows
+    uint32_t reserved;
+};
+
+struct replay_stream {
+    unsigned char *buf;
+    size_t len;
+    size_t cap;
+    size_t count;       // records
+    size_t bytes;       // sum of record sizes
+};
+
+// Heap calls made by the process, read around the measured section
+static uint64_t replay_allocs;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    replay_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    replay_allocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    replay_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+static inline uint64_t replay_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// xorshift64*, so a workload is the same stream on every run
+static inline uint64_t replay_rand(uint64_t *state) {
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+static inline uint32_t replay_range(uint64_t *state, uint32_t lo, uint32_t hi) {
+    return lo + (uint32_t)(replay_rand(state) % (hi - lo + 1));
+}
+
+static inline size_t replay_rec_space(size_t size) {
+    return sizeof(struct replay_rec) + ((size + REPLAY_ALIGN - 1) & ~(size_t)(REPLAY_ALIGN - 1));
+}
+
+// Append a zeroed record of size bytes, returns where to build it or NULL
+static inline void *replay_add(struct replay_stream *s, size_t size) {
+    size_t need = replay_rec_space(size);
+
+    if (s->len + need > s->cap) {
+        size_t cap = s->cap ? s->cap : 1 << 20;
+        unsigned char *buf;
+
+        while (cap < s->len + need)
+            cap *= 2;
+        buf = realloc(s->buf, cap);
+        if (!buf)
+            return NULL;
+        s->buf = buf;
+        s->cap = cap;
+    }
+
+    struct replay_rec *rec = (struct replay_rec *)(s->buf + s->len);
+    memset(rec, 0, need);
+    rec->size = size;
+    s->len += need;
+    s->count++;
+    s->bytes += size;
+    return rec + 1;
+}
+
+// Give back the tail of the record just added, for variable length records
+static inline void replay_trim(struct replay_stream *s, void *data, size_t size) {
+    struct replay_rec *rec = (struct replay_rec *)data - 1;
+
+    s->len -= replay_rec_space(rec->size) - replay_rec_space(size);
+    s->bytes -= rec->size - size;
+    rec->size = size;
+}
+
+// Walk the records: start with *off = 0, returns NULL at the end
+static inline void *replay_next(const struct replay_stream *s, size_t *off, size_t *size) {
+    if (*off + sizeof(struct replay_rec) > s->len)
+        return NULL;
+
+    struct replay_rec *rec = (struct replay_rec *)(s->buf + *off);
+    if (*off + replay_rec_space(rec->size) > s->len)
+        return NULL;
+    *off += replay_rec_space(rec->size);
+    *size = rec->size;
+    return rec + 1;
+}
+
+static inline void replay_free(struct replay_stream *s) {
+    free(s->buf);
+    memset(s, 0, sizeof(*s));
+}
+
+static inline int replay_save(const struct replay_stream *s, const char *path) {
+    FILE *f = fopen(path, "wb");
+    int err = 0;
+
+    if (!f)
+        return -errno;
+    if (fwrite(REPLAY_MAGIC, 1, REPLAY_MAGIC_LEN, f) != REPLAY_MAGIC_LEN ||
+        fwrite(s->buf, 1, s->len, f) != s->len)
+        err = -EIO;
+    if (fclose(f) && !err)
+        err = -errno;
+    return err;
+}
+
+// Load a saved stream, checking every record header
+static inline int replay_load(struct replay_stream *s, const char *path) {
+    char magic[REPLAY_MAGIC_LEN];
+    FILE *f = fopen(path, "rb");
+    long size;
+    int err = 0;
+
+    memset(s, 0, sizeof(*s));
+    if (!f)
+        return -errno;
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+        memcmp(magic, REPLAY_MAGIC, REPLAY_MAGIC_LEN) ||
+        fseek(f, 0, SEEK_END) || (size = ftell(f)) < REPLAY_MAGIC_LEN ||
+        fseek(f, REPLAY_MAGIC_LEN, SEEK_SET)) {
+        fclose(f);
+        return -EINVAL;
+    }
+
+    s->cap = s->len = size - REPLAY_MAGIC_LEN;
+    s->buf = malloc(s->cap ? s->cap : 1);
+    if (!s->buf)
+        err = -ENOMEM;
+    else if (fread(s->buf, 1, s->len, f) != s->len)
+        err = -EIO;
+    fclose(f);
+
+    for (size_t off = 0, n; !err && off < s->len;) {
+        if (!replay_next(s, &off, &n))
+            err = -EINVAL;
+        s->count++;
+        s->bytes += n;
+    }
+    if (err)
+        replay_free(s);
+    return err;
+}
+
+/*
+ * The tool under test: handle() feeds one record and returns the output bytes
+ * it produced, reset() brings the tool back to its state before the stream
+ * and finish() flushes whatever it still holds at the end of one.
+ */
+struct replay_target {
+    size_t (*handle)(void *data, size_t size);
+    void (*reset)(void);
+    size_t (*finish)(void);
+};
+
+struct replay_result {
+    uint64_t events;
+    uint64_t in_bytes;
+    uint64_t out_bytes;
+    double events_per_sec;
+    double in_mb_per_sec;
+    double out_mb_per_sec;
+    uint32_t p50_ns;
+    uint32_t p99_ns;
+    uint32_t max_ns;
+    double allocs_per_event;
+};
+
+static int replay_cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Throughput comes from whole passes without per-event clocks, repeated for
+ * REPLAY_MIN_NS. A last pass timing each handle() call gives the latency
+ * percentiles and the allocation count.
+ */
+static inline int replay_run(const struct replay_stream *s, const struct replay_target *t,
+                             struct replay_result *r) {
+    uint64_t elapsed = 0, passes = 0, out = 0;
+    uint32_t *lat;
+    size_t off, size, i;
+    void *data;
+
+    memset(r, 0, sizeof(*r));
+    if (!s->count)
+        return -EINVAL;
+    lat = malloc(s->count * sizeof(*lat));
+    if (!lat)
+        return -ENOMEM;
+
+    do {
+        t->reset();
+        uint64_t start = replay_now_ns();
+        for (off = 0; (data = replay_next(s, &off, &size));)
+            out += t->handle(data, size);
+        out += t->finish();
+        elapsed += replay_now_ns() - start;
+        passes++;
+    } while (elapsed < REPLAY_MIN_NS);
+
+    r->events = s->count * passes;
+    r->in_bytes = s->bytes * passes;
+    r->out_bytes = out;
+    r->events_per_sec = r->events / (elapsed / 1e9);
+    r->in_mb_per_sec = r->in_bytes / (elapsed / 1e9) / (1024 * 1024);
+    r->out_mb_per_sec = r->out_bytes / (elapsed / 1e9) / (1024 * 1024);
+
+    t->reset();
+    uint64_t allocs = replay_allocs;
+    for (off = 0, i = 0; (data = replay_next(s, &off, &size)); i++) {
+        uint64_t start = replay_now_ns();
+        t->handle(data, size);
+        lat[i] = replay_now_ns() - start;
+    }
+    t->finish();
+    r->allocs_per_event = (double)(replay_allocs - allocs) / s->count;
+
+    qsort(lat, s->count, sizeof(*lat), replay_cmp_u32);
+    r->p50_ns = lat[s->count / 2];
+    r->p99_ns = lat[s->count * 99 / 100];
+    r->max_ns = lat[s->count - 1];
+    free(lat);
+    return 0;
+}
+
+static inline void replay_print_header(void) {
+    printf("%-22s %9s %12s %9s %9s %8s %8s %9s %9s\n", "workload", "events", "events/s",
+           "in MB/s", "out MB/s", "p50 ns", "p99 ns", "max ns", "allocs/ev");
+}
+
+static inline void replay_print(const char *name, const struct replay_stream *s,
+                                const struct replay_result *r) {
+    printf("%-22s %9zu %12.0f %9.1f %9.1f %8u %8u %9u %9.3f\n", name, s->count,
+           r->events_per_sec, r->in_mb_per_sec, r->out_mb_per_sec, r->p50_ns, r->p99_ns,
+           r->max_ns, r->allocs_per_event);
+}
+
+#endif /* __BENCH_REPLAY_H */
@@ -0,0 +1,341 @@
+// Replay benchmark for sslsniff's userspace pipeline.
+//
+// Builds ring buffer streams of SSL records shaped like LLM agent traffic
+// (SSE token streams, large request uploads, short-lived connections) and
+// feeds every record to sslsniff.c's own handle_event(), with the output
+// going to a memory writer. Run with: make bench-replay, or
+// ./bench_sslsniff -h for the options.
+#define main sslsniff_main
+#include "sslsniff.c"
+#undef main
+
+#include <getopt.h>
+
+#include "bench_replay.h"
+
+#define BENCH_BASE_NS 1000000000000ULL
+#define BENCH_PID_BASE 4000
+#define BENCH_SSL_BASE 0x55d0c0de0000ULL
+
+static uint64_t bench_ts = BENCH_BASE_NS;
+
+// One SSL call: the header, then the first buf_size of len bytes of payload
+static int add_ssl(struct replay_stream *s, uint32_t pid, uint64_t ssl, int rw, const char *comm,
+                   const void *buf, uint32_t len, uint32_t buf_size, uint64_t gap_ns) {
+    struct probe_SSL_data_t *e = replay_add(s, SSL_DATA_HDR_SIZE + buf_size);
+
+    if (!e)
+        return -ENOMEM;
+    bench_ts += gap_ns;
+    e->timestamp_ns = bench_ts;
+    e->delta_ns = 12000;
+    e->pid = pid;
+    e->tid = pid;
+    e->uid = 1000;
+    e->len = len;
+    e->buf_size = buf_size;
+    e->buf_filled = buf_size > 0;
+    e->rw = rw;
+    e->ssl = ssl;
+    e->fd = 20 + (ssl & 0xff);
+    strncpy(e->comm, comm, TASK_COMM_LEN - 1);
+    memcpy(e->buf, buf, buf_size);
+    return 0;
+}
+
+static int add_handshake(struct replay_stream *s, uint32_t pid, uint64_t ssl, const char *comm) {
+    struct probe_SSL_data_t *e = replay_add(s, SSL_DATA_HDR_SIZE);
+
+    if (!e)
+        return -ENOMEM;
+    bench_ts += 30000;
+    e->timestamp_ns = bench_ts;
+    e->delta_ns = 4000000;
+    e->pid = pid;
+    e->tid = pid;
+    e->uid = 1000;
+    e->rw = SSL_PROBE_HANDSHAKE;
+    e->is_handshake = 1;
+    e->ssl = ssl;
+    e->fd = -1;
+    strncpy(e->comm, comm, TASK_COMM_LEN - 1);
+    return 0;
+}
+
+static int add_text(struct replay_stream *s, uint32_t pid, uint64_t ssl, int rw, const char *comm,
+                    const char *text, uint64_t gap_ns) {
+    size_t len = strlen(text);
+
+    return add_ssl(s, pid, ssl, rw, comm, text, len, len, gap_ns);
+}
+
+static int add_request(struct replay_stream *s, uint32_t pid, uint64_t ssl, const char *comm,
+                       size_t body_len) {
+    char head[256];
+
+    snprintf(head, sizeof(head),
+             "POST /v1/messages HTTP/1.1\r\nHost: api.anthropic.com\r\n"
+             "Content-Type: application/json\r\nAccept: text/event-stream\r\n"
+             "Content-Length: %zu\r\n\r\n", body_len);
+    return add_text(s, pid, ssl, SSL_PROBE_WRITE, comm, head, 20000);
+}
+
+// Streamed completions: concurrent connections, each a request and a
+// chunked event stream of small token deltas
+static int gen_sse(struct replay_stream *s, uint64_t *rng, int scale) {
+    static const char *const tokens[] = { "Sure", "! Here", " is a", " function", " that",
+                                          " parses", " the \\\"config\\\"", " file.\\n",
+                                          " \xe2\x9c\x85", " \xe5\xbd\x93\xe7\x84\xb6" };
+    static const char body[] = "{\"model\":\"claude\",\"stream\":true,\"max_tokens\":1024,"
+                               "\"messages\":[{\"role\":\"user\",\"content\":\"Write a config parser\"}]}";
+    static const char head[] = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                               "Transfer-Encoding: chunked\r\n\r\n";
+    char event[512], chunk[600];
+    int err = 0;
+
+    for (int round = 0; round < 25 * scale && !err; round++) {
+        for (int c = 0; c < 8 && !err; c++) {
+            uint64_t ssl = BENCH_SSL_BASE + c * 0x1000;
+
+            err = add_request(s, BENCH_PID_BASE, ssl, "node", sizeof(body) - 1);
+            if (!err)
+                err = add_text(s, BENCH_PID_BASE, ssl, SSL_PROBE_WRITE, "node", body, 5000);
+            if (!err)
+                err = add_text(s, BENCH_PID_BASE, ssl, SSL_PROBE_READ, "node", head, 300000);
+        }
+        for (int i = 0; i < 8 * 60 && !err; i++) {
+            uint64_t ssl = BENCH_SSL_BASE + replay_range(rng, 0, 7) * 0x1000;
+            int n = snprintf(event, sizeof(event),
+                             "event: content_block_delta\r\ndata: {\"type\":\"content_block_delta\","
+                             "\"index\":0,\"delta\":{\"type\":\"text_delta\",\"text\":\"%s\"}}\r\n\r\n",
+                             tokens[replay_range(rng, 0, 9)]);
+
+            snprintf(chunk, sizeof(chunk), "%x\r\n%s\r\n", n, event);
+            err = add_text(s, BENCH_PID_BASE, ssl, SSL_PROBE_READ, "node", chunk, 40000);
+        }
+        for (int c = 0; c < 8 && !err; c++)
+            err = add_text(s, BENCH_PID_BASE, BENCH_SSL_BASE + c * 0x1000, SSL_PROBE_READ, "node",
+                           "0\r\n\r\n", 10000);
+    }
+    return err;
+}
+
+// Requests carrying whole files and images: 1 MB bodies of base64 text or
+// raw bytes, written 64 KB at a time
+#define UPLOAD_SIZE (1024 * 1024)
+#define UPLOAD_WRITE (64 * 1024)
+
+static int gen_uploads(struct replay_stream *s, uint64_t *rng, int scale) {
+    static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    unsigned char *body = malloc(UPLOAD_SIZE);
+    int err = 0;
+
+    if (!body)
+        return -ENOMEM;
+    for (int u = 0; u < 8 * scale && !err; u++) {
+        uint64_t ssl = BENCH_SSL_BASE + (u % 4) * 0x1000;
+
+        // one upload in four is compressed data, the worst case for escaping
+        for (size_t i = 0; i < UPLOAD_SIZE; i++)
+            body[i] = u % 4 == 3 ? replay_rand(rng) : b64[replay_range(rng, 0, 63)];
+
+        err = add_request(s, BENCH_PID_BASE + 1, ssl, "python3", UPLOAD_SIZE);
+        for (size_t off = 0; off < UPLOAD_SIZE && !err; off += UPLOAD_WRITE)
+            err = add_ssl(s, BENCH_PID_BASE + 1, ssl, SSL_PROBE_WRITE, "python3", body + off,
+                          UPLOAD_WRITE, UPLOAD_WRITE, 200000);
+        if (!err)
+            err = add_text(s, BENCH_PID_BASE + 1, ssl, SSL_PROBE_READ, "python3",
+                           "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                           "Content-Length: 16\r\n\r\n{\"status\":\"ok\"}\n", 2000000);
+    }
+    free(body);
+    return err;
+}
+
+// Health checks and token refreshes: many short connections, each a
+// handshake, one request and one small response
+static int gen_handshakes(struct replay_stream *s, uint64_t *rng, int scale) {
+    int err = 0;
+
+    for (int c = 0; c < 4000 * scale && !err; c++) {
+        uint32_t pid = BENCH_PID_BASE + 10 + replay_range(rng, 0, 31);
+        uint64_t ssl = BENCH_SSL_BASE + 0x100000 + (uint64_t)c * 0x1000;
+
+        err = add_handshake(s, pid, ssl, "curl");
+        if (!err)
+            err = add_text(s, pid, ssl, SSL_PROBE_WRITE, "curl",
+                           "GET /healthz HTTP/1.1\r\nHost: internal.example.com\r\n"
+                           "User-Agent: curl/8.5.0\r\nAccept: */*\r\n\r\n", 50000);
+        if (!err)
+            err = add_text(s, pid, ssl, SSL_PROBE_READ, "curl",
+                           "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok", 800000);
+    }
+    return err;
+}
+
+static int gen_mixed(struct replay_stream *s, uint64_t *rng, int scale) {
+    int err = gen_sse(s, rng, scale);
+
+    if (!err)
+        err = gen_uploads(s, rng, scale);
+    if (!err)
+        err = gen_handshakes(s, rng, scale);
+    return err;
+}
+
+struct bench_workload {
+    const char *name;
+    int (*gen)(struct replay_stream *s, uint64_t *rng, int scale);
+};
+
+static const struct bench_workload workloads[] = {
+    { "sse-stream", gen_sse },
+    { "large-upload", gen_uploads },
+    { "short-connections", gen_handshakes },
+    { "mixed", gen_mixed },
+};
+
+// Hand out what one record added to the memory writer
+static size_t bench_take_output(void) {
+    size_t n = out.len;
+
+    out.len = 0;
+    return n;
+}
+
+static size_t bench_handle(void *data, size_t size) {
+    handle_event(&out, data, size);
+    return bench_take_output();
+}
+
+static void bench_reset(void) {
+    ssl_streams_free(&streams);
+    ssl_streams_init(&streams, SSL_DATA_HDR_SIZE, emit_ssl_frame, &out);
+    out.len = 0;
+}
+
+// Frames --reassemble still holds at the end of the stream
+static size_t bench_finish(void) {
+    ssl_streams_free(&streams);
+    return bench_take_output();
+}
+
+static const struct replay_target target = {
+    .handle = bench_handle,
+    .reset = bench_reset,
+    .finish = bench_finish,
+};
+
+static int bench_one(const char *name, const struct replay_stream *s) {
+    struct replay_result r;
+    int err = replay_run(s, &target, &r);
+
+    if (err) {
+        fprintf(stderr, "%s: %s\n", name, strerror(-err));
+        return err;
+    }
+    replay_print(name, s, &r);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-b] [-R] [-n scale] [-w workload] [-s file] [-r file]\n"
+            "  -b           binary output instead of JSON\n"
+            "  -R           --reassemble: stitch HTTP messages and SSE events\n"
+            "  -n scale     multiply the synthetic stream sizes (default 1)\n"
+            "  -w workload  run one of: sse-stream large-upload short-connections mixed\n"
+            "  -s file      save the workload's stream to file\n"
+            "  -r file      replay a saved stream instead\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    const char *workload = NULL, *save = NULL, *replay = NULL;
+    int scale = 1, opt, err = 0;
+
+    // Handshake records are printed too, so they cost what they would live
+    env.handshake = true;
+    while ((opt = getopt(argc, argv, "bRn:w:s:r:h")) != -1) {
+        switch (opt) {
+        case 'b':
+            env.format = OUTPUT_FORMAT_BINARY;
+            break;
+        case 'R':
+            env.reassemble = true;
+            break;
+        case 'n':
+            scale = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 'w':
+            workload = optarg;
+            break;
+        case 's':
+            save = optarg;
+            break;
+        case 'r':
+            replay = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    for (size_t i = 0; workload && i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        if (!strcmp(workload, workloads[i].name))
+            break;
+        if (i == sizeof(workloads) / sizeof(workloads[0]) - 1) {
+            fprintf(stderr, "unknown workload %s\n", workload);
+            return 1;
+        }
+    }
+    if (save && !workload) {
+        fprintf(stderr, "-s needs -w\n");
+        return 1;
+    }
+
+    if (jw_init(&out, -1, 0)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    out.binary = env.format == OUTPUT_FORMAT_BINARY;
+    ssl_streams_init(&streams, SSL_DATA_HDR_SIZE, emit_ssl_frame, &out);
+
+    printf("sslsniff: %s output%s\n", out.binary ? "binary" : "JSON",
+           env.reassemble ? ", reassembled" : "");
+    replay_print_header();
+
+    if (replay) {
+        struct replay_stream s;
+
+        err = replay_load(&s, replay);
+        if (err) {
+            fprintf(stderr, "%s: %s\n", replay, strerror(-err));
+            return 1;
+        }
+        err = bench_one(replay, &s);
+        replay_free(&s);
+    }
+
+    for (size_t i = 0; !replay && !err && i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        struct replay_stream s = {};
+        uint64_t rng = 0x9e3779b97f4a7c15ULL;
+
+        if (workload && strcmp(workload, workloads[i].name))
+            continue;
+        bench_ts = BENCH_BASE_NS;
+        err = workloads[i].gen(&s, &rng, scale);
+        if (!err && save)
+            err = replay_save(&s, save);
+        if (!err)
+            err = bench_one(workloads[i].name, &s);
+        else
+            fprintf(stderr, "%s: %s\n", workloads[i].name, strerror(-err));
+        replay_free(&s);
+    }
+
+    ssl_streams_free(&streams);
+    out.len = 0;
+    jw_free(&out);
+    return err ? 1 : 0;
+}
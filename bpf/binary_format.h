@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __BINARY_FORMAT_H
+#define __BINARY_FORMAT_H
+
+/*
+ * --format=binary output of process and sslsniff.
+ *
+ * Decoded by collector/src/framework/runners/binary_format.rs, keep the two
+ * in sync and bump BIN_VERSION on any layout change.
+ *
+ * The stream starts with an 8 byte header: "AGSB", u8 version, 3 zero bytes.
+ * Every record is a u32 length of what follows, a u8 kind and a body. All
+ * integers are little endian. A string is a u16 length and the raw bytes,
+ * with no NUL and no escaping. With --intern-strings a length of
+ * BIN_STR_REF is followed by the u32 id of an earlier STRING_DEF instead.
+ *
+ *   JW_RECORD_JSON         one JSON object, used for STATS and rare events
+ *   BIN_RECORD_STRING_DEF  u32 id, str value: what @id stands for from here
+ *                          on, see string_intern.h
+ *
+ * Every other kind starts with
+ *
+ *   u64 timestamp_ns, u32 pid, str comm
+ *
+ * then the fields below, and ends with str extra: extra "key":value pairs
+ * to merge into the event, comma separated as in the JSON output, usually
+ * empty.
+ *
+ *   BIN_RECORD_EXEC           u32 ppid, str filename, str full_command
+ *   BIN_RECORD_EXIT           u32 ppid, u32 exit_code, u64 duration_ns (0 = unknown)
+ *   BIN_RECORD_BASH_READLINE  str command
+ *   BIN_RECORD_FILE_OPEN      u32 count, i32 flags, str filepath
+ *   BIN_RECORD_SSL_DATA       u8 function (0 read, 1 write, 2 handshake),
+ *                             u32 tid, u32 uid, u32 len, u32 buf_size,
+ *                             u64 delta_ns, u8 is_handshake, u64 ssl, i32 fd,
+ *                             u8 frame (0 one SSL call, else reassembled, see
+ *                             ssl_stream.h), u32 chunks,
+ *                             u32 data length, raw payload bytes
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "json_writer.h"
+
+#define BIN_MAGIC "AGSB"
+#define BIN_VERSION 3
+
+/* String length marking a reference to an interned string */
+#define BIN_STR_REF UINT16_MAX
+
+enum bin_record_kind {
+	BIN_RECORD_JSON = JW_RECORD_JSON,
+	BIN_RECORD_EXEC = 1,
+	BIN_RECORD_EXIT = 2,
+	BIN_RECORD_BASH_READLINE = 3,
+	BIN_RECORD_FILE_OPEN = 4,
+	BIN_RECORD_SSL_DATA = 5,
+	BIN_RECORD_STRING_DEF = JW_RECORD_STRING_DEF,
+};
+
+/* Output format selected with --format */
+enum output_format {
+	OUTPUT_FORMAT_JSON = 0,
+	OUTPUT_FORMAT_BINARY,
+};
+
+/* Parse a --format argument, returns -1 if unknown */
+static inline int output_format_parse(const char *arg)
+{
+	if (strcmp(arg, "json") == 0)
+		return OUTPUT_FORMAT_JSON;
+	if (strcmp(arg, "binary") == 0)
+		return OUTPUT_FORMAT_BINARY;
+	return -1;
+}
+
+/* Switch the writer to binary records and write the stream header */
+static inline void bin_stream_start(struct json_writer *w)
+{
+	const char hdr[8] = { 'A', 'G', 'S', 'B', BIN_VERSION, 0, 0, 0 };
+
+	w->binary = true;
+	jw_raw(w, hdr, sizeof(hdr));
+	jw_commit(w);
+}
+
+/* Integers go out little endian, which is host order on every target we build */
+static inline void bin_u8(struct json_writer *w, uint8_t v)
+{
+	jw_char(w, v);
+}
+
+static inline void bin_u16(struct json_writer *w, uint16_t v)
+{
+	jw_raw(w, (const char *)&v, sizeof(v));
+}
+
+static inline void bin_u32(struct json_writer *w, uint32_t v)
+{
+	jw_raw(w, (const char *)&v, sizeof(v));
+}
+
+static inline void bin_i32(struct json_writer *w, int32_t v)
+{
+	jw_raw(w, (const char *)&v, sizeof(v));
+}
+
+static inline void bin_u64(struct json_writer *w, uint64_t v)
+{
+	jw_raw(w, (const char *)&v, sizeof(v));
+}
+
+/* Length prefixed string, truncated at 64KB */
+static inline void bin_str(struct json_writer *w, const char *s)
+{
+	size_t n = s ? strlen(s) : 0;
+
+	if (n > BIN_STR_REF - 1)
+		n = BIN_STR_REF - 1;
+	bin_u16(w, n);
+	if (n)
+		jw_raw(w, s, n);
+}
+
+/* A string that repeats across records: a reference with an intern table */
+static inline void bin_str_interned(struct json_writer *w, const char *s)
+{
+	int32_t id = s ? jw_intern(w, s) : STRING_INTERN_NONE;
+
+	if (id == STRING_INTERN_NONE) {
+		bin_str(w, s);
+		return;
+	}
+	bin_u16(w, BIN_STR_REF);
+	bin_u32(w, id);
+}
+
+/* Open an event record with the common prefix */
+static inline void bin_event_begin(struct json_writer *w, enum bin_record_kind kind,
+				   uint64_t timestamp_ns, uint32_t pid, const char *comm)
+{
+	jw_record_begin(w, kind);
+	bin_u64(w, timestamp_ns);
+	bin_u32(w, pid);
+	bin_str_interned(w, comm);
+}
+
+/* Close an event record, @extra may be NULL */
+static inline void bin_event_end(struct json_writer *w, const char *extra)
+{
+	bin_str(w, extra);
+	jw_record_end(w);
+}
+
+#endif /* __BINARY_FORMAT_H */
@@ -0,0 +1,430 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __CAPTURE_DIR_H
+#define __CAPTURE_DIR_H
+
+/*
+ * --output-dir: a long capture as compressed segments with a time index.
+ *
+ * The writer's output is cut into frames of about CAPTURE_FRAME_BYTES, or
+ * whatever arrived in CAPTURE_FRAME_MAX_MS, always at a record boundary.
+ * Each frame is compressed on its own as one gzip member and appended to
+ * DIR/seg-NNNNNNNN.jsonl.gz (.agsb.gz for --format binary) until that
+ * segment reaches CAPTURE_SEGMENT_BYTES. A frame decodes without anything
+ * before it: in binary output it starts with its own stream header, and
+ * with --intern-strings the table is reset so its strings are defined
+ * again inside it.
+ *
+ * Every frame then gets a line in DIR/index.jsonl, written after the frame
+ * itself so the index never points past the data:
+ *
+ *   {"segment":"seg-00000002.jsonl.gz","offset":1048576,"bytes":131072,
+ *    "raw_bytes":1048576,"records":2900,"min_ts_ns":...,"max_ts_ns":...,
+ *    "min_pid":...,"max_pid":...}
+ *
+ * so a reader seeks to offset and inflates bytes instead of reading from
+ * the start. Timestamps and pids are taken from the records themselves;
+ * records without them (STRING_DEF) count but do not widen the ranges.
+ * A restart in the same DIR continues after its last segment.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "json_writer.h"
+#include "binary_format.h"
+
+#define CAPTURE_FRAME_BYTES (1024 * 1024)
+#define CAPTURE_FRAME_MAX_MS 1000
+#define CAPTURE_SEGMENT_BYTES (64ULL * 1024 * 1024)
+#define CAPTURE_INDEX "index.jsonl"
+/* How far into a JSON record its timestamp and pid are looked for */
+#define CAPTURE_SCAN_BYTES 512
+
+struct capture_dir {
+	char path[PATH_MAX / 2];
+	int seg_fd;
+	int index_fd;
+	unsigned int seg_no;       /* number of the open segment */
+	uint64_t seg_off;          /* its size so far */
+	bool started;              /* the first write told JSON from binary */
+	bool binary;
+	char header[8];            /* binary stream header, repeated per frame */
+	size_t header_len;
+	char *frame;               /* records of the frame being collected */
+	size_t frame_len, frame_cap;
+	uint64_t frame_start_ns;
+	uint32_t records;
+	uint64_t min_ts, max_ts;
+	uint32_t min_pid, max_pid;
+	char *zbuf;
+	size_t zcap;
+	z_stream z;
+	struct json_writer *w;     /* its intern table is reset with every frame */
+	uint64_t frames;
+};
+
+/* Highest segment number already in @path, 0 if none */
+static inline unsigned int capture_dir_last_segment(const char *path)
+{
+	unsigned int last = 0, no;
+	struct dirent *de;
+	DIR *d = opendir(path);
+
+	if (!d)
+		return 0;
+	while ((de = readdir(d)))
+		if (sscanf(de->d_name, "seg-%8u.", &no) == 1 && no > last)
+			last = no;
+	closedir(d);
+	return last;
+}
+
+static inline void capture_dir_free(struct capture_dir *c)
+{
+	if (c->seg_fd >= 0)
+		close(c->seg_fd);
+	if (c->index_fd >= 0)
+		close(c->index_fd);
+	deflateEnd(&c->z);
+	free(c->frame);
+	free(c->zbuf);
+	c->seg_fd = c->index_fd = -1;
+	c->frame = c->zbuf = NULL;
+}
+
+/* Create @path if needed and open its index, returns 0 or -errno */
+static inline int capture_dir_init(struct capture_dir *c, const char *path)
+{
+	char name[PATH_MAX];
+	int err;
+
+	memset(c, 0, sizeof(*c));
+	c->seg_fd = c->index_fd = -1;
+	if (strlen(path) >= sizeof(c->path))
+		return -ENAMETOOLONG;
+	strcpy(c->path, path);
+	if (mkdir(path, 0755) && errno != EEXIST)
+		return -errno;
+	c->seg_no = capture_dir_last_segment(path);
+
+	snprintf(name, sizeof(name), "%s/" CAPTURE_INDEX, path);
+	c->index_fd = open(name, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (c->index_fd < 0)
+		return -errno;
+	/* gzip wrapper (15 + 16), so every frame is a valid .gz on its own */
+	if (deflateInit2(&c->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK) {
+		err = -ENOMEM;
+		close(c->index_fd);
+		c->index_fd = -1;
+		return err;
+	}
+	return 0;
+}
+
+static inline int capture_dir_write_all(int fd, const char *buf, size_t n)
+{
+	while (n) {
+		ssize_t w = write(fd, buf, n);
+
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += w;
+		n -= w;
+	}
+	return 0;
+}
+
+/* Start the next segment, returns 0 or -errno */
+static inline int capture_dir_next_segment(struct capture_dir *c)
+{
+	char name[PATH_MAX];
+
+	if (c->seg_fd >= 0)
+		close(c->seg_fd);
+	c->seg_no++;
+	snprintf(name, sizeof(name), "%s/seg-%08u.%s.gz", c->path, c->seg_no,
+		 c->binary ? "agsb" : "jsonl");
+	c->seg_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	c->seg_off = 0;
+	return c->seg_fd < 0 ? -errno : 0;
+}
+
+/* Widen the frame's ranges by one record's timestamp and pid */
+static inline void capture_dir_note(struct capture_dir *c, uint64_t ts, uint32_t pid)
+{
+	if (!c->min_ts || ts < c->min_ts)
+		c->min_ts = ts;
+	if (ts > c->max_ts)
+		c->max_ts = ts;
+	if (!c->min_pid || pid < c->min_pid)
+		c->min_pid = pid;
+	if (pid > c->max_pid)
+		c->max_pid = pid;
+}
+
+/* Unsigned number after the first @key in the @n bytes at @p */
+static inline bool capture_dir_json_u64(const char *p, size_t n, const char *key, uint64_t *v)
+{
+	size_t klen = strlen(key);
+
+	if (n > CAPTURE_SCAN_BYTES)
+		n = CAPTURE_SCAN_BYTES;
+	for (size_t i = 0; i + klen < n; i++) {
+		size_t j = i + klen;
+
+		if (memcmp(p + i, key, klen) != 0)
+			continue;
+		if (j >= n || p[j] < '0' || p[j] > '9')
+			return false;
+		for (*v = 0; j < n && p[j] >= '0' && p[j] <= '9'; j++)
+			*v = *v * 10 + (p[j] - '0');
+		return true;
+	}
+	return false;
+}
+
+/* One JSON object: "timestamp" or "timestamp_ns", and "pid" */
+static inline void capture_dir_note_json(struct capture_dir *c, const char *p, size_t n)
+{
+	uint64_t ts, pid;
+
+	if (!capture_dir_json_u64(p, n, "\"timestamp\":", &ts) &&
+	    !capture_dir_json_u64(p, n, "\"timestamp_ns\":", &ts))
+		return;
+	if (capture_dir_json_u64(p, n, "\"pid\":", &pid))
+		capture_dir_note(c, ts, pid);
+}
+
+/* Count the whole records in @buf and note their timestamps and pids */
+static inline void capture_dir_scan(struct capture_dir *c, const char *buf, size_t n)
+{
+	const char *end = buf + n, *p = buf;
+
+	while (p < end) {
+		if (c->binary) {
+			uint32_t len;
+			uint64_t ts;
+			uint32_t pid;
+
+			if (end - p < (ptrdiff_t)sizeof(len))
+				return;
+			memcpy(&len, p, sizeof(len));
+			if (len == 0 || (size_t)(end - p) - sizeof(len) < len)
+				return;
+			p += sizeof(len);
+			if (p[0] == JW_RECORD_JSON) {
+				capture_dir_note_json(c, p + 1, len - 1);
+			} else if (p[0] != JW_RECORD_STRING_DEF && len >= 1 + sizeof(ts) + sizeof(pid)) {
+				memcpy(&ts, p + 1, sizeof(ts));
+				memcpy(&pid, p + 1 + sizeof(ts), sizeof(pid));
+				capture_dir_note(c, ts, pid);
+			}
+			p += len;
+		} else {
+			const char *nl = memchr(p, '\n', end - p);
+			size_t len = nl ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+
+			capture_dir_note_json(c, p, len);
+			p += len;
+		}
+		c->records++;
+	}
+}
+
+/* Compress the collected frame into the segment and index it, returns 0 or -errno */
+static inline int capture_dir_frame_end(struct capture_dir *c)
+{
+	size_t bound, out;
+	int err;
+
+	if (c->frame_len <= c->header_len)
+		return 0;
+
+	bound = deflateBound(&c->z, c->frame_len);
+	if (bound > c->zcap) {
+		char *buf = realloc(c->zbuf, bound);
+
+		if (!buf)
+			return -ENOMEM;
+		c->zbuf = buf;
+		c->zcap = bound;
+	}
+	c->z.next_in = (Bytef *)c->frame;
+	c->z.avail_in = c->frame_len;
+	c->z.next_out = (Bytef *)c->zbuf;
+	c->z.avail_out = bound;
+	err = deflate(&c->z, Z_FINISH) == Z_STREAM_END ? 0 : -EIO;
+	out = bound - c->z.avail_out;
+	deflateReset(&c->z);
+	if (err)
+		return err;
+
+	/* a full segment gets no more frames, an oversized frame still goes in alone */
+	if (c->seg_fd < 0 || (c->seg_off && c->seg_off + out > CAPTURE_SEGMENT_BYTES)) {
+		err = capture_dir_next_segment(c);
+		if (err)
+			return err;
+	}
+	err = capture_dir_write_all(c->seg_fd, c->zbuf, out);
+	if (err)
+		return err;
+
+	dprintf(c->index_fd,
+		"{\"segment\":\"seg-%08u.%s.gz\",\"offset\":%llu,\"bytes\":%zu,\"raw_bytes\":%zu,"
+		"\"records\":%u,\"min_ts_ns\":%llu,\"max_ts_ns\":%llu,\"min_pid\":%u,\"max_pid\":%u}\n",
+		c->seg_no, c->binary ? "agsb" : "jsonl", (unsigned long long)c->seg_off, out,
+		c->frame_len, c->records, (unsigned long long)c->min_ts,
+		(unsigned long long)c->max_ts, c->min_pid, c->max_pid);
+	c->seg_off += out;
+	c->frames++;
+
+	c->frame_len = c->header_len;
+	c->records = 0;
+	c->min_ts = c->max_ts = 0;
+	c->min_pid = c->max_pid = 0;
+	c->frame_start_ns = 0;
+	if (c->w && c->w->intern)
+		string_intern_reset(c->w->intern);
+	return 0;
+}
+
+/*
+ * json_writer write_hook: take @n bytes of whole records, closing the frame
+ * once it is large or old enough. An idle writer calls it with no bytes from
+ * jw_batch_end(), so a frame left open by a burst still goes out about
+ * CAPTURE_FRAME_MAX_MS later. Returns 0 or -errno.
+ */
+static inline int capture_dir_write(void *ctx, const char *buf, size_t n)
+{
+	struct capture_dir *c = ctx;
+
+	if (!n) {
+		if (c->frame_len && jw_now_ns() - c->frame_start_ns >= CAPTURE_FRAME_MAX_MS * 1000000ULL)
+			return capture_dir_frame_end(c);
+		return 0;
+	}
+
+	/* the stream header of --format binary comes first, keep it for every frame */
+	if (!c->started) {
+		c->started = true;
+		if (n >= sizeof(c->header) && memcmp(buf, BIN_MAGIC, 4) == 0) {
+			c->binary = true;
+			memcpy(c->header, buf, sizeof(c->header));
+			c->header_len = sizeof(c->header);
+			buf += sizeof(c->header);
+			n -= sizeof(c->header);
+		}
+	}
+
+	if (c->frame_len + n + c->header_len > c->frame_cap) {
+		size_t cap = c->frame_cap ? c->frame_cap : CAPTURE_FRAME_BYTES + JW_FLUSH_BYTES;
+		char *frame;
+
+		while (cap < c->frame_len + n + c->header_len)
+			cap *= 2;
+		frame = realloc(c->frame, cap);
+		if (!frame)
+			return -ENOMEM;
+		c->frame = frame;
+		c->frame_cap = cap;
+	}
+	if (!c->frame_len && c->header_len) {
+		memcpy(c->frame, c->header, c->header_len);
+		c->frame_len = c->header_len;
+	}
+	if (!c->frame_start_ns)
+		c->frame_start_ns = jw_now_ns();
+
+	memcpy(c->frame + c->frame_len, buf, n);
+	c->frame_len += n;
+	capture_dir_scan(c, buf, n);
+
+	if (c->frame_len >= CAPTURE_FRAME_BYTES ||
+	    jw_now_ns() - c->frame_start_ns >= CAPTURE_FRAME_MAX_MS * 1000000ULL)
+		return capture_dir_frame_end(c);
+	return 0;
+}
+
+/* Write the last frame and close everything, returns 0 or -errno */
+static inline int capture_dir_close(struct capture_dir *c)
+{
+	int err;
+
+	/* the writer may be gone already, its strings need no reset anymore */
+	c->w = NULL;
+	err = capture_dir_frame_end(c);
+
+	capture_dir_free(c);
+	return err;
+}
+
+/*
+ * Inflate the frame of @bytes at @offset in segment @path into a malloc'd
+ * buffer, returns its length or -errno
+ */
+static inline ssize_t capture_dir_read_frame(const char *path, uint64_t offset, size_t bytes,
+					     char **out)
+{
+	size_t cap = bytes * 4 + 4096, len = 0;
+	char *in = malloc(bytes), *buf = malloc(cap);
+	z_stream z = {};
+	ssize_t ret = -EIO;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	*out = NULL;
+	if (fd < 0 || !in || !buf || pread(fd, in, bytes, offset) != (ssize_t)bytes ||
+	    inflateInit2(&z, 15 + 16) != Z_OK)
+		goto out;
+
+	z.next_in = (Bytef *)in;
+	z.avail_in = bytes;
+	for (;;) {
+		int zret;
+
+		if (len == cap) {
+			char *grown = realloc(buf, cap * 2);
+
+			if (!grown)
+				break;
+			buf = grown;
+			cap *= 2;
+		}
+		z.next_out = (Bytef *)buf + len;
+		z.avail_out = cap - len;
+		zret = inflate(&z, Z_NO_FLUSH);
+		len = cap - z.avail_out;
+		if (zret == Z_STREAM_END) {
+			*out = buf;
+			buf = NULL;
+			ret = len;
+			break;
+		}
+		if (zret != Z_OK && zret != Z_BUF_ERROR)
+			break;
+		if (zret == Z_BUF_ERROR && z.avail_out)
+			break;
+	}
+	inflateEnd(&z);
+out:
+	if (fd >= 0)
+		close(fd);
+	free(in);
+	free(buf);
+	return ret;
+}
+
+#endif /* __CAPTURE_DIR_H */
@@ -0,0 +1,171 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __EVENT_LOOP_H
+#define __EVENT_LOOP_H
+
+/*
+ * How the tracers wait for ring buffer records.
+ *
+ * By default every submit wakes the consumer, which at high event rates
+ * costs a context switch per record. With --wakeup-batch the BPF side
+ * submits with BPF_RB_NO_WAKEUP until wakeup_bytes are waiting and forces
+ * a wakeup from then on; whatever stays below the threshold is picked up
+ * by a periodic timer in userspace.
+ *
+ * Userspace waits in one epoll set holding the ring buffer's epoll fd, a
+ * signalfd for SIGINT/SIGTERM, the timerfd and any eventfd a thread wants
+ * to be woken through, so shutdown and flush deadlines never wait for a
+ * poll timeout to run out.
+ */
+
+#ifdef __bpf__
+
+/* Wake the consumer once this many bytes wait in the ring, 0 = every record */
+const volatile __u64 wakeup_bytes = 0;
+
+/* Flags for submitting one more record to @ringbuf */
+static __always_inline __u64 ringbuf_wakeup_flags(void *ringbuf)
+{
+	if (!wakeup_bytes)
+		return 0;
+	if (bpf_ringbuf_query(ringbuf, BPF_RB_AVAIL_DATA) >= wakeup_bytes)
+		return BPF_RB_FORCE_WAKEUP;
+	return BPF_RB_NO_WAKEUP;
+}
+
+#else /* !__bpf__ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/* Interval of the timer that drains records submitted without a wakeup */
+#define WAKEUP_TICK_MS 10
+
+/* What woke event_loop_wait(), as a bit mask */
+#define EVENT_LOOP_RING   (1 << 0)  /* a ring buffer epoll fd */
+#define EVENT_LOOP_TIMER  (1 << 1)  /* the periodic timer */
+#define EVENT_LOOP_WAKE   (1 << 2)  /* an eventfd added with event_loop_add() */
+#define EVENT_LOOP_SIGNAL (1 << 3)  /* SIGINT or SIGTERM */
+
+#define EVENT_LOOP_MAX_EVENTS 8
+
+struct event_loop {
+	int epfd;
+	int sigfd;       /* -1 unless event_loop_handle_signals() */
+	int timerfd;     /* -1 unless event_loop_set_tick() */
+	bool stop;       /* SIGINT or SIGTERM arrived */
+};
+
+static inline int event_loop_init(struct event_loop *l)
+{
+	memset(l, 0, sizeof(*l));
+	l->sigfd = -1;
+	l->timerfd = -1;
+	l->epfd = epoll_create1(EPOLL_CLOEXEC);
+	return l->epfd < 0 ? -errno : 0;
+}
+
+static inline void event_loop_free(struct event_loop *l)
+{
+	if (l->timerfd >= 0)
+		close(l->timerfd);
+	if (l->sigfd >= 0)
+		close(l->sigfd);
+	if (l->epfd >= 0)
+		close(l->epfd);
+	l->epfd = l->sigfd = l->timerfd = -1;
+}
+
+/* Wait on @fd too and report it as @source (EVENT_LOOP_RING or EVENT_LOOP_WAKE) */
+static inline int event_loop_add(struct event_loop *l, int fd, unsigned int source)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+
+	ev.data.u64 = (uint64_t)source << 32 | (uint32_t)fd;
+	return epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev) ? -errno : 0;
+}
+
+/*
+ * Take SIGINT and SIGTERM through the loop instead of a handler. Blocks
+ * them in the calling thread, so call it before starting any threads that
+ * should not see them either.
+ */
+static inline int event_loop_handle_signals(struct event_loop *l)
+{
+	sigset_t mask;
+	int err;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	err = pthread_sigmask(SIG_BLOCK, &mask, NULL);
+	if (err)
+		return -err;
+	l->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (l->sigfd < 0)
+		return -errno;
+	return event_loop_add(l, l->sigfd, EVENT_LOOP_SIGNAL);
+}
+
+/* Fire EVENT_LOOP_TIMER every @interval_ms */
+static inline int event_loop_set_tick(struct event_loop *l, unsigned int interval_ms)
+{
+	struct itimerspec its = {
+		.it_interval = { interval_ms / 1000, (interval_ms % 1000) * 1000000L },
+	};
+
+	its.it_value = its.it_interval;
+	l->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (l->timerfd < 0)
+		return -errno;
+	if (timerfd_settime(l->timerfd, 0, &its, NULL))
+		return -errno;
+	return event_loop_add(l, l->timerfd, EVENT_LOOP_TIMER);
+}
+
+/*
+ * Wait up to @timeout_ms, returns a mask of what fired (0 on timeout) or
+ * -errno. Signals set l->stop; timer and eventfd counts are read here so
+ * the caller only has to consume its rings.
+ */
+static inline int event_loop_wait(struct event_loop *l, int timeout_ms)
+{
+	struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+	int n, fired = 0;
+
+	n = epoll_wait(l->epfd, events, EVENT_LOOP_MAX_EVENTS, timeout_ms);
+	if (n < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	for (int i = 0; i < n; i++) {
+		unsigned int source = events[i].data.u64 >> 32;
+		int fd = (uint32_t)events[i].data.u64;
+		struct signalfd_siginfo si;
+		uint64_t count;
+
+		switch (source) {
+		case EVENT_LOOP_SIGNAL:
+			while (read(fd, &si, sizeof(si)) == sizeof(si))
+				l->stop = true;
+			break;
+		case EVENT_LOOP_TIMER:
+		case EVENT_LOOP_WAKE:
+			if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+				return -errno;
+			break;
+		}
+		fired |= source;
+	}
+	return fired;
+}
+
+#endif /* __bpf__ */
+
+#endif /* __EVENT_LOOP_H */
@@ -0,0 +1,447 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __FILE_DEDUP_H
+#define __FILE_DEDUP_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "process.h"
+
+/*
+ * FILE_OPEN aggregation state for the process tracer.
+ *
+ * Entries live in a fixed pool and are found through an open-addressed
+ * index keyed on (pid, path hash). Every hit moves the entry to the tail of
+ * an LRU list, and since the window restarts on each hit the head is always
+ * the next entry to expire, so expiry is O(1) per expired entry. Each pid
+ * also has a small state record chaining its entries, so a process exit
+ * flushes only that pid's entries.
+ */
+
+#define FILE_DEDUP_DEFAULT_CAPACITY 1024
+#define FILE_DEDUP_NONE (-1)
+
+struct file_dedup_entry {
+	uint64_t path_hash;
+	uint64_t timestamp_ns;  /* last time this (pid, path) was opened */
+	uint32_t count;
+	uint64_t kernel_count;  /* in-kernel repeat count at the last drain */
+	pid_t pid;
+	int flags;
+	char comm[TASK_COMM_LEN];
+	char filepath[MAX_FILENAME_LEN];
+	int32_t lru_prev, lru_next;  /* pool indices, FILE_DEDUP_NONE terminated */
+	int32_t pid_prev, pid_next;  /* chain of entries owned by the same pid */
+	int32_t owner;               /* index into pids[] */
+};
+
+struct file_dedup_pid {
+	pid_t pid;
+	int32_t files;  /* head of this pid's entry chain, or next free slot */
+};
+
+/* Called for aggregated entries leaving the table with @extra JSON fields */
+typedef void (*file_dedup_emit_fn)(const struct file_dedup_entry *f,
+				   uint64_t timestamp_ns, const char *extra, void *ctx);
+
+struct file_dedup {
+	uint32_t capacity;
+	uint32_t index_mask;
+	uint64_t window_ns;
+	int32_t *file_index;             /* index_mask + 1 slots, pool index or NONE */
+	int32_t *pid_index;
+	struct file_dedup_entry *files;  /* capacity entries */
+	struct file_dedup_pid *pids;     /* capacity entries */
+	int32_t file_free, pid_free;     /* free lists through lru_next / files */
+	int32_t lru_head, lru_tail;
+	uint32_t file_count, pid_count;
+	file_dedup_emit_fn on_remove;    /* optional, called for every removed entry */
+	void *on_remove_ctx;
+};
+
+/* FNV-1a over the path */
+static inline uint64_t file_dedup_hash_path(const char *path)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (*path) {
+		hash ^= (unsigned char)*path++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static inline uint32_t file_dedup_pid_slot(const struct file_dedup *d, pid_t pid)
+{
+	return (uint32_t)(((uint64_t)(uint32_t)pid * 0x9e3779b97f4a7c15ULL) >> 32) & d->index_mask;
+}
+
+static inline uint32_t file_dedup_file_slot(const struct file_dedup *d, pid_t pid, uint64_t path_hash)
+{
+	uint64_t h = path_hash ^ ((uint64_t)(uint32_t)pid * 0x9e3779b97f4a7c15ULL);
+
+	return (uint32_t)(h ^ (h >> 29)) & d->index_mask;
+}
+
+static inline void file_dedup_free(struct file_dedup *d)
+{
+	free(d->file_index);
+	free(d->pid_index);
+	free(d->files);
+	free(d->pids);
+	memset(d, 0, sizeof(*d));
+}
+
+/* Allocate a table for @capacity (pid, path) pairs, returns 0 or -errno */
+static inline int file_dedup_init(struct file_dedup *d, uint32_t capacity, uint64_t window_ns)
+{
+	uint32_t index_size = 2;
+	uint32_t i;
+
+	memset(d, 0, sizeof(*d));
+	if (capacity == 0 || capacity > (1U << 24))
+		return -EINVAL;
+
+	/* keep the index at most half full so probe chains stay short */
+	while (index_size < capacity * 2)
+		index_size <<= 1;
+
+	d->capacity = capacity;
+	d->index_mask = index_size - 1;
+	d->window_ns = window_ns;
+	d->file_index = malloc(index_size * sizeof(*d->file_index));
+	d->pid_index = malloc(index_size * sizeof(*d->pid_index));
+	d->files = calloc(capacity, sizeof(*d->files));
+	d->pids = calloc(capacity, sizeof(*d->pids));
+	if (!d->file_index || !d->pid_index || !d->files || !d->pids) {
+		file_dedup_free(d);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < index_size; i++) {
+		d->file_index[i] = FILE_DEDUP_NONE;
+		d->pid_index[i] = FILE_DEDUP_NONE;
+	}
+	for (i = 0; i < capacity; i++) {
+		d->files[i].lru_next = i + 1 < capacity ? (int32_t)(i + 1) : FILE_DEDUP_NONE;
+		d->pids[i].files = i + 1 < capacity ? (int32_t)(i + 1) : FILE_DEDUP_NONE;
+	}
+	d->file_free = 0;
+	d->pid_free = 0;
+	d->lru_head = d->lru_tail = FILE_DEDUP_NONE;
+	return 0;
+}
+
+/* Index slot holding the state of @pid, or the empty slot it would take */
+static inline uint32_t file_dedup_pid_lookup(const struct file_dedup *d, pid_t pid)
+{
+	uint32_t slot = file_dedup_pid_slot(d, pid);
+
+	for (;;) {
+		int32_t idx = d->pid_index[slot];
+
+		if (idx == FILE_DEDUP_NONE || d->pids[idx].pid == pid)
+			return slot;
+		slot = (slot + 1) & d->index_mask;
+	}
+}
+
+static inline struct file_dedup_pid *file_dedup_pid_find(struct file_dedup *d, pid_t pid)
+{
+	int32_t idx = d->pid_index[file_dedup_pid_lookup(d, pid)];
+
+	return idx == FILE_DEDUP_NONE ? NULL : &d->pids[idx];
+}
+
+/* Find or create the state of @pid, NULL if the pid pool is exhausted */
+static inline struct file_dedup_pid *file_dedup_pid_get(struct file_dedup *d, pid_t pid)
+{
+	uint32_t slot = file_dedup_pid_lookup(d, pid);
+	struct file_dedup_pid *p;
+	int32_t idx = d->pid_index[slot];
+
+	if (idx != FILE_DEDUP_NONE)
+		return &d->pids[idx];
+	if (d->pid_free == FILE_DEDUP_NONE)
+		return NULL;
+
+	idx = d->pid_free;
+	p = &d->pids[idx];
+	d->pid_free = p->files;
+	memset(p, 0, sizeof(*p));
+	p->pid = pid;
+	p->files = FILE_DEDUP_NONE;
+	d->pid_index[slot] = idx;
+	d->pid_count++;
+	return p;
+}
+
+/*
+ * Backward-shift deletion for linear probing: pull later members of the
+ * probe chain into the hole so lookups never need tombstones.
+ */
+static inline void file_dedup_index_delete(struct file_dedup *d, int32_t *index, uint32_t hole,
+					   uint32_t (*home)(const struct file_dedup *, int32_t))
+{
+	uint32_t slot = hole;
+
+	index[hole] = FILE_DEDUP_NONE;
+	for (;;) {
+		uint32_t want;
+		int32_t idx;
+
+		slot = (slot + 1) & d->index_mask;
+		idx = index[slot];
+		if (idx == FILE_DEDUP_NONE)
+			return;
+		want = home(d, idx);
+		/* move it if its home slot is not in (hole, slot] */
+		if (((slot - want) & d->index_mask) >= ((slot - hole) & d->index_mask)) {
+			index[hole] = idx;
+			index[slot] = FILE_DEDUP_NONE;
+			hole = slot;
+		}
+	}
+}
+
+static inline uint32_t file_dedup_pid_home(const struct file_dedup *d, int32_t idx)
+{
+	return file_dedup_pid_slot(d, d->pids[idx].pid);
+}
+
+static inline uint32_t file_dedup_file_home(const struct file_dedup *d, int32_t idx)
+{
+	return file_dedup_file_slot(d, d->files[idx].pid, d->files[idx].path_hash);
+}
+
+static inline void file_dedup_pid_release(struct file_dedup *d, pid_t pid)
+{
+	uint32_t slot = file_dedup_pid_lookup(d, pid);
+	int32_t idx = d->pid_index[slot];
+
+	if (idx == FILE_DEDUP_NONE)
+		return;
+	file_dedup_index_delete(d, d->pid_index, slot, file_dedup_pid_home);
+	d->pids[idx].files = d->pid_free;
+	d->pid_free = idx;
+	d->pid_count--;
+}
+
+/* Index slot of entry (@pid, @path), or the empty slot it would go into */
+static inline uint32_t file_dedup_file_lookup(const struct file_dedup *d, pid_t pid,
+					      uint64_t path_hash, const char *path)
+{
+	uint32_t slot = file_dedup_file_slot(d, pid, path_hash);
+
+	for (;;) {
+		int32_t idx = d->file_index[slot];
+		const struct file_dedup_entry *f;
+
+		if (idx == FILE_DEDUP_NONE)
+			return slot;
+		f = &d->files[idx];
+		if (f->pid == pid && f->path_hash == path_hash && strcmp(f->filepath, path) == 0)
+			return slot;
+		slot = (slot + 1) & d->index_mask;
+	}
+}
+
+static inline void file_dedup_lru_unlink(struct file_dedup *d, int32_t idx)
+{
+	struct file_dedup_entry *f = &d->files[idx];
+
+	if (f->lru_prev != FILE_DEDUP_NONE)
+		d->files[f->lru_prev].lru_next = f->lru_next;
+	else
+		d->lru_head = f->lru_next;
+	if (f->lru_next != FILE_DEDUP_NONE)
+		d->files[f->lru_next].lru_prev = f->lru_prev;
+	else
+		d->lru_tail = f->lru_prev;
+}
+
+static inline void file_dedup_lru_append(struct file_dedup *d, int32_t idx)
+{
+	struct file_dedup_entry *f = &d->files[idx];
+
+	f->lru_prev = d->lru_tail;
+	f->lru_next = FILE_DEDUP_NONE;
+	if (d->lru_tail != FILE_DEDUP_NONE)
+		d->files[d->lru_tail].lru_next = idx;
+	else
+		d->lru_head = idx;
+	d->lru_tail = idx;
+}
+
+/* Remove entry @idx, reporting it through @emit when it aggregated repeats */
+static inline void file_dedup_remove(struct file_dedup *d, int32_t idx, uint64_t timestamp_ns,
+				     const char *extra, file_dedup_emit_fn emit, void *ctx)
+{
+	struct file_dedup_entry *f = &d->files[idx];
+	struct file_dedup_pid *p = &d->pids[f->owner];
+
+	if (f->count > 1 && emit)
+		emit(f, timestamp_ns, extra, ctx);
+	if (d->on_remove)
+		d->on_remove(f, timestamp_ns, extra, d->on_remove_ctx);
+
+	file_dedup_index_delete(d, d->file_index,
+				file_dedup_file_lookup(d, f->pid, f->path_hash, f->filepath),
+				file_dedup_file_home);
+	file_dedup_lru_unlink(d, idx);
+
+	if (f->pid_prev != FILE_DEDUP_NONE)
+		d->files[f->pid_prev].pid_next = f->pid_next;
+	else
+		p->files = f->pid_next;
+	if (f->pid_next != FILE_DEDUP_NONE)
+		d->files[f->pid_next].pid_prev = f->pid_prev;
+	/* a pid's state lives only as long as its entries, its EXIT may never come */
+	if (p->files == FILE_DEDUP_NONE)
+		file_dedup_pid_release(d, f->pid);
+
+	f->lru_next = d->file_free;
+	d->file_free = idx;
+	d->file_count--;
+}
+
+/* Drop entries not seen for longer than the window */
+static inline void file_dedup_expire(struct file_dedup *d, uint64_t now_ns,
+				     file_dedup_emit_fn emit, void *ctx)
+{
+	while (d->lru_head != FILE_DEDUP_NONE) {
+		const struct file_dedup_entry *f = &d->files[d->lru_head];
+
+		if (now_ns <= f->timestamp_ns || now_ns - f->timestamp_ns <= d->window_ns)
+			break;
+		file_dedup_remove(d, d->lru_head, now_ns, "\"window_expired\":true", emit, ctx);
+	}
+}
+
+/*
+ * Record one open of @path by @pid and return the number of opens
+ * aggregated in its entry: 1 for the first occurrence, more for repeats.
+ * When the table is full the least recently used entry is evicted early.
+ */
+static inline uint32_t file_dedup_record(struct file_dedup *d, pid_t pid, const char *comm,
+					 const char *path, int flags, uint64_t timestamp_ns,
+					 file_dedup_emit_fn emit, void *ctx)
+{
+	uint64_t path_hash = file_dedup_hash_path(path);
+	uint32_t slot = file_dedup_file_lookup(d, pid, path_hash, path);
+	struct file_dedup_entry *f;
+	struct file_dedup_pid *p;
+	int32_t idx = d->file_index[slot];
+
+	if (idx != FILE_DEDUP_NONE) {
+		f = &d->files[idx];
+		f->count++;
+		if (timestamp_ns > f->timestamp_ns)
+			f->timestamp_ns = timestamp_ns;
+		file_dedup_lru_unlink(d, idx);
+		file_dedup_lru_append(d, idx);
+		return f->count;
+	}
+
+	/* evict first: the victim may be the last entry of the pid state we take */
+	if (d->file_free == FILE_DEDUP_NONE) {
+		file_dedup_remove(d, d->lru_head, timestamp_ns, "\"reason\":\"capacity\"", emit, ctx);
+		/* the backward shift may have moved our empty slot */
+		slot = file_dedup_file_lookup(d, pid, path_hash, path);
+	}
+
+	p = file_dedup_pid_get(d, pid);
+	if (!p)
+		return 1;  /* no state for this pid, report without aggregating */
+
+	idx = d->file_free;
+	f = &d->files[idx];
+	d->file_free = f->lru_next;
+
+	f->path_hash = path_hash;
+	f->timestamp_ns = timestamp_ns;
+	f->count = 1;
+	f->kernel_count = 0;
+	f->pid = pid;
+	f->flags = flags;
+	strncpy(f->comm, comm, TASK_COMM_LEN - 1);
+	f->comm[TASK_COMM_LEN - 1] = '\0';
+	strncpy(f->filepath, path, MAX_FILENAME_LEN - 1);
+	f->filepath[MAX_FILENAME_LEN - 1] = '\0';
+	f->owner = p - d->pids;
+	f->pid_prev = FILE_DEDUP_NONE;
+	f->pid_next = p->files;
+	if (p->files != FILE_DEDUP_NONE)
+		d->files[p->files].pid_prev = idx;
+	p->files = idx;
+
+	d->file_index[slot] = idx;
+	file_dedup_lru_append(d, idx);
+	d->file_count++;
+	return 1;
+}
+
+/* Entry of (@pid, @path_hash) for callers that only know the hash, or NULL */
+static inline struct file_dedup_entry *file_dedup_find_hash(struct file_dedup *d, pid_t pid,
+							    uint64_t path_hash)
+{
+	uint32_t slot = file_dedup_file_slot(d, pid, path_hash);
+
+	for (;;) {
+		int32_t idx = d->file_index[slot];
+
+		if (idx == FILE_DEDUP_NONE)
+			return NULL;
+		if (d->files[idx].pid == pid && d->files[idx].path_hash == path_hash)
+			return &d->files[idx];
+		slot = (slot + 1) & d->index_mask;
+	}
+}
+
+/*
+ * Fold the running in-kernel repeat count @kernel_count of @f into its
+ * total. A count lower than the last one means the kernel entry was evicted
+ * and recreated, so it is taken as new repeats.
+ */
+static inline void file_dedup_add_kernel_count(struct file_dedup *d, struct file_dedup_entry *f,
+					       uint64_t kernel_count, uint64_t last_ns)
+{
+	uint64_t delta = kernel_count >= f->kernel_count ? kernel_count - f->kernel_count : kernel_count;
+	int32_t idx = f - d->files;
+
+	f->kernel_count = kernel_count;
+	if (!delta)
+		return;
+	f->count += delta;
+	if (last_ns > f->timestamp_ns)
+		f->timestamp_ns = last_ns;
+	file_dedup_lru_unlink(d, idx);
+	file_dedup_lru_append(d, idx);
+}
+
+/* Report and drop every entry of @pid along with its state, returns the entries dropped */
+static inline int file_dedup_flush_pid(struct file_dedup *d, pid_t pid, uint64_t timestamp_ns,
+				       file_dedup_emit_fn emit, void *ctx)
+{
+	struct file_dedup_pid *p = file_dedup_pid_find(d, pid);
+	int removed = 0;
+
+	if (!p)
+		return 0;
+	/* removing the last entry releases @p as well */
+	while (p->files != FILE_DEDUP_NONE) {
+		bool last = d->files[p->files].pid_next == FILE_DEDUP_NONE;
+
+		file_dedup_remove(d, p->files, timestamp_ns, "\"reason\":\"process_exit\"", emit, ctx);
+		removed++;
+		if (last)
+			break;
+	}
+	file_dedup_pid_release(d, pid);
+	return removed;
+}
+
+#endif /* __FILE_DEDUP_H */
@@ -0,0 +1,201 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __HISTOGRAM_H
+#define __HISTOGRAM_H
+
+/*
+ * In-kernel latency histograms for --histogram.
+ *
+ * The probes fold each measurement into a log2 histogram keyed by (comm,
+ * kind) in a BPF_MAP_TYPE_PERCPU_HASH instead of sending a record through
+ * the ring buffer. Slot 0 counts zeros and slot n >= 1 values in
+ * [2^(n-1), 2^n). Userspace sums the per-CPU copies, drains the map every
+ * interval and prints one "event":"HISTOGRAM" line per key (see stats.h).
+ */
+
+#ifndef __bpf__
+#include <linux/types.h>
+#endif
+
+#define HIST_SLOTS 64
+#define HIST_COMM_LEN 16
+#define HIST_MAX_ENTRIES 4096
+
+enum hist_kind {
+	HIST_SSL_READ = 0,       /* SSL_read and friends, entry to return */
+	HIST_SSL_WRITE,
+	HIST_SSL_HANDSHAKE,      /* SSL_do_handshake, entry to return */
+	HIST_SSL_FIRST_READ,     /* handshake done to the first read returning data */
+	HIST_PROCESS_LIFETIME,   /* exec to exit */
+	HIST_KIND_MAX,
+};
+
+struct hist_key {
+	char comm[HIST_COMM_LEN];
+	__u32 kind;
+};
+
+struct hist {
+	__u64 count;
+	__u64 sum;
+	__u64 max;
+	__u64 slots[HIST_SLOTS];
+};
+
+/* floor(log2(v)) for v > 0, branch free so the verifier sees no loop */
+static inline __u32 hist_log2(__u64 v)
+{
+	__u32 r, shift;
+
+	r = (v > 0xFFFFFFFF) << 5;
+	v >>= r;
+	shift = (v > 0xFFFF) << 4;
+	v >>= shift;
+	r |= shift;
+	shift = (v > 0xFF) << 3;
+	v >>= shift;
+	r |= shift;
+	shift = (v > 0xF) << 2;
+	v >>= shift;
+	r |= shift;
+	shift = (v > 0x3) << 1;
+	v >>= shift;
+	r |= shift;
+	r |= (v >> 1);
+	return r;
+}
+
+static inline __u32 hist_slot(__u64 v)
+{
+	__u32 slot = v ? hist_log2(v) + 1 : 0;
+
+	return slot < HIST_SLOTS ? slot : HIST_SLOTS - 1;
+}
+
+#ifdef __bpf__
+
+/* New keys start from this, a struct hist is too large for the BPF stack */
+static const struct hist hist_zero;
+
+/* Add @value to the current task's (comm, @kind) histogram in @map */
+static __always_inline void hist_add(void *map, __u32 kind, __u64 value)
+{
+	struct hist_key key = { .kind = kind };
+	struct hist *h;
+	__u32 slot = hist_slot(value);
+
+	bpf_get_current_comm(&key.comm, sizeof(key.comm));
+	h = bpf_map_lookup_elem(map, &key);
+	if (!h) {
+		bpf_map_update_elem(map, &key, &hist_zero, BPF_NOEXIST);
+		h = bpf_map_lookup_elem(map, &key);
+		if (!h)
+			return;
+	}
+	/* per-CPU values, no other writer */
+	h->count++;
+	h->sum += value;
+	if (value > h->max)
+		h->max = value;
+	if (slot < HIST_SLOTS)
+		h->slots[slot]++;
+}
+
+#else /* !__bpf__ */
+
+#include <stdio.h>
+#include <string.h>
+#include "json_writer.h"
+
+static const char *const hist_kind_names[HIST_KIND_MAX] = {
+	[HIST_SSL_READ] = "ssl_read",
+	[HIST_SSL_WRITE] = "ssl_write",
+	[HIST_SSL_HANDSHAKE] = "ssl_handshake",
+	[HIST_SSL_FIRST_READ] = "ssl_first_read",
+	[HIST_PROCESS_LIFETIME] = "process_lifetime",
+};
+
+/* Largest value slot @slot holds */
+static inline __u64 hist_slot_max(__u32 slot)
+{
+	if (!slot)
+		return 0;
+	if (slot >= HIST_SLOTS - 1)
+		return ~0ULL;
+	return (1ULL << slot) - 1;
+}
+
+/* Sum @ncpus per-CPU copies into @out */
+static inline void hist_sum(struct hist *out, const struct hist *percpu, int ncpus)
+{
+	memset(out, 0, sizeof(*out));
+	for (int cpu = 0; cpu < ncpus; cpu++) {
+		const struct hist *h = &percpu[cpu];
+
+		out->count += h->count;
+		out->sum += h->sum;
+		if (h->max > out->max)
+			out->max = h->max;
+		for (int i = 0; i < HIST_SLOTS; i++)
+			out->slots[i] += h->slots[i];
+	}
+}
+
+/* Upper bound of the slot holding the @pct percentile, capped at the max seen */
+static inline __u64 hist_percentile(const struct hist *h, unsigned int pct)
+{
+	__u64 rank = (h->count * pct + 99) / 100, seen = 0;
+
+	if (!h->count)
+		return 0;
+	if (!rank)
+		rank = 1;
+	for (int i = 0; i < HIST_SLOTS; i++) {
+		seen += h->slots[i];
+		if (seen >= rank)
+			return hist_slot_max(i) < h->max ? hist_slot_max(i) : h->max;
+	}
+	return h->max;
+}
+
+/*
+ * One HISTOGRAM line: summary fields, then "buckets" mapping each non-empty
+ * slot's upper bound to its count.
+ */
+static inline void hist_print(struct json_writer *w, const char *ts_key, __u64 now_ns,
+			      const char *tracer, __u64 interval_ns, const struct hist_key *key,
+			      const struct hist *h)
+{
+	char comm[HIST_COMM_LEN + 1], bound[24];
+
+	memcpy(comm, key->comm, HIST_COMM_LEN);
+	comm[HIST_COMM_LEN] = '\0';
+
+	jw_begin(w);
+	jw_field_u64(w, ts_key, now_ns);
+	jw_field_str(w, "event", "HISTOGRAM");
+	jw_field_str(w, "tracer", tracer);
+	jw_field_str(w, "comm", comm);
+	jw_field_str(w, "kind", key->kind < HIST_KIND_MAX ? hist_kind_names[key->kind] : "unknown");
+	jw_field_u64(w, "interval_ms", interval_ns / 1000000);
+	jw_field_u64(w, "count", h->count);
+	jw_field_u64(w, "sum_ns", h->sum);
+	jw_field_u64(w, "avg_ns", h->count ? h->sum / h->count : 0);
+	jw_field_u64(w, "p50_ns", hist_percentile(h, 50));
+	jw_field_u64(w, "p90_ns", hist_percentile(h, 90));
+	jw_field_u64(w, "p99_ns", hist_percentile(h, 99));
+	jw_field_u64(w, "max_ns", h->max);
+	jw_key(w, "buckets");
+	jw_object_begin(w);
+	for (int i = 0; i < HIST_SLOTS; i++) {
+		if (!h->slots[i])
+			continue;
+		snprintf(bound, sizeof(bound), "%llu", (unsigned long long)hist_slot_max(i));
+		jw_field_u64(w, bound, h->slots[i]);
+	}
+	jw_object_end(w);
+	jw_end(w);
+}
+
+#endif /* __bpf__ */
+
+#endif /* __HISTOGRAM_H */
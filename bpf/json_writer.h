@@ -0,0 +1,717 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __JSON_WRITER_H
+#define __JSON_WRITER_H
+
+/*
+ * Buffered JSON line writer shared by the tracers.
+ *
+ * Records are formatted into one growable buffer and written with write(2)
+ * on batch boundaries instead of printf + fflush per record: when the buffer
+ * passes JW_FLUSH_BYTES, and after each ring_buffer__poll() batch once the
+ * oldest buffered record is flush_ms old (0 = every batch). The buffer only
+ * reallocates when a record outgrows it, so steady state is allocation free.
+ *
+ * With jw_set_binary() the same buffer carries the length prefixed records of
+ * binary_format.h instead; JSON objects written with jw_begin()/jw_end() are
+ * then framed as JW_RECORD_JSON records.
+ *
+ * On a non-blocking fd (see output_transport.h) a short write keeps the rest
+ * buffered for the next flush instead of stalling the ring buffer consumer.
+ * Once more than max_buffered bytes back up, whole new records are dropped
+ * and counted, so a slow reader costs output, not in-kernel drops.
+ *
+ * A writer initialised with fd -1 never flushes: consumer threads use one to
+ * format records that are then handed over with jw_append(). One with a
+ * write_hook hands every flush, always whole records, to the hook instead
+ * of write(2), and calls it with no bytes from an idle jw_batch_end() so it
+ * can close what it holds on time (--output-dir, see capture_dir.h).
+ *
+ * With an intern table (--intern-strings, see string_intern.h) fields
+ * written with jw_field_interned() carry an id, and the STRING_DEF a reader
+ * needs first is slipped in front of the record that uses it.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "string_intern.h"
+
+#define JW_INITIAL_SIZE (256 * 1024)
+#define JW_FLUSH_BYTES (64 * 1024)
+
+/* Binary record kind of a framed JSON object, see binary_format.h */
+#define JW_RECORD_JSON 0
+/* Binary record kind of a STRING_DEF, see jw_intern() */
+#define JW_RECORD_STRING_DEF 6
+
+/* jw_escape_table classes, any other non-zero value is a two byte \x escape */
+#define JW_ESC_NONE 0
+#define JW_ESC_UNICODE 'u'
+
+/* Escape class per byte: control characters, '"' and '\\' need escaping */
+static const unsigned char jw_escape_table[256] = {
+	['\b'] = 'b', ['\t'] = 't', ['\n'] = 'n', ['\f'] = 'f', ['\r'] = 'r',
+	[0x00] = 'u', [0x01] = 'u', [0x02] = 'u', [0x03] = 'u', [0x04] = 'u',
+	[0x05] = 'u', [0x06] = 'u', [0x07] = 'u', [0x0b] = 'u', [0x0e] = 'u',
+	[0x0f] = 'u', [0x10] = 'u', [0x11] = 'u', [0x12] = 'u', [0x13] = 'u',
+	[0x14] = 'u', [0x15] = 'u', [0x16] = 'u', [0x17] = 'u', [0x18] = 'u',
+	[0x19] = 'u', [0x1a] = 'u', [0x1b] = 'u', [0x1c] = 'u', [0x1d] = 'u',
+	[0x1e] = 'u', [0x1f] = 'u', [0x7f] = 'u',
+	['"'] = '"', ['\\'] = '\\',
+};
+
+struct json_writer {
+	char *buf;
+	size_t len;
+	size_t cap;
+	int fd;
+	bool first_field;        /* no comma before the next field */
+	uint64_t flush_ns;       /* max age of buffered output, 0 = flush every batch */
+	uint64_t pending_ns;     /* when the oldest unflushed record was completed */
+	bool binary;             /* length prefixed records instead of JSON lines */
+	bool in_record;          /* a record is open, never flush or drop it half written */
+	size_t record_start;     /* offset where the open record starts */
+	bool blocked;            /* the last flush hit EAGAIN, output is still pending */
+	size_t max_buffered;     /* drop new records past this many bytes, 0 = never */
+	uint64_t dropped;        /* records dropped at max_buffered */
+	void (*flush_hook)(void *ctx, bool begin); /* around every write(2), for timing */
+	void *flush_ctx;
+	int (*write_hook)(void *ctx, const char *buf, size_t n); /* instead of write(2), 0 or -errno */
+	void *write_ctx;
+	struct string_intern *intern;  /* --intern-strings, NULL = strings inline */
+};
+
+static inline uint64_t jw_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int jw_init(struct json_writer *w, int fd, unsigned int flush_ms)
+{
+	memset(w, 0, sizeof(*w));
+	w->buf = malloc(JW_INITIAL_SIZE);
+	if (!w->buf)
+		return -ENOMEM;
+	w->cap = JW_INITIAL_SIZE;
+	w->fd = fd;
+	w->flush_ns = (uint64_t)flush_ms * 1000000ULL;
+	return 0;
+}
+
+/*
+ * Write out everything buffered, returns 0 or -errno. On EAGAIN the unwritten
+ * tail stays buffered, on any other error the buffer is dropped.
+ */
+static inline int jw_flush(struct json_writer *w)
+{
+	size_t off = 0;
+	int err = 0;
+
+	/* a memory writer, its owner takes the records out of buf itself */
+	if (w->fd < 0 && !w->write_hook)
+		return 0;
+	if (w->flush_hook)
+		w->flush_hook(w->flush_ctx, true);
+
+	if (w->write_hook && w->len)
+		err = w->write_hook(w->write_ctx, w->buf, w->len);
+	while (!w->write_hook && off < w->len) {
+		ssize_t n = write(w->fd, w->buf + off, w->len - off);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			break;
+		}
+		off += n;
+	}
+	if (w->flush_hook)
+		w->flush_hook(w->flush_ctx, false);
+
+	if (err == -EAGAIN || err == -EWOULDBLOCK) {
+		memmove(w->buf, w->buf + off, w->len - off);
+		w->len -= off;
+		w->blocked = true;
+		return -EAGAIN;
+	}
+	w->len = 0;
+	w->pending_ns = 0;
+	w->blocked = false;
+	return err;
+}
+
+static inline void jw_free(struct json_writer *w)
+{
+	/* last chance for the backlog, wait for the reader this time */
+	if (w->buf && w->blocked) {
+		int flags = fcntl(w->fd, F_GETFL);
+
+		if (flags >= 0)
+			fcntl(w->fd, F_SETFL, flags & ~O_NONBLOCK);
+	}
+	if (w->buf)
+		jw_flush(w);
+	free(w->buf);
+	w->buf = NULL;
+	w->cap = 0;
+}
+
+/* Make room for @n more bytes, flushing or growing the buffer as needed */
+static inline bool jw_reserve(struct json_writer *w, size_t n)
+{
+	size_t cap;
+	char *buf;
+
+	if (w->len + n <= w->cap)
+		return true;
+
+	/*
+	 * A byte stream, so splitting a record across writes is fine, except
+	 * while a binary record still needs its length patched in
+	 */
+	if (w->len >= JW_FLUSH_BYTES && !w->in_record) {
+		jw_flush(w);
+		if (w->len + n <= w->cap)
+			return true;
+	}
+
+	cap = w->cap ? w->cap : JW_INITIAL_SIZE;
+	while (cap < w->len + n)
+		cap *= 2;
+	buf = realloc(w->buf, cap);
+	if (!buf)
+		return false;
+	w->buf = buf;
+	w->cap = cap;
+	return true;
+}
+
+static inline void jw_raw(struct json_writer *w, const char *s, size_t n)
+{
+	if (!jw_reserve(w, n))
+		return;
+	memcpy(w->buf + w->len, s, n);
+	w->len += n;
+}
+
+static inline void jw_puts(struct json_writer *w, const char *s)
+{
+	jw_raw(w, s, strlen(s));
+}
+
+static inline void jw_char(struct json_writer *w, char c)
+{
+	if (!jw_reserve(w, 1))
+		return;
+	w->buf[w->len++] = c;
+}
+
+static inline void jw_u64(struct json_writer *w, uint64_t v)
+{
+	char tmp[20];
+	int i = sizeof(tmp);
+
+	do {
+		tmp[--i] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	jw_raw(w, tmp + i, sizeof(tmp) - i);
+}
+
+static inline void jw_i64(struct json_writer *w, int64_t v)
+{
+	if (v < 0) {
+		jw_char(w, '-');
+		jw_u64(w, -(uint64_t)v);
+		return;
+	}
+	jw_u64(w, v);
+}
+
+static inline void jw_printf(struct json_writer *w, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/* printf into the buffer for the rare fields that need a format */
+static inline void jw_printf(struct json_writer *w, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (!jw_reserve(w, 64))
+		return;
+	va_start(ap, fmt);
+	n = vsnprintf(w->buf + w->len, w->cap - w->len, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return;
+	if ((size_t)n >= w->cap - w->len) {
+		if (!jw_reserve(w, n + 1))
+			return;
+		va_start(ap, fmt);
+		vsnprintf(w->buf + w->len, w->cap - w->len, fmt, ap);
+		va_end(ap);
+	}
+	w->len += n;
+}
+
+/* \uXXXX escape of a single byte */
+static inline void jw_unicode_escape(struct json_writer *w, unsigned char c)
+{
+	static const char hex[] = "0123456789abcdef";
+	char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+
+	jw_raw(w, esc, sizeof(esc));
+}
+
+/* Escape one byte that jw_escape_table marks as special */
+static inline void jw_escape_byte(struct json_writer *w, unsigned char c)
+{
+	unsigned char cls = jw_escape_table[c];
+
+	if (cls == JW_ESC_UNICODE) {
+		jw_unicode_escape(w, c);
+	} else {
+		char esc[2] = { '\\', (char)cls };
+
+		jw_raw(w, esc, sizeof(esc));
+	}
+}
+
+/* Append @n bytes of @s as JSON string content; bytes >= 0x80 pass through */
+static inline void jw_escaped(struct json_writer *w, const char *s, size_t n)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	size_t i = 0;
+
+	while (i < n) {
+		size_t run = i;
+
+		while (run < n && jw_escape_table[p[run]] == JW_ESC_NONE)
+			run++;
+		jw_raw(w, (const char *)p + i, run - i);
+		if (run == n)
+			break;
+		jw_escape_byte(w, p[run]);
+		i = run + 1;
+	}
+}
+
+/* Length of the leading run of printable ASCII that needs no escaping */
+static inline size_t jw_clean_prefix_scalar(const unsigned char *p, size_t n)
+{
+	size_t i = 0;
+
+	while (i < n && p[i] < 0x80 && jw_escape_table[p[i]] == JW_ESC_NONE)
+		i++;
+	return i;
+}
+
+/*
+ * Same as jw_clean_prefix_scalar(), 16 or 32 bytes at a time. A byte stops
+ * the run if it is < 0x20, '"', '\\', 0x7f or >= 0x80; as a signed char the
+ * last case is negative, so one signed compare against 0x20 covers both ends.
+ */
+static inline size_t jw_clean_prefix(const unsigned char *p, size_t n)
+{
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	const __m256i space = _mm256_set1_epi8(0x20);
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i bslash = _mm256_set1_epi8('\\');
+	const __m256i del = _mm256_set1_epi8(0x7f);
+
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i bad = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpgt_epi8(space, v), _mm256_cmpeq_epi8(v, quote)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, bslash), _mm256_cmpeq_epi8(v, del)));
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(bad);
+
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i space16 = _mm_set1_epi8(0x20);
+	const __m128i quote16 = _mm_set1_epi8('"');
+	const __m128i bslash16 = _mm_set1_epi8('\\');
+	const __m128i del16 = _mm_set1_epi8(0x7f);
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i bad = _mm_or_si128(
+			_mm_or_si128(_mm_cmplt_epi8(v, space16), _mm_cmpeq_epi8(v, quote16)),
+			_mm_or_si128(_mm_cmpeq_epi8(v, bslash16), _mm_cmpeq_epi8(v, del16)));
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(bad);
+
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t v = vld1q_u8(p + i);
+		uint8x16_t bad = vorrq_u8(
+			vorrq_u8(vcltq_u8(v, vdupq_n_u8(0x20)), vcgeq_u8(v, vdupq_n_u8(0x7f))),
+			vorrq_u8(vceqq_u8(v, vdupq_n_u8('"')), vceqq_u8(v, vdupq_n_u8('\\'))));
+		/* narrow to one nibble per byte to get a 64-bit mask */
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+			vshrn_n_u16(vreinterpretq_u16_u8(bad), 4)), 0);
+
+		if (mask)
+			return i + (__builtin_ctzll(mask) >> 2);
+	}
+#endif
+	return i + jw_clean_prefix_scalar(p + i, n - i);
+}
+
+/*
+ * Length of the well-formed UTF-8 sequence at @p (Unicode table 3-7), or 0
+ * if it is truncated, overlong, a surrogate or above U+10FFFF. Locale
+ * independent, unlike mbrtowc().
+ */
+static inline size_t jw_utf8_seq_len(const unsigned char *p, size_t n)
+{
+	unsigned char c = p[0];
+	unsigned char lo = 0x80, hi = 0xbf;
+	size_t len;
+
+	if (c < 0x80)
+		return 1;
+	if (c < 0xc2)
+		return 0;
+	if (c < 0xe0) {
+		len = 2;
+	} else if (c < 0xf0) {
+		len = 3;
+		if (c == 0xe0)
+			lo = 0xa0;
+		else if (c == 0xed)
+			hi = 0x9f;
+	} else if (c < 0xf5) {
+		len = 4;
+		if (c == 0xf0)
+			lo = 0x90;
+		else if (c == 0xf4)
+			hi = 0x8f;
+	} else {
+		return 0;
+	}
+
+	if (n < len || p[1] < lo || p[1] > hi)
+		return 0;
+	for (size_t i = 2; i < len; i++) {
+		if ((p[i] & 0xc0) != 0x80)
+			return 0;
+	}
+	return len;
+}
+
+/*
+ * Append @n bytes of untrusted data as JSON string content: valid UTF-8 is
+ * copied through, invalid bytes become \u00XX. Clean ASCII and runs of
+ * multi-byte characters are copied in bulk.
+ */
+static inline void jw_escaped_utf8(struct json_writer *w, const char *s, size_t n)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	size_t i = 0;
+
+	while (i < n) {
+		size_t run = i + jw_clean_prefix(p + i, n - i);
+
+		jw_raw(w, (const char *)p + i, run - i);
+		if (run == n)
+			break;
+		i = run;
+
+		if (p[i] < 0x80) {
+			jw_escape_byte(w, p[i]);
+			i++;
+			continue;
+		}
+
+		/* CJK and emoji text tends to come in long multi-byte runs */
+		while (run < n && p[run] >= 0x80) {
+			size_t len = jw_utf8_seq_len(p + run, n - run);
+
+			if (!len)
+				break;
+			run += len;
+		}
+		if (run > i) {
+			jw_raw(w, (const char *)p + i, run - i);
+			i = run;
+		} else {
+			jw_unicode_escape(w, p[i]);
+			i++;
+		}
+	}
+}
+
+/* Open a binary record: u32 length placeholder, then the kind byte */
+static inline void jw_record_begin(struct json_writer *w, uint8_t kind)
+{
+	uint32_t len = 0;
+
+	w->record_start = w->len;
+	w->in_record = true;
+	jw_raw(w, (const char *)&len, sizeof(len));
+	jw_char(w, kind);
+}
+
+/*
+ * Close the open record: drop it if the reader is too far behind, otherwise
+ * flush right away once the buffer is large
+ */
+static inline void jw_commit(struct json_writer *w)
+{
+	w->in_record = false;
+	if (w->max_buffered && w->len > w->max_buffered) {
+		w->len = w->record_start;
+		w->dropped++;
+		return;
+	}
+	if (!w->pending_ns)
+		w->pending_ns = jw_now_ns();
+	if (w->len >= JW_FLUSH_BYTES)
+		jw_flush(w);
+}
+
+/* Patch the length of the open binary record and commit it */
+static inline void jw_record_end(struct json_writer *w)
+{
+	uint32_t len;
+
+	if (!w->in_record)
+		return;
+	/* a failed allocation truncated the record, drop it */
+	if (w->len < w->record_start + sizeof(len)) {
+		w->in_record = false;
+		w->len = w->record_start;
+		return;
+	}
+	len = w->len - w->record_start - sizeof(len);
+	memcpy(w->buf + w->record_start, &len, sizeof(len));
+	jw_commit(w);
+}
+
+/* Append a complete record formatted by a memory writer */
+static inline void jw_append(struct json_writer *w, const char *rec, size_t n)
+{
+	w->record_start = w->len;
+	w->in_record = true;
+	jw_raw(w, rec, n);
+	jw_commit(w);
+}
+
+/* Start a top level record */
+static inline void jw_begin(struct json_writer *w)
+{
+	if (w->binary) {
+		jw_record_begin(w, JW_RECORD_JSON);
+	} else {
+		w->record_start = w->len;
+		w->in_record = true;
+	}
+	jw_char(w, '{');
+	w->first_field = true;
+}
+
+/* Open a nested object after jw_key() */
+static inline void jw_object_begin(struct json_writer *w)
+{
+	jw_char(w, '{');
+	w->first_field = true;
+}
+
+/* Close a nested object opened with jw_object_begin() */
+static inline void jw_object_end(struct json_writer *w)
+{
+	jw_char(w, '}');
+	w->first_field = false;
+}
+
+/* Append ,"key": (the comma only after the first field) */
+static inline void jw_key(struct json_writer *w, const char *key)
+{
+	if (!w->first_field)
+		jw_char(w, ',');
+	w->first_field = false;
+	jw_char(w, '"');
+	jw_puts(w, key);
+	jw_raw(w, "\":", 2);
+}
+
+static inline void jw_field_str(struct json_writer *w, const char *key, const char *val)
+{
+	jw_key(w, key);
+	jw_char(w, '"');
+	jw_escaped(w, val, strlen(val));
+	jw_char(w, '"');
+}
+
+static inline void jw_field_u64(struct json_writer *w, const char *key, uint64_t val)
+{
+	jw_key(w, key);
+	jw_u64(w, val);
+}
+
+static inline void jw_field_i64(struct json_writer *w, const char *key, int64_t val)
+{
+	jw_key(w, key);
+	jw_i64(w, val);
+}
+
+static inline void jw_field_bool(struct json_writer *w, const char *key, bool val)
+{
+	jw_key(w, key);
+	if (val)
+		jw_raw(w, "true", 4);
+	else
+		jw_raw(w, "false", 5);
+}
+
+/* Append pre-formatted "key":value pairs */
+static inline void jw_fields_raw(struct json_writer *w, const char *fields)
+{
+	if (!fields || !fields[0])
+		return;
+	if (!w->first_field)
+		jw_char(w, ',');
+	w->first_field = false;
+	jw_puts(w, fields);
+}
+
+static inline void jw_reverse(char *p, size_t n)
+{
+	for (size_t i = 0; i < n / 2; i++) {
+		char c = p[i];
+
+		p[i] = p[n - 1 - i];
+		p[n - 1 - i] = c;
+	}
+}
+
+/*
+ * Id of @s for a field of the open record, or STRING_INTERN_NONE to write
+ * @s inline. A string the reader has not seen under its id gets a
+ * STRING_DEF first, moved in front of the open record:
+ *
+ *   {"event":"STRING_DEF","id":3,"value":"/etc/hosts"}
+ *
+ * or a JW_RECORD_STRING_DEF record of u32 id and str value. Definitions
+ * are never dropped at max_buffered, the table would go out of sync.
+ */
+static inline int32_t jw_intern(struct json_writer *w, const char *s)
+{
+	size_t n = strlen(s), start = w->len;
+	bool is_new;
+	int32_t id;
+
+	if (!w->intern || n >= UINT16_MAX)
+		return STRING_INTERN_NONE;
+	/* room for the definition at its largest, so none of it is cut short */
+	if (!jw_reserve(w, 64 + 6 * n))
+		return STRING_INTERN_NONE;
+	id = string_intern_get(w->intern, s, n, &is_new);
+	if (id == STRING_INTERN_NONE || !is_new)
+		return id;
+
+	if (w->binary) {
+		uint32_t len = 1 + sizeof(uint32_t) + sizeof(uint16_t) + n, uid = id;
+		uint16_t slen = n;
+
+		jw_raw(w, (const char *)&len, sizeof(len));
+		jw_char(w, JW_RECORD_STRING_DEF);
+		jw_raw(w, (const char *)&uid, sizeof(uid));
+		jw_raw(w, (const char *)&slen, sizeof(slen));
+		jw_raw(w, s, n);
+	} else {
+		jw_puts(w, "{\"event\":\"STRING_DEF\",\"id\":");
+		jw_u64(w, id);
+		jw_puts(w, ",\"value\":\"");
+		jw_escaped(w, s, n);
+		jw_raw(w, "\"}\n", 3);
+	}
+
+	/* rotate the definition in front of what the record has so far */
+	if (w->in_record) {
+		jw_reverse(w->buf + w->record_start, start - w->record_start);
+		jw_reverse(w->buf + start, w->len - start);
+		jw_reverse(w->buf + w->record_start, w->len - w->record_start);
+		w->record_start += w->len - start;
+	}
+	return id;
+}
+
+/* "key":"val", or "key":id with an intern table */
+static inline void jw_field_interned(struct json_writer *w, const char *key, const char *val)
+{
+	int32_t id = jw_intern(w, val);
+
+	if (id == STRING_INTERN_NONE)
+		jw_field_str(w, key, val);
+	else
+		jw_field_u64(w, key, id);
+}
+
+/* Close a top level record opened with jw_begin() */
+static inline void jw_end(struct json_writer *w)
+{
+	if (w->binary) {
+		jw_char(w, '}');
+		jw_record_end(w);
+		return;
+	}
+	jw_raw(w, "}\n", 2);
+	jw_commit(w);
+}
+
+/* Call after each poll batch: flush if the oldest record is old enough */
+static inline void jw_batch_end(struct json_writer *w)
+{
+	/* nothing is formatted but unsent, the hook may close what it holds */
+	if (!w->len) {
+		if (w->write_hook)
+			w->write_hook(w->write_ctx, w->buf, 0);
+		return;
+	}
+	if (!w->flush_ns || w->blocked || jw_now_ns() - w->pending_ns >= w->flush_ns)
+		jw_flush(w);
+}
+
+/* Retry interval for output a non-blocking reader has not taken yet */
+#define JW_BLOCKED_RETRY_MS 10
+
+/* Poll timeout that still honours the flush deadline */
+static inline int jw_poll_timeout_ms(const struct json_writer *w, int timeout_ms)
+{
+	int flush_ms = w->flush_ns / 1000000ULL;
+
+	if (w->blocked && JW_BLOCKED_RETRY_MS < timeout_ms)
+		timeout_ms = JW_BLOCKED_RETRY_MS;
+	if (flush_ms && flush_ms < timeout_ms)
+		return flush_ms;
+	return timeout_ms;
+}
+
+#endif /* __JSON_WRITER_H */
@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __OUTPUT_TRANSPORT_H
+#define __OUTPUT_TRANSPORT_H
+
+/*
+ * Where the tracers' json_writer output goes.
+ *
+ * By default stdout, with the pipe grown from 64KB so a briefly slow reader
+ * does not stall the ring buffer consumer. With --output-socket the tracer
+ * connects to a unix stream socket the collector listens on and writes to
+ * it non-blocking: whatever the collector has not taken stays in the
+ * writer's buffer up to OUTPUT_MAX_BUFFERED, after which new records are
+ * dropped and reported as output_dropped in STATS instead of backing up
+ * into the kernel. With --output-dir the output goes to compressed,
+ * indexed segment files instead (capture_dir.h).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "json_writer.h"
+#include "capture_dir.h"
+
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#endif
+
+/* Requested stdout pipe size, capped by /proc/sys/fs/pipe-max-size */
+#define OUTPUT_PIPE_SIZE (1024 * 1024)
+/* Requested socket send buffer */
+#define OUTPUT_SOCKET_SNDBUF (4 * 1024 * 1024)
+/* Backlog kept for a slow collector before records are dropped */
+#define OUTPUT_MAX_BUFFERED (64 * 1024 * 1024)
+
+/* Connect to a unix stream socket, returns a non-blocking fd or -errno */
+static inline int output_socket_connect(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int sndbuf = OUTPUT_SOCKET_SNDBUF;
+	int fd, err;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+	/* best effort, the kernel caps it at net.core.wmem_max */
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+	return fd;
+}
+
+/* Set up @w on --output-socket @socket_path, or on stdout if NULL */
+static inline int output_open(struct json_writer *w, const char *socket_path, unsigned int flush_ms)
+{
+	struct stat st;
+	int fd = STDOUT_FILENO, err;
+
+	if (socket_path) {
+		fd = output_socket_connect(socket_path);
+		if (fd < 0) {
+			fprintf(stderr, "Failed to connect to output socket %s: %s\n",
+				socket_path, strerror(-fd));
+			return fd;
+		}
+	} else if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+		/* best effort, unprivileged users are capped at pipe-max-size */
+		fcntl(fd, F_SETPIPE_SZ, OUTPUT_PIPE_SIZE);
+	}
+
+	err = jw_init(w, fd, flush_ms);
+	if (err) {
+		if (fd != STDOUT_FILENO)
+			close(fd);
+		return err;
+	}
+	if (socket_path)
+		w->max_buffered = OUTPUT_MAX_BUFFERED;
+	return 0;
+}
+
+/* Set up @w on the segments and index of --output-dir @dir */
+static inline int output_open_dir(struct json_writer *w, const char *dir, unsigned int flush_ms)
+{
+	struct capture_dir *c = malloc(sizeof(*c));
+	int err;
+
+	if (!c)
+		return -ENOMEM;
+	err = capture_dir_init(c, dir);
+	if (err) {
+		fprintf(stderr, "Failed to open output directory %s: %s\n", dir, strerror(-err));
+		free(c);
+		return err;
+	}
+	err = jw_init(w, -1, flush_ms);
+	if (err) {
+		capture_dir_free(c);
+		free(c);
+		return err;
+	}
+	c->w = w;
+	w->write_hook = capture_dir_write;
+	w->write_ctx = c;
+	return 0;
+}
+
+/* Flush what is left and release the writer and its socket or directory */
+static inline void output_close(struct json_writer *w)
+{
+	/* a writer output_open() never set up owns no fd */
+	bool owned = w->buf && w->fd >= 0 && w->fd != STDOUT_FILENO;
+	struct capture_dir *c = w->write_hook == capture_dir_write ? w->write_ctx : NULL;
+	int fd = w->fd;
+
+	jw_free(w);
+	if (owned)
+		close(fd);
+	if (c) {
+		int err = capture_dir_close(c);
+
+		if (err)
+			fprintf(stderr, "Failed to write the last capture frame: %s\n", strerror(-err));
+		free(c);
+		w->write_hook = NULL;
+		w->write_ctx = NULL;
+	}
+}
+
+#endif /* __OUTPUT_TRANSPORT_H */
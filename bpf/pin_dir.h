@@ -0,0 +1,392 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __PIN_DIR_H
+#define __PIN_DIR_H
+
+/*
+ * --pin-dir: keep the BPF side running across restarts of a tracer.
+ *
+ * A fresh start loads and attaches the object as usual, then pins every map
+ * under DIR/maps, every program under DIR/progs and every link under
+ * DIR/links. The links keep the probes attached after the tracer exits and
+ * records keep collecting in the pinned ring buffer until it is full, after
+ * which the drops show up in the next STATS.
+ *
+ * The next start with the same DIR opens its skeleton but skips loading
+ * when DIR/fingerprint matches: a hash of the object file and of everything
+ * userspace sets before loading (.rodata and the other global data, map
+ * sizes, which programs load and how). Its maps are then pointed at the
+ * pinned ones with bpf_map__reuse_fd(), so bpf_map__fd() works as before,
+ * and nothing is verified or attached again; the ring buffer picks up where
+ * the last consumer stopped. A mismatch, i.e. an option that changes the BPF
+ * side or a new build, clears DIR and loads from scratch.
+ *
+ * The fingerprint is pinned last, so a run that dies half way through
+ * pinning leaves nothing that matches. Removing DIR detaches everything.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#define PIN_DIR_ROOT "/sys/fs/bpf/agentsight"
+#define PIN_DIR_FINGERPRINT "fingerprint"
+
+struct pin_dir {
+	char path[PATH_MAX / 2];
+	bool reused;              /* took over a pinned object instead of loading */
+	unsigned int nr_links;    /* next free name under links/ */
+	const struct bpf_object *obj;
+	int *prog_fds;            /* pinned programs in object order, after pin_dir_reuse() */
+	int nr_progs;
+};
+
+/* @d->path/@kind/@name, with the dots bpffs rejects replaced as libbpf does */
+static inline int pin_dir_path(const struct pin_dir *d, char *buf, size_t size,
+			       const char *kind, const char *name)
+{
+	size_t base = strlen(d->path) + 1;
+	int n;
+
+	n = kind ? snprintf(buf, size, "%s/%s/%s", d->path, kind, name) :
+		   snprintf(buf, size, "%s/%s", d->path, name);
+	if (n < 0 || (size_t)n >= size)
+		return -ENAMETOOLONG;
+	for (char *p = buf + base; *p; p++)
+		if (*p == '.')
+			*p = '_';
+	return 0;
+}
+
+/* Create @path with its maps/, progs/ and links/, the parents as needed */
+static inline int pin_dir_init(struct pin_dir *d, const char *path)
+{
+	static const char *const kinds[] = { "maps", "progs", "links" };
+	char buf[PATH_MAX];
+
+	memset(d, 0, sizeof(*d));
+	if (strlen(path) >= sizeof(d->path) || path[0] != '/')
+		return -EINVAL;
+	strcpy(d->path, path);
+
+	for (char *p = d->path + 1; ; p++) {
+		if (*p != '/' && *p)
+			continue;
+		memcpy(buf, d->path, p - d->path);
+		buf[p - d->path] = '\0';
+		if (mkdir(buf, 0700) < 0 && errno != EEXIST)
+			return -errno;
+		if (!*p)
+			break;
+	}
+	for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+		snprintf(buf, sizeof(buf), "%s/%s", d->path, kinds[i]);
+		if (mkdir(buf, 0700) < 0 && errno != EEXIST)
+			return -errno;
+	}
+	return 0;
+}
+
+static inline uint64_t pin_hash(uint64_t h, const void *data, size_t n)
+{
+	const unsigned char *p = data;
+
+	/* FNV-1a */
+	for (size_t i = 0; i < n; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* What makes a pinned object the one this run would load */
+static inline uint64_t pin_dir_fingerprint(const struct bpf_object_skeleton *s)
+{
+	const struct bpf_object *obj = *s->obj;
+	uint64_t h = pin_hash(0xcbf29ce484222325ULL, s->data, s->data_sz);
+	struct bpf_program *prog;
+	struct bpf_map *map;
+
+	bpf_object__for_each_map(map, obj) {
+		__u32 def[] = { bpf_map__type(map), bpf_map__key_size(map), bpf_map__value_size(map),
+				bpf_map__max_entries(map), bpf_map__map_flags(map) };
+		const void *init;
+		size_t size;
+
+		h = pin_hash(h, bpf_map__name(map), strlen(bpf_map__name(map)) + 1);
+		h = pin_hash(h, def, sizeof(def));
+		init = bpf_map__initial_value(map, &size);
+		if (init)
+			h = pin_hash(h, init, size);
+	}
+	bpf_object__for_each_program(prog, obj) {
+		__u32 def[] = { bpf_program__autoload(prog), bpf_program__type(prog),
+				bpf_program__expected_attach_type(prog) };
+
+		h = pin_hash(h, bpf_program__name(prog), strlen(bpf_program__name(prog)) + 1);
+		h = pin_hash(h, def, sizeof(def));
+	}
+	return h;
+}
+
+/* Did a previous run pin exactly the object @s would load? */
+static inline bool pin_dir_match(const struct pin_dir *d, const struct bpf_object_skeleton *s)
+{
+	char path[PATH_MAX];
+	__u64 have = 0;
+	__u32 zero = 0;
+	int fd, err;
+
+	if (pin_dir_path(d, path, sizeof(path), NULL, PIN_DIR_FINGERPRINT))
+		return false;
+	fd = bpf_obj_get(path);
+	if (fd < 0)
+		return false;
+	err = bpf_map_lookup_elem(fd, &zero, &have);
+	close(fd);
+	return !err && have == pin_dir_fingerprint(s);
+}
+
+/* Is maps/@name the same map as @fd? */
+static inline bool pin_dir_same_map(const struct pin_dir *d, const char *name, int fd)
+{
+	struct bpf_map_info a = {}, b = {};
+	__u32 a_len = sizeof(a), b_len = sizeof(b);
+	char path[PATH_MAX];
+	int pinned;
+	bool same;
+
+	if (pin_dir_path(d, path, sizeof(path), "maps", name))
+		return false;
+	pinned = bpf_obj_get(path);
+	if (pinned < 0)
+		return false;
+	same = !bpf_obj_get_info_by_fd(pinned, &a, &a_len) &&
+	       !bpf_obj_get_info_by_fd(fd, &b, &b_len) && a.id == b.id;
+	close(pinned);
+	return same;
+}
+
+/* Unlink everything but directories in @path */
+static inline void pin_dir_unlink_all(const char *path)
+{
+	struct dirent *e;
+	DIR *dir;
+
+	dir = opendir(path);
+	if (!dir)
+		return;
+	while ((e = readdir(dir)))
+		if (e->d_type != DT_DIR)
+			unlinkat(dirfd(dir), e->d_name, 0);
+	closedir(dir);
+}
+
+/* Drop whatever a previous run pinned, detaching its links */
+static inline int pin_dir_reset(struct pin_dir *d)
+{
+	static const char *const kinds[] = { "links", "progs", "maps" };
+	char path[PATH_MAX];
+	int err;
+
+	/* first, so an interrupted reset never leaves a match behind */
+	err = pin_dir_path(d, path, sizeof(path), NULL, PIN_DIR_FINGERPRINT);
+	if (err)
+		return err;
+	if (unlink(path) < 0 && errno != ENOENT)
+		return -errno;
+	pin_dir_unlink_all(d->path);
+	for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+		snprintf(path, sizeof(path), "%s/%s", d->path, kinds[i]);
+		pin_dir_unlink_all(path);
+	}
+	d->nr_links = 0;
+	return 0;
+}
+
+/*
+ * Take over the pinned object in place of loading @s: its maps reuse the
+ * pinned ones and the pinned programs are opened for pin_dir_prog_fd().
+ */
+static inline int pin_dir_reuse(struct pin_dir *d, const struct bpf_object_skeleton *s)
+{
+	const struct bpf_object *obj = *s->obj;
+	struct bpf_program *prog;
+	struct bpf_map *map;
+	char path[PATH_MAX];
+	int fd, err, n = 0;
+
+	bpf_object__for_each_map(map, obj) {
+		err = pin_dir_path(d, path, sizeof(path), "maps", bpf_map__name(map));
+		if (err)
+			return err;
+		fd = bpf_obj_get(path);
+		if (fd < 0)
+			return -errno;
+		err = bpf_map__reuse_fd(map, fd);
+		close(fd);
+		if (err)
+			return err;
+	}
+
+	bpf_object__for_each_program(prog, obj)
+		n++;
+	d->prog_fds = malloc((n ?: 1) * sizeof(*d->prog_fds));
+	if (!d->prog_fds)
+		return -ENOMEM;
+	for (int i = 0; i < n; i++)
+		d->prog_fds[i] = -1;
+	d->nr_progs = n;
+	d->obj = obj;
+
+	n = 0;
+	bpf_object__for_each_program(prog, obj) {
+		if (bpf_program__autoload(prog)) {
+			err = pin_dir_path(d, path, sizeof(path), "progs", bpf_program__name(prog));
+			if (err)
+				return err;
+			d->prog_fds[n] = bpf_obj_get(path);
+			if (d->prog_fds[n] < 0)
+				return -errno;
+		}
+		n++;
+	}
+	d->reused = true;
+	return 0;
+}
+
+/* Pin @link_fd under links/, where it stays attached after the tracer exits */
+static inline int pin_dir_link(struct pin_dir *d, int link_fd)
+{
+	char name[16], path[PATH_MAX];
+	int err;
+
+	for (;;) {
+		snprintf(name, sizeof(name), "%u", d->nr_links++);
+		err = pin_dir_path(d, path, sizeof(path), "links", name);
+		if (err)
+			return err;
+		if (!bpf_obj_pin(link_fd, path))
+			return 0;
+		/* a taken over dir already has the lower names */
+		if (errno != EEXIST)
+			return -errno;
+	}
+}
+
+/* After a fresh load and attach: pin @s's maps, programs and links, then the fingerprint */
+static inline int pin_dir_save(struct pin_dir *d, const struct bpf_object_skeleton *s)
+{
+	const struct bpf_object *obj = *s->obj;
+	struct bpf_program *prog;
+	struct bpf_map *map;
+	char path[PATH_MAX];
+	__u64 fingerprint = pin_dir_fingerprint(s);
+	__u32 zero = 0;
+	int fd, err;
+
+	bpf_object__for_each_map(map, obj) {
+		err = pin_dir_path(d, path, sizeof(path), "maps", bpf_map__name(map));
+		if (err)
+			return err;
+		/* not bpf_map__pin(), which refuses a map already pinned elsewhere */
+		if (bpf_obj_pin(bpf_map__fd(map), path))
+			return -errno;
+	}
+	bpf_object__for_each_program(prog, obj) {
+		if (bpf_program__fd(prog) < 0)
+			continue;
+		err = pin_dir_path(d, path, sizeof(path), "progs", bpf_program__name(prog));
+		if (err)
+			return err;
+		if (bpf_obj_pin(bpf_program__fd(prog), path))
+			return -errno;
+	}
+	for (int i = 0; i < s->prog_cnt; i++) {
+		const struct bpf_prog_skeleton *p =
+			(const void *)((const char *)s->progs + i * s->prog_skel_sz);
+		struct bpf_link *link = *p->link;
+
+		if (!link)
+			continue;
+		err = pin_dir_link(d, bpf_link__fd(link));
+		if (err)
+			return err;
+		/* so bpf_link__destroy() leaves it attached */
+		bpf_link__disconnect(link);
+	}
+
+	fd = bpf_map_create(BPF_MAP_TYPE_ARRAY, PIN_DIR_FINGERPRINT, sizeof(zero),
+			    sizeof(fingerprint), 1, NULL);
+	if (fd < 0)
+		return -errno;
+	err = pin_dir_path(d, path, sizeof(path), NULL, PIN_DIR_FINGERPRINT);
+	if (!err && (bpf_map_update_elem(fd, &zero, &fingerprint, BPF_ANY) ||
+		     bpf_obj_pin(fd, path)))
+		err = -errno;
+	close(fd);
+	return err;
+}
+
+/* Fd to attach @prog by: the pinned program after a takeover, else the loaded one */
+static inline int pin_dir_prog_fd(const struct pin_dir *d, const struct bpf_program *prog)
+{
+	struct bpf_program *p;
+	int i = 0;
+
+	if (!d->reused)
+		return bpf_program__fd(prog);
+	bpf_object__for_each_program(p, d->obj) {
+		if (p == prog)
+			return i < d->nr_progs ? d->prog_fds[i] : -ENOENT;
+		i++;
+	}
+	return -ENOENT;
+}
+
+/*
+ * A map userspace keeps across restarts, pinned as @name next to the
+ * object's: the one already pinned, or a new empty one. Returns an fd or -errno.
+ */
+static inline int pin_dir_map(struct pin_dir *d, const char *name, enum bpf_map_type type,
+			      __u32 key_size, __u32 value_size, __u32 max_entries)
+{
+	char path[PATH_MAX];
+	int fd, err;
+
+	err = pin_dir_path(d, path, sizeof(path), NULL, name);
+	if (err)
+		return err;
+	fd = bpf_obj_get(path);
+	if (fd >= 0)
+		return fd;
+	fd = bpf_map_create(type, name, key_size, value_size, max_entries, NULL);
+	if (fd < 0)
+		return -errno;
+	if (bpf_obj_pin(fd, path)) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+	return fd;
+}
+
+static inline void pin_dir_free(struct pin_dir *d)
+{
+	for (int i = 0; i < d->nr_progs; i++)
+		if (d->prog_fds[i] >= 0)
+			close(d->prog_fds[i]);
+	free(d->prog_fds);
+	d->prog_fds = NULL;
+	d->nr_progs = 0;
+}
+
+#endif /* __PIN_DIR_H */
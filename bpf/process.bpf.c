@@ -5,9 +5,19 @@
 #include <bpf/bpf_tracing.h>
 #include <bpf/bpf_core_read.h>
 #include "process.h"
+#include "stats.h"
+#include "histogram.h"
+#include "rate_limit.h"
+#include "event_loop.h"
+#include "tracked_pids.h"
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
+#ifndef S_IFMT
+#define S_IFMT 00170000
+#define S_IFLNK 0120000
+#endif
+
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__uint(max_entries, 8192);
@@ -20,15 +30,231 @@ struct {
 	__uint(max_entries, 256 * 1024);
 } rb SEC(".maps");
 
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, PROCESS_PROBE_MAX);
+	__type(key, u32);
+	__type(value, struct probe_stats);
+} rb_stats SEC(".maps");
+
+/* Staging area for variable-length records, sent with bpf_ringbuf_output() */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, union event_record);
+} event_scratch SEC(".maps");
+
+/* Command names from -c, consulted at exec in FILTER mode */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_COMMAND_LIST);
+	__type(key, char[TASK_COMM_LEN]);
+	__type(value, u8);
+} allowed_comms SEC(".maps");
+
+/* Repeat counts of (tgid, path) pairs already sent to userspace */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, OPEN_COUNTS_MAX_ENTRIES);
+	__type(key, struct file_open_key);
+	__type(value, struct file_open_agg);
+} open_counts SEC(".maps");
+
+/* --histogram: process lifetimes per comm, instead of EXIT records */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, HIST_MAX_ENTRIES);
+	__type(key, struct hist_key);
+	__type(value, struct hist);
+} latency_hist SEC(".maps");
+
+/* Per-tgid token buckets for FILE_OPEN and EXEC records */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, RATE_LIMIT_MAX_ENTRIES);
+	__type(key, struct rate_key);
+	__type(value, struct rate_bucket);
+} rate_buckets SEC(".maps");
+
+/*
+ * --resolve-paths: an open that needs the kernel to resolve its name waits
+ * here from syscall entry until security_file_open() or the syscall's exit
+ */
+struct open_pending {
+	struct file_op_event e;  /* the record as it would go out with the raw name */
+	u32 len;                 /* of e.filepath, NUL included */
+	u32 probe;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, OPEN_PENDING_MAX_ENTRIES);
+	__type(key, u64);  /* pid_tgid, one open per thread is in flight */
+	__type(value, struct open_pending);
+} open_pending SEC(".maps");
+
+/* Staging area for FILE_OPEN records, in the form open_pending keeps them */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, struct open_pending);
+} open_scratch SEC(".maps");
+
+/* The cwd of a process as an absolute path, valid while it stays in that directory */
+struct cwd_entry {
+	u64 dentry;  /* fs->pwd.dentry and its inode number when it was learned */
+	u64 ino;
+	u32 len;     /* of prefix, no NUL and no trailing '/', 0 for the root */
+	char prefix[MAX_FILENAME_LEN];
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, CWD_CACHE_MAX_ENTRIES);
+	__type(key, u32);  /* tgid */
+	__type(value, struct cwd_entry);
+} cwd_cache SEC(".maps");
+
+/* Room to join a cwd prefix and a name, and to learn a cwd_entry */
+struct path_scratch {
+	char buf[2 * (MAX_FILENAME_LEN + 1)];
+	struct cwd_entry cwd;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, struct path_scratch);
+} path_scratch SEC(".maps");
+
 const volatile unsigned long long min_duration_ns = 0;
+const volatile bool aggregate_opens = false;
+const volatile enum filter_mode filter_mode = FILTER_MODE_ALL;
+const volatile pid_t targ_pid = 0;
+const volatile bool histogram_only = false;
+const volatile u32 max_args_len = MAX_ARGS_DEFAULT;
+const volatile bool resolve_paths = false;
+
+/* Records per second and tgid by rate_class, 0 = no limit */
+const volatile __u64 rate_limit[RATE_CLASS_MAX] = {};
+
+/* In FILTER mode only tracked tgids produce events, in other modes everything does */
+static __always_inline bool filter_allows(u32 pid)
+{
+	return filter_mode != FILTER_MODE_FILTER || tgid_is_tracked(pid);
+}
+
+/* Kernel side of should_track_process(), marks @pid tracked on a match */
+static __always_inline bool exec_should_track(u32 pid, u32 ppid)
+{
+	char comm[TASK_COMM_LEN] = {};
+
+	if (tgid_is_tracked(pid))  /* forked from a tracked parent */
+		return true;
+
+	bpf_get_current_comm(&comm, sizeof(comm));
+	if ((targ_pid && pid == targ_pid) || tgid_is_tracked(ppid) ||
+	    bpf_map_lookup_elem(&allowed_comms, comm)) {
+		tgid_track(pid);
+		return true;
+	}
+	return false;
+}
+
+/* FNV-1a over the path, must match file_dedup_hash_path() in userspace */
+static __always_inline u64 hash_path(const char *path)
+{
+	u64 hash = 0xcbf29ce484222325ULL;
+
+	for (int i = 0; i < MAX_FILENAME_LEN; i++) {
+		unsigned char c = path[i];
+
+		if (!c)
+			break;
+		hash ^= c;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/*
+ * With aggregate_opens only the first open of a (tgid, path) pair reaches
+ * the ring; repeats are counted here until userspace drains and deletes the
+ * entry. Returns true if this open was absorbed.
+ */
+static __always_inline bool file_open_repeat(u32 pid, const char *path, u64 ts)
+{
+	struct file_open_key key = { .tgid = pid };
+	struct file_open_agg *agg, first = { .last_ns = ts };
+
+	if (!aggregate_opens)
+		return false;
+
+	key.path_hash = hash_path(path);
+	agg = bpf_map_lookup_elem(&open_counts, &key);
+	if (agg) {
+		__sync_fetch_and_add(&agg->count, 1);
+		agg->last_ns = ts;
+		return true;
+	}
+	bpf_map_update_elem(&open_counts, &key, &first, BPF_NOEXIST);
+	return false;
+}
+
+static __always_inline void fill_header(struct event_header *hdr, enum event_type type,
+					u32 pid, u64 ts)
+{
+	hdr->type = type;
+	hdr->pid = pid;
+	hdr->timestamp_ns = ts;
+	bpf_get_current_comm(&hdr->comm, sizeof(hdr->comm));
+}
+
+/* Length of a string read by a bpf_probe_read_*_str() helper, NUL included */
+static __always_inline u32 str_size(long ret, u32 max)
+{
+	if (ret <= 0)
+		return 0;
+	if (ret > max)
+		return max;
+	return ret;
+}
+
+/* Copy the first @size bytes of a staged record to the ring */
+static __always_inline void output_record(void *rec, u64 size, u32 probe)
+{
+	if (bpf_ringbuf_output(&rb, rec, size, ringbuf_wakeup_flags(&rb))) {
+		stats_drop(&rb_stats, &rb, probe);
+		return;
+	}
+	stats_submit(&rb_stats, &rb, probe, size);
+}
+
+/* Children forked by a tracked process are tracked before they exec */
+SEC("tp_btf/sched_process_fork")
+int BPF_PROG(handle_fork, struct task_struct *parent, struct task_struct *child)
+{
+	u32 pid = BPF_CORE_READ(child, tgid);
+
+	/* new threads share the parent's tgid */
+	if (pid != BPF_CORE_READ(child, pid))
+		return 0;
+
+	if (tgid_is_tracked(BPF_CORE_READ(parent, tgid)))
+		tgid_track(pid);
+	return 0;
+}
 
 /* Bash readline uretprobe handler */
 SEC("uretprobe//usr/bin/bash:readline")
 int BPF_URETPROBE(bash_readline, const void *ret)
 {
-	struct event *e;
+	struct bash_readline_event *e;
 	char comm[TASK_COMM_LEN];
-	u32 pid;
+	u32 pid, zero = 0, len;
 
 	if (!ret)
 		return 0;
@@ -39,25 +265,25 @@ int BPF_URETPROBE(bash_readline, const void *ret)
 		return 0;
 
 	pid = bpf_get_current_pid_tgid() >> 32;
+	if (!filter_allows(pid))
+		return 0;
 
-	/* Reserve sample from BPF ringbuf */
-	e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
+	e = bpf_map_lookup_elem(&event_scratch, &zero);
 	if (!e)
 		return 0;
 
-	/* Fill out the sample with bash readline data */
-	e->type = EVENT_TYPE_BASH_READLINE;
-	e->pid = pid;
-	e->ppid = 0; /* Not relevant for bash commands */
-	e->exit_code = 0;
-	e->duration_ns = 0;
-	e->timestamp_ns = bpf_ktime_get_ns();
-	e->exit_event = false;
-	bpf_get_current_comm(&e->comm, sizeof(e->comm));
-	bpf_probe_read_user_str(&e->command, sizeof(e->command), ret);
+	/* Fill out the record with bash readline data */
+	fill_header(&e->hdr, EVENT_TYPE_BASH_READLINE, pid, bpf_ktime_get_ns());
+	len = str_size(bpf_probe_read_user_str(e->command, sizeof(e->command), ret),
+		       sizeof(e->command));
+	if (!len) {
+		e->command[0] = '\0';
+		len = 1;
+	}
 
 	/* Submit to user-space for post-processing */
-	bpf_ringbuf_submit(e, 0);
+	output_record(e, offsetof(struct bash_readline_event, command) + len,
+		      PROCESS_PROBE_BASH_READLINE);
 	return 0;
 }
 
@@ -66,7 +292,9 @@ int handle_exec(struct trace_event_raw_sched_process_exec *ctx)
 {
 	struct task_struct *task;
 	unsigned fname_off;
-	struct event *e;
+	struct exec_event *e;
+	u32 zero = 0, fname_len, args_len;
+	char *args;
 	pid_t pid;
 	u64 ts;
 
@@ -74,60 +302,75 @@ int handle_exec(struct trace_event_raw_sched_process_exec *ctx)
 	pid = bpf_get_current_pid_tgid() >> 32;
 	task = (struct task_struct *)bpf_get_current_task();
 
+	if (filter_mode == FILTER_MODE_FILTER &&
+	    !exec_should_track(pid, BPF_CORE_READ(task, real_parent, tgid)))
+		return 0;
+
 	/* remember time exec() was executed for this PID */
 	ts = bpf_ktime_get_ns();
 	bpf_map_update_elem(&exec_start, &pid, &ts, BPF_ANY);
 
 	/* don't emit exec events when minimum duration is specified */
-	if (min_duration_ns)
+	if (min_duration_ns || histogram_only)
 		return 0;
 
-	/* reserve sample from BPF ringbuf */
-	e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
+	e = bpf_map_lookup_elem(&event_scratch, &zero);
 	if (!e)
 		return 0;
 
-	/* fill out the sample with data */
-	e->type = EVENT_TYPE_PROCESS;
-	e->exit_event = false;
-	e->pid = pid;
+	/* the process is tracked either way, only its EXEC record is dropped */
+	if (!rate_limit_allow(&rate_buckets, pid, RATE_CLASS_EXEC, 1, rate_limit[RATE_CLASS_EXEC], ts,
+			      &e->suppressed))
+		return 0;
+
+	/* fill out the record with data */
+	fill_header(&e->hdr, EVENT_TYPE_EXEC, pid, ts);
 	e->ppid = BPF_CORE_READ(task, real_parent, tgid);
-	e->timestamp_ns = ts;
-	bpf_get_current_comm(&e->comm, sizeof(e->comm));
 
 	fname_off = ctx->__data_loc_filename & 0xFFFF;
-	bpf_probe_read_str(&e->filename, sizeof(e->filename), (void *)ctx + fname_off);
+	fname_len = str_size(bpf_probe_read_str(e->data, MAX_FILENAME_LEN, (void *)ctx + fname_off),
+			     MAX_FILENAME_LEN);
+	if (!fname_len) {
+		e->data[0] = '\0';
+		fname_len = 1;
+	}
+	e->filename_len = fname_len;
+
+	/* argv follows the filename's NUL */
+	args = e->data + (fname_len & MAX_FILENAME_LEN);
 
-	/* Capture full command line with arguments from mm->arg_start */
+	/*
+	 * Copy argv from mm->arg_start as it is, one read of at most max_args_len
+	 * bytes; userspace joins the NUL separated arguments with spaces
+	 */
 	struct mm_struct *mm = BPF_CORE_READ(task, mm);
 	unsigned long arg_start = BPF_CORE_READ(mm, arg_start);
 	unsigned long arg_end = BPF_CORE_READ(mm, arg_end);
-	unsigned long arg_len = arg_end - arg_start;
-
-	/* Limit to buffer size */
-	if (arg_len > MAX_COMMAND_LEN - 1)
-		arg_len = MAX_COMMAND_LEN - 1;
-
-	/* Read command line from userspace memory */
-	if (arg_len > 0) {
-		long ret = bpf_probe_read_user_str(&e->full_command, arg_len + 1, (void *)arg_start);
-		if (ret < 0) {
-			/* Fallback to just comm if we can't read cmdline */
-			bpf_probe_read_kernel_str(&e->full_command, sizeof(e->full_command), e->comm);
-		} else {
-			/* Replace null bytes with spaces for readability */
-			for (int i = 0; i < MAX_COMMAND_LEN - 1 && i < ret - 1; i++) {
-				if (e->full_command[i] == '\0')
-					e->full_command[i] = ' ';
-			}
-		}
+	u32 arg_len = arg_end > arg_start ? arg_end - arg_start : 0;
+
+	e->args_total = arg_len;
+	if (arg_len > max_args_len)
+		arg_len = max_args_len;
+	if (arg_len > MAX_ARGS_LEN)
+		arg_len = MAX_ARGS_LEN;
+
+	if (arg_len && !bpf_probe_read_user(args, arg_len, (void *)arg_start)) {
+		args_len = arg_len;
 	} else {
-		/* No arguments, use comm */
-		bpf_probe_read_kernel_str(&e->full_command, sizeof(e->full_command), e->comm);
+		/* No arguments or unreadable cmdline, use comm */
+		args_len = str_size(bpf_probe_read_kernel_str(args, TASK_COMM_LEN, e->hdr.comm),
+				    TASK_COMM_LEN);
+		if (!args_len) {
+			args[0] = '\0';
+			args_len = 1;
+		}
+		e->args_total = args_len;
 	}
+	e->args_len = args_len;
 
 	/* successfully submit it to user-space for post-processing */
-	bpf_ringbuf_submit(e, 0);
+	output_record(e, offsetof(struct exec_event, data) + (fname_len & MAX_FILENAME_LEN) + args_len,
+		      PROCESS_PROBE_EXEC);
 	return 0;
 }
 
@@ -135,9 +378,10 @@ SEC("tp/sched/sched_process_exit")
 int handle_exit(struct trace_event_raw_sched_process_template* ctx)
 {
 	struct task_struct *task;
-	struct event *e;
+	struct exit_event *e;
 	pid_t pid, tid;
 	u64 id, ts, *start_ts, duration_ns = 0;
+	u32 suppressed;
 
 	/* get PID and TID of exiting thread/process */
 	id = bpf_get_current_pid_tgid();
@@ -148,6 +392,12 @@ int handle_exit(struct trace_event_raw_sched_process_template* ctx)
 	if (pid != tid)
 		return 0;
 
+	if (filter_mode == FILTER_MODE_FILTER) {
+		if (!tgid_is_tracked(pid))
+			return 0;
+		tgid_untrack(pid);
+	}
+
 	/* if we recorded start of the process, calculate lifetime duration */
 	start_ts = bpf_map_lookup_elem(&exec_start, &pid);
 	ts = bpf_ktime_get_ns();
@@ -156,124 +406,261 @@ int handle_exit(struct trace_event_raw_sched_process_template* ctx)
 	else if (min_duration_ns)
 		return 0;
 	bpf_map_delete_elem(&exec_start, &pid);
+	suppressed = rate_limit_forget(&rate_buckets, pid);
+	if (resolve_paths)
+		bpf_map_delete_elem(&cwd_cache, &pid);
 
 	/* if process didn't live long enough, return early */
 	if (min_duration_ns && duration_ns < min_duration_ns)
 		return 0;
 
+	if (histogram_only) {
+		if (start_ts)
+			hist_add(&latency_hist, HIST_PROCESS_LIFETIME, duration_ns);
+		return 0;
+	}
+
 	/* reserve sample from BPF ringbuf */
 	e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
-	if (!e)
+	if (!e) {
+		stats_drop(&rb_stats, &rb, PROCESS_PROBE_EXIT);
 		return 0;
+	}
 
 	/* fill out the sample with data */
 	task = (struct task_struct *)bpf_get_current_task();
 
-	e->type = EVENT_TYPE_PROCESS;
-	e->exit_event = true;
+	fill_header(&e->hdr, EVENT_TYPE_EXIT, pid, ts);
 	e->duration_ns = duration_ns;
-	e->pid = pid;
 	e->ppid = BPF_CORE_READ(task, real_parent, tgid);
-	e->timestamp_ns = ts;
 	e->exit_code = (BPF_CORE_READ(task, exit_code) >> 8) & 0xff;
-	bpf_get_current_comm(&e->comm, sizeof(e->comm));
+	e->suppressed = suppressed;
 
 	/* send data to user-space for post-processing */
-	bpf_ringbuf_submit(e, 0);
+	bpf_ringbuf_submit(e, ringbuf_wakeup_flags(&rb));
+	stats_submit(&rb_stats, &rb, PROCESS_PROBE_EXIT, sizeof(*e));
 	return 0;
 }
 
-/* Syscall tracepoint for openat */
-SEC("tp/syscalls/sys_enter_openat")
-int trace_openat(struct trace_event_raw_sys_enter *ctx)
+/* Send a staged FILE_OPEN unless it repeats an earlier one or is over the rate */
+static __always_inline int output_file_open(struct file_op_event *e, u32 len, u32 probe)
 {
-	struct event *e;
-	pid_t pid;
-	char filepath[MAX_FILENAME_LEN];
-	int dfd, flags;
-	const char *filename;
+	u32 pid = e->hdr.pid;
+	u64 ts = e->hdr.timestamp_ns;
 
-	pid = bpf_get_current_pid_tgid() >> 32;
+	if (file_open_repeat(pid, e->filepath, ts))
+		return 0;
+	if (!rate_limit_allow(&rate_buckets, pid, RATE_CLASS_FILE_OPEN, 1,
+			      rate_limit[RATE_CLASS_FILE_OPEN], ts, &e->suppressed))
+		return 0;
+
+	output_record(e, offsetof(struct file_op_event, filepath) + (len & MAX_FILENAME_LEN), probe);
+	return 0;
+}
+
+static __always_inline void current_pwd(u64 *dentry, u64 *ino)
+{
+	struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+	struct dentry *pwd = BPF_CORE_READ(task, fs, pwd.dentry);
 
-	/* Get syscall arguments */
-	dfd = (int)ctx->args[0];
-	filename = (const char *)ctx->args[1];
-	flags = (int)ctx->args[2];
+	*dentry = (u64)pwd;
+	*ino = BPF_CORE_READ(pwd, d_inode, i_ino);
+}
+
+/*
+ * True if @file was found directly in the cwd, on the cwd's mount and not
+ * through a symlink, so its path is the cwd's path plus its own name
+ */
+static __always_inline bool file_in_cwd(struct file *file)
+{
+	struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+	struct dentry *dentry = BPF_CORE_READ(file, f_path.dentry);
+	struct dentry *pwd = BPF_CORE_READ(task, fs, pwd.dentry);
+	umode_t mode = BPF_CORE_READ(dentry, d_inode, i_mode);
+
+	/* a mount root is its own parent, it is not in the cwd even if it is the cwd */
+	return (mode & S_IFMT) != S_IFLNK && dentry != pwd &&
+	       BPF_CORE_READ(dentry, d_parent) == pwd &&
+	       BPF_CORE_READ(file, f_path.mnt) == BPF_CORE_READ(task, fs, pwd.mnt);
+}
+
+/*
+ * The path of @file, found right in the cwd, as the cached cwd prefix +
+ * "/" + its dentry name in @buf: what bpf_d_path() would give, without the
+ * walk. Returns its size with the NUL, 0 if the cwd is not known or has
+ * changed, or the path does not fit.
+ */
+static __always_inline u32 join_cwd(u32 tgid, struct file *file, char *buf)
+{
+	struct cwd_entry *cwd;
+	u64 dentry, ino;
+	u32 plen, total;
+	long ret;
+
+	cwd = bpf_map_lookup_elem(&cwd_cache, &tgid);
+	if (!cwd)
+		return 0;
+	current_pwd(&dentry, &ino);
+	if (cwd->dentry != dentry || cwd->ino != ino)
+		return 0;
+
+	plen = cwd->len & MAX_FILENAME_LEN;
+	if (plen + 2 > MAX_FILENAME_LEN)
+		return 0;
+	if (bpf_probe_read_kernel(buf, plen, cwd->prefix))
+		return 0;
+	buf[plen & MAX_FILENAME_LEN] = '/';
+	ret = bpf_probe_read_kernel_str(buf + ((plen + 1) & MAX_FILENAME_LEN), MAX_FILENAME_LEN,
+					BPF_CORE_READ(file, f_path.dentry, d_name.name));
+	if (ret <= 0)
+		return 0;
+	total = plen + 1 + ret;
+	return total > MAX_FILENAME_LEN ? 0 : total;
+}
+
+/*
+ * @path (@len bytes) is what bpf_d_path() gave for @file, found right in
+ * the cwd: without "/" and its name the rest is the cwd, remember it for
+ * the next open from there
+ */
+static __always_inline void learn_cwd(u32 tgid, struct file *file, const char *path, u32 len,
+				      struct path_scratch *scratch)
+{
+	char *name = scratch->buf + MAX_FILENAME_LEN + 1;
+	long nlen;
+	int plen;
+
+	nlen = bpf_probe_read_kernel_str(name, MAX_FILENAME_LEN,
+					 BPF_CORE_READ(file, f_path.dentry, d_name.name));
+	if (nlen <= 1)
+		return;
+	plen = cwd_prefix_len(path, len, name, nlen - 1, true);
+	if (plen < 0)
+		return;
+
+	current_pwd(&scratch->cwd.dentry, &scratch->cwd.ino);
+	scratch->cwd.len = plen & MAX_FILENAME_LEN;
+	if (bpf_probe_read_kernel(scratch->cwd.prefix, plen & MAX_FILENAME_LEN, path))
+		return;
+	bpf_map_update_elem(&cwd_cache, &tgid, &scratch->cwd, BPF_ANY);
+}
+
+/* Shared body of the open/openat tracepoints */
+static __always_inline int emit_file_open(const char *filename, int flags, u32 probe)
+{
+	struct open_pending *p;
+	struct file_op_event *e;
+	u32 pid, zero = 0, len;
+	u64 id;
+
+	id = bpf_get_current_pid_tgid();
+	pid = id >> 32;
+	if (!filter_allows(pid))
+		return 0;
+
+	p = bpf_map_lookup_elem(&open_scratch, &zero);
+	if (!p)
+		return 0;
+	e = &p->e;
 
 	/* Read filename from user space */
-	if (bpf_probe_read_user_str(filepath, sizeof(filepath), filename) < 0)
+	len = str_size(bpf_probe_read_user_str(e->filepath, sizeof(e->filepath), filename),
+		       sizeof(e->filepath));
+	if (!len)
 		return 0;
 
-	/* Reserve sample from BPF ringbuf */
-	e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
-	if (!e)
+	/* Fill out the record */
+	fill_header(&e->hdr, EVENT_TYPE_FILE_OPERATION, pid, bpf_ktime_get_ns());
+	e->fd = -1; /* Will be set on return if needed */
+	e->flags = flags;
+	e->is_open = true;
+
+	/* --resolve-paths: every name waits for the file it finds, so one file gets one path */
+	if (resolve_paths) {
+		p->len = len;
+		p->probe = probe;
+		bpf_map_update_elem(&open_pending, &id, p, BPF_ANY);
 		return 0;
+	}
 
-	/* Fill out the event */
-	e->type = EVENT_TYPE_FILE_OPERATION;
-	e->pid = pid;
-	e->ppid = 0; /* Will be filled if needed */
-	e->exit_code = 0;
-	e->duration_ns = 0;
-	e->timestamp_ns = bpf_ktime_get_ns();
-	e->exit_event = false;
-	bpf_get_current_comm(&e->comm, sizeof(e->comm));
-
-	/* Copy filepath and set file open details */
-	bpf_probe_read_kernel_str(e->file_op.filepath, sizeof(e->file_op.filepath), filepath);
-	e->file_op.fd = -1; /* Will be set on return if needed */
-	e->file_op.flags = flags;
-	e->file_op.is_open = true;
-
-	/* Submit to user-space */
-	bpf_ringbuf_submit(e, 0);
-	return 0;
+	return output_file_open(e, len, probe);
+}
+
+/* Syscall tracepoint for openat */
+SEC("tp/syscalls/sys_enter_openat")
+int trace_openat(struct trace_event_raw_sys_enter *ctx)
+{
+	/* args: dfd, filename, flags */
+	return emit_file_open((const char *)ctx->args[1], (int)ctx->args[2], PROCESS_PROBE_OPENAT);
 }
 
 /* Syscall tracepoint for open */
 SEC("tp/syscalls/sys_enter_open")
 int trace_open(struct trace_event_raw_sys_enter *ctx)
 {
-	struct event *e;
-	pid_t pid;
-	char filepath[MAX_FILENAME_LEN];
-	int flags;
-	const char *filename;
-
-	pid = bpf_get_current_pid_tgid() >> 32;
-
-	/* Get syscall arguments */
-	filename = (const char *)ctx->args[0];
-	flags = (int)ctx->args[1];
+	/* args: filename, flags */
+	return emit_file_open((const char *)ctx->args[0], (int)ctx->args[1], PROCESS_PROBE_OPEN);
+}
 
-	/* Read filename from user space */
-	if (bpf_probe_read_user_str(filepath, sizeof(filepath), filename) < 0)
+/* --resolve-paths: the file a pending open found, by its absolute path */
+SEC("fentry/security_file_open")
+int BPF_PROG(resolve_file_open, struct file *file)
+{
+	u64 id = bpf_get_current_pid_tgid();
+	struct open_pending *p;
+	u32 zero = 0, len;
+	struct path_scratch *scratch;
+	bool in_cwd;
+	long ret;
+
+	p = bpf_map_lookup_elem(&open_pending, &id);
+	if (!p)
+		return 0;
+	scratch = bpf_map_lookup_elem(&path_scratch, &zero);
+	if (!scratch)
 		return 0;
 
-	/* Reserve sample from BPF ringbuf */
-	e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
-	if (!e)
+	/* a file right in a known cwd is joined, anything else is walked */
+	in_cwd = file_in_cwd(file);
+	len = in_cwd ? join_cwd(p->e.hdr.pid, file, scratch->buf) : 0;
+	if (!len) {
+		/* too long or unreachable: the syscall's exit sends the raw name */
+		ret = bpf_d_path(&file->f_path, scratch->buf, MAX_FILENAME_LEN);
+		if (ret <= 0)
+			return 0;
+		len = str_size(ret, MAX_FILENAME_LEN);
+		if (in_cwd)
+			learn_cwd(p->e.hdr.pid, file, scratch->buf, len, scratch);
+	}
+	if (bpf_probe_read_kernel(p->e.filepath, len & MAX_FILENAME_LEN, scratch->buf))
 		return 0;
 
-	/* Fill out the event */
-	e->type = EVENT_TYPE_FILE_OPERATION;
-	e->pid = pid;
-	e->ppid = 0;
-	e->exit_code = 0;
-	e->duration_ns = 0;
-	e->timestamp_ns = bpf_ktime_get_ns();
-	e->exit_event = false;
-	bpf_get_current_comm(&e->comm, sizeof(e->comm));
-
-	/* Copy filepath and set file open details */
-	bpf_probe_read_kernel_str(e->file_op.filepath, sizeof(e->file_op.filepath), filepath);
-	e->file_op.fd = -1;
-	e->file_op.flags = flags;
-	e->file_op.is_open = true;
-
-	/* Submit to user-space */
-	bpf_ringbuf_submit(e, 0);
+	output_file_open(&p->e, len, p->probe);
+	bpf_map_delete_elem(&open_pending, &id);
+	return 0;
+}
+
+/* An open that never reached security_file_open(), failed or not, goes out as named */
+static __always_inline int finish_pending_open(void)
+{
+	u64 id = bpf_get_current_pid_tgid();
+	struct open_pending *p = bpf_map_lookup_elem(&open_pending, &id);
+
+	if (!p)
+		return 0;
+	output_file_open(&p->e, p->len, p->probe);
+	bpf_map_delete_elem(&open_pending, &id);
 	return 0;
 }
 
+SEC("tp/syscalls/sys_exit_openat")
+int trace_openat_exit(struct trace_event_raw_sys_exit *ctx)
+{
+	return finish_pending_open();
+}
 
+SEC("tp/syscalls/sys_exit_open")
+int trace_open_exit(struct trace_event_raw_sys_exit *ctx)
+{
+	return finish_pending_open();
+}
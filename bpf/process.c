@@ -1,12 +1,12 @@
 // SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
 /* Copyright (c) 2020 Facebook */
 #include <argp.h>
-#include <signal.h>
 #include <stdio.h>
 #include <time.h>
 #include <sys/resource.h>
 #include <bpf/libbpf.h>
 #include <dirent.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -14,38 +14,54 @@
 #include "process.skel.h"
 #include "process_utils.h"
 #include "process_filter.h"
+#include "stats.h"
+#include "tracked_pids.h"
+#include "pin_dir.h"
+#include "file_dedup.h"
+#include "rate_limit.h"
+#include "json_writer.h"
+#include "binary_format.h"
+#include "output_transport.h"
+#include "event_loop.h"
+#include "tracer.h"
 
-#define MAX_COMMAND_LIST 256
 #define FILE_DEDUP_WINDOW_NS 60000000000ULL  // 60 seconds in nanoseconds
-#define MAX_FILE_HASHES 1024
-
-// Rate limiting per second
-#define MAX_PID_LIMITS 256
-#define MAX_DISTINCT_FILES_PER_SEC 30
-
-struct per_second_limit {
-    pid_t pid;
-    uint64_t current_second;
-    uint32_t distinct_file_count;
-    bool should_warn_next;
-};
-
-// Simple hash table for FILE_OPEN deduplication
-struct file_hash_entry {
-    uint64_t hash;
-    uint64_t timestamp_ns;
-    uint32_t count;
-    pid_t pid;
-    char comm[TASK_COMM_LEN];
-    char filepath[MAX_FILENAME_LEN];
-    int flags;
-};
-
-static struct file_hash_entry file_hashes[MAX_FILE_HASHES];
-static int hash_count = 0;
-
-static struct per_second_limit pid_limits[MAX_PID_LIMITS];
-static int pid_limit_count = 0;
+#define OPEN_DRAIN_INTERVAL_NS 1000000000ULL  // drain in-kernel open counts every second
+#define OPEN_DRAIN_MAX_ORPHANS 256
+
+// Default per-tgid FILE_OPEN rate, see rate_limit.h
+#define OPEN_RATE_DEFAULT 30
+
+#define STATS_INTERVAL_KEY 1001
+#define PIN_TRACKED_KEY 1002
+#define DEDUP_ENTRIES_KEY 1003
+#define AGGREGATE_OPENS_KEY 1004
+#define FLUSH_MS_KEY 1005
+#define FORMAT_KEY 1006
+#define OUTPUT_SOCKET_KEY 1007
+#define WAKEUP_BATCH_KEY 1008
+#define SELF_STATS_KEY 1009
+#define HISTOGRAM_KEY 1010
+#define OPEN_RATE_KEY 1011
+#define EXEC_RATE_KEY 1012
+#define PIN_DIR_KEY 1013
+#define INTERN_STRINGS_KEY 1014
+#define OUTPUT_DIR_KEY 1015
+#define MAX_ARGS_KEY 1016
+#define RESOLVE_PATHS_KEY 1017
+
+/* STATS interval --self-stats uses unless --stats-interval is given */
+#define SELF_STATS_DEFAULT_INTERVAL 10
+
+/* HISTOGRAM interval of a bare --histogram */
+#define HISTOGRAM_DEFAULT_INTERVAL 10
+
+// FILE_OPEN deduplication, see file_dedup.h
+static struct file_dedup file_dedup;
+
+// open_counts map when --aggregate-opens counts repeats in the kernel
+static int open_counts_fd = -1;
+static uint64_t last_open_drain_ns;
 
 static struct env {
 	bool verbose;
@@ -54,8 +70,28 @@ static struct env {
 	int command_count;
 	enum filter_mode filter_mode;
 	pid_t pid;
+	unsigned int stats_interval;
+	const char *pin_tracked;
+	const char *pin_dir;               /* --pin-dir, NULL = load every run */
+	unsigned int dedup_entries;
+	bool aggregate_opens;
+	unsigned int flush_ms;
+	enum output_format format;
+	const char *output_socket;
+	const char *output_dir;            /* --output-dir, NULL = stdout or the socket */
+	unsigned int wakeup_batch_kb;
+	bool self_stats;
+	unsigned int histogram_interval;   /* --histogram, 0 = off */
+	unsigned int open_rate;            /* FILE_OPENs per second and process, 0 = off */
+	unsigned int exec_rate;            /* EXECs per second and process, 0 = off */
+	unsigned int intern_strings;       /* --intern-strings table size, 0 = off */
+	unsigned int max_args;             /* argv bytes copied per EXEC */
+	bool resolve_paths;
 } env = {
 	.verbose = false,
+	.max_args = MAX_ARGS_DEFAULT,
+	.open_rate = OPEN_RATE_DEFAULT,
+	.dedup_entries = FILE_DEDUP_DEFAULT_CAPACITY,
 	.min_duration_ms = 0,
 	.command_count = 0,
 	.filter_mode = FILTER_MODE_PROC,
@@ -65,9 +101,30 @@ static struct env {
 /* Global PID tracker for userspace filtering */
 static struct pid_tracker pid_tracker;
 
+/* Ring buffer telemetry, see stats.h */
+static const char *const process_probe_names[PROCESS_PROBE_MAX] = {
+	[PROCESS_PROBE_BASH_READLINE] = "bash_readline",
+	[PROCESS_PROBE_EXEC] = "exec",
+	[PROCESS_PROBE_EXIT] = "exit",
+	[PROCESS_PROBE_OPENAT] = "openat",
+	[PROCESS_PROBE_OPEN] = "open",
+};
+static struct stats_reporter stats;
+
+/* --histogram lifetimes, see histogram.h */
+static struct hist_reporter hist;
+
+/* Buffered stdout, all JSON output goes through it */
+static struct json_writer out;
+
+/* --intern-strings, see string_intern.h */
+static struct string_intern strings;
+
+#ifndef TRACER_LIBRARY
 const char *argp_program_version = "process-tracer 1.0";
 const char *argp_program_bug_address = "<bpf@vger.kernel.org>";
-const char argp_program_doc[] =
+#endif
+static const char argp_program_doc[] =
 "BPF process tracer with 3-level filtering.\n"
 "\n"
 "It traces process start and exits with configurable filtering levels.\n"
@@ -85,7 +142,12 @@ const char argp_program_doc[] =
 "  ./process -m 1                   # Trace all processes, selective read/write\n"
 "  ./process -c \"claude,python\"    # Trace only claude/python processes\n"
 "  ./process -c \"ssh\" -d 1000     # Trace ssh processes lasting > 1 second\n"
-"  ./process -p 1234                # Trace only PID 1234\n";
+"  ./process -p 1234                # Trace only PID 1234\n"
+"  ./process --stats-interval 10    # Print ring buffer STATS every 10s\n"
+"  ./process --histogram=60         # Process lifetime distributions per command every 60s\n"
+"  ./process -c python --pin-tracked  # Share the tracked PID set with sslsniff\n"
+"  ./process -c python --pin-dir    # Restart without reloading the BPF programs\n"
+"  ./process --intern-strings --format binary  # Each comm and path once, then by id\n";
 
 static const struct argp_option opts[] = {
 	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
@@ -94,6 +156,27 @@ static const struct argp_option opts[] = {
 	{ "pid", 'p', "PID", 0, "Trace this PID only" },
 	{ "mode", 'm', "FILTER-MODE", 0, "Filter mode: 0=all, 1=proc, 2=filter (default=2)" },
 	{ "all", 'a', NULL, 0, "Deprecated: use -m 0 instead" },
+	{ "stats-interval", STATS_INTERVAL_KEY, "SECONDS", 0, "Print ring buffer STATS every SECONDS (0=off)" },
+	{ "pin-tracked", PIN_TRACKED_KEY, "PATH", OPTION_ARG_OPTIONAL,
+	  "Pin the tracked PID map (default " TRACKED_PIDS_PIN_PATH ") for sslsniff --follow-tracked" },
+	{ "pin-dir", PIN_DIR_KEY, "DIR", OPTION_ARG_OPTIONAL,
+	  "Leave programs, links and maps pinned under DIR (default " PIN_DIR_ROOT "/process) and take them over on the next start instead of reloading" },
+	{ "dedup-entries", DEDUP_ENTRIES_KEY, "N", 0, "FILE_OPEN aggregation table size (default 1024)" },
+	{ "format", FORMAT_KEY, "FORMAT", 0, "Output format: json (default) or binary (length prefixed records for the collector)" },
+	{ "output-socket", OUTPUT_SOCKET_KEY, "PATH", 0, "Write output to the unix socket at PATH instead of stdout, dropping records rather than blocking when the reader falls behind" },
+	{ "output-dir", OUTPUT_DIR_KEY, "DIR", 0, "Write output to compressed segment files in DIR with an index.jsonl of their time and pid ranges instead of stdout" },
+	{ "flush-ms", FLUSH_MS_KEY, "MS", 0, "Buffer JSON output for up to MS ms (default 0 = flush after every poll batch)" },
+	{ "wakeup-batch", WAKEUP_BATCH_KEY, "KB", 0, "Wake up only once KB of events wait in the ring buffer, collecting the rest every 10ms (default 0 = wake on every event)" },
+	{ "aggregate-opens", AGGREGATE_OPENS_KEY, NULL, 0, "Count repeated FILE_OPENs in the kernel, only first opens use the ring buffer" },
+	{ "self-stats", SELF_STATS_KEY, NULL, 0, "Add BPF program run time and userspace stage timings to STATS (every 10s unless --stats-interval is set)" },
+	{ "histogram", HISTOGRAM_KEY, "SECONDS", OPTION_ARG_OPTIONAL,
+	  "Only aggregate process lifetimes per command in the kernel and print HISTOGRAM lines every SECONDS (default 10), no events" },
+	{ "open-rate", OPEN_RATE_KEY, "N", 0, "Let each process send at most N FILE_OPENs per second, counting the rest in the kernel (default 30, 0 = off)" },
+	{ "exec-rate", EXEC_RATE_KEY, "N", 0, "Let each process send at most N EXECs per second, counting the rest in the kernel (default 0 = off)" },
+	{ "resolve-paths", RESOLVE_PATHS_KEY, NULL, 0, "Report each FILE_OPEN by the canonical path of the file it opened, resolved in the kernel (needs bpf_d_path, 5.10+)" },
+	{ "max-args", MAX_ARGS_KEY, "BYTES", 0, "Copy at most BYTES of each EXEC's arguments into full_command (default 4096, at most 16384)" },
+	{ "intern-strings", INTERN_STRINGS_KEY, "N", OPTION_ARG_OPTIONAL,
+	  "Write each comm, filename, path and command line once as a STRING_DEF and refer to it by id, remembering the last N (default 4096)" },
 	{},
 };
 
@@ -165,6 +248,112 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 		}
 		free(arg_copy);
 		break;
+	case STATS_INTERVAL_KEY:
+		errno = 0;
+		long interval = strtol(arg, NULL, 10);
+		if (errno || interval < 0) {
+			fprintf(stderr, "Invalid stats interval: %s\n", arg);
+			argp_usage(state);
+		}
+		env.stats_interval = (unsigned int)interval;
+		break;
+	case RESOLVE_PATHS_KEY:
+		env.resolve_paths = true;
+		break;
+	case MAX_ARGS_KEY:
+		errno = 0;
+		long max_args = strtol(arg, NULL, 10);
+		if (errno || max_args <= 0 || max_args > MAX_ARGS_LEN) {
+			fprintf(stderr, "Invalid argument size: %s (must be 1 to %d)\n", arg, MAX_ARGS_LEN);
+			argp_usage(state);
+		}
+		env.max_args = (unsigned int)max_args;
+		break;
+	case DEDUP_ENTRIES_KEY:
+		errno = 0;
+		long entries = strtol(arg, NULL, 10);
+		if (errno || entries <= 0 || entries > (1L << 24)) {
+			fprintf(stderr, "Invalid dedup entries: %s\n", arg);
+			argp_usage(state);
+		}
+		env.dedup_entries = (unsigned int)entries;
+		break;
+	case FORMAT_KEY: {
+		int format = output_format_parse(arg);
+		if (format < 0) {
+			fprintf(stderr, "Invalid format: %s\n", arg);
+			argp_usage(state);
+		}
+		env.format = format;
+		break;
+	}
+	case OUTPUT_SOCKET_KEY:
+		env.output_socket = arg;
+		break;
+	case OUTPUT_DIR_KEY:
+		env.output_dir = arg;
+		break;
+	case FLUSH_MS_KEY:
+		errno = 0;
+		long flush_ms = strtol(arg, NULL, 10);
+		if (errno || flush_ms < 0 || flush_ms > 60000) {
+			fprintf(stderr, "Invalid flush interval: %s\n", arg);
+			argp_usage(state);
+		}
+		env.flush_ms = (unsigned int)flush_ms;
+		break;
+	case WAKEUP_BATCH_KEY:
+		errno = 0;
+		long batch_kb = strtol(arg, NULL, 10);
+		if (errno || batch_kb < 0 || batch_kb > (1L << 20)) {
+			fprintf(stderr, "Invalid wakeup batch: %s\n", arg);
+			argp_usage(state);
+		}
+		env.wakeup_batch_kb = (unsigned int)batch_kb;
+		break;
+	case AGGREGATE_OPENS_KEY:
+		env.aggregate_opens = true;
+		break;
+	case SELF_STATS_KEY:
+		env.self_stats = true;
+		break;
+	case HISTOGRAM_KEY:
+		errno = 0;
+		long hist_interval = arg ? strtol(arg, NULL, 10) : HISTOGRAM_DEFAULT_INTERVAL;
+		if (errno || hist_interval <= 0) {
+			fprintf(stderr, "Invalid histogram interval: %s\n", arg);
+			argp_usage(state);
+		}
+		env.histogram_interval = (unsigned int)hist_interval;
+		break;
+	case OPEN_RATE_KEY:
+	case EXEC_RATE_KEY:
+		errno = 0;
+		long rate = strtol(arg, NULL, 10);
+		if (errno || rate < 0 || rate > 1000000) {
+			fprintf(stderr, "Invalid rate: %s\n", arg);
+			argp_usage(state);
+		}
+		if (key == OPEN_RATE_KEY)
+			env.open_rate = (unsigned int)rate;
+		else
+			env.exec_rate = (unsigned int)rate;
+		break;
+	case PIN_TRACKED_KEY:
+		env.pin_tracked = arg ? arg : TRACKED_PIDS_PIN_PATH;
+		break;
+	case PIN_DIR_KEY:
+		env.pin_dir = arg ? arg : PIN_DIR_ROOT "/process";
+		break;
+	case INTERN_STRINGS_KEY:
+		errno = 0;
+		long intern = arg ? strtol(arg, NULL, 10) : STRING_INTERN_DEFAULT_CAPACITY;
+		if (errno || intern <= 0 || intern > STRING_INTERN_MAX_CAPACITY) {
+			fprintf(stderr, "Invalid intern table size: %s\n", arg);
+			argp_usage(state);
+		}
+		env.intern_strings = (unsigned int)intern;
+		break;
 	case ARGP_KEY_ARG:
 		argp_usage(state);
 		break;
@@ -187,182 +376,142 @@ static int libbpf_print_fn(enum libbpf_print_level level, const char *format, va
 	return vfprintf(stderr, format, args);
 }
 
-static volatile bool exiting = false;
-
-// Rate limiting check function
-static bool should_rate_limit_file(const struct event *e, uint64_t timestamp_ns, bool *add_warning) {
-    uint64_t current_second = timestamp_ns / 1000000000ULL;  // Convert to seconds
-    *add_warning = false;
-    
-    // Find/create entry for this PID
-    struct per_second_limit *limit = NULL;
-    for (int i = 0; i < pid_limit_count; i++) {
-        if (pid_limits[i].pid == e->pid) {
-            limit = &pid_limits[i];
-            break;
-        }
-    }
-    
-    if (!limit && pid_limit_count < MAX_PID_LIMITS) {
-        limit = &pid_limits[pid_limit_count++];
-        limit->pid = e->pid;
-        limit->current_second = current_second;
-        limit->distinct_file_count = 0;
-        limit->should_warn_next = false;
-    }
-    
-    if (!limit) return false;
-    
-    // New second - reset and check if we need to warn
-    if (limit->current_second != current_second) {
-        if (limit->should_warn_next) {
-            *add_warning = true;
-            limit->should_warn_next = false;
-        }
-        limit->current_second = current_second;
-        limit->distinct_file_count = 0;
-    }
-    
-    limit->distinct_file_count++;
-    
-    // Check if over limit
-    if (limit->distinct_file_count > MAX_DISTINCT_FILES_PER_SEC) {
-        limit->should_warn_next = true;  // Warn on next event
-        return true;  // Drop this event
-    }
-    
-    return false;
+/* The loaded tracer, see process_setup() */
+static struct process_bpf *skel;
+/* --pin-dir, see pin_dir.h */
+static struct pin_dir pins;
+static struct ring_buffer *rb;
+
+/* Under trace, where formatted records go instead of the output */
+static struct ring_merge *sink;
+
+/* "suppressed":N of a record the kernel's rate limiter let through, NULL if none */
+static const char *suppressed_field(char *buf, size_t size, unsigned int suppressed)
+{
+	if (!suppressed)
+		return NULL;
+	snprintf(buf, size, "\"suppressed\":%u", suppressed);
+	return buf;
 }
 
 // Shared function to print FILE_OPEN events
-static void print_file_open_event(const struct event *e, uint64_t timestamp_ns, uint32_t count, const char *extra_fields)
+static void print_file_open_event(const char *comm, pid_t pid, const char *filepath, int flags,
+				  uint64_t timestamp_ns, uint32_t count, const char *extra_fields)
 {
-	printf("{");
-	printf("\"timestamp\":%llu,", timestamp_ns);
-	printf("\"event\":\"FILE_OPEN\",");
-	printf("\"comm\":\"%s\",", e->comm);
-	printf("\"pid\":%d,", e->pid);
-	printf("\"count\":%u,", count);
-	printf("\"filepath\":\"%s\",", e->file_op.filepath);
-	printf("\"flags\":%d", e->file_op.flags);
-	
-	if (extra_fields && strlen(extra_fields) > 0) {
-		printf(",%s", extra_fields);
+	if (out.binary) {
+		bin_event_begin(&out, BIN_RECORD_FILE_OPEN, timestamp_ns, pid, comm);
+		bin_u32(&out, count);
+		bin_i32(&out, flags);
+		bin_str_interned(&out, filepath);
+		bin_event_end(&out, extra_fields);
+		return;
 	}
 
-	printf("}\n");
-	fflush(stdout);
+	jw_begin(&out);
+	jw_field_u64(&out, "timestamp", timestamp_ns);
+	jw_field_str(&out, "event", "FILE_OPEN");
+	jw_field_interned(&out, "comm", comm);
+	jw_field_i64(&out, "pid", pid);
+	jw_field_u64(&out, "count", count);
+	jw_field_interned(&out, "filepath", filepath);
+	jw_field_i64(&out, "flags", flags);
+	jw_fields_raw(&out, extra_fields);
+	jw_end(&out);
 }
 
 
-// Hash function for FILE_OPEN events
-static uint64_t hash_file_open(const struct event *e)
+// Print an aggregated FILE_OPEN entry leaving the dedup table
+static void emit_file_open_aggregate(const struct file_dedup_entry *f, uint64_t timestamp_ns,
+				     const char *extra_fields, void *ctx)
 {
-	uint64_t hash = 5381;
-	hash = ((hash << 5) + hash) + e->pid;
-	
-	// Hash the filepath for FILE_OPEN events
-	const char *str = e->file_op.filepath;
-	while (*str) {
-		hash = ((hash << 5) + hash) + *str++;
+	if (env.verbose) {
+		fprintf(stderr, "DEBUG: Emitting FILE_OPEN aggregation for PID %d, count=%u (%s)\n",
+			f->pid, f->count, extra_fields);
 	}
-	
-	return hash;
+	print_file_open_event(f->comm, f->pid, f->filepath, f->flags, timestamp_ns, f->count, extra_fields);
 }
 
-// Get count for FILE_OPEN operations (handles deduplication internally)
-static uint32_t get_file_open_count(const struct event *e, uint64_t timestamp_ns, char *warning_msg, size_t warning_msg_size)
+// Forget the kernel side of an entry so the next open is sent again
+static void forget_kernel_open_count(const struct file_dedup_entry *f, uint64_t timestamp_ns,
+				     const char *extra_fields, void *ctx)
 {
-	if (e->type != EVENT_TYPE_FILE_OPERATION || !e->file_op.is_open) {
-		return 1;  // Return count of 1 for non-FILE_OPEN operations
-	}
-	
-	// Initialize warning message
-	warning_msg[0] = '\0';
-	
-	// Rate limiting check
-	bool add_warning = false;
-	if (should_rate_limit_file(e, timestamp_ns, &add_warning)) {
-		return 0;  // Drop this event
-	}
-	
-	// Build warning message if needed
-	if (add_warning) {
-		snprintf(warning_msg, warning_msg_size, "\"rate_limit_warning\":\"Previous second exceeded %d file limit\"", MAX_DISTINCT_FILES_PER_SEC);
-	}
-	
-	uint64_t hash = hash_file_open(e);
-	
-	// Clean up expired entries first
-	for (int i = 0; i < hash_count; i++) {
-		if (timestamp_ns - file_hashes[i].timestamp_ns > FILE_DEDUP_WINDOW_NS) {
-			// Print aggregated result if count > 1
-			if (file_hashes[i].count > 1) {
-				if (env.verbose) {
-					fprintf(stderr, "DEBUG: Aggregation window expired for FILE_OPEN, count=%u\n", 
-						file_hashes[i].count);
-				}
-				// Create fake event structure for aggregated output
-				struct event fake_event = {
-					.type = EVENT_TYPE_FILE_OPERATION,
-					.pid = file_hashes[i].pid,
-					.ppid = 0,
-					.exit_code = 0,
-					.duration_ns = 0,
-					.exit_event = false,
-					.file_op = {
-						.fd = -1,
-						.flags = file_hashes[i].flags,
-						.is_open = true
-					}
-				};
-				strncpy(fake_event.comm, file_hashes[i].comm, TASK_COMM_LEN - 1);
-				fake_event.comm[TASK_COMM_LEN - 1] = '\0';
-				strncpy(fake_event.file_op.filepath, file_hashes[i].filepath, MAX_FILENAME_LEN - 1);
-				fake_event.file_op.filepath[MAX_FILENAME_LEN - 1] = '\0';
-				print_file_open_event(&fake_event, timestamp_ns, file_hashes[i].count, "\"window_expired\":true");
-			}
-			
-			// Remove expired entry
-			file_hashes[i] = file_hashes[hash_count - 1];
-			hash_count--;
-			i--;
+	struct file_open_key key = { .tgid = f->pid, .path_hash = f->path_hash };
+
+	bpf_map_delete_elem(open_counts_fd, &key);
+}
+
+// Pull the in-kernel repeat counts of one entry
+static void sync_kernel_open_count(struct file_dedup_entry *f)
+{
+	struct file_open_key key = { .tgid = f->pid, .path_hash = f->path_hash };
+	struct file_open_agg agg;
+
+	if (bpf_map_lookup_elem(open_counts_fd, &key, &agg) == 0)
+		file_dedup_add_kernel_count(&file_dedup, f, agg.count, agg.last_ns);
+}
+
+// Fold all in-kernel repeat counts into the dedup table and close expired windows
+static void drain_kernel_open_counts(uint64_t now_ns)
+{
+	struct file_open_key keys[2], orphans[OPEN_DRAIN_MAX_ORPHANS];
+	struct file_open_key *prev = NULL, *key = &keys[0];
+	struct file_open_agg agg;
+	int orphan_count = 0;
+
+	while (bpf_map_get_next_key(open_counts_fd, prev, key) == 0) {
+		struct file_dedup_entry *f = file_dedup_find_hash(&file_dedup, key->tgid, key->path_hash);
+
+		if (f) {
+			if (bpf_map_lookup_elem(open_counts_fd, key, &agg) == 0)
+				file_dedup_add_kernel_count(&file_dedup, f, agg.count, agg.last_ns);
+		} else if (orphan_count < OPEN_DRAIN_MAX_ORPHANS) {
+			// The first open never made it into the table (ring drop,
+			// rate limit, eviction): let the kernel send it again
+			orphans[orphan_count++] = *key;
 		}
+		prev = key;
+		key = key == &keys[0] ? &keys[1] : &keys[0];
 	}
-	
-	// Check if this hash already exists
-	for (int i = 0; i < hash_count; i++) {
-		if (file_hashes[i].hash == hash) {
-			file_hashes[i].count++;
-			file_hashes[i].timestamp_ns = timestamp_ns;
-			if (env.verbose) {
-				fprintf(stderr, "DEBUG: Aggregating FILE_OPEN for PID %d, count now %u\n", 
-					e->pid, file_hashes[i].count);
-			}
-			return 0;  // Return 0 to indicate this should be skipped (duplicate)
-		}
+
+	for (int i = 0; i < orphan_count; i++)
+		bpf_map_delete_elem(open_counts_fd, &orphans[i]);
+
+	file_dedup_expire(&file_dedup, now_ns, emit_file_open_aggregate, NULL);
+}
+
+static void tick_kernel_open_counts(void)
+{
+	uint64_t now_ns;
+
+	if (open_counts_fd < 0)
+		return;
+	now_ns = stats_now_ns();
+	if (now_ns - last_open_drain_ns < OPEN_DRAIN_INTERVAL_NS)
+		return;
+	int prev = stats_stage(&stats, STATS_STAGE_DEDUP);
+	drain_kernel_open_counts(now_ns);
+	stats_stage(&stats, prev);
+	last_open_drain_ns = now_ns;
+}
+
+// Get count for FILE_OPEN operations (handles deduplication internally)
+static uint32_t get_file_open_count(const struct file_op_event *e, uint64_t timestamp_ns)
+{
+	if (!e->is_open) {
+		return 1;  // Return count of 1 for non-FILE_OPEN operations
 	}
 	
-	// Add new hash entry if we have space
-	if (hash_count < MAX_FILE_HASHES) {
-		file_hashes[hash_count].hash = hash;
-		file_hashes[hash_count].timestamp_ns = timestamp_ns;
-		file_hashes[hash_count].count = 1;
-		file_hashes[hash_count].pid = e->pid;
-		strncpy(file_hashes[hash_count].comm, e->comm, TASK_COMM_LEN - 1);
-		file_hashes[hash_count].comm[TASK_COMM_LEN - 1] = '\0';
-		strncpy(file_hashes[hash_count].filepath, e->file_op.filepath, MAX_FILENAME_LEN - 1);
-		file_hashes[hash_count].filepath[MAX_FILENAME_LEN - 1] = '\0';
-		file_hashes[hash_count].flags = e->file_op.flags;
-		hash_count++;
+	// Report entries whose window ran out, then count this open
+	stats_stage(&stats, STATS_STAGE_DEDUP);
+	file_dedup_expire(&file_dedup, timestamp_ns, emit_file_open_aggregate, NULL);
+	uint32_t count = file_dedup_record(&file_dedup, e->hdr.pid, e->hdr.comm, e->filepath,
+					   e->flags, timestamp_ns, emit_file_open_aggregate, NULL);
+	if (count > 1) {
 		if (env.verbose) {
-			fprintf(stderr, "DEBUG: Created new aggregation entry for FILE_OPEN, PID %d (total entries: %d)\n", 
-				e->pid, hash_count);
+			fprintf(stderr, "DEBUG: Aggregating FILE_OPEN for PID %d, count now %u\n", 
+				e->hdr.pid, count);
 		}
-	} else if (env.verbose) {
-		fprintf(stderr, "DEBUG: Max aggregation entries reached (%d), cannot track more\n", MAX_FILE_HASHES);
-		// just print the event
-		print_file_open_event(e, timestamp_ns, 1, NULL);
+		return 0;  // Return 0 to indicate this should be skipped (duplicate)
 	}
 	
 	return 1;  // Return count of 1 for first occurrence
@@ -371,335 +520,628 @@ static uint32_t get_file_open_count(const struct event *e, uint64_t timestamp_ns
 // Flush all pending FILE_OPEN aggregations for a specific PID
 static void flush_pid_file_opens(pid_t pid, uint64_t timestamp_ns)
 {
-	int flushed_count = 0;
-	for (int i = 0; i < hash_count; i++) {
-		if (file_hashes[i].pid == pid && file_hashes[i].count > 1) {
-			if (env.verbose) {
-				fprintf(stderr, "DEBUG: Flushing FILE_OPEN aggregation on process exit, PID %d, count=%u\n", 
-					pid, file_hashes[i].count);
-			}
-			// Create fake event structure for aggregated output
-			struct event fake_event = {
-				.type = EVENT_TYPE_FILE_OPERATION,
-				.pid = file_hashes[i].pid,
-				.ppid = 0,
-				.exit_code = 0,
-				.duration_ns = 0,
-				.exit_event = false,
-				.file_op = {
-					.fd = -1,
-					.flags = file_hashes[i].flags,
-					.is_open = true
-				}
-			};
-			strncpy(fake_event.comm, file_hashes[i].comm, TASK_COMM_LEN - 1);
-			fake_event.comm[TASK_COMM_LEN - 1] = '\0';
-			strncpy(fake_event.file_op.filepath, file_hashes[i].filepath, MAX_FILENAME_LEN - 1);
-			fake_event.file_op.filepath[MAX_FILENAME_LEN - 1] = '\0';
-			print_file_open_event(&fake_event, timestamp_ns, file_hashes[i].count, "\"reason\":\"process_exit\"");
-			flushed_count++;
-		}
-	}
-	
-	// Remove all entries for this PID
-	int removed_count = 0;
-	for (int i = 0; i < hash_count; i++) {
-		if (file_hashes[i].pid == pid) {
-			// Remove this entry by moving last entry to this position
-			file_hashes[i] = file_hashes[hash_count - 1];
-			hash_count--;
-			removed_count++;
-			i--; // Recheck this position since we moved an entry here
-		}
+	struct file_dedup_pid *p = file_dedup_pid_find(&file_dedup, pid);
+
+	// Collect repeats still counted in the kernel before reporting
+	if (p && open_counts_fd >= 0) {
+		for (int32_t idx = p->files; idx != FILE_DEDUP_NONE; idx = file_dedup.files[idx].pid_next)
+			sync_kernel_open_count(&file_dedup.files[idx]);
 	}
+
+	int removed_count = file_dedup_flush_pid(&file_dedup, pid, timestamp_ns, emit_file_open_aggregate, NULL);
 	
 	if (env.verbose && removed_count > 0) {
-		fprintf(stderr, "DEBUG: Cleared %d FILE_OPEN aggregation entries for PID %d (flushed %d)\n", 
-			removed_count, pid, flushed_count);
+		fprintf(stderr, "DEBUG: Cleared %d FILE_OPEN aggregation entries for PID %d\n", 
+			removed_count, pid);
 	}
 }
 
-static void sig_handler(int sig)
+/* Threads reading /proc at startup, used once there are enough tasks */
+#define INITIAL_SCAN_THREADS 4
+
+struct initial_pids_ctx {
+	struct pid_tracker *tracker;
+	int tracked_count;
+};
+
+static void add_initial_pid(void *ctx, const struct proc_task *t)
 {
-	exiting = true;
+	struct initial_pids_ctx *c = ctx;
+
+	/* Check if we should track this process */
+	if (should_track_process(c->tracker, t->comm, t->pid, t->ppid)) {
+		if (pid_tracker_add(c->tracker, t->pid, t->ppid)) {
+			c->tracked_count++;
+		} else if (env.verbose) {
+			fprintf(stderr, "Warning: Failed to add PID %d to tracker (table full)\n", t->pid);
+		}
+	}
 }
 
 /* Populate initial PIDs in the userspace tracker from existing processes */
-static int populate_initial_pids(struct pid_tracker *tracker, char **command_list, int command_count, enum filter_mode filter_mode)
+static int populate_initial_pids(struct pid_tracker *tracker)
 {
-	DIR *proc_dir;
-	struct dirent *entry;
-	pid_t pid, ppid;
-	char comm[TASK_COMM_LEN];
-	int tracked_count = 0;
-
-	proc_dir = opendir("/proc");
-	if (!proc_dir) {
-		fprintf(stderr, "Failed to open /proc directory\n");
+	struct initial_pids_ctx ctx = { .tracker = tracker };
+	int err;
+
+	err = proc_scan("/proc", INITIAL_SCAN_THREADS, add_initial_pid, &ctx);
+	if (err < 0) {
+		fprintf(stderr, "Failed to scan /proc: %s\n", strerror(-err));
 		return -1;
 	}
+	return ctx.tracked_count;
+}
 
-	while ((entry = readdir(proc_dir)) != NULL) {
-		/* Skip non-numeric entries */
-		if (strspn(entry->d_name, "0123456789") != strlen(entry->d_name))
-			continue;
+/* Remove the commands of a previous run's -c list that this run's lacks */
+static void drop_stale_commands(int comms_fd)
+{
+	char key[TASK_COMM_LEN], next[TASK_COMM_LEN];
+	bool more, wanted;
+
+	more = bpf_map_get_next_key(comms_fd, NULL, next) == 0;
+	while (more) {
+		memcpy(key, next, sizeof(key));
+		more = bpf_map_get_next_key(comms_fd, key, next) == 0;
+		wanted = false;
+		for (int i = 0; i < env.command_count && !wanted; i++)
+			wanted = strncmp(key, env.command_list[i], sizeof(key) - 1) == 0;
+		if (!wanted)
+			bpf_map_delete_elem(comms_fd, key);
+	}
+}
 
-		pid = (pid_t)strtol(entry->d_name, NULL, 10);
-		if (pid <= 0)
-			continue;
+/* Mirror the userspace tracker and -c filters into the maps used by the FILTER mode probes */
+static int seed_kernel_filter(struct process_bpf *skel, struct pid_tracker *tracker)
+{
+	int pids_fd = bpf_map__fd(skel->maps.tracked_pids);
+	int comms_fd = bpf_map__fd(skel->maps.allowed_comms);
+	__u32 *pids;
+	__u32 nr = 0;
+	__u8 one = 1;
+	int err;
 
-		/* Read process command */
-		if (read_proc_comm(pid, comm, sizeof(comm)) != 0)
-			continue;
+	/*
+	 * A pinned map may still hold the tree of a previous run. A taken over
+	 * one is live and kept tracking forks meanwhile, so it is only added to.
+	 */
+	if (env.pin_tracked && !pins.reused)
+		tracked_pids_clear(pids_fd);
+
+	pids = calloc(tracker->count ?: 1, sizeof(*pids));
+	if (!pids)
+		return -ENOMEM;
+	for (unsigned int i = 0; i < tracker->capacity; i++) {
+		const struct tracked_pid_entry *entry = &tracker->entries[i];
+
+		if (entry->is_active && entry->is_tracked)
+			pids[nr++] = entry->pid;
+	}
+	err = tracked_pids_add_batch(pids_fd, pids, nr);
+	free(pids);
+	if (err) {
+		fprintf(stderr, "Failed to seed %u tracked PIDs: %d\n", nr, err);
+		return err;
+	}
 
-		/* Read parent PID */
-		if (read_proc_ppid(pid, &ppid) != 0)
-			continue;
+	for (int i = 0; i < env.command_count; i++) {
+		char key[TASK_COMM_LEN] = {};
 
-		/* Check if we should track this process */
-		if (should_track_process(tracker, comm, pid, ppid)) {
-			if (pid_tracker_add(tracker, pid, ppid)) {
-				tracked_count++;
-			} else if (env.verbose) {
-				fprintf(stderr, "Warning: Failed to add PID %d to tracker (table full)\n", pid);
-			}
+		strncpy(key, env.command_list[i], sizeof(key) - 1);
+		err = bpf_map_update_elem(comms_fd, key, &one, BPF_ANY);
+		if (err) {
+			fprintf(stderr, "Failed to add command filter %s: %d\n", key, err);
+			return err;
 		}
 	}
+	if (pins.reused)
+		drop_stale_commands(comms_fd);
+	return 0;
+}
 
-	closedir(proc_dir);
-	return tracked_count;
+/* A string at the end of a record must fit in it and be NUL terminated */
+static bool record_str_ok(const char *str, size_t len, const void *data, size_t data_sz)
+{
+	return len > 0 && str + len <= (const char *)data + data_sz && str[len - 1] == '\0';
 }
 
-static int handle_event(void *ctx, void *data, size_t data_sz)
+static void handle_exec_event(struct pid_tracker *tracker, const struct exec_event *e, size_t data_sz)
 {
-	const struct event *e = data;
-	struct pid_tracker *tracker = (struct pid_tracker *)ctx;
+	static char full_command[MAX_ARGS_LEN + 1];
+	const char *filename = e->data;
+	const char *args = e->data + e->filename_len;
 
-	// Use kernel timestamp from the event instead of generating our own
-	uint64_t timestamp_ns = e->timestamp_ns;
+	if (data_sz < offsetof(struct exec_event, data) ||
+	    !record_str_ok(filename, e->filename_len, e, data_sz) ||
+	    !e->args_len || args + e->args_len > (const char *)e + data_sz)
+		return;
 
-	switch (e->type) {
-		case EVENT_TYPE_PROCESS:
-			if (e->exit_event) {
-				// EXIT event: check if tracked before reporting
-				bool is_tracked = pid_tracker_is_tracked(tracker, e->pid);
+	// EXEC event: in FILTER mode the kernel already applied
+	// should_track_process(), ALL/PROC modes track everything
+	stats_stage(&stats, STATS_STAGE_FILTER);
+	pid_tracker_add(tracker, e->hdr.pid, e->ppid);
+	stats_stage(&stats, STATS_STAGE_FORMAT);
 
-				// Remove from tracker regardless
-				pid_tracker_remove(tracker, e->pid);
+	// The kernel sends argv as it is, NUL separated
+	argv_to_command(full_command, sizeof(full_command), args, e->args_len);
 
-				// Only report if tracked (or if in ALL/PROC mode)
-				if (!is_tracked && tracker->filter_mode == FILTER_MODE_FILTER) {
-					break;
-				}
+	// suppressed count, and whether --max-args cut the command line
+	char extra_buf[64];
+	const char *extra = suppressed_field(extra_buf, sizeof(extra_buf), e->suppressed);
 
-				printf("{");
-				printf("\"timestamp\":%llu,", timestamp_ns);
-				printf("\"event\":\"EXIT\",");
-				printf("\"comm\":\"%s\",", e->comm);
-				printf("\"pid\":%d,", e->pid);
-				printf("\"ppid\":%d", e->ppid);
-				printf(",\"exit_code\":%u", e->exit_code);
-				if (e->duration_ns)
-					printf(",\"duration_ms\":%llu", e->duration_ns / 1000000);
-
-				// Check if this PID has pending rate limit warning
-				bool add_warning = false;
-				for (int i = 0; i < pid_limit_count; i++) {
-					if (pid_limits[i].pid == e->pid && pid_limits[i].should_warn_next) {
-						add_warning = true;
-						// Remove this entry
-						pid_limits[i] = pid_limits[--pid_limit_count];
-						break;
-					}
-				}
+	if (e->args_total > e->args_len) {
+		size_t n = extra ? strlen(extra) : 0;
 
-				if (add_warning) {
-					printf(",\"rate_limit_warning\":\"Process had %d+ file ops per second\"", MAX_DISTINCT_FILES_PER_SEC);
-				}
-				printf("}\n");
-				fflush(stdout);
-
-				// Flush all pending FILE_OPEN aggregations for this PID
-				flush_pid_file_opens(e->pid, timestamp_ns);
-			} else {
-				// EXEC event: check if should track
-				if (should_track_process(tracker, e->comm, e->pid, e->ppid)) {
-					pid_tracker_add(tracker, e->pid, e->ppid);
-
-					// Report the EXEC event
-					printf("{");
-					printf("\"timestamp\":%llu,", timestamp_ns);
-					printf("\"event\":\"EXEC\",");
-					printf("\"comm\":\"%s\",", e->comm);
-					printf("\"pid\":%d,", e->pid);
-					printf("\"ppid\":%d", e->ppid);
-					printf(",\"filename\":\"%s\"", e->filename);
-					printf(",\"full_command\":\"%s\"", e->full_command);
-					printf("}\n");
-					fflush(stdout);
-				} else if (tracker->filter_mode == FILTER_MODE_FILTER) {
-					// In filter mode, don't report untracked processes
-					break;
-				} else {
-					// In ALL/PROC modes, report all processes but add them to tracker for PROC mode
-					if (tracker->filter_mode == FILTER_MODE_PROC) {
-						pid_tracker_add(tracker, e->pid, e->ppid);
-					}
-
-					printf("{");
-					printf("\"timestamp\":%llu,", timestamp_ns);
-					printf("\"event\":\"EXEC\",");
-					printf("\"comm\":\"%s\",", e->comm);
-					printf("\"pid\":%d,", e->pid);
-					printf("\"ppid\":%d", e->ppid);
-					printf(",\"filename\":\"%s\"", e->filename);
-					printf(",\"full_command\":\"%s\"", e->full_command);
-					printf("}\n");
-					fflush(stdout);
-				}
-			}
-			break;
+		snprintf(extra_buf + n, sizeof(extra_buf) - n, "%s\"args_truncated\":true", n ? "," : "");
+		extra = extra_buf;
+	}
 
-		case EVENT_TYPE_BASH_READLINE:
-			// Check if should report bash readline for this PID
-			if (!should_report_bash_readline(tracker, e->pid)) {
-				break;
-			}
+	if (out.binary) {
+		bin_event_begin(&out, BIN_RECORD_EXEC, e->hdr.timestamp_ns, e->hdr.pid, e->hdr.comm);
+		bin_u32(&out, e->ppid);
+		bin_str_interned(&out, filename);
+		bin_str_interned(&out, full_command);
+		bin_event_end(&out, extra);
+		return;
+	}
 
-			printf("{");
-			printf("\"timestamp\":%llu,", timestamp_ns);
-			printf("\"event\":\"BASH_READLINE\",");
-			printf("\"comm\":\"%s\",", e->comm);
-			printf("\"pid\":%d,", e->pid);
-			printf("\"command\":\"%s\"", e->command);
-			printf("}\n");
-			fflush(stdout);
-			break;
+	jw_begin(&out);
+	jw_field_u64(&out, "timestamp", e->hdr.timestamp_ns);
+	jw_field_str(&out, "event", "EXEC");
+	jw_field_interned(&out, "comm", e->hdr.comm);
+	jw_field_i64(&out, "pid", e->hdr.pid);
+	jw_field_i64(&out, "ppid", e->ppid);
+	jw_field_interned(&out, "filename", filename);
+	jw_field_interned(&out, "full_command", full_command);
+	jw_fields_raw(&out, extra);
+	jw_end(&out);
+}
 
-		case EVENT_TYPE_FILE_OPERATION:
-			// Only handle FILE_OPEN events, skip FILE_CLOSE
-			if (!e->file_op.is_open) {
-				break;
-			}
+static void handle_exit_event(struct pid_tracker *tracker, const struct exit_event *e, size_t data_sz)
+{
+	if (data_sz < sizeof(*e))
+		return;
+
+	// EXIT event: in FILTER mode the kernel only emits tracked exits
+	stats_stage(&stats, STATS_STAGE_FILTER);
+	pid_tracker_remove(tracker, e->hdr.pid);
+	stats_stage(&stats, STATS_STAGE_FORMAT);
+
+	// Records the kernel rate limited after this PID's last reported one
+	char suppressed_buf[32];
+	const char *suppressed = suppressed_field(suppressed_buf, sizeof(suppressed_buf), e->suppressed);
+
+	if (out.binary) {
+		bin_event_begin(&out, BIN_RECORD_EXIT, e->hdr.timestamp_ns, e->hdr.pid, e->hdr.comm);
+		bin_u32(&out, e->ppid);
+		bin_u32(&out, e->exit_code);
+		bin_u64(&out, e->duration_ns);
+		bin_event_end(&out, suppressed);
+	} else {
+		jw_begin(&out);
+		jw_field_u64(&out, "timestamp", e->hdr.timestamp_ns);
+		jw_field_str(&out, "event", "EXIT");
+		jw_field_interned(&out, "comm", e->hdr.comm);
+		jw_field_i64(&out, "pid", e->hdr.pid);
+		jw_field_i64(&out, "ppid", e->ppid);
+		jw_field_u64(&out, "exit_code", e->exit_code);
+		if (e->duration_ns)
+			jw_field_u64(&out, "duration_ms", e->duration_ns / 1000000);
+		jw_fields_raw(&out, suppressed);
+		jw_end(&out);
+	}
 
-			// Check if should report file ops for this PID
-			if (!should_report_file_ops(tracker, e->pid)) {
-				break;
-			}
+	// Flush all pending FILE_OPEN aggregations for this PID
+	stats_stage(&stats, STATS_STAGE_DEDUP);
+	flush_pid_file_opens(e->hdr.pid, e->hdr.timestamp_ns);
+}
 
-			// Get count for this FILE_OPEN operation
-			char warning_msg[128];
-			uint32_t count = get_file_open_count(e, timestamp_ns, warning_msg, sizeof(warning_msg));
+static void handle_bash_readline_event(const struct bash_readline_event *e, size_t data_sz)
+{
+	size_t len = data_sz - offsetof(struct bash_readline_event, command);
+
+	if (data_sz <= offsetof(struct bash_readline_event, command) ||
+	    !record_str_ok(e->command, len, e, data_sz))
+		return;
+
+	// Filtered in the kernel (only tracked PIDs in FILTER mode)
+	if (out.binary) {
+		bin_event_begin(&out, BIN_RECORD_BASH_READLINE, e->hdr.timestamp_ns, e->hdr.pid, e->hdr.comm);
+		bin_str(&out, e->command);
+		bin_event_end(&out, NULL);
+		return;
+	}
 
-			// Skip if this is a duplicate (count == 0)
-			if (count == 0) {
-				break;
-			}
+	jw_begin(&out);
+	jw_field_u64(&out, "timestamp", e->hdr.timestamp_ns);
+	jw_field_str(&out, "event", "BASH_READLINE");
+	jw_field_interned(&out, "comm", e->hdr.comm);
+	jw_field_i64(&out, "pid", e->hdr.pid);
+	jw_field_str(&out, "command", e->command);
+	jw_end(&out);
+}
+
+static void handle_file_op_event(struct pid_tracker *tracker, const struct file_op_event *e, size_t data_sz)
+{
+	size_t len = data_sz - offsetof(struct file_op_event, filepath);
+
+	if (data_sz <= offsetof(struct file_op_event, filepath) ||
+	    !record_str_ok(e->filepath, len, e, data_sz))
+		return;
+
+	// Only handle FILE_OPEN events, skip FILE_CLOSE
+	if (!e->is_open)
+		return;
+
+	// FILTER mode is handled in the kernel, PROC mode still checks here
+	stats_stage(&stats, STATS_STAGE_FILTER);
+	if (tracker->filter_mode == FILTER_MODE_PROC &&
+	    !should_report_file_ops(tracker, e->hdr.pid))
+		return;
+
+	// Get count for this FILE_OPEN operation
+	uint32_t count = get_file_open_count(e, e->hdr.timestamp_ns);
+	char suppressed_buf[32];
+
+	// Skip if this is a duplicate (count == 0)
+	if (count == 0)
+		return;
+
+	// Report the FILE_OPEN event with count
+	stats_stage(&stats, STATS_STAGE_FORMAT);
+	print_file_open_event(e->hdr.comm, e->hdr.pid, e->filepath, e->flags, e->hdr.timestamp_ns,
+			      count, suppressed_field(suppressed_buf, sizeof(suppressed_buf), e->suppressed));
+}
+
+static int handle_event(void *ctx, void *data, size_t data_sz)
+{
+	const struct event_header *hdr = data;
+	struct pid_tracker *tracker = (struct pid_tracker *)ctx;
+	int stage;
+
+	if (data_sz < sizeof(*hdr))
+		return 0;
+
+	/* handlers switch stages as they go, see stats_stage() */
+	stage = stats_stage(&stats, STATS_STAGE_FORMAT);
+	switch (hdr->type) {
+		case EVENT_TYPE_EXEC:
+			handle_exec_event(tracker, data, data_sz);
+			break;
+
+		case EVENT_TYPE_EXIT:
+			handle_exit_event(tracker, data, data_sz);
+			break;
 
-			// Report the FILE_OPEN event with count
-			print_file_open_event(e, timestamp_ns, count, strlen(warning_msg) > 0 ? warning_msg : NULL);
+		case EVENT_TYPE_BASH_READLINE:
+			handle_bash_readline_event(data, data_sz);
+			break;
+
+		case EVENT_TYPE_FILE_OPERATION:
+			handle_file_op_event(tracker, data, data_sz);
 			break;
 
 		default:
 			// For unknown events, always report immediately
-			printf("{");
-			printf("\"timestamp\":%llu,", timestamp_ns);
-			printf("\"event\":\"UNKNOWN\",");
-			printf("\"event_type\":%d", e->type);
-			printf("}\n");
-			fflush(stdout);
+			jw_begin(&out);
+			jw_field_u64(&out, "timestamp", hdr->timestamp_ns);
+			jw_field_str(&out, "event", "UNKNOWN");
+			jw_field_i64(&out, "event_type", hdr->type);
+			jw_end(&out);
 			break;
 	}
+	stats_stage(&stats, stage);
 
 	return 0;
 }
 
-int main(int argc, char **argv)
+/* Under trace: hand each record to the shared merge, see tracer.h */
+static int handle_sink_event(void *ctx, void *data, size_t data_sz)
+{
+	const struct event_header *hdr = data;
+
+	handle_event(ctx, data, data_sz);
+	if (data_sz >= sizeof(*hdr))
+		tracer_sink_take(sink, &out, hdr->timestamp_ns);
+	return 0;
+}
+
+/*
+ * Point the skeleton at what an earlier run left under --pin-dir if it was
+ * loaded the same way and still shares the --pin-tracked map, otherwise
+ * clear the dir for this run to pin its own
+ */
+static int take_over_pins(void)
+{
+	bool same;
+	int err, fd;
+
+	err = pin_dir_init(&pins, env.pin_dir);
+	if (err)
+		return err;
+	same = pin_dir_match(&pins, skel->skeleton);
+	if (same && env.pin_tracked) {
+		fd = bpf_obj_get(env.pin_tracked);
+		same = fd >= 0 && pin_dir_same_map(&pins, "tracked_pids", fd);
+		if (fd >= 0)
+			close(fd);
+	}
+	if (!same)
+		return pin_dir_reset(&pins);
+	return pin_dir_reuse(&pins, skel->skeleton);
+}
+
+static int process_setup(int argc, char **argv, struct tracer_ctx *ctx)
 {
-	struct ring_buffer *rb = NULL;
-	struct process_bpf *skel;
 	int err;
 
 	/* Parse command line arguments */
 	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
 	if (err)
-		return err;
+		return -err;
+	if (env.self_stats && !env.stats_interval)
+		env.stats_interval = SELF_STATS_DEFAULT_INTERVAL;
 
 	/* filter_mode is set via -m flag or -a flag, defaults to FILTER_MODE_FILTER */
 
+	if (env.output_dir && env.output_socket) {
+		fprintf(stderr, "--output-dir cannot be combined with --output-socket\n");
+		return -EINVAL;
+	}
+
+	sink = ctx->sink;
+	if (sink) {
+		/* trace owns the output, records are formatted in memory */
+		if (env.output_socket || env.output_dir || env.flush_ms || env.format != OUTPUT_FORMAT_JSON) {
+			fprintf(stderr, "Set --format, --output-socket, --output-dir and --flush-ms on trace itself\n");
+			return -EINVAL;
+		}
+		/* the merge reorders records, a STRING_DEF could end up after its use */
+		if (env.intern_strings) {
+			fprintf(stderr, "--intern-strings is not supported under trace\n");
+			return -EINVAL;
+		}
+		err = jw_init(&out, -1, 0);
+		out.binary = ctx->binary;
+	} else if (env.output_dir) {
+		err = output_open_dir(&out, env.output_dir, env.flush_ms);
+	} else {
+		err = output_open(&out, env.output_socket, env.flush_ms);
+	}
+	if (err) {
+		fprintf(stderr, "Failed to set up output: %d\n", err);
+		return -1;
+	}
+
+	if (!sink && env.format == OUTPUT_FORMAT_BINARY)
+		bin_stream_start(&out);
+
+	if (env.intern_strings) {
+		err = string_intern_init(&strings, env.intern_strings);
+		if (err) {
+			fprintf(stderr, "Failed to allocate string intern table: %d\n", err);
+			return -1;
+		}
+		out.intern = &strings;
+	}
+
+	err = file_dedup_init(&file_dedup, env.dedup_entries, FILE_DEDUP_WINDOW_NS);
+	if (err) {
+		fprintf(stderr, "Failed to allocate FILE_OPEN dedup table: %d\n", err);
+		return -1;
+	}
+
 	/* Initialize userspace PID tracker */
-	pid_tracker_init(&pid_tracker, env.command_list, env.command_count, env.filter_mode, env.pid);
+	err = pid_tracker_init(&pid_tracker, env.command_list, env.command_count, env.filter_mode, env.pid);
+	if (err) {
+		fprintf(stderr, "Failed to allocate PID tracker: %d\n", err);
+		return -1;
+	}
 
 	/* Set up libbpf errors and debug info callback */
 	libbpf_set_print(libbpf_print_fn);
 
-	/* Cleaner handling of Ctrl-C */
-	signal(SIGINT, sig_handler);
-	signal(SIGTERM, sig_handler);
-
 	/* Load and verify BPF application */
 	skel = process_bpf__open();
 	if (!skel) {
 		fprintf(stderr, "Failed to open and load BPF skeleton\n");
-		return 1;
+		return -1;
 	}
 
 	/* Parameterize BPF code with minimum duration */
 	skel->rodata->min_duration_ns = env.min_duration_ms * 1000000ULL;
+	skel->rodata->filter_mode = env.filter_mode;
+	skel->rodata->targ_pid = env.pid;
+	skel->rodata->aggregate_opens = env.aggregate_opens;
+	skel->rodata->wakeup_bytes = env.wakeup_batch_kb * 1024ULL;
+	skel->rodata->histogram_only = env.histogram_interval > 0;
+	skel->rodata->rate_limit[RATE_CLASS_FILE_OPEN] = env.open_rate;
+	skel->rodata->rate_limit[RATE_CLASS_EXEC] = env.exec_rate;
+	skel->rodata->max_args_len = env.max_args;
+	skel->rodata->resolve_paths = env.resolve_paths;
+
+	/* Only exec and exit feed the lifetime histograms */
+	if (env.histogram_interval) {
+		bpf_program__set_autoload(skel->progs.bash_readline, false);
+		bpf_program__set_autoload(skel->progs.trace_openat, false);
+		bpf_program__set_autoload(skel->progs.trace_open, false);
+	}
+
+	/* bpf_d_path() and the syscall exits only serve --resolve-paths */
+	if (!env.resolve_paths || env.histogram_interval) {
+		bpf_program__set_autoload(skel->progs.resolve_file_open, false);
+		bpf_program__set_autoload(skel->progs.trace_openat_exit, false);
+		bpf_program__set_autoload(skel->progs.trace_open_exit, false);
+		/* nothing but those use the maps, keep them small */
+		bpf_map__set_max_entries(skel->maps.open_pending, 1);
+		bpf_map__set_max_entries(skel->maps.cwd_cache, 1);
+	}
+
+	/* past half the ring, a burst would fill it before anyone is woken */
+	if (skel->rodata->wakeup_bytes > bpf_map__max_entries(skel->maps.rb) / 2) {
+		fprintf(stderr, "--wakeup-batch must be at most %u KB\n",
+			bpf_map__max_entries(skel->maps.rb) / 2 / 1024);
+		return -EINVAL;
+	}
+
+	/* The tracked PID map is only maintained in FILTER mode */
+	if (env.filter_mode != FILTER_MODE_FILTER)
+		bpf_program__set_autoload(skel->progs.handle_fork, false);
+
+	if (env.pin_tracked) {
+		if (env.filter_mode != FILTER_MODE_FILTER)
+			fprintf(stderr, "Warning: --pin-tracked only tracks PIDs in filter mode (-m 2)\n");
+		err = bpf_map__set_pin_path(skel->maps.tracked_pids, env.pin_tracked);
+		if (err) {
+			fprintf(stderr, "Failed to set tracked PID pin path: %d\n", err);
+			return err;
+		}
+	}
+
+	if (env.pin_dir) {
+		err = take_over_pins();
+		if (err) {
+			fprintf(stderr, "Failed to take over BPF object pinned under %s: %s\n",
+				env.pin_dir, strerror(-err));
+			return err;
+		}
+		if (env.verbose && pins.reused)
+			fprintf(stderr, "Took over BPF object pinned under %s\n", env.pin_dir);
+	}
 
 	/* Load & verify BPF programs */
-	err = process_bpf__load(skel);
-	if (err) {
-		fprintf(stderr, "Failed to load and verify BPF skeleton\n");
-		goto cleanup;
+	if (!pins.reused) {
+		err = process_bpf__load(skel);
+		if (err) {
+			fprintf(stderr, "Failed to load and verify BPF skeleton\n");
+			return err;
+		}
+	}
+
+	if (env.aggregate_opens) {
+		open_counts_fd = bpf_map__fd(skel->maps.open_counts);
+		file_dedup.on_remove = forget_kernel_open_count;
+		last_open_drain_ns = stats_now_ns();
 	}
 
 	/* Populate initial PIDs from existing processes into userspace tracker */
-	int tracked_count = populate_initial_pids(&pid_tracker, env.command_list, env.command_count, env.filter_mode);
+	int tracked_count = populate_initial_pids(&pid_tracker);
 	if (tracked_count < 0) {
 		fprintf(stderr, "Failed to populate initial PIDs\n");
-		goto cleanup;
+		return tracked_count;
+	}
+
+	if (env.filter_mode == FILTER_MODE_FILTER) {
+		err = seed_kernel_filter(skel, &pid_tracker);
+		if (err)
+			return err;
+		/* sslsniff --follow-tracked under trace follows this tree */
+		ctx->tracked_pids_fd = bpf_map__fd(skel->maps.tracked_pids);
 	}
 	
 	/* Output configuration as JSON */
 	// printf("Config: filter_mode=%d, min_duration_ms=%ld, commands=%d, pid=%d, initial_tracked_pids=%d\n", 
 	//        env.filter_mode, env.min_duration_ms, env.command_count, env.pid, tracked_count);
 
-	/* Attach tracepoints */
-	err = process_bpf__attach(skel);
-	if (err) {
-		fprintf(stderr, "Failed to attach BPF skeleton\n");
-		goto cleanup;
+	/* Attach tracepoints, a taken over object still is */
+	if (!pins.reused) {
+		err = process_bpf__attach(skel);
+		if (err) {
+			fprintf(stderr, "Failed to attach BPF skeleton\n");
+			return err;
+		}
+	}
+	if (env.pin_dir && !pins.reused) {
+		err = pin_dir_save(&pins, skel->skeleton);
+		if (err) {
+			fprintf(stderr, "Failed to pin BPF object under %s: %s\n", env.pin_dir,
+				strerror(-err));
+			return err;
+		}
 	}
 
 	/* Set up ring buffer polling with pid_tracker as context */
-	rb = ring_buffer__new(bpf_map__fd(skel->maps.rb), handle_event, &pid_tracker, NULL);
+	rb = ring_buffer__new(bpf_map__fd(skel->maps.rb), sink ? handle_sink_event : handle_event,
+			      &pid_tracker, NULL);
 	if (!rb) {
-		err = -1;
 		fprintf(stderr, "Failed to create ring buffer\n");
-		goto cleanup;
+		return -1;
 	}
 
+	err = event_loop_add(ctx->loop, ring_buffer__epoll_fd(rb), EVENT_LOOP_RING);
+	/* records below the wakeup threshold are collected on the tick */
+	if (!err && env.wakeup_batch_kb && ctx->loop->timerfd < 0)
+		err = event_loop_set_tick(ctx->loop, WAKEUP_TICK_MS);
+	if (err) {
+		fprintf(stderr, "Failed to wait on ring buffer: %d\n", err);
+		return err;
+	}
 
-
-	/* Process events */
-	while (!exiting) {
-		err = ring_buffer__poll(rb, 100 /* timeout, ms */);
-		/* Ctrl-C will cause -EINTR */
-		if (err == -EINTR) {
-			err = 0;
-			break;
+	err = stats_reporter_init(&stats, bpf_map__fd(skel->maps.rb_stats),
+				  process_probe_names, PROCESS_PROBE_MAX, "process", "timestamp", &out,
+				  bpf_map__max_entries(skel->maps.rb), env.stats_interval);
+	if (err) {
+		fprintf(stderr, "Failed to set up ring buffer stats\n");
+		return err;
+	}
+	if (env.self_stats) {
+		err = stats_reporter_enable_self(&stats, skel->obj, NULL, NULL);
+		if (err) {
+			fprintf(stderr, "Failed to enable BPF run time stats: %s\n", strerror(-err));
+			return err;
 		}
-		if (err < 0) {
-			fprintf(stderr, "Error polling perf buffer: %d\n", err);
-			break;
+	}
+
+	if (env.histogram_interval) {
+		err = hist_reporter_init(&hist, bpf_map__fd(skel->maps.latency_hist), "process",
+					 "timestamp", &out, env.histogram_interval);
+		if (err) {
+			fprintf(stderr, "Failed to set up histograms: %d\n", err);
+			return err;
 		}
 	}
+	return 0;
+}
+
+static int process_timeout_ms(int timeout_ms)
+{
+	return jw_poll_timeout_ms(&out, timeout_ms);
+}
+
+/* Process events */
+static int process_poll(void)
+{
+	int err;
+
+	stats_stage(&stats, STATS_STAGE_POLL);
+	err = ring_buffer__consume(rb);
+	stats_stage(&stats, STATS_STAGE_NONE);
+	if (err < 0) {
+		fprintf(stderr, "Error consuming ring buffer: %d\n", err);
+		return err;
+	}
+	stats_reporter_tick(&stats);
+	hist_reporter_tick(&hist);
+	tick_kernel_open_counts();
+	tracer_sink_take(sink, &out, stats_now_ns());
+	jw_batch_end(&out);
+	return 0;
+}
 
-cleanup:
+/* what the last, partial interval collected */
+static void process_finish(void)
+{
+	hist_reporter_print(&hist, stats_now_ns());
+	tracer_sink_take(sink, &out, stats_now_ns());
+}
+
+static int process_cleanup(int err)
+{
 	/* Clean up */
+	stats_reporter_free(&stats);
+	hist_reporter_free(&hist);
 	ring_buffer__free(rb);
 	process_bpf__destroy(skel);
+	pin_dir_free(&pins);
 	
 	/* Free allocated command strings */
 	for (int i = 0; i < env.command_count; i++) {
@@ -707,10 +1149,28 @@ cleanup:
 	}
 	
 	/* Clean up FILE_OPEN deduplication tracking */
-	hash_count = 0;
-	
-	/* Clean up rate limiting tracking */
-	pid_limit_count = 0;
+	file_dedup_free(&file_dedup);
+	pid_tracker_free(&pid_tracker);
+
+	/* Write out anything still buffered */
+	output_close(&out);
+	string_intern_free(&strings);
 
 	return err < 0 ? -err : 0;
 }
+
+const struct tracer process_tracer = {
+	.name = "process",
+	.setup = process_setup,
+	.timeout_ms = process_timeout_ms,
+	.poll = process_poll,
+	.finish = process_finish,
+	.cleanup = process_cleanup,
+};
+
+#ifndef TRACER_LIBRARY
+int main(int argc, char **argv)
+{
+	return tracer_main(&process_tracer, argc, argv);
+}
+#endif
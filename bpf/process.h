@@ -8,6 +8,9 @@
 #define MAX_COMMAND_FILTERS 10
 #define MAX_TRACKED_PIDS 1024
 #define MAX_COMMAND_LEN 256
+#define MAX_ARGS_LEN 16384     /* argv bytes an EXEC can carry at most */
+#define MAX_ARGS_DEFAULT 4096  /* unless --max-args says otherwise */
+#define MAX_COMMAND_LIST 256
 
 enum filter_mode {
 	FILTER_MODE_ALL = 0,      /* Trace all processes and all read/write operations */
@@ -16,31 +19,118 @@ enum filter_mode {
 };
 
 enum event_type {
-	EVENT_TYPE_PROCESS = 0,
+	EVENT_TYPE_EXEC = 0,
 	EVENT_TYPE_BASH_READLINE = 1,
 	EVENT_TYPE_FILE_OPERATION = 2,
+	EVENT_TYPE_EXIT = 3,
 };
 
-struct event {
+/* Probe ids for the rb_stats counters */
+enum process_probe {
+	PROCESS_PROBE_BASH_READLINE = 0,
+	PROCESS_PROBE_EXEC,
+	PROCESS_PROBE_EXIT,
+	PROCESS_PROBE_OPENAT,
+	PROCESS_PROBE_OPEN,
+	PROCESS_PROBE_MAX,
+};
+
+/*
+ * Ring buffer records: a common header followed by a type specific body.
+ * Bodies that carry strings are variable length, the record ends after the
+ * string's NUL, so consumers must not read past the record size.
+ */
+struct event_header {
 	enum event_type type;
 	int pid;
+	unsigned long long timestamp_ns;
+	char comm[TASK_COMM_LEN];
+};
+
+struct exec_event {
+	struct event_header hdr;
+	int ppid;
+	unsigned short filename_len;  /* including NUL */
+	unsigned short args_len;      /* argv as read, each argument NUL terminated */
+	unsigned int suppressed;      /* EXECs the rate limiter dropped before this one */
+	unsigned int args_total;      /* size of the whole argv, past args_len if it was cut */
+	/* filename, then argv at data[filename_len], turned into a command line in userspace */
+	char data[MAX_FILENAME_LEN + 1 + MAX_ARGS_LEN];
+};
+
+struct exit_event {
+	struct event_header hdr;
 	int ppid;
 	unsigned exit_code;
 	unsigned long long duration_ns;
-	unsigned long long timestamp_ns;
-	char comm[TASK_COMM_LEN];
-	char full_command[MAX_COMMAND_LEN];     /* full command line with args */
-	union {
-		char filename[MAX_FILENAME_LEN];     /* for process events */
-		char command[MAX_COMMAND_LEN];       /* for bash readline events */
-		struct {                             /* for file operation events */
-			char filepath[MAX_FILENAME_LEN];
-			int fd;
-			int flags;
-			bool is_open;  /* true for open/openat, false for close */
-		} file_op;
-	};
-	bool exit_event;
+	unsigned int suppressed;  /* rate limited records never reported by a later one */
+};
+
+struct file_op_event {
+	struct event_header hdr;
+	int fd;
+	int flags;
+	unsigned int suppressed;  /* FILE_OPENs the rate limiter dropped before this one */
+	bool is_open;  /* true for open/openat, false for close */
+	char filepath[MAX_FILENAME_LEN];
+};
+
+struct bash_readline_event {
+	struct event_header hdr;
+	char command[MAX_COMMAND_LEN];
+};
+
+union event_record {
+	struct event_header hdr;
+	struct exec_event exec;
+	struct exit_event exit;
+	struct file_op_event file_op;
+	struct bash_readline_event readline;
+};
+
+/* In-kernel FILE_OPEN aggregation (--aggregate-opens) */
+#define OPEN_COUNTS_MAX_ENTRIES 16384
+
+/* --resolve-paths: opens in flight and the cwd of recently seen processes */
+#define OPEN_PENDING_MAX_ENTRIES 4096
+#define CWD_CACHE_MAX_ENTRIES 4096
+
+/*
+ * --resolve-paths: @path (@len bytes, NUL included) is the resolved path of
+ * a file named @name (@nlen bytes, no NUL). If the file was found right in
+ * the cwd (@in_cwd: on its mount, not through a symlink) and @path ends in
+ * "/" + @name, the rest is the cwd: returns its length, 0 for the root.
+ * Otherwise -1, the suffix alone says nothing about the cwd.
+ */
+static inline int cwd_prefix_len(const char *path, unsigned int len, const char *name,
+				 unsigned int nlen, bool in_cwd)
+{
+	unsigned int plen;
+
+	if (!in_cwd || !nlen || len > MAX_FILENAME_LEN || len < nlen + 2)
+		return -1;
+	plen = len - nlen - 2;
+	if (path[plen & MAX_FILENAME_LEN] != '/')
+		return -1;
+	for (unsigned int i = 0; i < MAX_FILENAME_LEN; i++) {
+		if (i >= nlen)
+			break;
+		if (name[i & MAX_FILENAME_LEN] == '/' ||
+		    path[(plen + 1 + i) & MAX_FILENAME_LEN] != name[i & MAX_FILENAME_LEN])
+			return -1;
+	}
+	return plen;
+}
+
+struct file_open_key {
+	unsigned int tgid;
+	unsigned int pad;
+	unsigned long long path_hash;  /* FNV-1a, same as file_dedup_hash_path() */
+};
+
+struct file_open_agg {
+	unsigned long long count;    /* repeat opens suppressed since the first one */
+	unsigned long long last_ns;  /* time of the latest open */
 };
 
 struct command_filter {
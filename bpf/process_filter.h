@@ -3,13 +3,27 @@
 #ifndef __PROCESS_FILTER_H
 #define __PROCESS_FILTER_H
 
+#include <errno.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include "process.h"
 
-/* Hash table for tracking PIDs in userspace */
-#define TRACKED_PIDS_HASH_SIZE 2048
-#define TRACKED_PIDS_HASH_MASK (TRACKED_PIDS_HASH_SIZE - 1)
+/*
+ * Hash table for tracking PIDs in userspace.
+ *
+ * Open addressing with linear probing, sized to a power of two and doubled
+ * once it is TRACKED_PIDS_LOAD_NUM/TRACKED_PIDS_LOAD_DEN full. Removal
+ * shifts the rest of the probe chain back instead of leaving a hole, so
+ * lookups past a removed slot keep working and PID churn leaves nothing
+ * behind. No entry sits more than TRACKED_PIDS_MAX_PROBE slots from its
+ * home slot (the table grows instead), which bounds every scan.
+ */
+#define TRACKED_PIDS_HASH_SIZE 2048         /* initial number of slots */
+#define TRACKED_PIDS_MAX_SIZE (1U << 24)    /* slots the table may grow to */
+#define TRACKED_PIDS_MAX_PROBE 64
+#define TRACKED_PIDS_LOAD_NUM 3
+#define TRACKED_PIDS_LOAD_DEN 4
 
 struct tracked_pid_entry {
 	pid_t pid;
@@ -19,92 +33,171 @@ struct tracked_pid_entry {
 };
 
 struct pid_tracker {
-	struct tracked_pid_entry entries[TRACKED_PIDS_HASH_SIZE];
+	struct tracked_pid_entry *entries;
+	unsigned int capacity;  /* slots in entries, a power of two */
+	unsigned int count;     /* active entries */
 	char **command_filters;
 	int command_filter_count;
 	enum filter_mode filter_mode;
 	pid_t target_pid;  /* For -p option */
 };
 
-/* Simple hash function for PIDs */
+/* Fibonacci hash of a PID; sequential PIDs from fork() spread over the table */
 static inline unsigned int pid_hash(pid_t pid)
 {
-	return (unsigned int)pid & TRACKED_PIDS_HASH_MASK;
+	return (unsigned int)pid * 0x9e3779b1U;
 }
 
-/* Initialize the PID tracker */
-static inline void pid_tracker_init(struct pid_tracker *tracker,
-                                    char **command_filters,
-                                    int command_filter_count,
-                                    enum filter_mode filter_mode,
-                                    pid_t target_pid)
+/* Home slot of @pid in a table of @capacity slots */
+static inline unsigned int pid_slot(pid_t pid, unsigned int capacity)
 {
-	memset(tracker->entries, 0, sizeof(tracker->entries));
+	/* the high bits of the product are the well mixed ones */
+	return capacity > 1 ? pid_hash(pid) >> (32 - __builtin_ctz(capacity)) : 0;
+}
+
+/* Initialize the PID tracker, 0 or -ENOMEM */
+static inline int pid_tracker_init(struct pid_tracker *tracker,
+                                   char **command_filters,
+                                   int command_filter_count,
+                                   enum filter_mode filter_mode,
+                                   pid_t target_pid)
+{
+	memset(tracker, 0, sizeof(*tracker));
 	tracker->command_filters = command_filters;
 	tracker->command_filter_count = command_filter_count;
 	tracker->filter_mode = filter_mode;
 	tracker->target_pid = target_pid;
+	tracker->entries = calloc(TRACKED_PIDS_HASH_SIZE, sizeof(*tracker->entries));
+	if (!tracker->entries)
+		return -ENOMEM;
+	tracker->capacity = TRACKED_PIDS_HASH_SIZE;
+	return 0;
+}
+
+static inline void pid_tracker_free(struct pid_tracker *tracker)
+{
+	free(tracker->entries);
+	tracker->entries = NULL;
+	tracker->capacity = 0;
+	tracker->count = 0;
 }
 
 /* Find a PID in the tracker */
 static inline struct tracked_pid_entry *pid_tracker_find(struct pid_tracker *tracker, pid_t pid)
 {
-	unsigned int hash = pid_hash(pid);
-	unsigned int i;
+	unsigned int mask = tracker->capacity - 1;
+	unsigned int idx = pid_slot(pid, tracker->capacity);
 
-	/* Linear probing */
-	for (i = 0; i < TRACKED_PIDS_HASH_SIZE; i++) {
-		unsigned int idx = (hash + i) & TRACKED_PIDS_HASH_MASK;
+	if (!tracker->capacity)
+		return NULL;
+	for (unsigned int i = 0; i <= TRACKED_PIDS_MAX_PROBE; i++, idx = (idx + 1) & mask) {
 		struct tracked_pid_entry *entry = &tracker->entries[idx];
 
-		if (!entry->is_active) {
+		if (!entry->is_active)
 			return NULL;  /* Empty slot, not found */
-		}
-
-		if (entry->pid == pid) {
+		if (entry->pid == pid)
 			return entry;
+	}
+	return NULL;
+}
+
+/* Place @entry in a table known not to hold its PID; false past TRACKED_PIDS_MAX_PROBE */
+static inline bool pid_table_insert(struct tracked_pid_entry *entries, unsigned int capacity,
+                                    const struct tracked_pid_entry *entry)
+{
+	unsigned int mask = capacity - 1;
+	unsigned int idx = pid_slot(entry->pid, capacity);
+
+	for (unsigned int i = 0; i <= TRACKED_PIDS_MAX_PROBE && i < capacity;
+	     i++, idx = (idx + 1) & mask) {
+		if (!entries[idx].is_active) {
+			entries[idx] = *entry;
+			return true;
 		}
 	}
+	return false;
+}
 
-	return NULL;  /* Table full or not found */
+/* Rehash into the smallest table of at least @capacity slots that fits every entry */
+static inline bool pid_tracker_grow(struct pid_tracker *tracker, unsigned int capacity)
+{
+	for (; capacity && capacity <= TRACKED_PIDS_MAX_SIZE; capacity *= 2) {
+		struct tracked_pid_entry *entries = calloc(capacity, sizeof(*entries));
+		unsigned int i;
+
+		if (!entries)
+			return false;
+		for (i = 0; i < tracker->capacity; i++) {
+			if (tracker->entries[i].is_active &&
+			    !pid_table_insert(entries, capacity, &tracker->entries[i]))
+				break;
+		}
+		if (i < tracker->capacity) {
+			free(entries);
+			continue;
+		}
+		free(tracker->entries);
+		tracker->entries = entries;
+		tracker->capacity = capacity;
+		return true;
+	}
+	return false;
 }
 
-/* Add a PID to the tracker */
+/* Add a PID to the tracker, false once it cannot grow any further */
 static inline bool pid_tracker_add(struct pid_tracker *tracker, pid_t pid, pid_t ppid)
 {
-	unsigned int hash = pid_hash(pid);
-	unsigned int i;
+	struct tracked_pid_entry entry = {
+		.pid = pid,
+		.ppid = ppid,
+		.is_tracked = true,
+		.is_active = true,
+	};
 
 	/* Check if already exists */
-	struct tracked_pid_entry *existing = pid_tracker_find(tracker, pid);
-	if (existing) {
+	if (pid_tracker_find(tracker, pid))
 		return true;  /* Already tracked */
-	}
 
-	/* Linear probing to find empty slot */
-	for (i = 0; i < TRACKED_PIDS_HASH_SIZE; i++) {
-		unsigned int idx = (hash + i) & TRACKED_PIDS_HASH_MASK;
-		struct tracked_pid_entry *entry = &tracker->entries[idx];
+	if ((unsigned long long)(tracker->count + 1) * TRACKED_PIDS_LOAD_DEN >
+	    (unsigned long long)tracker->capacity * TRACKED_PIDS_LOAD_NUM &&
+	    !pid_tracker_grow(tracker, tracker->capacity ? tracker->capacity * 2 : TRACKED_PIDS_HASH_SIZE))
+		return false;
 
-		if (!entry->is_active) {
-			entry->pid = pid;
-			entry->ppid = ppid;
-			entry->is_tracked = true;
-			entry->is_active = true;
-			return true;
-		}
+	/* A long probe chain is a sign of clustering, spread it over a bigger table */
+	while (!pid_table_insert(tracker->entries, tracker->capacity, &entry)) {
+		if (!pid_tracker_grow(tracker, tracker->capacity * 2))
+			return false;
 	}
-
-	return false;  /* Table full */
+	tracker->count++;
+	return true;
 }
 
 /* Remove a PID from the tracker */
 static inline void pid_tracker_remove(struct pid_tracker *tracker, pid_t pid)
 {
 	struct tracked_pid_entry *entry = pid_tracker_find(tracker, pid);
-	if (entry) {
-		entry->is_active = false;
+	unsigned int mask = tracker->capacity - 1;
+	unsigned int hole, idx;
+
+	if (!entry)
+		return;
+
+	/*
+	 * Backward shift: pull each later entry of the chain into the hole
+	 * unless its home slot lies cyclically in (hole, idx], where moving it
+	 * would put it before its home.
+	 */
+	hole = entry - tracker->entries;
+	for (idx = (hole + 1) & mask; tracker->entries[idx].is_active; idx = (idx + 1) & mask) {
+		unsigned int home = pid_slot(tracker->entries[idx].pid, tracker->capacity);
+
+		if (((idx - home) & mask) >= ((idx - hole) & mask)) {
+			tracker->entries[hole] = tracker->entries[idx];
+			hole = idx;
+		}
 	}
+	tracker->entries[hole].is_active = false;
+	tracker->count--;
 }
 
 /* Check if a PID is tracked */
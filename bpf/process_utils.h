@@ -6,9 +6,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/syscall.h>
 
 // Forward declarations for BPF types when not in test mode
 #ifndef BPF_ANY
@@ -79,71 +83,286 @@ static bool command_matches_filter(const char *comm, const char *filter)
 	return strstr(comm, filter) != NULL;
 }
 
-/* Count and print processes that match the given command filters */
-static int count_matching_processes(char **command_list, int command_count, bool trace_all)
+/*
+ * Turn the @len bytes of NUL terminated arguments an EXEC carries into one
+ * command line in @dst: the NULs between arguments become spaces, the ones
+ * at the end go. An argv cut at --max-args simply ends mid argument.
+ */
+static inline const char *argv_to_command(char *dst, size_t size, const char *argv, size_t len)
 {
-	DIR *proc_dir;
-	struct dirent *entry;
-	pid_t pid, ppid;
+	if (len >= size)
+		len = size - 1;
+	while (len && argv[len - 1] == '\0')
+		len--;
+	for (size_t i = 0; i < len; i++)
+		dst[i] = argv[i] ? argv[i] : ' ';
+	dst[len] = '\0';
+	return dst;
+}
+
+/*
+ * Fast /proc walk for startup. On hosts with tens of thousands of tasks the
+ * readdir + fopen(comm) + fopen(stat) per PID took seconds, so PIDs are
+ * read with large getdents64 batches and each task costs one openat() on a
+ * /proc dirfd and one read() of its stat file, which also carries the comm.
+ * Big scans spread the reads over a few threads, results stay in /proc
+ * (PID) order.
+ */
+
+struct proc_task {
+	pid_t pid;
+	pid_t ppid;
 	char comm[TASK_COMM_LEN];
-	int matching_count = 0;
-	
-	proc_dir = opendir("/proc");
-	if (!proc_dir) {
-		fprintf(stderr, "Failed to open /proc directory\n");
+};
+
+#define PROC_SCAN_DENTS_SIZE (64 * 1024)
+#define PROC_SCAN_MAX_THREADS 8
+#define PROC_SCAN_PIDS_PER_THREAD 2048  /* fewer PIDs than this per thread: stay serial */
+
+/* The kernel's getdents64 record, glibc only wraps it since 2.30 */
+struct proc_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/*
+ * Parse "pid (comm) state ppid ..." as found in /proc/<pid>/stat. comm can
+ * hold spaces and parentheses, so it runs to the last ')'.
+ */
+static inline int proc_parse_stat(const char *buf, size_t len, struct proc_task *t)
+{
+	const char *open = memchr(buf, '(', len);
+	const char *close = NULL, *p, *end = buf + len;
+	size_t comm_len;
+	pid_t ppid = 0;
+
+	for (p = end; p > buf; p--) {
+		if (p[-1] == ')') {
+			close = p - 1;
+			break;
+		}
+	}
+	if (!open || !close || close < open)
+		return -1;
+
+	comm_len = close - open - 1;
+	if (comm_len >= sizeof(t->comm))
+		comm_len = sizeof(t->comm) - 1;
+	memcpy(t->comm, open + 1, comm_len);
+	t->comm[comm_len] = '\0';
+
+	/* ") S 1234 " */
+	p = close + 1;
+	if (end - p < 4 || p[0] != ' ' || p[2] != ' ')
+		return -1;
+	p += 3;
+	if (p == end || *p < '0' || *p > '9')
+		return -1;
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+		ppid = ppid * 10 + (*p - '0');
+	t->ppid = ppid;
+	return 0;
+}
+
+/* Read the task @pid through @proc_fd, a directory fd on /proc */
+static inline int proc_read_task(int proc_fd, pid_t pid, struct proc_task *t)
+{
+	char path[32], buf[512];
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "%d/stat", pid);
+	fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
 		return -1;
+	n = read(fd, buf, sizeof(buf));
+	close(fd);
+	if (n <= 0)
+		return -1;
+	t->pid = pid;
+	return proc_parse_stat(buf, n, t);
+}
+
+/* Numeric entries of the directory @dir_fd, appended to *pids. Returns the count or -errno. */
+static inline int proc_list_pids(int dir_fd, pid_t **pids, size_t *cap)
+{
+	char *dents = malloc(PROC_SCAN_DENTS_SIZE);
+	size_t nr = 0;
+	long n;
+
+	if (!dents)
+		return -ENOMEM;
+	while ((n = syscall(SYS_getdents64, dir_fd, dents, PROC_SCAN_DENTS_SIZE)) > 0) {
+		for (long off = 0; off < n;) {
+			struct proc_dirent64 *d = (struct proc_dirent64 *)(dents + off);
+			const char *c = d->d_name;
+			pid_t pid = 0;
+
+			off += d->d_reclen;
+			for (; *c >= '0' && *c <= '9'; c++)
+				pid = pid * 10 + (*c - '0');
+			if (*c || pid <= 0)
+				continue;
+			if (nr == *cap) {
+				size_t grown = *cap ? *cap * 2 : 1024;
+				pid_t *p = realloc(*pids, grown * sizeof(*p));
+
+				if (!p) {
+					free(dents);
+					return -ENOMEM;
+				}
+				*pids = p;
+				*cap = grown;
+			}
+			(*pids)[nr++] = pid;
+		}
 	}
-	
-	if (trace_all) {
-		printf("Tracing all processes (no filter specified)\n");
-	} else {
-		printf("Scanning existing processes for matching commands...\n");
+	free(dents);
+	return n < 0 ? -errno : (int)nr;
+}
+
+struct proc_scan_part {
+	pthread_t thread;
+	int proc_fd;
+	const pid_t *pids;
+	struct proc_task *tasks;  /* pid 0 where the task could not be read */
+	size_t nr;
+	bool started;
+};
+
+static inline void *proc_scan_part_run(void *arg)
+{
+	struct proc_scan_part *part = arg;
+
+	for (size_t i = 0; i < part->nr; i++) {
+		if (proc_read_task(part->proc_fd, part->pids[i], &part->tasks[i]))
+			part->tasks[i].pid = 0;
 	}
-	
-	while ((entry = readdir(proc_dir)) != NULL) {
-		/* Skip non-numeric entries */
-		if (strspn(entry->d_name, "0123456789") != strlen(entry->d_name))
-			continue;
-		
-		pid = (pid_t)strtol(entry->d_name, NULL, 10);
-		if (pid <= 0)
-			continue;
-		
-		/* Read process command */
-		if (read_proc_comm(pid, comm, sizeof(comm)) != 0)
-			continue;
-		
-		/* Read parent PID */
-		if (read_proc_ppid(pid, &ppid) != 0)
+	return NULL;
+}
+
+typedef void (*proc_scan_fn)(void *ctx, const struct proc_task *t);
+
+/*
+ * Call @fn for every task under @proc ("/proc"), in PID order, from the
+ * calling thread. Up to @threads threads read the stat files. Returns the
+ * number of tasks read or -errno.
+ */
+static inline int proc_scan(const char *proc, int threads, proc_scan_fn fn, void *ctx)
+{
+	struct proc_scan_part parts[PROC_SCAN_MAX_THREADS] = {};
+	struct proc_task *tasks = NULL;
+	pid_t *pids = NULL;
+	size_t cap = 0, per;
+	int proc_fd, nr, found = 0;
+
+	proc_fd = open(proc, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (proc_fd < 0)
+		return -errno;
+	nr = proc_list_pids(proc_fd, &pids, &cap);
+	if (nr <= 0)
+		goto out;
+	tasks = calloc(nr, sizeof(*tasks));
+	if (!tasks) {
+		nr = -ENOMEM;
+		goto out;
+	}
+
+	if (threads > PROC_SCAN_MAX_THREADS)
+		threads = PROC_SCAN_MAX_THREADS;
+	if (threads > nr / PROC_SCAN_PIDS_PER_THREAD)
+		threads = nr / PROC_SCAN_PIDS_PER_THREAD;
+	if (threads < 1)
+		threads = 1;
+	per = (nr + threads - 1) / threads;
+	for (int i = 0; i < threads; i++) {
+		size_t start = i * per;
+
+		parts[i].proc_fd = proc_fd;
+		parts[i].pids = pids + start;
+		parts[i].tasks = tasks + start;
+		parts[i].nr = start >= (size_t)nr ? 0 : ((size_t)nr - start < per ? (size_t)nr - start : per);
+		/* part 0 runs here, and so does any part whose thread won't start */
+		parts[i].started = i > 0 &&
+			!pthread_create(&parts[i].thread, NULL, proc_scan_part_run, &parts[i]);
+		if (!parts[i].started)
+			proc_scan_part_run(&parts[i]);
+	}
+	for (int i = 1; i < threads; i++) {
+		if (parts[i].started)
+			pthread_join(parts[i].thread, NULL);
+	}
+
+	for (int i = 0; i < nr; i++) {
+		if (!tasks[i].pid)
 			continue;
-		
-		bool should_track = trace_all;
-		
-		/* If not tracing all, check if this process matches any configured filter */
-		if (!trace_all && command_list && command_count > 0) {
-			should_track = false;
-			for (int i = 0; i < command_count; i++) {
-				if (command_matches_filter(comm, command_list[i])) {
-					should_track = true;
-					break;
-				}
+		fn(ctx, &tasks[i]);
+		found++;
+	}
+	nr = found;
+out:
+	free(tasks);
+	free(pids);
+	close(proc_fd);
+	return nr;
+}
+
+struct count_matching_ctx {
+	char **command_list;
+	int command_count;
+	bool trace_all;
+	int matching_count;
+};
+
+static inline void count_matching_task(void *ctx, const struct proc_task *t)
+{
+	struct count_matching_ctx *c = ctx;
+	bool should_track = c->trace_all;
+
+	/* If not tracing all, check if this process matches any configured filter */
+	if (!c->trace_all && c->command_list && c->command_count > 0) {
+		for (int i = 0; i < c->command_count; i++) {
+			if (command_matches_filter(t->comm, c->command_list[i])) {
+				should_track = true;
+				break;
 			}
 		}
-		
-		if (should_track) {
-			if (!trace_all) {
-				printf("  Found matching process: PID=%d, PPID=%d, COMM=%s\n", 
-					pid, ppid, comm);
-			}
-			matching_count++;
+	}
+
+	if (should_track) {
+		if (!c->trace_all) {
+			printf("  Found matching process: PID=%d, PPID=%d, COMM=%s\n",
+				t->pid, t->ppid, t->comm);
 		}
+		c->matching_count++;
 	}
-	
-	closedir(proc_dir);
-	printf("Initially tracking %d processes\n", matching_count);
-	return matching_count;
 }
 
+/* Count and print processes that match the given command filters */
+static int count_matching_processes(char **command_list, int command_count, bool trace_all)
+{
+	struct count_matching_ctx ctx = {
+		.command_list = command_list,
+		.command_count = command_count,
+		.trace_all = trace_all,
+	};
 
+	if (trace_all) {
+		printf("Tracing all processes (no filter specified)\n");
+	} else {
+		printf("Scanning existing processes for matching commands...\n");
+	}
+
+	if (proc_scan("/proc", 1, count_matching_task, &ctx) < 0) {
+		fprintf(stderr, "Failed to open /proc directory\n");
+		return -1;
+	}
+
+	printf("Initially tracking %d processes\n", ctx.matching_count);
+	return ctx.matching_count;
+}
 
 #endif /* __PROCESS_UTILS_H */ 
\ No newline at end of file
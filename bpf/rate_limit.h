@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __RATE_LIMIT_H
+#define __RATE_LIMIT_H
+
+/*
+ * Per-tgid token buckets, checked in the probes before a record is staged
+ * for the ring buffer.
+ *
+ * Each (tgid, class) pair in a BPF_MAP_TYPE_LRU_HASH holds up to one second
+ * of tokens at the class rate userspace configured (0 = unlimited). A record
+ * costs one token, or its payload bytes for RATE_CLASS_SSL_BYTES. Records
+ * that find the bucket empty are counted instead of sent, and the next
+ * record the bucket lets through carries that count as "suppressed".
+ *
+ * Tracing programs can't take a bpf_spin_lock, so concurrent threads of one
+ * tgid may spend the same token or both report the same suppressed count:
+ * limits and counts are approximate while a tgid's threads race.
+ */
+
+#ifndef __bpf__
+#include <stdbool.h>
+#include <linux/types.h>
+#endif
+
+#define RATE_LIMIT_MAX_ENTRIES 16384
+#define RATE_LIMIT_NS 1000000000ULL  /* refill period, also the burst size */
+#define RATE_LIMIT_MAX_RATE 1000000000ULL  /* keeps rate * RATE_LIMIT_NS in 64 bits */
+
+enum rate_class {
+	RATE_CLASS_FILE_OPEN = 0,  /* first FILE_OPEN of a path, in records */
+	RATE_CLASS_EXEC,           /* in records */
+	RATE_CLASS_SSL_BYTES,      /* in payload bytes */
+	RATE_CLASS_MAX,
+};
+
+struct rate_key {
+	__u32 tgid;
+	__u32 cls;
+};
+
+struct rate_bucket {
+	__u64 credit;      /* tokens * RATE_LIMIT_NS */
+	__u64 last_ns;     /* last refill */
+	__u32 suppressed;  /* records dropped since the last one let through */
+	__u32 pad;
+};
+
+/*
+ * Refill @b for the time since its last check and take @cost tokens if it
+ * holds them. Costs above one second's worth would never fit, so they are
+ * charged a full bucket instead.
+ */
+static inline bool rate_bucket_take(struct rate_bucket *b, __u64 cost, __u64 rate, __u64 now)
+{
+	__u64 cap = rate * RATE_LIMIT_NS, credit, elapsed;
+
+	if (cost > rate)
+		cost = rate;
+	elapsed = now > b->last_ns ? now - b->last_ns : 0;
+	if (elapsed > RATE_LIMIT_NS)
+		elapsed = RATE_LIMIT_NS;
+	credit = b->credit + elapsed * rate;
+	if (credit > cap)
+		credit = cap;
+	b->last_ns = now;
+	if (credit < cost * RATE_LIMIT_NS) {
+		b->credit = credit;
+		return false;
+	}
+	b->credit = credit - cost * RATE_LIMIT_NS;
+	return true;
+}
+
+#ifdef __bpf__
+
+/*
+ * May @tgid send a record of class @cls costing @cost now? On true
+ * *@suppressed is set to the records dropped before this one, and the caller
+ * reports it with the record. A tgid's first record finds a full bucket.
+ */
+static __always_inline bool rate_limit_allow(void *map, __u32 tgid, __u32 cls, __u64 cost,
+					     __u64 rate, __u64 now, __u32 *suppressed)
+{
+	struct rate_key key = { .tgid = tgid, .cls = cls };
+	struct rate_bucket *b, fresh = { .last_ns = now };
+	__u32 pending;
+
+	*suppressed = 0;
+	if (!rate)
+		return true;
+
+	b = bpf_map_lookup_elem(map, &key);
+	if (!b) {
+		fresh.credit = rate * RATE_LIMIT_NS;
+		rate_bucket_take(&fresh, cost, rate, now);
+		bpf_map_update_elem(map, &key, &fresh, BPF_NOEXIST);
+		return true;
+	}
+	if (!rate_bucket_take(b, cost, rate, now)) {
+		__sync_fetch_and_add(&b->suppressed, 1);
+		return false;
+	}
+	pending = b->suppressed;
+	if (pending)
+		__sync_fetch_and_add(&b->suppressed, -pending);
+	*suppressed = pending;
+	return true;
+}
+
+/* Drop @tgid's buckets, returning the records they suppressed but never reported */
+static __always_inline __u32 rate_limit_forget(void *map, __u32 tgid)
+{
+	struct rate_key key = { .tgid = tgid };
+	struct rate_bucket *b;
+	__u32 pending = 0;
+
+	for (__u32 cls = 0; cls < RATE_CLASS_MAX; cls++) {
+		key.cls = cls;
+		b = bpf_map_lookup_elem(map, &key);
+		if (!b)
+			continue;
+		pending += b->suppressed;
+		bpf_map_delete_elem(map, &key);
+	}
+	return pending;
+}
+
+#endif /* __bpf__ */
+
+#endif /* __RATE_LIMIT_H */
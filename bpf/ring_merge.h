@@ -0,0 +1,263 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __RING_MERGE_H
+#define __RING_MERGE_H
+
+/*
+ * Timestamp ordered merge of records formatted by several consumer threads.
+ *
+ * With one ring buffer per CPU group (sslsniff --ring-cpus) each ring has its
+ * own consumer thread, and a thread that migrates between CPUs can have
+ * consecutive records land in different rings. Consumers hand fully
+ * formatted records to a ring_merge, which keeps them in a min-heap on
+ * (timestamp_ns, arrival order) and releases a record once it is window_ns
+ * old, by which time every ring has had that long to deliver anything older.
+ * A thread's records carry increasing timestamps, so as long as delivery
+ * takes less than the window, per-thread (and so per-connection) order is
+ * the order of the merged output.
+ *
+ * Producers block once max_bytes are queued; the heap head is then released
+ * early so a slow writer backs up into the kernel rings and shows up as ring
+ * drops in STATS rather than as unbounded memory.
+ *
+ * The popping thread sleeps in its event loop: efd is an eventfd that is
+ * signalled whenever the heap gets a new head, and ring_merge_timeout_ms()
+ * says how long until the current one is due.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+struct merge_record {
+	uint64_t ts;
+	uint64_t seq;     /* arrival order, breaks timestamp ties */
+	size_t len;
+	char data[];
+};
+
+struct ring_merge {
+	pthread_mutex_t lock;
+	pthread_cond_t space;    /* queued bytes dropped below max_bytes */
+	int efd;                 /* eventfd: a new heap head, or closed */
+	struct merge_record **heap;
+	size_t nr;
+	size_t cap;
+	size_t bytes;
+	size_t max_bytes;
+	uint64_t window_ns;
+	uint64_t seq;
+	bool closed;
+};
+
+static inline uint64_t ring_merge_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int ring_merge_init(struct ring_merge *m, uint64_t window_ns, size_t max_bytes)
+{
+	memset(m, 0, sizeof(*m));
+	m->window_ns = window_ns;
+	m->max_bytes = max_bytes;
+	m->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m->efd < 0)
+		return -errno;
+	pthread_mutex_init(&m->lock, NULL);
+	pthread_cond_init(&m->space, NULL);
+	return 0;
+}
+
+static inline void ring_merge_notify(struct ring_merge *m)
+{
+	uint64_t one = 1;
+
+	/* only fails when the counter is saturated, i.e. already signalled */
+	if (write(m->efd, &one, sizeof(one)) < 0)
+		return;
+}
+
+static inline void ring_merge_free(struct ring_merge *m)
+{
+	for (size_t i = 0; i < m->nr; i++)
+		free(m->heap[i]);
+	free(m->heap);
+	m->heap = NULL;
+	m->nr = m->cap = 0;
+	pthread_cond_destroy(&m->space);
+	pthread_mutex_destroy(&m->lock);
+	close(m->efd);
+	m->efd = -1;
+}
+
+/* Copy @len bytes of a formatted record stamped @ts, NULL on ENOMEM */
+static inline struct merge_record *merge_record_new(uint64_t ts, const void *data, size_t len)
+{
+	struct merge_record *r = malloc(sizeof(*r) + len);
+
+	if (!r)
+		return NULL;
+	r->ts = ts;
+	r->seq = 0;
+	r->len = len;
+	memcpy(r->data, data, len);
+	return r;
+}
+
+static inline bool merge_record_before(const struct merge_record *a, const struct merge_record *b)
+{
+	return a->ts < b->ts || (a->ts == b->ts && a->seq < b->seq);
+}
+
+static inline void ring_merge_sift_up(struct ring_merge *m, size_t i)
+{
+	struct merge_record *r = m->heap[i];
+
+	while (i) {
+		size_t parent = (i - 1) / 2;
+
+		if (!merge_record_before(r, m->heap[parent]))
+			break;
+		m->heap[i] = m->heap[parent];
+		i = parent;
+	}
+	m->heap[i] = r;
+}
+
+static inline void ring_merge_sift_down(struct ring_merge *m, size_t i)
+{
+	struct merge_record *r = m->heap[i];
+
+	for (;;) {
+		size_t child = 2 * i + 1;
+
+		if (child >= m->nr)
+			break;
+		if (child + 1 < m->nr && merge_record_before(m->heap[child + 1], m->heap[child]))
+			child++;
+		if (!merge_record_before(m->heap[child], r))
+			break;
+		m->heap[i] = m->heap[child];
+		i = child;
+	}
+	m->heap[i] = r;
+}
+
+/*
+ * Queue a batch of records from one consumer, in the order it read them.
+ * Blocks while the merge is full. Takes ownership of the records, returns
+ * 0 or -ENOMEM (the batch is then freed).
+ */
+static inline int ring_merge_push(struct ring_merge *m, struct merge_record **recs, size_t n)
+{
+	struct merge_record *head;
+	int err = 0;
+
+	if (!n)
+		return 0;
+
+	pthread_mutex_lock(&m->lock);
+	while (m->max_bytes && m->bytes >= m->max_bytes && !m->closed)
+		pthread_cond_wait(&m->space, &m->lock);
+
+	if (m->nr + n > m->cap) {
+		size_t cap = m->cap ? m->cap : 1024;
+		struct merge_record **heap;
+
+		while (cap < m->nr + n)
+			cap *= 2;
+		heap = realloc(m->heap, cap * sizeof(*heap));
+		if (!heap) {
+			err = -ENOMEM;
+			goto out;
+		}
+		m->heap = heap;
+		m->cap = cap;
+	}
+
+	head = m->nr ? m->heap[0] : NULL;
+	for (size_t i = 0; i < n; i++) {
+		recs[i]->seq = m->seq++;
+		m->bytes += recs[i]->len;
+		m->heap[m->nr] = recs[i];
+		ring_merge_sift_up(m, m->nr++);
+	}
+	/* the popper sleeps until the old head is due, wake it for a new one */
+	if (m->heap[0] != head)
+		ring_merge_notify(m);
+out:
+	pthread_mutex_unlock(&m->lock);
+	if (err) {
+		for (size_t i = 0; i < n; i++)
+			free(recs[i]);
+	}
+	return err;
+}
+
+/* The head may go out: it is window_ns old, the merge is full or draining */
+static inline bool ring_merge_head_due(const struct ring_merge *m, uint64_t now_ns)
+{
+	const struct merge_record *head = m->heap[0];
+
+	return m->closed || (m->max_bytes && m->bytes >= m->max_bytes) ||
+	       head->ts + m->window_ns <= now_ns;
+}
+
+/* Milliseconds until the heap head is due, at most @timeout_ms */
+static inline int ring_merge_timeout_ms(struct ring_merge *m, int timeout_ms)
+{
+	uint64_t now, due;
+
+	pthread_mutex_lock(&m->lock);
+	if (m->nr) {
+		now = ring_merge_now_ns();
+		due = m->heap[0]->ts + m->window_ns;
+		if (ring_merge_head_due(m, now))
+			timeout_ms = 0;
+		else if ((due - now + 999999) / 1000000 < (uint64_t)timeout_ms)
+			timeout_ms = (due - now + 999999) / 1000000;
+	}
+	pthread_mutex_unlock(&m->lock);
+	return timeout_ms;
+}
+
+/* Move up to @max due records, oldest first, to @out; the caller frees them */
+static inline size_t ring_merge_pop(struct ring_merge *m, struct merge_record **out, size_t max)
+{
+	uint64_t now = ring_merge_now_ns();
+	size_t n = 0;
+
+	pthread_mutex_lock(&m->lock);
+	while (n < max && m->nr && ring_merge_head_due(m, now)) {
+		out[n] = m->heap[0];
+		m->bytes -= out[n]->len;
+		n++;
+		m->heap[0] = m->heap[--m->nr];
+		if (m->nr)
+			ring_merge_sift_down(m, 0);
+	}
+	if (n)
+		pthread_cond_broadcast(&m->space);
+	pthread_mutex_unlock(&m->lock);
+	return n;
+}
+
+/* Release blocked producers and everything queued, for shutdown */
+static inline void ring_merge_close(struct ring_merge *m)
+{
+	pthread_mutex_lock(&m->lock);
+	m->closed = true;
+	pthread_cond_broadcast(&m->space);
+	pthread_mutex_unlock(&m->lock);
+	ring_merge_notify(m);
+}
+
+#endif /* __RING_MERGE_H */
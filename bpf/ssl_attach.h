@@ -0,0 +1,567 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __SSL_ATTACH_H
+#define __SSL_ATTACH_H
+
+/*
+ * Finding the TLS libraries sslsniff attaches to.
+ *
+ * Agents often ship their own OpenSSL or BoringSSL (Node, Bun, Python
+ * wheels), which a lookup of the system libssl never sees. The attach
+ * manager instead walks /proc/<pid>/maps of running processes, and of every
+ * process that execs afterwards, and looks at each executable file mapping
+ * once per (dev, inode):
+ *
+ *  - libssl*, libgnutls* and libnspr4* by name, for the libraries enabled;
+ *  - anything else that exports SSL_write, which covers statically linked
+ *    and bundled OpenSSL/BoringSSL.
+ *
+ * Symbol offsets are read straight from the ELF symbol tables and handed to
+ * the attach callback, which places uprobes by offset. Every inode is
+ * resolved and attached at most once; uprobes on a file apply to every
+ * process mapping it, including ones that are already running.
+ *
+ * At exec time the dynamic loader has not mapped anything yet, so an exec
+ * only queues the process, and its maps are scanned SSL_ATTACH_SCAN_NS and
+ * SSL_ATTACH_RESCAN_NS later, the second time for libraries that are
+ * dlopen()ed after startup.
+ */
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/types.h>
+
+enum ssl_lib {
+	SSL_LIB_OPENSSL = 0,
+	SSL_LIB_GNUTLS,
+	SSL_LIB_NSS,
+	SSL_LIB_MAX,
+};
+
+/* Symbols resolved for each library, indexes into the callback's offsets */
+enum {
+	SSL_SYM_WRITE = 0,
+	SSL_SYM_READ,
+	SSL_SYM_WRITE_EX,
+	SSL_SYM_READ_EX,
+	SSL_SYM_DO_HANDSHAKE,
+	SSL_SYM_SET_FD,
+	SSL_SYM_FREE,
+};
+
+enum {
+	GNUTLS_SYM_SEND = 0,
+	GNUTLS_SYM_RECV,
+};
+
+enum {
+	NSS_SYM_WRITE = 0,
+	NSS_SYM_SEND,
+	NSS_SYM_READ,
+	NSS_SYM_RECV,
+};
+
+#define SSL_ATTACH_MAX_SYMS 7
+
+static const char *const ssl_lib_names[SSL_LIB_MAX] = {
+	[SSL_LIB_OPENSSL] = "OpenSSL",
+	[SSL_LIB_GNUTLS] = "GnuTLS",
+	[SSL_LIB_NSS] = "NSS",
+};
+
+static const char *const ssl_lib_symbols[SSL_LIB_MAX][SSL_ATTACH_MAX_SYMS] = {
+	[SSL_LIB_OPENSSL] = {
+		[SSL_SYM_WRITE] = "SSL_write",
+		[SSL_SYM_READ] = "SSL_read",
+		[SSL_SYM_WRITE_EX] = "SSL_write_ex",
+		[SSL_SYM_READ_EX] = "SSL_read_ex",
+		[SSL_SYM_DO_HANDSHAKE] = "SSL_do_handshake",
+		[SSL_SYM_SET_FD] = "SSL_set_fd",
+		[SSL_SYM_FREE] = "SSL_free",
+	},
+	[SSL_LIB_GNUTLS] = {
+		[GNUTLS_SYM_SEND] = "gnutls_record_send",
+		[GNUTLS_SYM_RECV] = "gnutls_record_recv",
+	},
+	[SSL_LIB_NSS] = {
+		[NSS_SYM_WRITE] = "PR_Write",
+		[NSS_SYM_SEND] = "PR_Send",
+		[NSS_SYM_READ] = "PR_Read",
+		[NSS_SYM_RECV] = "PR_Recv",
+	},
+};
+
+/* Basename prefixes of the shared libraries, matched when followed by '.' or '-' */
+static const char *const ssl_lib_prefixes[SSL_LIB_MAX] = {
+	[SSL_LIB_OPENSSL] = "libssl",
+	[SSL_LIB_GNUTLS] = "libgnutls",
+	[SSL_LIB_NSS] = "libnspr4",
+};
+
+#define SSL_ATTACH_SCAN_NS   (20 * 1000000ULL)   /* first maps scan after exec */
+#define SSL_ATTACH_RESCAN_NS (500 * 1000000ULL)  /* second scan, for dlopen() */
+#define SSL_ATTACH_MAX_PENDING 4096
+
+/*
+ * File offsets of names[0..n) in the ELF file at path, as uprobes want them.
+ * Missing symbols get offset 0. Returns how many were found, or -errno.
+ */
+static inline int elf_func_offsets(const char *path, const char *const *names, int n,
+				   size_t *offsets)
+{
+	const Elf64_Ehdr *eh;
+	const Elf64_Shdr *sh;
+	struct stat st;
+	int found = 0;
+	void *map;
+	int fd;
+
+	for (int i = 0; i < n; i++)
+		offsets[i] = 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0) {
+		int err = -errno;
+
+		close(fd);
+		return err;
+	}
+	if ((size_t)st.st_size < sizeof(*eh)) {
+		close(fd);
+		return -ENOEXEC;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	eh = map;
+	if (memcmp(eh->e_ident, ELFMAG, SELFMAG) || eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+	    eh->e_shentsize != sizeof(*sh) || eh->e_shoff > (size_t)st.st_size ||
+	    eh->e_shnum > ((size_t)st.st_size - eh->e_shoff) / sizeof(*sh)) {
+		munmap(map, st.st_size);
+		return -ENOEXEC;
+	}
+	sh = (const Elf64_Shdr *)((const char *)map + eh->e_shoff);
+
+	/* .dynsym first: stripped binaries only have that one */
+	for (int pass = 0; pass < 2 && found < n; pass++) {
+		Elf32_Word type = pass ? SHT_SYMTAB : SHT_DYNSYM;
+
+		for (int s = 0; s < eh->e_shnum && found < n; s++) {
+			const Elf64_Shdr *strtab;
+			const Elf64_Sym *syms;
+			size_t nsyms;
+
+			if (sh[s].sh_type != type || sh[s].sh_link >= eh->e_shnum ||
+			    sh[s].sh_offset > (size_t)st.st_size ||
+			    sh[s].sh_size > (size_t)st.st_size - sh[s].sh_offset)
+				continue;
+			strtab = &sh[sh[s].sh_link];
+			if (strtab->sh_offset > (size_t)st.st_size ||
+			    strtab->sh_size > (size_t)st.st_size - strtab->sh_offset)
+				continue;
+			syms = (const Elf64_Sym *)((const char *)map + sh[s].sh_offset);
+			nsyms = sh[s].sh_size / sizeof(*syms);
+
+			for (size_t k = 0; k < nsyms && found < n; k++) {
+				const Elf64_Sym *sym = &syms[k];
+				const Elf64_Shdr *text;
+				const char *name;
+
+				if (ELF64_ST_TYPE(sym->st_info) != STT_FUNC ||
+				    sym->st_shndx == SHN_UNDEF || sym->st_shndx >= eh->e_shnum ||
+				    !sym->st_value || sym->st_name >= strtab->sh_size)
+					continue;
+				name = (const char *)map + strtab->sh_offset + sym->st_name;
+				text = &sh[sym->st_shndx];
+				for (int i = 0; i < n; i++) {
+					size_t left = strtab->sh_size - sym->st_name;
+
+					if (offsets[i] || !names[i] || strnlen(name, left) == left ||
+					    strcmp(name, names[i]))
+						continue;
+					if (sym->st_value < text->sh_addr)
+						break;
+					offsets[i] = sym->st_value - text->sh_addr + text->sh_offset;
+					found++;
+					break;
+				}
+			}
+		}
+	}
+
+	munmap(map, st.st_size);
+	return found;
+}
+
+/* One line of /proc/<pid>/maps, path points into the line */
+struct maps_entry {
+	__u64 dev;
+	__u64 ino;
+	bool exec;
+	const char *path;
+};
+
+/* Split a maps line; false for anything without a backing file */
+static inline bool maps_parse_line(char *line, struct maps_entry *e)
+{
+	unsigned int major, minor;
+	unsigned long long ino;
+	char perms[5];
+	int path_off = 0;
+	size_t len;
+
+	if (sscanf(line, "%*x-%*x %4s %*x %x:%x %llu %n", perms, &major, &minor, &ino,
+		   &path_off) < 4 || !path_off || line[path_off] != '/' || !ino)
+		return false;
+	len = strcspn(line + path_off, "\n");
+	line[path_off + len] = '\0';
+	if (len > 10 && !strcmp(line + path_off + len - 10, " (deleted)"))
+		return false;
+
+	e->dev = makedev(major, minor);
+	e->ino = ino;
+	e->exec = perms[2] == 'x';
+	e->path = line + path_off;
+	return true;
+}
+
+/* Library a mapped file is by name, SSL_LIB_MAX if none */
+static inline enum ssl_lib ssl_lib_by_name(const char *path)
+{
+	const char *base = strrchr(path, '/');
+
+	base = base ? base + 1 : path;
+	for (int lib = 0; lib < SSL_LIB_MAX; lib++) {
+		size_t len = strlen(ssl_lib_prefixes[lib]);
+
+		if (!strncmp(base, ssl_lib_prefixes[lib], len) &&
+		    (base[len] == '.' || base[len] == '-') && strstr(base + len, ".so"))
+			return lib;
+	}
+	return SSL_LIB_MAX;
+}
+
+/*
+ * Attach @lib's probes to the file at @path, offsets indexed like
+ * ssl_lib_symbols[lib] (0 = symbol missing). Returns 0 or -errno.
+ */
+typedef int (*ssl_attach_fn)(void *ctx, enum ssl_lib lib, const char *path,
+			     const size_t *offsets);
+
+enum ssl_inode_state {
+	SSL_INODE_FREE = 0,
+	SSL_INODE_NONE,      /* no TLS library in this file */
+	SSL_INODE_ATTACHED,
+	SSL_INODE_FAILED,    /* resolving or attaching failed, not retried */
+};
+
+struct ssl_inode {
+	__u64 dev;
+	__u64 ino;
+	enum ssl_inode_state state;
+};
+
+struct ssl_pending {
+	__u64 due_ns;
+	pid_t pid;
+	bool rescan;     /* the second, dlopen() catching scan */
+};
+
+struct ssl_attach {
+	struct ssl_inode *inodes;     /* open addressing on (dev, ino) */
+	size_t nr_inodes;
+	size_t cap_inodes;            /* power of two */
+	struct ssl_pending *pending;  /* execs waiting for a scan, in due order */
+	size_t nr_pending;
+	unsigned int libs;            /* 1 << enum ssl_lib, the libraries to look for */
+	const char *proc;             /* "/proc", overridable for tests */
+	ssl_attach_fn attach;
+	void *ctx;
+	/* optional, told about every inode recorded, e.g. to keep them across restarts */
+	void (*on_set)(void *ctx, __u64 dev, __u64 ino, enum ssl_inode_state state);
+	unsigned int attached;        /* files attached so far */
+	__u64 attach_ns;              /* time spent in the attach callback */
+	bool verbose;
+};
+
+static inline int ssl_attach_init(struct ssl_attach *m, unsigned int libs,
+				  ssl_attach_fn attach, void *ctx)
+{
+	memset(m, 0, sizeof(*m));
+	m->cap_inodes = 64;
+	m->inodes = calloc(m->cap_inodes, sizeof(*m->inodes));
+	m->pending = calloc(SSL_ATTACH_MAX_PENDING, sizeof(*m->pending));
+	if (!m->inodes || !m->pending) {
+		free(m->inodes);
+		free(m->pending);
+		return -ENOMEM;
+	}
+	m->libs = libs;
+	m->proc = "/proc";
+	m->attach = attach;
+	m->ctx = ctx;
+	return 0;
+}
+
+static inline void ssl_attach_free(struct ssl_attach *m)
+{
+	free(m->inodes);
+	free(m->pending);
+	m->inodes = NULL;
+	m->pending = NULL;
+}
+
+static inline size_t ssl_inode_hash(__u64 dev, __u64 ino)
+{
+	__u64 h = (ino ^ (dev << 32 | dev >> 32)) * 0x9e3779b97f4a7c15ULL;
+
+	return h >> 17;
+}
+
+/* Slot of (dev, ino), or the free slot it would go in */
+static inline struct ssl_inode *ssl_inode_slot(struct ssl_inode *tab, size_t cap,
+					       __u64 dev, __u64 ino)
+{
+	size_t i = ssl_inode_hash(dev, ino) & (cap - 1);
+
+	while (tab[i].state != SSL_INODE_FREE && (tab[i].dev != dev || tab[i].ino != ino))
+		i = (i + 1) & (cap - 1);
+	return &tab[i];
+}
+
+static inline bool ssl_attach_known(const struct ssl_attach *m, __u64 dev, __u64 ino)
+{
+	return ssl_inode_slot(m->inodes, m->cap_inodes, dev, ino)->state != SSL_INODE_FREE;
+}
+
+/* Record (dev, ino) as @state unless it is known already. Returns its state. */
+static inline enum ssl_inode_state ssl_attach_set(struct ssl_attach *m, __u64 dev, __u64 ino,
+						  enum ssl_inode_state state)
+{
+	struct ssl_inode *slot;
+
+	if ((m->nr_inodes + 1) * 2 > m->cap_inodes) {
+		size_t cap = m->cap_inodes * 2;
+		struct ssl_inode *tab = calloc(cap, sizeof(*tab));
+
+		if (!tab)
+			return state;
+		for (size_t i = 0; i < m->cap_inodes; i++) {
+			if (m->inodes[i].state != SSL_INODE_FREE)
+				*ssl_inode_slot(tab, cap, m->inodes[i].dev, m->inodes[i].ino) = m->inodes[i];
+		}
+		free(m->inodes);
+		m->inodes = tab;
+		m->cap_inodes = cap;
+	}
+	slot = ssl_inode_slot(m->inodes, m->cap_inodes, dev, ino);
+	if (slot->state == SSL_INODE_FREE) {
+		*slot = (struct ssl_inode){ .dev = dev, .ino = ino, .state = state };
+		m->nr_inodes++;
+		if (m->on_set)
+			m->on_set(m->ctx, dev, ino, state);
+	}
+	return slot->state;
+}
+
+/* Resolve and attach one file, @lib SSL_LIB_MAX to go by its symbols */
+static inline enum ssl_inode_state ssl_attach_file(struct ssl_attach *m, const char *path,
+						   enum ssl_lib lib)
+{
+	size_t offsets[SSL_ATTACH_MAX_SYMS];
+	struct timespec start, end;
+	__u64 ns;
+	int err;
+
+	if (lib == SSL_LIB_MAX) {
+		/* Bundled OpenSSL/BoringSSL, only if OpenSSL is wanted */
+		if (!(m->libs & (1 << SSL_LIB_OPENSSL)))
+			return SSL_INODE_NONE;
+		lib = SSL_LIB_OPENSSL;
+		err = elf_func_offsets(path, ssl_lib_symbols[lib], SSL_ATTACH_MAX_SYMS, offsets);
+		if (err < 0 || !offsets[SSL_SYM_WRITE] || !offsets[SSL_SYM_READ])
+			return SSL_INODE_NONE;
+	} else {
+		if (!(m->libs & (1 << lib)))
+			return SSL_INODE_NONE;
+		err = elf_func_offsets(path, ssl_lib_symbols[lib], SSL_ATTACH_MAX_SYMS, offsets);
+		if (err <= 0) {
+			if (m->verbose)
+				fprintf(stderr, "no %s symbols in %s: %d\n", ssl_lib_names[lib], path, err);
+			return SSL_INODE_FAILED;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	err = m->attach(m->ctx, lib, path, offsets);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+	m->attach_ns += ns;
+	if (m->verbose)
+		fprintf(stderr, "%s %s: %s in %.2f ms\n", ssl_lib_names[lib], path,
+			err ? strerror(-err) : "attached", ns / 1e6);
+	if (err)
+		return SSL_INODE_FAILED;
+	m->attached++;
+	return SSL_INODE_ATTACHED;
+}
+
+/*
+ * Attach to the file at @path unless its inode was seen before, keyed by
+ * what stat() says. On overlayfs that differs from the real inode in
+ * /proc/<pid>/maps, so scans check both. Returns the inode's state, or
+ * SSL_INODE_FREE if the file is gone.
+ */
+static inline enum ssl_inode_state ssl_attach_resolve(struct ssl_attach *m, const char *path,
+						      enum ssl_lib lib)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0)
+		return SSL_INODE_FREE;
+	if (ssl_attach_known(m, st.st_dev, st.st_ino))
+		return ssl_attach_set(m, st.st_dev, st.st_ino, SSL_INODE_FREE);
+	return ssl_attach_set(m, st.st_dev, st.st_ino, ssl_attach_file(m, path, lib));
+}
+
+/* Attach to the file at @path, 0 if it is (or already was) attached */
+static inline int ssl_attach_path(struct ssl_attach *m, const char *path, enum ssl_lib lib)
+{
+	enum ssl_inode_state state = ssl_attach_resolve(m, path, lib);
+
+	if (state == SSL_INODE_FREE)
+		return -errno;
+	return state == SSL_INODE_ATTACHED ? 0 : -ENOENT;
+}
+
+/* Attach to every library with @lib's name in the usual library directories */
+static inline int ssl_attach_system(struct ssl_attach *m, enum ssl_lib lib)
+{
+	static const char *const dirs[] = {
+		"/lib", "/lib64", "/usr/lib", "/usr/lib64", "/usr/local/lib",
+		"/lib/*-linux-gnu", "/usr/lib/*-linux-gnu",
+	};
+	char pattern[128];
+	glob_t g = {};
+	bool found = false;
+
+	for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+		snprintf(pattern, sizeof(pattern), "%s/%s.so*", dirs[i], ssl_lib_prefixes[lib]);
+		glob(pattern, i ? GLOB_APPEND : 0, NULL, &g);
+	}
+	/* attached now, or known attached from ssl_attach_set() */
+	for (size_t i = 0; i < g.gl_pathc; i++)
+		if (!ssl_attach_path(m, g.gl_pathv[i], lib))
+			found = true;
+	globfree(&g);
+	return found ? 0 : -ENOENT;
+}
+
+/* Look at every executable mapping of @pid. Returns mappings looked at or -errno. */
+static inline int ssl_attach_scan(struct ssl_attach *m, pid_t pid)
+{
+	char path[64], file[PATH_MAX + 64], line[PATH_MAX + 128];
+	enum ssl_inode_state state;
+	struct maps_entry e;
+	int n = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%d/maps", m->proc, pid);
+	f = fopen(path, "re");
+	if (!f)
+		return -errno;
+	while (fgets(line, sizeof(line), f)) {
+		if (!maps_parse_line(line, &e) || !e.exec)
+			continue;
+		n++;
+		if (ssl_attach_known(m, e.dev, e.ino))
+			continue;
+		/* through the process' root, so files in containers resolve */
+		snprintf(file, sizeof(file), "%s/%d/root%s", m->proc, pid, e.path);
+		state = ssl_attach_resolve(m, file, ssl_lib_by_name(e.path));
+		if (state != SSL_INODE_FREE)
+			ssl_attach_set(m, e.dev, e.ino, state);
+	}
+	fclose(f);
+	return n;
+}
+
+/* Scan every running process */
+static inline void ssl_attach_scan_all(struct ssl_attach *m)
+{
+	char pattern[64];
+	glob_t g = {};
+
+	snprintf(pattern, sizeof(pattern), "%s/[0-9]*", m->proc);
+	if (glob(pattern, GLOB_ONLYDIR | GLOB_NOSORT, NULL, &g))
+		return;
+	for (size_t i = 0; i < g.gl_pathc; i++)
+		ssl_attach_scan(m, atoi(strrchr(g.gl_pathv[i], '/') + 1));
+	globfree(&g);
+}
+
+/* Queue a scan of @pid at @due_ns, keeping the queue in due order */
+static inline void ssl_attach_queue(struct ssl_attach *m, pid_t pid, __u64 due_ns, bool rescan)
+{
+	size_t i;
+
+	if (m->nr_pending == SSL_ATTACH_MAX_PENDING)
+		return;
+	for (i = m->nr_pending; i > 0 && m->pending[i - 1].due_ns > due_ns; i--)
+		m->pending[i] = m->pending[i - 1];
+	m->pending[i] = (struct ssl_pending){ .due_ns = due_ns, .pid = pid, .rescan = rescan };
+	m->nr_pending++;
+}
+
+/* @pid exec()ed at @now_ns */
+static inline void ssl_attach_exec(struct ssl_attach *m, pid_t pid, __u64 now_ns)
+{
+	ssl_attach_queue(m, pid, now_ns + SSL_ATTACH_SCAN_NS, false);
+}
+
+/* Scan every process that is due by @now_ns */
+static inline void ssl_attach_tick(struct ssl_attach *m, __u64 now_ns)
+{
+	while (m->nr_pending && m->pending[0].due_ns <= now_ns) {
+		struct ssl_pending p = m->pending[0];
+
+		m->nr_pending--;
+		memmove(m->pending, m->pending + 1, m->nr_pending * sizeof(*m->pending));
+		/* a process that is gone needs no rescan */
+		if (ssl_attach_scan(m, p.pid) >= 0 && !p.rescan)
+			ssl_attach_queue(m, p.pid, p.due_ns - SSL_ATTACH_SCAN_NS + SSL_ATTACH_RESCAN_NS,
+					 true);
+	}
+}
+
+/* Milliseconds until the next queued scan, capped at @max_ms */
+static inline int ssl_attach_timeout_ms(const struct ssl_attach *m, __u64 now_ns, int max_ms)
+{
+	__u64 wait_ms;
+
+	if (!m->nr_pending)
+		return max_ms;
+	if (m->pending[0].due_ns <= now_ns)
+		return 0;
+	wait_ms = (m->pending[0].due_ns - now_ns + 999999) / 1000000;
+	return wait_ms < (__u64)max_ms ? (int)wait_ms : max_ms;
+}
+
+#endif /* __SSL_ATTACH_H */
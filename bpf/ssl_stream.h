@@ -0,0 +1,688 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __SSL_STREAM_H
+#define __SSL_STREAM_H
+
+/*
+ * sslsniff --reassemble: stitch the SSL_read()/SSL_write() chunks of each
+ * connection back into whole HTTP/1.x messages and SSE events.
+ *
+ * A stream is one direction of one connection, keyed by (pid, SSL*, rw).
+ * Bytes are buffered up to a message boundary: the end of the header block
+ * plus Content-Length bytes, or the last chunk of a chunked body. When a
+ * message turns out to be text/event-stream, its head goes out on its own
+ * and the body is de-chunked and cut after the blank line ending each event,
+ * so the collector gets one record per event instead of one per SSL call.
+ *
+ * Anything that does not start like HTTP/1.x (HTTP/2, other protocols, a
+ * capture that began mid-message) is passed through chunk by chunk, as are
+ * calls the probe could not copy in full. Buffers are capped and a stream
+ * that goes quiet hands over what it holds, so a wrong guess costs a split
+ * message at worst.
+ *
+ * Not thread safe, sslsniff feeds every stream from its main thread.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+enum ssl_frame {
+	SSL_FRAME_CHUNK = 0,  /* one SSL call, as captured */
+	SSL_FRAME_HTTP,       /* a whole message, or the head of an event stream */
+	SSL_FRAME_SSE,        /* one event of an event stream */
+	SSL_FRAME_PARTIAL,    /* part of a message, handed over early */
+	SSL_FRAME_MAX,
+};
+
+static const char *const ssl_frame_names[SSL_FRAME_MAX] = {
+	[SSL_FRAME_CHUNK] = "chunk",
+	[SSL_FRAME_HTTP] = "http",
+	[SSL_FRAME_SSE] = "sse",
+	[SSL_FRAME_PARTIAL] = "partial",
+};
+
+#define SSL_STREAM_BUCKET_BITS 10
+#define SSL_STREAM_BUCKETS (1 << SSL_STREAM_BUCKET_BITS)
+#define SSL_STREAM_MAX_STREAMS 4096              /* more connections pass through */
+#define SSL_STREAM_MAX_HEAD (64 * 1024)          /* header block without its blank line */
+#define SSL_STREAM_MAX_BYTES (4 * 1024 * 1024)   /* buffered message or event */
+#define SSL_STREAM_KEEP_BYTES (64 * 1024)        /* buffer kept between messages */
+#define SSL_STREAM_IDLE_NS (1000 * 1000000ULL)   /* hand over buffered bytes after this */
+#define SSL_STREAM_FORGET_NS (300 * 1000000000ULL) /* and forget the stream after this */
+
+struct ssl_stream_key {
+	uint64_t ssl;
+	uint32_t pid;
+	uint32_t rw;
+};
+
+enum ssl_stream_state {
+	SSL_STREAM_START,       /* at a message boundary */
+	SSL_STREAM_PASS,        /* not HTTP/1.x, chunks go out as they come */
+	SSL_STREAM_HEAD,        /* in the header block */
+	SSL_STREAM_BODY,        /* Content-Length body */
+	SSL_STREAM_CHUNKED,     /* chunked body */
+	SSL_STREAM_UNTIL_IDLE,  /* body ends with the connection */
+};
+
+enum ssl_chunk_state {
+	SSL_CHUNK_SIZE,         /* hex size */
+	SSL_CHUNK_EXT,          /* extensions up to the end of the size line */
+	SSL_CHUNK_DATA,
+	SSL_CHUNK_DATA_END,     /* CRLF after the data */
+	SSL_CHUNK_TRAILER,      /* trailer lines up to an empty one */
+};
+
+struct ssl_buf {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+struct ssl_stream {
+	struct ssl_stream *next;
+	struct ssl_stream_key key;
+	enum ssl_stream_state state;
+	enum ssl_chunk_state chunk;
+	bool sse;               /* body is text/event-stream, goes out per event */
+	bool split;             /* part of this message already went out */
+	unsigned int crlf;      /* bytes of "\r\n\r\n" matched so far in the head */
+	unsigned int line_len;  /* of the current trailer line */
+	uint64_t remaining;     /* body or chunk bytes left */
+	struct ssl_buf buf;     /* current message, raw */
+	struct ssl_buf events;  /* de-chunked event stream not yet cut into events */
+	size_t scanned;         /* events bytes already searched for an event end */
+	uint64_t ts;            /* timestamp of the last chunk */
+	uint64_t first_ts;      /* timestamp of the first chunk in the pending frame */
+	unsigned int chunks;    /* SSL calls in the pending frame */
+	uint64_t feed;          /* chunks fed so far */
+	uint64_t counted;       /* last of them counted in chunks */
+	void *hdr;              /* copy of the caller's header of the last chunk */
+};
+
+/* Called with every frame, s->hdr is the header of the chunk that ended it */
+typedef void (*ssl_stream_emit_fn)(void *ctx, const struct ssl_stream *s, enum ssl_frame frame,
+				   const char *data, size_t len);
+
+struct ssl_streams {
+	struct ssl_stream *buckets[SSL_STREAM_BUCKETS];
+	size_t nr;
+	size_t hdr_len;
+	uint64_t next_sweep;
+	ssl_stream_emit_fn emit;
+	void *ctx;
+};
+
+static inline void ssl_streams_init(struct ssl_streams *t, size_t hdr_len,
+				    ssl_stream_emit_fn emit, void *ctx)
+{
+	memset(t, 0, sizeof(*t));
+	t->hdr_len = hdr_len;
+	t->emit = emit;
+	t->ctx = ctx;
+}
+
+static inline int ssl_buf_append(struct ssl_buf *b, const char *p, size_t n)
+{
+	if (b->len + n > b->cap) {
+		size_t cap = b->cap ? b->cap : 4096;
+		char *data;
+
+		while (cap < b->len + n)
+			cap *= 2;
+		data = realloc(b->data, cap);
+		if (!data)
+			return -ENOMEM;
+		b->data = data;
+		b->cap = cap;
+	}
+	memcpy(b->data + b->len, p, n);
+	b->len += n;
+	return 0;
+}
+
+/* Empty @b, giving back the memory of an unusually large message */
+static inline void ssl_buf_reset(struct ssl_buf *b)
+{
+	b->len = 0;
+	if (b->cap > SSL_STREAM_KEEP_BYTES) {
+		free(b->data);
+		b->data = NULL;
+		b->cap = 0;
+	}
+}
+
+/* 1 if @p starts an HTTP/1.x message, 0 if not, -1 if @n is too short to tell */
+static inline int ssl_http_start(const char *p, size_t n)
+{
+	static const char *const starts[] = {
+		"HTTP/1.", "GET ", "POST ", "PUT ", "DELETE ", "HEAD ",
+		"OPTIONS ", "PATCH ", "CONNECT ", "TRACE ",
+	};
+	int ret = 0;
+
+	for (size_t i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+		size_t len = strlen(starts[i]);
+
+		if (n >= len) {
+			if (!memcmp(p, starts[i], len))
+				return 1;
+		} else if (!memcmp(p, starts[i], n)) {
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+/* Value of header @name in the head @p, or NULL. Sets *vlen, trimmed. */
+static inline const char *ssl_http_header(const char *p, size_t n, const char *name, size_t *vlen)
+{
+	const char *end = p + n;
+	const char *line = memchr(p, '\n', n);   /* skip the start line */
+	size_t nlen = strlen(name);
+
+	while (line && ++line < end) {
+		const char *eol = memchr(line, '\n', end - line);
+		const char *v = line + nlen + 1, *ve = eol ? eol : end;
+
+		if (ve - line > (ptrdiff_t)nlen && line[nlen] == ':' && !strncasecmp(line, name, nlen)) {
+			while (v < ve && (*v == ' ' || *v == '\t'))
+				v++;
+			while (ve > v && (ve[-1] == '\r' || ve[-1] == ' ' || ve[-1] == '\t'))
+				ve--;
+			*vlen = ve - v;
+			return v;
+		}
+		line = eol;
+	}
+	return NULL;
+}
+
+static inline bool ssl_http_value_has(const char *v, size_t vlen, const char *token)
+{
+	size_t n = strlen(token);
+
+	for (size_t i = 0; v && i + n <= vlen; i++) {
+		if (!strncasecmp(v + i, token, n))
+			return true;
+	}
+	return false;
+}
+
+/* Count the current chunk in the pending frame */
+static inline void ssl_stream_count(struct ssl_stream *s)
+{
+	if (s->counted == s->feed)
+		return;
+	s->counted = s->feed;
+	if (!s->chunks++)
+		s->first_ts = s->ts;
+}
+
+static inline void ssl_stream_emit(struct ssl_streams *t, struct ssl_stream *s,
+				   enum ssl_frame frame, const char *p, size_t n)
+{
+	ssl_stream_count(s);
+	t->emit(t->ctx, s, frame, p, n);
+	s->chunks = 0;
+	s->counted = 0;
+}
+
+/* Hand over whatever is buffered, the message carries on as partial frames */
+static inline void ssl_stream_flush(struct ssl_streams *t, struct ssl_stream *s)
+{
+	if (s->buf.len) {
+		bool whole = s->state == SSL_STREAM_UNTIL_IDLE && !s->split;
+
+		ssl_stream_emit(t, s, whole ? SSL_FRAME_HTTP : SSL_FRAME_PARTIAL, s->buf.data, s->buf.len);
+		ssl_buf_reset(&s->buf);
+		if (s->state != SSL_STREAM_START && s->state != SSL_STREAM_PASS)
+			s->split = true;
+	}
+	if (s->events.len) {
+		ssl_stream_emit(t, s, SSL_FRAME_PARTIAL, s->events.data, s->events.len);
+		ssl_buf_reset(&s->events);
+		s->scanned = 0;
+	}
+}
+
+/* The rest of this chunk can't be followed, pass it through and resync later */
+static inline void ssl_stream_desync(struct ssl_streams *t, struct ssl_stream *s,
+				     const char *p, size_t n)
+{
+	ssl_stream_flush(t, s);
+	if (n)
+		ssl_stream_emit(t, s, SSL_FRAME_CHUNK, p, n);
+	s->state = SSL_STREAM_PASS;
+	s->sse = false;
+	s->split = false;
+}
+
+static inline void ssl_stream_message_done(struct ssl_streams *t, struct ssl_stream *s)
+{
+	enum ssl_frame frame = s->split ? SSL_FRAME_PARTIAL : SSL_FRAME_HTTP;
+
+	if (s->sse) {
+		frame = s->split ? SSL_FRAME_PARTIAL : SSL_FRAME_SSE;
+		if (s->events.len)
+			ssl_stream_emit(t, s, frame, s->events.data, s->events.len);
+		ssl_buf_reset(&s->events);
+		s->scanned = 0;
+	} else {
+		ssl_stream_emit(t, s, frame, s->buf.data, s->buf.len);
+	}
+	ssl_buf_reset(&s->buf);
+	s->state = SSL_STREAM_START;
+	s->sse = false;
+	s->split = false;
+}
+
+/* Emit every complete event, ended by a blank line ("\n\n" or "\n\r\n") */
+static inline void ssl_stream_cut_events(struct ssl_streams *t, struct ssl_stream *s)
+{
+	struct ssl_buf *ev = &s->events;
+	size_t start = 0, rest;
+
+	for (size_t i = s->scanned; i < ev->len; i++) {
+		size_t end = 0;
+
+		if (ev->data[i] != '\n')
+			continue;
+		if (i + 1 < ev->len && ev->data[i + 1] == '\n')
+			end = i + 2;
+		else if (i + 2 < ev->len && ev->data[i + 1] == '\r' && ev->data[i + 2] == '\n')
+			end = i + 3;
+		if (!end)
+			continue;
+
+		ssl_stream_emit(t, s, s->split ? SSL_FRAME_PARTIAL : SSL_FRAME_SSE,
+				ev->data + start, end - start);
+		s->split = false;
+		start = end;
+		i = end - 1;
+		// What follows came in with this chunk too
+		if (start < ev->len)
+			ssl_stream_count(s);
+	}
+
+	rest = ev->len - start;
+	if (start)
+		memmove(ev->data, ev->data + start, rest);
+	ev->len = rest;
+	s->scanned = rest > 2 ? rest - 2 : 0;
+	if (ev->len > SSL_STREAM_MAX_BYTES) {
+		ssl_stream_emit(t, s, SSL_FRAME_PARTIAL, ev->data, ev->len);
+		ssl_buf_reset(ev);
+		s->scanned = 0;
+		s->split = true;
+	}
+}
+
+/* Keep raw message bytes: the head, body and chunk framing */
+static inline void ssl_stream_take(struct ssl_streams *t, struct ssl_stream *s,
+				   const char *p, size_t n)
+{
+	if (!n)
+		return;
+	ssl_stream_count(s);
+	if (ssl_buf_append(&s->buf, p, n)) {
+		ssl_stream_flush(t, s);
+		ssl_stream_emit(t, s, SSL_FRAME_PARTIAL, p, n);
+		s->split = true;
+		return;
+	}
+	if (s->buf.len > SSL_STREAM_MAX_BYTES) {
+		ssl_stream_emit(t, s, SSL_FRAME_PARTIAL, s->buf.data, s->buf.len);
+		ssl_buf_reset(&s->buf);
+		s->split = true;
+	}
+}
+
+/* Keep body bytes, which for an event stream go to the event cutter */
+static inline void ssl_stream_take_data(struct ssl_streams *t, struct ssl_stream *s,
+					const char *p, size_t n)
+{
+	if (!s->sse) {
+		ssl_stream_take(t, s, p, n);
+		return;
+	}
+	if (!n)
+		return;
+	ssl_stream_count(s);
+	if (ssl_buf_append(&s->events, p, n)) {
+		ssl_stream_flush(t, s);
+		ssl_stream_emit(t, s, SSL_FRAME_PARTIAL, p, n);
+		return;
+	}
+	ssl_stream_cut_events(t, s);
+}
+
+/* Look for the end of the head, returns the bytes of @p that belong to it */
+static inline size_t ssl_stream_head_scan(struct ssl_stream *s, const char *p, size_t n)
+{
+	static const char end[] = "\r\n\r\n";
+
+	for (size_t i = 0; i < n; i++) {
+		if (p[i] == end[s->crlf]) {
+			if (++s->crlf == 4)
+				return i + 1;
+		} else {
+			s->crlf = p[i] == '\r';
+		}
+	}
+	return n;
+}
+
+/* The head is complete in s->buf, work out how the body is framed */
+static inline void ssl_stream_head_done(struct ssl_streams *t, struct ssl_stream *s)
+{
+	const char *p = s->buf.data, *v;
+	size_t n = s->buf.len, vlen = 0;
+	bool response = n > 12 && !memcmp(p, "HTTP/", 5);
+	int status = response ? atoi(p + 9) : 0;
+
+	v = ssl_http_header(p, n, "Content-Type", &vlen);
+	s->sse = ssl_http_value_has(v, vlen, "text/event-stream");
+
+	if (response && (status / 100 == 1 || status == 204 || status == 304)) {
+		s->sse = false;
+		ssl_stream_message_done(t, s);
+		return;
+	}
+	if ((v = ssl_http_header(p, n, "Transfer-Encoding", &vlen)) &&
+	    ssl_http_value_has(v, vlen, "chunked")) {
+		s->state = SSL_STREAM_CHUNKED;
+		s->chunk = SSL_CHUNK_SIZE;
+		s->remaining = 0;
+	} else if ((v = ssl_http_header(p, n, "Content-Length", &vlen))) {
+		s->remaining = 0;
+		for (size_t i = 0; i < vlen && v[i] >= '0' && v[i] <= '9'; i++)
+			s->remaining = s->remaining * 10 + (v[i] - '0');
+		s->state = SSL_STREAM_BODY;
+	} else if (response) {
+		s->state = SSL_STREAM_UNTIL_IDLE;
+	} else {
+		s->remaining = 0;
+		s->state = SSL_STREAM_BODY;
+	}
+
+	if (s->state == SSL_STREAM_BODY && !s->remaining) {
+		s->sse = false;
+		ssl_stream_message_done(t, s);
+	} else if (s->sse) {
+		// The head goes out now, the events as they complete
+		ssl_stream_emit(t, s, s->split ? SSL_FRAME_PARTIAL : SSL_FRAME_HTTP, s->buf.data, s->buf.len);
+		ssl_buf_reset(&s->buf);
+		s->split = false;
+	}
+}
+
+/* Step through a chunked body, returns the bytes of @p consumed */
+static inline size_t ssl_stream_chunked(struct ssl_streams *t, struct ssl_stream *s,
+					const char *p, size_t n)
+{
+	size_t i = 0;
+
+	while (i < n) {
+		char c = p[i];
+
+		if (s->chunk == SSL_CHUNK_DATA) {
+			size_t k = n - i < s->remaining ? n - i : s->remaining;
+
+			ssl_stream_take_data(t, s, p + i, k);
+			i += k;
+			s->remaining -= k;
+			if (!s->remaining)
+				s->chunk = SSL_CHUNK_DATA_END;
+			continue;
+		}
+
+		switch (s->chunk) {
+		case SSL_CHUNK_SIZE:
+			if (c >= '0' && c <= '9')
+				s->remaining = s->remaining * 16 + (c - '0');
+			else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+				s->remaining = s->remaining * 16 + ((c | 0x20) - 'a' + 10);
+			else if (c == ';' || c == ' ' || c == '\t')
+				s->chunk = SSL_CHUNK_EXT;
+			else if (c != '\r' && c != '\n')
+				goto desync;
+			if (s->remaining > SSL_STREAM_MAX_BYTES * 256ULL)
+				goto desync;
+			/* fallthrough */
+		case SSL_CHUNK_EXT:
+			if (c == '\n') {
+				s->chunk = s->remaining ? SSL_CHUNK_DATA : SSL_CHUNK_TRAILER;
+				s->line_len = 0;
+			}
+			break;
+		case SSL_CHUNK_DATA_END:
+			if (c == '\n') {
+				s->chunk = SSL_CHUNK_SIZE;
+				s->remaining = 0;
+			} else if (c != '\r') {
+				goto desync;
+			}
+			break;
+		case SSL_CHUNK_TRAILER:
+			if (c == '\n' && !s->line_len) {
+				ssl_stream_take(t, s, p + i, 1);
+				ssl_stream_message_done(t, s);
+				return i + 1;
+			}
+			if (c == '\n')
+				s->line_len = 0;
+			else if (c != '\r')
+				s->line_len++;
+			break;
+		case SSL_CHUNK_DATA:
+			break;
+		}
+		if (!s->sse)
+			ssl_stream_take(t, s, p + i, 1);
+		i++;
+	}
+	return n;
+
+desync:
+	ssl_stream_desync(t, s, p + i, n - i);
+	return n;
+}
+
+/* Feed @p to @s, in pieces as messages end and new ones start */
+static inline void ssl_stream_feed(struct ssl_streams *t, struct ssl_stream *s,
+				   const char *p, size_t n)
+{
+	while (n) {
+		size_t k;
+		int r;
+
+		switch (s->state) {
+		case SSL_STREAM_START:
+		case SSL_STREAM_PASS:
+			if (s->buf.len) {
+				// A start line too short to tell was held back
+				char probe[16];
+				size_t held = s->buf.len < sizeof(probe) ? s->buf.len : sizeof(probe);
+				size_t more = n < sizeof(probe) - held ? n : sizeof(probe) - held;
+
+				memcpy(probe, s->buf.data, held);
+				memcpy(probe + held, p, more);
+				r = ssl_http_start(probe, held + more);
+			} else {
+				r = ssl_http_start(p, n);
+			}
+			if (r > 0) {
+				s->state = SSL_STREAM_HEAD;
+				s->crlf = 0;
+				s->split = false;
+				continue;
+			}
+			if (r < 0 && s->state == SSL_STREAM_START) {
+				ssl_stream_take(t, s, p, n);
+				return;
+			}
+			if (s->buf.len) {
+				ssl_stream_take(t, s, p, n);
+				ssl_stream_emit(t, s, SSL_FRAME_CHUNK, s->buf.data, s->buf.len);
+				ssl_buf_reset(&s->buf);
+			} else {
+				ssl_stream_emit(t, s, SSL_FRAME_CHUNK, p, n);
+			}
+			s->state = SSL_STREAM_PASS;
+			return;
+		case SSL_STREAM_HEAD:
+			k = ssl_stream_head_scan(s, p, n);
+			ssl_stream_take(t, s, p, k);
+			p += k;
+			n -= k;
+			if (s->crlf == 4) {
+				ssl_stream_head_done(t, s);
+			} else if (s->buf.len > SSL_STREAM_MAX_HEAD) {
+				ssl_stream_desync(t, s, p, n);
+				return;
+			}
+			break;
+		case SSL_STREAM_BODY:
+			k = n < s->remaining ? n : s->remaining;
+			ssl_stream_take_data(t, s, p, k);
+			p += k;
+			n -= k;
+			s->remaining -= k;
+			if (!s->remaining)
+				ssl_stream_message_done(t, s);
+			break;
+		case SSL_STREAM_CHUNKED:
+			k = ssl_stream_chunked(t, s, p, n);
+			p += k;
+			n -= k;
+			break;
+		case SSL_STREAM_UNTIL_IDLE:
+			ssl_stream_take_data(t, s, p, n);
+			return;
+		}
+	}
+}
+
+static inline struct ssl_stream **ssl_streams_slot(struct ssl_streams *t,
+						   const struct ssl_stream_key *key)
+{
+	uint64_t h = (key->ssl ^ ((uint64_t)key->pid << 1 | key->rw)) * 0x9E3779B97F4A7C15ULL;
+	struct ssl_stream **sp = &t->buckets[h >> (64 - SSL_STREAM_BUCKET_BITS)];
+
+	while (*sp && memcmp(&(*sp)->key, key, sizeof(*key)))
+		sp = &(*sp)->next;
+	return sp;
+}
+
+static inline void ssl_stream_free(struct ssl_stream *s)
+{
+	free(s->buf.data);
+	free(s->events.data);
+	free(s->hdr);
+	free(s);
+}
+
+/*
+ * One SSL call's worth of @key's stream: @hdr is the caller's record header
+ * (hdr_len bytes), @lost how much of the call the probe failed to copy.
+ */
+static inline void ssl_streams_feed(struct ssl_streams *t, const struct ssl_stream_key *key,
+				    const void *hdr, uint64_t ts, const char *p, size_t n, size_t lost)
+{
+	struct ssl_stream **sp = ssl_streams_slot(t, key);
+	struct ssl_stream *s = *sp;
+
+	if (!s && t->nr < SSL_STREAM_MAX_STREAMS) {
+		s = calloc(1, sizeof(*s));
+		if (s && !(s->hdr = malloc(t->hdr_len))) {
+			free(s);
+			s = NULL;
+		}
+		if (s) {
+			s->key = *key;
+			*sp = s;
+			t->nr++;
+		}
+	}
+	if (!s) {
+		// Out of streams, this connection goes through unassembled
+		struct ssl_stream tmp = { .key = *key, .ts = ts, .first_ts = ts, .chunks = 1,
+					  .hdr = (void *)hdr };
+
+		t->emit(t->ctx, &tmp, SSL_FRAME_CHUNK, p, n);
+		return;
+	}
+
+	memcpy(s->hdr, hdr, t->hdr_len);
+	s->ts = ts;
+	s->feed++;
+	if (lost) {
+		// Bytes are missing, whatever was being followed is lost with them
+		ssl_stream_desync(t, s, NULL, 0);
+		ssl_stream_emit(t, s, SSL_FRAME_CHUNK, p, n);
+	} else if (n) {
+		ssl_stream_feed(t, s, p, n);
+	}
+}
+
+/* Flush and forget both directions of a connection, e.g. on a new handshake */
+static inline void ssl_streams_close(struct ssl_streams *t, uint32_t pid, uint64_t ssl)
+{
+	for (uint32_t rw = 0; rw < 2; rw++) {
+		struct ssl_stream_key key = { .ssl = ssl, .pid = pid, .rw = rw };
+		struct ssl_stream **sp = ssl_streams_slot(t, &key);
+		struct ssl_stream *s = *sp;
+
+		if (!s)
+			continue;
+		ssl_stream_flush(t, s);
+		*sp = s->next;
+		t->nr--;
+		ssl_stream_free(s);
+	}
+}
+
+/*
+ * Hand over what streams quiet since SSL_STREAM_IDLE_NS hold, and forget
+ * those quiet since SSL_STREAM_FORGET_NS; all of them if @now is UINT64_MAX.
+ * Cheap to call on every loop iteration.
+ */
+static inline void ssl_streams_expire(struct ssl_streams *t, uint64_t now)
+{
+	if (now < t->next_sweep)
+		return;
+	t->next_sweep = now == UINT64_MAX ? 0 : now + SSL_STREAM_IDLE_NS / 4;
+
+	for (size_t i = 0; i < SSL_STREAM_BUCKETS; i++) {
+		struct ssl_stream **sp = &t->buckets[i];
+
+		while (*sp) {
+			struct ssl_stream *s = *sp;
+			uint64_t idle = now > s->ts ? now - s->ts : 0;
+
+			if (idle >= SSL_STREAM_IDLE_NS)
+				ssl_stream_flush(t, s);
+			if (idle >= SSL_STREAM_FORGET_NS) {
+				*sp = s->next;
+				t->nr--;
+				ssl_stream_free(s);
+			} else {
+				sp = &s->next;
+			}
+		}
+	}
+}
+
+/* Flush every stream and free them */
+static inline void ssl_streams_free(struct ssl_streams *t)
+{
+	t->next_sweep = 0;
+	ssl_streams_expire(t, UINT64_MAX);
+}
+
+#endif /* __SSL_STREAM_H */
@@ -9,18 +9,43 @@
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_tracing.h>
 #include "sslsniff.h"
+#include "stats.h"
+#include "histogram.h"
+#include "rate_limit.h"
+#include "event_loop.h"
+#include "tracked_pids.h"
 
 struct {
     __uint(type, BPF_MAP_TYPE_RINGBUF);
     __uint(max_entries, RING_BUFFER_SIZE);
 } rb SEC(".maps");
 
+/* PIDs that exec'd, so userspace can attach to the TLS libraries they map */
 struct {
-    __uint(type, BPF_MAP_TYPE_HASH);
-    __uint(max_entries, 10240);
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, EXEC_RING_SIZE);
+} exec_rb SEC(".maps");
+
+/* With --ring-cpus, one ring per ring_cpus CPUs instead of the shared rb.
+ * Userspace sizes the array and creates the rings before attach. */
+struct ssl_ring {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, RING_BUFFER_SIZE);
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __uint(max_entries, 1);
     __type(key, __u32);
-    __type(value, size_t*);
-} readbytes_ptrs SEC(".maps");
+    __array(values, struct ssl_ring);
+} ssl_rings SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, SSL_PROBE_MAX);
+    __type(key, __u32);
+    __type(value, struct probe_stats);
+} rb_stats SEC(".maps");
 
 #define MAX_ENTRIES 10240
 
@@ -32,24 +57,163 @@ struct {
         _min1 < _min2 ? _min1 : _min2; \
     })
 
-/* ssl_data per-CPU array removed - ring buffer allocates memory directly */
+/* Scratch record used to stage plaintext before it is copied into the ring
+ * with its real size. Per-CPU array values are capped at 32KB, so this is a
+ * plain array indexed by CPU; userspace sizes it to the possible CPU count. */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct probe_SSL_data_t);
+} ssl_scratch SEC(".maps");
+
+/* The SSL call in flight on a thread, for its uretprobe. Each thread keeps
+ * its slot across calls and start_ns marks it busy, so after a thread's
+ * first call entry and exit are one lockless lookup each, with no update or
+ * delete taking a bucket lock. LRU recycles the slots of exited threads. */
+struct ssl_call {
+    __u64 start_ns;   /* 0 when no call is in flight */
+    __u64 buf;
+    __u64 ssl;
+    __u64 readbytes;  /* size_t * result of the _ex calls */
+};
 
 struct {
-    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
     __uint(max_entries, MAX_ENTRIES);
     __type(key, __u32);
-    __type(value, __u64);
-} start_ns SEC(".maps");
+    __type(value, struct ssl_call);
+} ssl_calls SEC(".maps");
+
+static __always_inline void ssl_call_enter(u32 tid, u64 ts, void *ssl, void *buf, void *readbytes)
+{
+    struct ssl_call *call = bpf_map_lookup_elem(&ssl_calls, &tid);
+
+    if (!call) {
+        struct ssl_call fresh = {
+            .start_ns = ts, .buf = (u64)buf, .ssl = (u64)ssl, .readbytes = (u64)readbytes,
+        };
+        bpf_map_update_elem(&ssl_calls, &tid, &fresh, BPF_ANY);
+        return;
+    }
+    call->buf = (u64)buf;
+    call->ssl = (u64)ssl;
+    call->readbytes = (u64)readbytes;
+    call->start_ns = ts;
+}
+
+/* Copy out the call in flight on tid and free the slot, false if the entry
+ * probe did not record one (filtered, or attached mid-call) */
+static __always_inline bool ssl_call_take(u32 tid, struct ssl_call *out)
+{
+    struct ssl_call *call = bpf_map_lookup_elem(&ssl_calls, &tid);
+
+    if (!call || !call->start_ns)
+        return false;
+    *out = *call;
+    call->start_ns = 0;
+    return true;
+}
+
+/* One connection: forked workers of one binary share their heap layout, so
+ * an SSL* address alone can be another process's connection */
+struct capture_key {
+    __u64 ssl;
+    __u32 pid;
+    __u32 pad;
+};
+
+/* Socket of each SSL*, from SSL_set_fd(). Connections set up through a BIO
+ * never show up here and report fd -1. */
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, MAX_SSL_FDS);
+    __type(key, struct capture_key);
+    __type(value, int);
+} ssl_fds SEC(".maps");
+
+/* Capture budget of one connection, for the policy below */
+struct capture_state {
+    __u64 window_start;  /* start of the current CAPTURE_WINDOW_NS */
+    __u32 window_bytes;  /* bytes captured in that window */
+    __u32 msg_budget;    /* body bytes still captured for the current message */
+    int rw;              /* direction of the last call */
+};
 
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, MAX_SSL_CAPTURE);
+    __type(key, struct capture_key);
+    __type(value, struct capture_state);
+} ssl_capture SEC(".maps");
+
+/* Allow-sets for -p/-c, filled by userspace before attach. Checked on every
+ * probe so filtered processes never pay for the plaintext copy. */
 struct {
     __uint(type, BPF_MAP_TYPE_HASH);
-    __uint(max_entries, MAX_ENTRIES);
+    __uint(max_entries, MAX_FILTER_PIDS);
     __type(key, __u32);
+    __type(value, __u8);
+} allowed_pids SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, MAX_FILTER_COMMS);
+    __type(key, char[TASK_COMM_LEN]);
+    __type(value, __u8);
+} allowed_comms SEC(".maps");
+
+/* --histogram: call latencies per (comm, kind) instead of data records */
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(max_entries, HIST_MAX_ENTRIES);
+    __type(key, struct hist_key);
+    __type(value, struct hist);
+} latency_hist SEC(".maps");
+
+/* When each connection finished its handshake, until its first read returns data */
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, MAX_SSL_FDS);
+    __type(key, struct capture_key);
     __type(value, __u64);
-} bufs SEC(".maps");
+} ssl_handshake_done SEC(".maps");
+
+/* Per-tgid token buckets for plaintext bytes */
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, RATE_LIMIT_MAX_ENTRIES);
+    __type(key, struct rate_key);
+    __type(value, struct rate_bucket);
+} rate_buckets SEC(".maps");
 
 const volatile pid_t targ_pid = 0;
 const volatile uid_t targ_uid = -1;
+const volatile bool filter_pids = false;
+const volatile bool filter_comms = false;
+const volatile bool filter_tracked = false;
+const volatile __u32 ring_cpus = 0;
+const volatile bool histogram_only = false;
+
+/* Capture policy, 0 = no limit. len always reports the full call, so the
+ * bytes left out show up as truncated/bytes_lost. */
+const volatile __u32 capture_cap[2] = {};     /* per call, by rw */
+const volatile __u32 capture_msg_head = 0;    /* body bytes per HTTP message */
+const volatile __u32 capture_conn_rate = 0;   /* bytes per connection per second */
+
+/* Per-tgid rates by rate_class, only RATE_CLASS_SSL_BYTES is used here */
+const volatile __u64 rate_limit[RATE_CLASS_MAX] = {};
+
+/* Ring for records from this CPU */
+static __always_inline void *ssl_ring(void)
+{
+    __u32 idx;
+
+    if (!ring_cpus)
+        return &rb;
+    idx = bpf_get_smp_processor_id() / ring_cpus;
+    return bpf_map_lookup_elem(&ssl_rings, &idx);
+}
 
 static __always_inline bool trace_allowed(u32 uid, u32 pid)
 {
@@ -61,9 +225,190 @@ static __always_inline bool trace_allowed(u32 uid, u32 pid)
             return false;
         }
     }
+    if (filter_pids && !bpf_map_lookup_elem(&allowed_pids, &pid))
+        return false;
+    if (filter_tracked && !tgid_is_tracked(pid))
+        return false;
+    if (filter_comms) {
+        char comm[TASK_COMM_LEN] = {};
+
+        bpf_get_current_comm(&comm, sizeof(comm));
+        if (!bpf_map_lookup_elem(&allowed_comms, comm))
+            return false;
+    }
     return true;
 }
 
+static __always_inline int ssl_fd(u32 pid, u64 ssl)
+{
+    struct capture_key key = { .ssl = ssl, .pid = pid };
+    int *fd = bpf_map_lookup_elem(&ssl_fds, &key);
+
+    return fd ? *fd : -1;
+}
+
+/* Does buf open an HTTP/1.x request or response? */
+static __always_inline bool http_start_line(const char *p)
+{
+    switch (p[0]) {
+    case 'G': return p[1] == 'E' && p[2] == 'T' && p[3] == ' ';
+    case 'P': return (p[1] == 'O' && p[2] == 'S' && p[3] == 'T') ||
+                     (p[1] == 'U' && p[2] == 'T' && p[3] == ' ') ||
+                     (p[1] == 'A' && p[2] == 'T' && p[3] == 'C');
+    case 'D': return p[1] == 'E' && p[2] == 'L' && p[3] == 'E';
+    case 'O': return p[1] == 'P' && p[2] == 'T' && p[3] == 'I';
+    case 'H': return (p[1] == 'E' && p[2] == 'A' && p[3] == 'D') ||
+                     (p[1] == 'T' && p[2] == 'T' && p[3] == 'P' && p[4] == '/');
+    }
+    return false;
+}
+
+static __always_inline bool sse_line_at(const char *p, int i)
+{
+    return (p[i] == 'd' && p[i + 1] == 'a' && p[i + 2] == 't' && p[i + 3] == 'a' &&
+            p[i + 4] == ':') ||
+           (p[i] == 'e' && p[i + 1] == 'v' && p[i + 2] == 'e' && p[i + 3] == 'n' &&
+            p[i + 4] == 't');
+}
+
+/* Is buf an SSE "data:" or "event:" line, possibly behind a chunk size? */
+static __always_inline bool sse_frame(const char *p)
+{
+    bool hex = true;
+
+    if (sse_line_at(p, 0))
+        return true;
+#pragma unroll
+    for (int i = 0; i < 9; i++) {
+        char c = p[i];
+
+        if (i && hex && c == '\r' && p[i + 1] == '\n')
+            return sse_line_at(p, i + 2);
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')))
+            hex = false;
+    }
+    return false;
+}
+
+/* Bytes of a len byte call to copy under the capture policy. Message starts
+ * and SSE frames are kept whole; only bodies past capture_msg_head are cut.
+ * Message and window boundaries move here, but nothing is charged: *stp and
+ * *body go to capture_charge() once the copy actually went out. */
+static __always_inline u32 capture_size(u64 ts, u32 pid, u64 ssl, int rw, u64 buf, u32 len,
+                                        struct capture_state **stp, bool *body)
+{
+    struct capture_key key = { .ssl = ssl, .pid = pid };
+    struct capture_state *st, fresh = {};
+    char head[16] = {};
+    u32 size = len > MAX_BUF_SIZE ? MAX_BUF_SIZE : len;
+
+    *stp = NULL;
+    *body = false;
+    if (capture_cap[rw & 1] && size > capture_cap[rw & 1])
+        size = capture_cap[rw & 1];
+    if (!capture_msg_head && !capture_conn_rate)
+        return size;
+
+    st = bpf_map_lookup_elem(&ssl_capture, &key);
+    if (!st) {
+        fresh.rw = -1;
+        bpf_map_update_elem(&ssl_capture, &key, &fresh, BPF_ANY);
+        st = bpf_map_lookup_elem(&ssl_capture, &key);
+        if (!st)
+            return size;
+    }
+    *stp = st;
+
+    if (capture_msg_head) {
+        bpf_probe_read_user(head, sizeof(head), (void *)buf);
+        if (rw != st->rw || http_start_line(head)) {
+            /* headers are in the call that opens the message */
+            st->msg_budget = capture_msg_head;
+        } else if (!sse_frame(head)) {
+            if (size > st->msg_budget)
+                size = st->msg_budget;
+            *body = true;
+        }
+        st->rw = rw;
+    }
+
+    if (capture_conn_rate) {
+        if (ts - st->window_start >= CAPTURE_WINDOW_NS) {
+            st->window_start = ts;
+            st->window_bytes = 0;
+        }
+        if (st->window_bytes >= capture_conn_rate)
+            size = 0;
+        else if (size > capture_conn_rate - st->window_bytes)
+            size = capture_conn_rate - st->window_bytes;
+    }
+    return size;
+}
+
+/* Charge the @bytes of payload a record carried to its connection's budgets */
+static __always_inline void capture_charge(struct capture_state *st, bool body, u32 bytes)
+{
+    if (!st || !bytes)
+        return;
+    if (body)
+        st->msg_budget -= bytes < st->msg_budget ? bytes : st->msg_budget;
+    if (capture_conn_rate)
+        st->window_bytes += bytes;
+}
+
+/* Stage one SSL read/write in the scratch record and emit only the header plus
+ * the bytes actually copied, so small writes don't pin MAX_BUF_SIZE of ring. */
+static __always_inline int emit_ssl_data(u64 ts, u64 delta_ns, u32 pid, u32 tid,
+                                         u32 uid, int len, int rw, u64 buf, u64 ssl)
+{
+    u32 cpu = bpf_get_smp_processor_id();
+    struct probe_SSL_data_t *data = bpf_map_lookup_elem(&ssl_scratch, &cpu);
+    void *ring = ssl_ring();
+    if (!data || !ring)
+        return 0;
+
+    data->timestamp_ns = ts;
+    data->delta_ns = delta_ns;
+    data->pid = pid;
+    data->tid = tid;
+    data->uid = uid;
+    data->len = (u32)len;
+    data->rw = rw;
+    data->is_handshake = false;
+    data->ssl = ssl;
+    data->fd = ssl_fd(pid, ssl);
+    bpf_get_current_comm(&data->comm, sizeof(data->comm));
+
+    /* Explicit bounds clamping to satisfy eBPF verifier
+     * Use bitmask first to ensure value range, then clamp to actual max */
+    struct capture_state *st;
+    bool body;
+    u32 buf_copy_size = capture_size(ts, pid, ssl, rw, buf, len, &st, &body) & 0xFFFFF;  /* Mask to 20 bits (1MB-1) */
+    if (buf_copy_size > MAX_BUF_SIZE)
+        buf_copy_size = MAX_BUF_SIZE;
+
+    /* A process over its byte rate loses whole records, before the copy */
+    if (!rate_limit_allow(&rate_buckets, pid, RATE_CLASS_SSL_BYTES, buf_copy_size,
+                          rate_limit[RATE_CLASS_SSL_BYTES], ts, &data->suppressed))
+        return 0;
+
+    u32 payload = 0;
+    if (buf_copy_size && !bpf_probe_read_user(&data->buf, buf_copy_size, (char *)buf))
+        payload = buf_copy_size;
+
+    data->buf_filled = payload ? 1 : 0;
+    data->buf_size = payload;
+
+    if (bpf_ringbuf_output(ring, data, SSL_DATA_HDR_SIZE + payload, ringbuf_wakeup_flags(ring))) {
+        stats_drop(&rb_stats, ring, rw);
+        return 0;
+    }
+    stats_submit(&rb_stats, ring, rw, SSL_DATA_HDR_SIZE + payload);
+    /* only bytes that reached the ring use up the body and window budgets */
+    capture_charge(st, body, payload);
+    return 0;
+}
+
 SEC("uprobe/do_handshake")
 int BPF_UPROBE(probe_SSL_rw_enter, void *ssl, void *buf, int num) {
     u64 pid_tgid = bpf_get_current_pid_tgid();
@@ -77,83 +422,58 @@ int BPF_UPROBE(probe_SSL_rw_enter, void *ssl, void *buf, int num) {
     }
 
     /* store arg info for later lookup */
-    bpf_map_update_elem(&bufs, &tid, &buf, BPF_ANY);
-    bpf_map_update_elem(&start_ns, &tid, &ts, BPF_ANY);
+    ssl_call_enter(tid, ts, ssl, buf, NULL);
     return 0;
 }
 
-static int SSL_exit(struct pt_regs *ctx, int rw) {
-    int ret = 0;
+/* The filters ran at entry: a call is only in flight if they let it through */
+static __always_inline int SSL_exit(struct pt_regs *ctx, int rw, bool ex) {
     u64 pid_tgid = bpf_get_current_pid_tgid();
     u32 pid = pid_tgid >> 32;
     u32 tid = (u32)pid_tgid;
-    u32 uid = bpf_get_current_uid_gid();
     u64 ts = bpf_ktime_get_ns();
+    struct ssl_call call;
+    int len = PT_REGS_RC(ctx);
 
-    if (!trace_allowed(uid, pid)) {
+    if (!ssl_call_take(tid, &call))
         return 0;
-    }
 
-    /* store arg info for later lookup */
-    u64 *bufp = bpf_map_lookup_elem(&bufs, &tid);
-    if (bufp == 0)
-        return 0;
+    /* SSL_read_ex/SSL_write_ex return 1 and store the byte count */
+    if (ex) {
+        size_t done = 0;
 
-    u64 *tsp = bpf_map_lookup_elem(&start_ns, &tid);
-    if (!tsp)
-        return 0;
-    u64 delta_ns = ts - *tsp;
+        if (len != 1 || bpf_probe_read_user(&done, sizeof(done), (void *)call.readbytes))
+            return 0;
+        len = done;
+    }
 
-    int len = PT_REGS_RC(ctx);
     if (len <= 0)  // no data
         return 0;
 
-    /* reserve space in ring buffer */
-    struct probe_SSL_data_t *data = bpf_ringbuf_reserve(&rb, sizeof(*data), 0);
-    if (!data)
-        return 0;
+    if (histogram_only) {
+        struct capture_key key = { .ssl = call.ssl, .pid = pid };
+        u64 *done_ns;
 
-    data->timestamp_ns = ts;
-    data->delta_ns = delta_ns;
-    data->pid = pid;
-    data->tid = tid;
-    data->uid = uid;
-    data->len = (u32)len;
-    data->buf_filled = 0;
-    data->buf_size = 0;
-    data->rw = rw;
-    data->is_handshake = false;
-    u32 buf_copy_size = min((size_t)MAX_BUF_SIZE, (size_t)len);
-
-    bpf_get_current_comm(&data->comm, sizeof(data->comm));
-
-    if (bufp != 0)
-        ret = bpf_probe_read_user(&data->buf, buf_copy_size, (char *)*bufp);
-
-    bpf_map_delete_elem(&bufs, &tid);
-    bpf_map_delete_elem(&start_ns, &tid);
-
-    if (!ret) {
-        data->buf_filled = 1;
-        data->buf_size = buf_copy_size;
-    } else {
-        data->buf_filled = 0;
-        data->buf_size = 0;
+        if (rw == 0 && (done_ns = bpf_map_lookup_elem(&ssl_handshake_done, &key))) {
+            hist_add(&latency_hist, HIST_SSL_FIRST_READ, ts - *done_ns);
+            bpf_map_delete_elem(&ssl_handshake_done, &key);
+        }
+        hist_add(&latency_hist, rw ? HIST_SSL_WRITE : HIST_SSL_READ, ts - call.start_ns);
+        return 0;
     }
 
-    /* submit to ring buffer */
-    bpf_ringbuf_submit(data, 0);
-    return 0;
+    return emit_ssl_data(ts, ts - call.start_ns, pid, tid, bpf_get_current_uid_gid(), len, rw,
+                         call.buf, call.ssl);
 }
 
 SEC("uretprobe/SSL_read")
 int BPF_URETPROBE(probe_SSL_read_exit) {
-    return (SSL_exit(ctx, 0));
+    return (SSL_exit(ctx, 0, false));
 }
 
 SEC("uretprobe/SSL_write")
 int BPF_URETPROBE(probe_SSL_write_exit) {
-    return (SSL_exit(ctx, 1));
+    return (SSL_exit(ctx, 1, false));
 }
 
 SEC("uprobe/SSL_write_ex")
@@ -168,11 +488,7 @@ int BPF_UPROBE(probe_SSL_write_ex_enter, void *ssl, void *buf, size_t num, size_
         return 0;
     }
 
-    bpf_map_update_elem(&bufs, &tid, &buf, BPF_ANY);
-    bpf_map_update_elem(&start_ns, &tid, &ts, BPF_ANY); 
-    
-    bpf_map_update_elem(&readbytes_ptrs, &tid, &readbytes, BPF_ANY);
-
+    ssl_call_enter(tid, ts, ssl, buf, readbytes);
     return 0;
 }
 
@@ -188,117 +504,20 @@ int BPF_UPROBE(probe_SSL_read_ex_enter, void *ssl, void *buf, size_t num, size_t
         return 0;
     }
 
-    bpf_map_update_elem(&bufs, &tid, &buf, BPF_ANY);
-    bpf_map_update_elem(&start_ns, &tid, &ts, BPF_ANY); 
-
-    bpf_map_update_elem(&readbytes_ptrs, &tid, &readbytes, BPF_ANY);
-
-    return 0;
-}
-
-static int ex_SSL_exit(struct pt_regs *ctx, int rw, int len) {
-    int ret = 0;
-    u64 pid_tgid = bpf_get_current_pid_tgid();
-    u32 pid = pid_tgid >> 32;
-    u32 tid = (u32)pid_tgid;
-    u32 uid = bpf_get_current_uid_gid();
-    u64 ts = bpf_ktime_get_ns();
-
-    if (!trace_allowed(uid, pid)) {
-        return 0;
-    }
-
-    /* store arg info for later lookup */
-    u64 *bufp = bpf_map_lookup_elem(&bufs, &tid);
-    if (bufp == 0)
-        return 0;
-
-    u64 *tsp = bpf_map_lookup_elem(&start_ns, &tid);
-    if (!tsp)
-        return 0;
-    u64 delta_ns = ts - *tsp;
-
-    if (len <= 0)  // no data
-        return 0;
-
-    /* reserve space in ring buffer */
-    struct probe_SSL_data_t *data = bpf_ringbuf_reserve(&rb, sizeof(*data), 0);
-    if (!data)
-        return 0;
-
-    data->timestamp_ns = ts;
-    data->delta_ns = delta_ns;
-    data->pid = pid;
-    data->tid = tid;
-    data->uid = uid;
-    data->len = (u32)len;
-    data->buf_filled = 0;
-    data->buf_size = 0;
-    data->rw = rw;
-    data->is_handshake = false;
-    
-    /* Explicit bounds clamping to satisfy eBPF verifier
-     * Use bitmask first to ensure value range, then clamp to actual max */
-    u32 buf_copy_size = (u32)len & 0xFFFFF;  /* Mask to 20 bits (1MB-1) */
-    if (buf_copy_size > MAX_BUF_SIZE)
-        buf_copy_size = MAX_BUF_SIZE;
-
-    bpf_get_current_comm(&data->comm, sizeof(data->comm));
-
-    if (bufp != 0)
-        ret = bpf_probe_read_user(&data->buf, buf_copy_size, (char *)*bufp);
-
-    bpf_map_delete_elem(&bufs, &tid);
-    bpf_map_delete_elem(&start_ns, &tid);
-
-    if (!ret) {
-        data->buf_filled = 1;
-        data->buf_size = buf_copy_size;
-    } else {
-        data->buf_filled = 0;
-        data->buf_size = 0;
-    }
-
-    /* submit to ring buffer */
-    bpf_ringbuf_submit(data, 0);
-    
+    ssl_call_enter(tid, ts, ssl, buf, readbytes);
     return 0;
 }
 
 SEC("uretprobe/SSL_write_ex")
 int BPF_URETPROBE(probe_SSL_write_ex_exit)
 {
-    u32 tid = (u32)bpf_get_current_pid_tgid();
-    size_t **readbytes_ptr = bpf_map_lookup_elem(&readbytes_ptrs, &tid);
-    if (!readbytes_ptr)
-        return 0;
-
-    size_t written = 0;
-    bpf_probe_read_user(&written, sizeof(written), *readbytes_ptr);
-    bpf_map_delete_elem(&readbytes_ptrs, &tid);
-
-    int ret = PT_REGS_RC(ctx);
-    int len = (ret == 1) ? written : 0;
-
-    return ex_SSL_exit(ctx, 1, len);
+    return SSL_exit(ctx, 1, true);
 }
 
 SEC("uretprobe/SSL_read_ex")
 int BPF_URETPROBE(probe_SSL_read_ex_exit)
 {
-    u32 tid = (u32)bpf_get_current_pid_tgid();
-    size_t **readbytes_ptr = bpf_map_lookup_elem(&readbytes_ptrs, &tid);
-    if (!readbytes_ptr)
-        return 0;
-
-    size_t written = 0;
-    bpf_probe_read_user(&written, sizeof(written), *readbytes_ptr);
-    bpf_map_delete_elem(&readbytes_ptrs, &tid);
-
-    int ret = PT_REGS_RC(ctx);
-    int len = (ret == 1) ? written : 0;
-
-    return ex_SSL_exit(ctx, 0, len);
+    return SSL_exit(ctx, 0, true);
 }
 
 SEC("uprobe/do_handshake")
@@ -314,7 +533,7 @@ int BPF_UPROBE(probe_SSL_do_handshake_enter, void *ssl) {
     }
 
     /* store arg info for later lookup */
-    bpf_map_update_elem(&start_ns, &tid, &ts, BPF_ANY);
+    ssl_call_enter(tid, ts, ssl, NULL, NULL);
     return 0;
 }
 
@@ -323,46 +542,94 @@ int BPF_URETPROBE(probe_SSL_do_handshake_exit) {
     u64 pid_tgid = bpf_get_current_pid_tgid();
     u32 pid = pid_tgid >> 32;
     u32 tid = (u32)pid_tgid;
-    u32 uid = bpf_get_current_uid_gid();
     u64 ts = bpf_ktime_get_ns();
+    struct ssl_call call;
     int ret = 0;
 
-    /* use kernel terminology here for tgid/pid: */
-    u32 tgid = pid_tgid >> 32;
+    if (!ssl_call_take(tid, &call))
+        return 0;
 
-    /* store arg info for later lookup */
-    if (!trace_allowed(tgid, pid)) {
+    ret = PT_REGS_RC(ctx);
+    if (ret <= 0)  // handshake failed
         return 0;
-    }
 
-    u64 *tsp = bpf_map_lookup_elem(&start_ns, &tid);
-    if (tsp == 0)
+    if (histogram_only) {
+        struct capture_key key = { .ssl = call.ssl, .pid = pid };
+
+        hist_add(&latency_hist, HIST_SSL_HANDSHAKE, ts - call.start_ns);
+        bpf_map_update_elem(&ssl_handshake_done, &key, &ts, BPF_ANY);
         return 0;
+    }
 
-    ret = PT_REGS_RC(ctx);
-    if (ret <= 0)  // handshake failed
+    void *ring = ssl_ring();
+    if (!ring)
         return 0;
 
-    /* reserve space in ring buffer */
-    struct probe_SSL_data_t *data = bpf_ringbuf_reserve(&rb, sizeof(*data), 0);
-    if (!data)
+    /* handshake records carry no payload, reserve the header only */
+    struct probe_SSL_data_t *data = bpf_ringbuf_reserve(ring, SSL_DATA_HDR_SIZE, 0);
+    if (!data) {
+        stats_drop(&rb_stats, ring, SSL_PROBE_HANDSHAKE);
         return 0;
+    }
 
     data->timestamp_ns = ts;
-    data->delta_ns = ts - *tsp;
+    data->delta_ns = ts - call.start_ns;
     data->pid = pid;
     data->tid = tid;
-    data->uid = uid;
+    data->uid = bpf_get_current_uid_gid();
     data->len = ret;
     data->buf_filled = 0;
     data->buf_size = 0;
     data->rw = 2;
     data->is_handshake = true;
+    data->ssl = call.ssl;
+    data->fd = ssl_fd(pid, call.ssl);
+    data->suppressed = 0;
     bpf_get_current_comm(&data->comm, sizeof(data->comm));
-    bpf_map_delete_elem(&start_ns, &tid);
 
     /* submit to ring buffer */
-    bpf_ringbuf_submit(data, 0);
+    bpf_ringbuf_submit(data, ringbuf_wakeup_flags(ring));
+    stats_submit(&rb_stats, ring, SSL_PROBE_HANDSHAKE, SSL_DATA_HDR_SIZE);
+    return 0;
+}
+
+/* OpenSSL only: remember which socket an SSL* talks to */
+SEC("uprobe/SSL_set_fd")
+int BPF_UPROBE(probe_SSL_set_fd_enter, void *ssl, int fd) {
+    u32 pid = bpf_get_current_pid_tgid() >> 32;
+    struct capture_key key = { .ssl = (u64)ssl, .pid = pid };
+
+    if (!trace_allowed(bpf_get_current_uid_gid(), pid))
+        return 0;
+    bpf_map_update_elem(&ssl_fds, &key, &fd, BPF_ANY);
+    return 0;
+}
+
+/* A freed SSL* can come back from malloc for another connection */
+SEC("uprobe/SSL_free")
+int BPF_UPROBE(probe_SSL_free_enter, void *ssl) {
+    struct capture_key ckey = { .ssl = (u64)ssl, .pid = bpf_get_current_pid_tgid() >> 32 };
+
+    bpf_map_delete_elem(&ssl_fds, &ckey);
+    bpf_map_delete_elem(&ssl_capture, &ckey);
+    if (histogram_only)
+        bpf_map_delete_elem(&ssl_handshake_done, &ckey);
+    return 0;
+}
+
+/* Attach manager: hand the PID over, its maps are read later from /proc */
+SEC("tp/sched/sched_process_exec")
+int handle_exec(struct trace_event_raw_sched_process_exec *ctx) {
+    u32 pid = bpf_get_current_pid_tgid() >> 32;
+    u32 *e;
+
+    if (!trace_allowed(bpf_get_current_uid_gid(), pid))
+        return 0;
+    e = bpf_ringbuf_reserve(&exec_rb, sizeof(*e), 0);
+    if (!e)
+        return 0;
+    *e = pid;
+    bpf_ringbuf_submit(e, 0);
     return 0;
 }
 
@@ -3,60 +3,52 @@
 //
 // Based on sslsniff from BCC by Adrian Lopez & Mark Drayton.
 // 15-Aug-2023   Yusheng Zheng   Created this.
+#define _GNU_SOURCE
 #include <argp.h>
 #include <bpf/bpf.h>
 #include <bpf/libbpf.h>
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <sys/eventfd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
-#include <locale.h>
-#include <wchar.h>
 #include <string.h>
 
 #include "sslsniff.skel.h"
 #include "sslsniff.h"
+#include "stats.h"
+#include "rate_limit.h"
+#include "tracked_pids.h"
+#include "pin_dir.h"
+#include "json_writer.h"
+#include "binary_format.h"
+#include "output_transport.h"
+#include "ring_merge.h"
+#include "event_loop.h"
+#include "tracer.h"
+#include "ssl_stream.h"
+#include "ssl_attach.h"
 
 #define INVALID_UID -1
 #define INVALID_PID -1
 #define DEFAULT_BUFFER_SIZE 8192
+#define DEFAULT_MERGE_WINDOW_MS 10
 
-#define __ATTACH_UPROBE(skel, binary_path, sym_name, prog_name, is_retprobe)   \
-	do {                                                                       \
-	  LIBBPF_OPTS(bpf_uprobe_opts, uprobe_opts, .func_name = #sym_name,        \
-				  .retprobe = is_retprobe);                                    \
-	  skel->links.prog_name = bpf_program__attach_uprobe_opts(                 \
-		  skel->progs.prog_name, env.pid, binary_path, 0, &uprobe_opts);       \
-	} while (false)
-
-#define __CHECK_PROGRAM(skel, prog_name)               \
-	do {                                               \
-	  if (!skel->links.prog_name) {                    \
-		perror("no program attached for " #prog_name); \
-		return -errno;                                 \
-	  }                                                \
-	} while (false)
-
-#define __ATTACH_UPROBE_CHECKED(skel, binary_path, sym_name, prog_name,     \
-								is_retprobe)                                \
-	do {                                                                    \
-	  __ATTACH_UPROBE(skel, binary_path, sym_name, prog_name, is_retprobe); \
-	  __CHECK_PROGRAM(skel, prog_name);                                     \
-	} while (false)
-
-#define ATTACH_UPROBE_CHECKED(skel, binary_path, sym_name, prog_name)     \
-	__ATTACH_UPROBE_CHECKED(skel, binary_path, sym_name, prog_name, false)
-#define ATTACH_URETPROBE_CHECKED(skel, binary_path, sym_name, prog_name)  \
-	__ATTACH_UPROBE_CHECKED(skel, binary_path, sym_name, prog_name, true)
-
-volatile sig_atomic_t exiting = 0;
+#define warn(...) fprintf(stderr, __VA_ARGS__)
+
+// Set by the main thread when it stops, polled by the ring consumers
+static volatile bool exiting = false;
 
+#ifndef TRACER_LIBRARY
 const char *argp_program_version = "sslsniff 0.1";
 const char *argp_program_bug_address = "https://github.com/iovisor/bcc/tree/master/libbpf-tools";
-const char argp_program_doc[] =
+#endif
+static const char argp_program_doc[] =
 	"Sniff SSL data and output in JSON format.\n"
 	"\n"
 	"USAGE: sslsniff [OPTIONS]\n"
@@ -67,23 +59,56 @@ const char argp_program_doc[] =
 	"EXAMPLES:\n"
 	"    ./sslsniff              # sniff OpenSSL and GnuTLS functions\n"
 	"    ./sslsniff -p 181       # sniff PID 181 only\n"
+	"    ./sslsniff -p 181,182   # sniff PIDs 181 and 182 only\n"
 	"    ./sslsniff -u 1000      # sniff only UID 1000\n"
 	"    ./sslsniff -c curl      # sniff curl command only\n"
+	"    ./sslsniff -c curl,node # sniff curl and node commands only\n"
 	"    ./sslsniff --no-openssl # don't show OpenSSL calls\n"
 	"    ./sslsniff --no-gnutls  # don't show GnuTLS calls\n"
 	"    ./sslsniff --no-nss     # don't show NSS calls\n"
 	"    ./sslsniff --handshake # show handshake events\n"
+	"    ./sslsniff --stats-interval 10 # print ring buffer STATS every 10s\n"
+	"    ./sslsniff --self-stats # add probe run time and SSL call latency to STATS\n"
+	"    ./sslsniff --histogram=60 # SSL call latency distributions per command every 60s, no data\n"
+	"    ./sslsniff --ring-cpus 8 # one ring buffer and consumer thread per 8 CPUs\n"
+	"    ./sslsniff --no-auto-attach # only the system libraries and --binary-path\n"
+	"    ./sslsniff --follow-tracked # sniff the process tree tracked by process --pin-tracked\n"
+	"    ./sslsniff --pin-dir    # restart without reloading or reattaching the probes\n"
+	"    ./sslsniff --intern-strings --format binary # each comm once, then by id\n"
 	"    ./sslsniff --binary-path ~/.nvm/versions/node/v20.0.0/bin/node # attach to Node.js binary\n";
 
-struct env {
+static struct env {
 	pid_t pid;
+	pid_t pids[MAX_FILTER_PIDS];
+	int pid_count;
 	int uid;
-	char *comm;
+	char *comms[MAX_FILTER_COMMS];
+	int comm_count;
 	bool openssl;
 	bool gnutls;
 	bool nss;
 	bool handshake;
 	char *extra_lib;
+	unsigned int stats_interval;
+	const char *follow_tracked;
+	unsigned int flush_ms;
+	enum output_format format;
+	const char *output_socket;
+	const char *output_dir;
+	unsigned int ring_cpus;
+	unsigned int merge_window_ms;
+	unsigned int wakeup_batch_kb;
+	bool reassemble;
+	unsigned int capture_cap[2];
+	unsigned int capture_head;
+	unsigned int capture_rate;
+	unsigned int process_rate_kb;
+	bool auto_attach;
+	const char *pin_dir;  // --pin-dir, NULL = load every run
+	bool self_stats;
+	bool no_uprobe_multi;
+	unsigned int histogram_interval;  // --histogram, 0 = off
+	unsigned int intern_strings;  // --intern-strings table size, 0 = off
 } env = {
 	.uid = INVALID_UID,
 	.pid = INVALID_PID,
@@ -91,36 +116,102 @@ struct env {
 	.gnutls = false,
 	.nss = false,
 	.handshake = false,
-	.comm = NULL,
+	.auto_attach = true,
+	.merge_window_ms = DEFAULT_MERGE_WINDOW_MS,
 };
 
 #define EXTRA_LIB_KEY 1003
+#define STATS_INTERVAL_KEY 1004
+#define FOLLOW_TRACKED_KEY 1005
+#define FLUSH_MS_KEY 1006
+#define FORMAT_KEY 1007
+#define OUTPUT_SOCKET_KEY 1008
+#define RING_CPUS_KEY 1009
+#define MERGE_WINDOW_MS_KEY 1010
+#define WAKEUP_BATCH_KEY 1011
+#define REASSEMBLE_KEY 1012
+#define CAPTURE_READ_KEY 1013
+#define CAPTURE_WRITE_KEY 1014
+#define CAPTURE_HEAD_KEY 1015
+#define CAPTURE_RATE_KEY 1016
+#define NO_AUTO_ATTACH_KEY 1017
+#define SELF_STATS_KEY 1018
+#define NO_UPROBE_MULTI_KEY 1019
+#define HISTOGRAM_KEY 1020
+#define PROCESS_RATE_KEY 1021
+#define PIN_DIR_KEY 1022
+#define INTERN_STRINGS_KEY 1023
+#define OUTPUT_DIR_KEY 1024
+
+// STATS interval --self-stats uses unless --stats-interval is given
+#define SELF_STATS_DEFAULT_INTERVAL 10
+
+// HISTOGRAM interval of a bare --histogram
+#define HISTOGRAM_DEFAULT_INTERVAL 10
 
 static const struct argp_option opts[] = {
-	{"pid", 'p', "PID", 0, "Sniff this PID only."},
+	{"pid", 'p', "PID[,PID...]", 0, "Sniff these PIDs only."},
 	{"uid", 'u', "UID", 0, "Sniff this UID only."},
-	{"comm", 'c', "COMMAND", 0, "Sniff only commands matching string."},
+	{"comm", 'c', "COMMAND[,COMMAND...]", 0, "Sniff only these commands (exact comm match)."},
 	{"no-openssl", 'o', NULL, 0, "Do not show OpenSSL calls."},
 	{"no-gnutls", 'g', NULL, 0, "Do not show GnuTLS calls."},
 	{"no-nss", 'n', NULL, 0, "Do not show NSS calls."},
 	{"handshake", 'h', NULL, 0, "Show handshake events."},
 	{"verbose", 'v', NULL, 0, "Verbose debug output"},
+	{"no-auto-attach", NO_AUTO_ATTACH_KEY, NULL, 0, "Only attach to the system libraries and --binary-path, not to TLS libraries found in running and new processes."},
+	{"no-uprobe-multi", NO_UPROBE_MULTI_KEY, NULL, 0, "Attach one uprobe per symbol even where the kernel has uprobe_multi links."},
 	{"binary-path", EXTRA_LIB_KEY, "PATH", 0, "Attach to specific binary (e.g., ~/.nvm/versions/node/v20.0.0/bin/node)."},
+	{"stats-interval", STATS_INTERVAL_KEY, "SECONDS", 0, "Print ring buffer STATS every SECONDS (0 = off)."},
+	{"self-stats", SELF_STATS_KEY, NULL, 0, "Add BPF program run time, userspace stage timings and SSL call latency to STATS (every 10s unless --stats-interval is set)."},
+	{"histogram", HISTOGRAM_KEY, "SECONDS", OPTION_ARG_OPTIONAL, "Only aggregate SSL read/write/handshake latencies per command in the kernel and print HISTOGRAM lines every SECONDS (default 10), no data is captured."},
+	{"format", FORMAT_KEY, "FORMAT", 0, "Output format: json (default) or binary (length prefixed records for the collector)."},
+	{"output-socket", OUTPUT_SOCKET_KEY, "PATH", 0, "Write output to the unix socket at PATH instead of stdout, dropping records rather than blocking when the reader falls behind."},
+	{"output-dir", OUTPUT_DIR_KEY, "DIR", 0, "Write output to compressed segment files in DIR with an index.jsonl of their time and pid ranges instead of stdout."},
+	{"ring-cpus", RING_CPUS_KEY, "N", 0, "Give every N CPUs their own ring buffer and consumer thread (default 0 = one shared ring)."},
+	{"merge-window-ms", MERGE_WINDOW_MS_KEY, "MS", 0, "With --ring-cpus, hold records up to MS ms to put the rings back in timestamp order (default 10)."},
+	{"wakeup-batch", WAKEUP_BATCH_KEY, "KB", 0, "Wake up only once KB of records wait in a ring buffer, collecting the rest every 10ms (default 0 = wake on every record)."},
+	{"reassemble", REASSEMBLE_KEY, NULL, 0, "Join each connection's chunks into whole HTTP messages and SSE events."},
+	{"capture-read", CAPTURE_READ_KEY, "BYTES", 0, "Copy at most BYTES of each read (default 0 = up to the 512KB record limit)."},
+	{"capture-write", CAPTURE_WRITE_KEY, "BYTES", 0, "Copy at most BYTES of each write (default 0 = up to the 512KB record limit)."},
+	{"capture-head", CAPTURE_HEAD_KEY, "BYTES", 0, "Copy only the first BYTES of each HTTP message body; headers and SSE events are kept whole (default 0 = off)."},
+	{"capture-rate", CAPTURE_RATE_KEY, "BYTES", 0, "Copy at most BYTES per connection per second (default 0 = off)."},
+	{"process-rate", PROCESS_RATE_KEY, "KB", 0, "Send at most KB of plaintext per process per second, dropping and counting whole records past it (default 0 = off)."},
+	{"flush-ms", FLUSH_MS_KEY, "MS", 0, "Buffer JSON output for up to MS ms (default 0 = flush after every poll batch)."},
+	{"follow-tracked", FOLLOW_TRACKED_KEY, "PATH", OPTION_ARG_OPTIONAL,
+	 "Sniff only PIDs in the tracked PID map pinned by process (default " TRACKED_PIDS_PIN_PATH ")."},
+	{"pin-dir", PIN_DIR_KEY, "DIR", OPTION_ARG_OPTIONAL,
+	 "Leave programs, links and maps pinned under DIR (default " PIN_DIR_ROOT "/sslsniff) and take them over on the next start instead of reloading and reattaching. Needs uprobe_multi links (Linux 6.6+)."},
+	{"intern-strings", INTERN_STRINGS_KEY, "N", OPTION_ARG_OPTIONAL,
+	 "Write each comm once as a STRING_DEF and refer to it by id, remembering the last N (default 4096). Not with --ring-cpus."},
 	{},
 };
 
 static bool verbose = false;
 
 static error_t parse_arg(int key, char *arg, struct argp_state *state) {
+	char *token, *saveptr;
+
 	switch (key) {
 	case 'p':
-		env.pid = atoi(arg);
+		for (token = strtok_r(arg, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr)) {
+			if (env.pid_count >= MAX_FILTER_PIDS) {
+				warn("too many PIDs, max %d\n", MAX_FILTER_PIDS);
+				argp_usage(state);
+			}
+			env.pids[env.pid_count++] = atoi(token);
+		}
 		break;
 	case 'u':
 		env.uid = atoi(arg);
 		break;
 	case 'c':
-		env.comm = strdup(arg);
+		for (token = strtok_r(arg, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr)) {
+			if (env.comm_count >= MAX_FILTER_COMMS) {
+				warn("too many commands, max %d\n", MAX_FILTER_COMMS);
+				argp_usage(state);
+			}
+			env.comms[env.comm_count++] = strdup(token);
+		}
 		break;
 	case 'o':
 		env.openssl = false;
@@ -137,9 +228,89 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
 	case 'v':
 		verbose = true;
 		break;
+	case NO_AUTO_ATTACH_KEY:
+		env.auto_attach = false;
+		break;
+	case SELF_STATS_KEY:
+		env.self_stats = true;
+		break;
+	case NO_UPROBE_MULTI_KEY:
+		env.no_uprobe_multi = true;
+		break;
+	case HISTOGRAM_KEY:
+		env.histogram_interval = arg ? atoi(arg) : HISTOGRAM_DEFAULT_INTERVAL;
+		if ((int)env.histogram_interval <= 0) {
+			warn("invalid histogram interval: %s\n", arg);
+			argp_usage(state);
+		}
+		break;
 	case EXTRA_LIB_KEY:
 		env.extra_lib = strdup(arg);
 		break;
+	case STATS_INTERVAL_KEY:
+		env.stats_interval = atoi(arg);
+		break;
+	case FORMAT_KEY:
+		if (output_format_parse(arg) < 0) {
+			warn("invalid format: %s\n", arg);
+			argp_usage(state);
+		}
+		env.format = output_format_parse(arg);
+		break;
+	case OUTPUT_SOCKET_KEY:
+		env.output_socket = arg;
+		break;
+	case OUTPUT_DIR_KEY:
+		env.output_dir = arg;
+		break;
+	case FLUSH_MS_KEY:
+		env.flush_ms = atoi(arg);
+		break;
+	case RING_CPUS_KEY:
+		env.ring_cpus = atoi(arg);
+		break;
+	case MERGE_WINDOW_MS_KEY:
+		env.merge_window_ms = atoi(arg);
+		break;
+	case WAKEUP_BATCH_KEY:
+		env.wakeup_batch_kb = atoi(arg);
+		break;
+	case REASSEMBLE_KEY:
+		env.reassemble = true;
+		break;
+	case CAPTURE_READ_KEY:
+		env.capture_cap[0] = atoi(arg);
+		break;
+	case CAPTURE_WRITE_KEY:
+		env.capture_cap[1] = atoi(arg);
+		break;
+	case CAPTURE_HEAD_KEY:
+		env.capture_head = atoi(arg);
+		break;
+	case CAPTURE_RATE_KEY:
+		env.capture_rate = atoi(arg);
+		break;
+	case PROCESS_RATE_KEY:
+		env.process_rate_kb = atoi(arg);
+		if ((int)env.process_rate_kb < 0 ||
+		    env.process_rate_kb > RATE_LIMIT_MAX_RATE / 1024) {
+			warn("invalid process rate: %s\n", arg);
+			argp_usage(state);
+		}
+		break;
+	case FOLLOW_TRACKED_KEY:
+		env.follow_tracked = arg ? arg : TRACKED_PIDS_PIN_PATH;
+		break;
+	case PIN_DIR_KEY:
+		env.pin_dir = arg ? arg : PIN_DIR_ROOT "/sslsniff";
+		break;
+	case INTERN_STRINGS_KEY:
+		env.intern_strings = arg ? atoi(arg) : STRING_INTERN_DEFAULT_CAPACITY;
+		if ((int)env.intern_strings <= 0 || env.intern_strings > STRING_INTERN_MAX_CAPACITY) {
+			warn("invalid intern table size: %s\n", arg);
+			argp_usage(state);
+		}
+		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
@@ -147,7 +318,6 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
 }
 
 #define PERF_POLL_TIMEOUT_MS 100
-#define warn(...) fprintf(stderr, __VA_ARGS__)
 
 static struct argp argp = {
 	opts,
@@ -163,401 +333,1217 @@ static int libbpf_print_fn(enum libbpf_print_level level, const char *format,
 	return vfprintf(stderr, format, args);
 }
 
-/* handle_lost_events removed - ring buffer doesn't have lost events like perf buffer */
+/* Ring buffer drops are counted in-kernel per probe, see stats.h */
+static const char *const ssl_probe_names[SSL_PROBE_MAX] = {
+	[SSL_PROBE_READ] = "READ/RECV",
+	[SSL_PROBE_WRITE] = "WRITE/SEND",
+	[SSL_PROBE_HANDSHAKE] = "HANDSHAKE",
+};
+
+static struct stats_reporter stats;
 
-static void sig_int(int signo) { 
-	exiting = 1;
-}
+// --histogram latencies, see histogram.h
+static struct hist_reporter hist;
 
-int attach_openssl(struct sslsniff_bpf *skel, const char *lib) {
-	ATTACH_UPROBE_CHECKED(skel, lib, SSL_write, probe_SSL_rw_enter);
-	ATTACH_URETPROBE_CHECKED(skel, lib, SSL_write, probe_SSL_write_exit);
-	ATTACH_UPROBE_CHECKED(skel, lib, SSL_read, probe_SSL_rw_enter);
-	ATTACH_URETPROBE_CHECKED(skel, lib, SSL_read, probe_SSL_read_exit);
+// --self-stats: latency of the SSL calls in the records, per direction
+struct ssl_latency {
+	__u64 calls;
+	__u64 ns;
+};
+static struct ssl_latency ssl_latency[2], ssl_latency_prev[2];
 
-	ATTACH_UPROBE_CHECKED(skel, lib, SSL_write_ex, probe_SSL_write_ex_enter);
-	ATTACH_URETPROBE_CHECKED(skel, lib, SSL_write_ex, probe_SSL_write_ex_exit);
-	ATTACH_UPROBE_CHECKED(skel, lib, SSL_read_ex, probe_SSL_read_ex_enter);
-	ATTACH_URETPROBE_CHECKED(skel, lib, SSL_read_ex, probe_SSL_read_ex_exit);
+// Programs run on every SSL_read/SSL_write; the uretprobes run once per call
+static const char *const ssl_rw_progs[] = {
+	"probe_SSL_rw_enter", "probe_SSL_read_ex_enter", "probe_SSL_write_ex_enter",
+	"probe_SSL_read_exit", "probe_SSL_write_exit", "probe_SSL_read_ex_exit",
+	"probe_SSL_write_ex_exit",
+};
+#define SSL_RW_FIRST_EXIT 3
 
-	ATTACH_UPROBE_CHECKED(skel, lib, SSL_do_handshake,
-							probe_SSL_do_handshake_enter);
-	ATTACH_URETPROBE_CHECKED(skel, lib, SSL_do_handshake,
-								probe_SSL_do_handshake_exit);
+// Set stats.self_fn: what the probes cost next to the calls they trace
+static void print_ssl_self_stats(struct stats_reporter *r, struct json_writer *w, void *ctx) {
+	static const char *const dirs[] = { "read", "write" };
+	__u64 probe_calls = 0, probe_ns = 0, calls = 0, ns = 0;
 
-	return 0;
+	for (size_t i = 0; i < sizeof(ssl_rw_progs) / sizeof(ssl_rw_progs[0]); i++) {
+		__u64 cnt, t;
+
+		if (!stats_program_delta(r, ssl_rw_progs[i], &cnt, &t))
+			continue;
+		probe_ns += t;
+		if (i >= SSL_RW_FIRST_EXIT)
+			probe_calls += cnt;
+	}
+
+	jw_key(w, "ssl_latency");
+	jw_object_begin(w);
+	for (int d = 0; d < 2; d++) {
+		struct ssl_latency cur = {
+			.calls = __atomic_load_n(&ssl_latency[d].calls, __ATOMIC_RELAXED),
+			.ns = __atomic_load_n(&ssl_latency[d].ns, __ATOMIC_RELAXED),
+		};
+		__u64 dc = cur.calls - ssl_latency_prev[d].calls;
+		__u64 dn = cur.ns - ssl_latency_prev[d].ns;
+
+		jw_key(w, dirs[d]);
+		jw_object_begin(w);
+		jw_field_u64(w, "calls", dc);
+		jw_field_u64(w, "avg_ns", dc ? dn / dc : 0);
+		jw_object_end(w);
+		calls += dc;
+		ns += dn;
+		ssl_latency_prev[d] = cur;
+	}
+	jw_object_end(w);
+
+	// Probe time per traced call, and its share of what the call took
+	__u64 per_call = probe_calls ? probe_ns / probe_calls : 0;
+	jw_field_u64(w, "probe_ns_per_call", per_call);
+	jw_key(w, "probe_overhead_pct");
+	jw_printf(w, "%.2f", calls && ns ? 100.0 * per_call / ((double)ns / calls) : 0.0);
 }
 
-int attach_gnutls(struct sslsniff_bpf *skel, const char *lib) {
-	ATTACH_UPROBE_CHECKED(skel, lib, gnutls_record_send, probe_SSL_rw_enter);
-	ATTACH_URETPROBE_CHECKED(skel, lib, gnutls_record_send, probe_SSL_write_exit);
-	ATTACH_UPROBE_CHECKED(skel, lib, gnutls_record_recv, probe_SSL_rw_enter);
-	ATTACH_URETPROBE_CHECKED(skel, lib, gnutls_record_recv, probe_SSL_read_exit);
+// Buffered stdout, all JSON output goes through it
+static struct json_writer out;
 
-	return 0;
+// --intern-strings, see string_intern.h
+static struct string_intern strings;
+
+// The loaded tracer and the main thread's rings, see sslsniff_setup()
+static struct sslsniff_bpf *obj;
+static struct ring_buffer *rb, *exec_rb;
+
+// Under trace, where formatted records go instead of the output
+static struct ring_merge *sink;
+
+/* TLS libraries found so far, and the uprobe links on them */
+static struct ssl_attach attach;
+static struct bpf_link **links;
+static size_t nr_links;
+
+// uprobe_multi links (Linux 6.6+): one link per program and file for all
+// its offsets, instead of a perf event and a link per offset
+static bool multi_uprobes;
+
+/*
+ * --pin-dir, see pin_dir.h. Every file looked at is also kept in the pinned
+ * known_files map, so a run that takes over neither resolves nor attaches
+ * what the probes it inherited already cover.
+ */
+static struct pin_dir pins;
+static int known_files_fd = -1;
+
+#define KNOWN_FILES_MAX_ENTRIES 65536
+
+struct known_file {
+	__u64 dev;
+	__u64 ino;
+};
+
+/*
+ * The check libbpf does internally: a uprobe_multi link on "/" fails with
+ * -EBADF where the kernel has the attach type, -EINVAL where it does not.
+ */
+static bool probe_uprobe_multi(void) {
+	LIBBPF_OPTS(bpf_prog_load_opts, load_opts, .expected_attach_type = BPF_TRACE_UPROBE_MULTI);
+	LIBBPF_OPTS(bpf_link_create_opts, link_opts);
+	const struct bpf_insn insns[] = {
+		{ .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_0 },
+		{ .code = BPF_JMP | BPF_EXIT },
+	};
+	unsigned long offset = 0;
+	int prog_fd, link_fd, err;
+
+	prog_fd = bpf_prog_load(BPF_PROG_TYPE_KPROBE, NULL, "GPL", insns, 2, &load_opts);
+	if (prog_fd < 0)
+		return false;
+	link_opts.uprobe_multi.path = "/";
+	link_opts.uprobe_multi.offsets = &offset;
+	link_opts.uprobe_multi.cnt = 1;
+	link_fd = bpf_link_create(prog_fd, -1, BPF_TRACE_UPROBE_MULTI, &link_opts);
+	err = -errno;
+	if (link_fd >= 0)
+		close(link_fd);
+	close(prog_fd);
+	return link_fd < 0 && err == -EBADF;
 }
 
-int attach_nss(struct sslsniff_bpf *skel, const char *lib) {
-	ATTACH_UPROBE_CHECKED(skel, lib, PR_Write, probe_SSL_rw_enter);
-	ATTACH_URETPROBE_CHECKED(skel, lib, PR_Write, probe_SSL_write_exit);
-	ATTACH_UPROBE_CHECKED(skel, lib, PR_Send, probe_SSL_rw_enter);
-	ATTACH_URETPROBE_CHECKED(skel, lib, PR_Send, probe_SSL_write_exit);
-	ATTACH_UPROBE_CHECKED(skel, lib, PR_Read, probe_SSL_rw_enter);
-	ATTACH_URETPROBE_CHECKED(skel, lib, PR_Read, probe_SSL_read_exit);
-	ATTACH_UPROBE_CHECKED(skel, lib, PR_Recv, probe_SSL_rw_enter);
-	ATTACH_URETPROBE_CHECKED(skel, lib, PR_Recv, probe_SSL_read_exit);
+static int keep_link(struct bpf_link *link) {
+	struct bpf_link **grown;
 
+	if (!link)
+		return -errno;
+	grown = realloc(links, (nr_links + 1) * sizeof(*links));
+	if (!grown) {
+		bpf_link__destroy(link);
+		return -ENOMEM;
+	}
+	links = grown;
+	links[nr_links++] = link;
 	return 0;
 }
 
 /*
- * Find the path of a library using ldconfig.
+ * The probes for one file, gathered per program so each program attaches
+ * once with every offset it has there: one uprobe_multi link, or one uprobe
+ * per offset where the kernel lacks them.
  */
-char *find_library_path(const char *libname) {
-	char cmd[128];
-	static char path[512];
-	FILE *fp;
-
-	// Construct the ldconfig command with grep
-	snprintf(cmd, sizeof(cmd), "ldconfig -p | grep %s", libname);
-
-	// Execute the command and read the output
-	fp = popen(cmd, "r");
-	if (fp == NULL) {
-		perror("Failed to run ldconfig");
-		return NULL;
-	}
-
-	// Read the first line of output which should have the library path
-	if (fgets(path, sizeof(path) - 1, fp) != NULL) {
-		// Extract the path from the ldconfig output
-		char *start = strrchr(path, '>');
-		if (start && *(start + 1) == ' ') {
-			memmove(path, start + 2, strlen(start + 2) + 1);
-			char *end = strchr(path, '\n');
-			if (end) {
-				*end = '\0';  // Null-terminate the path
-			}
-			pclose(fp);
-			return path;
-		}
+struct probe_set {
+	struct {
+		struct bpf_program *prog;
+		bool retprobe;
+		bool required;     // failing to attach fails the file
+		size_t cnt;
+		unsigned long offsets[SSL_ATTACH_MAX_SYMS];
+	} progs[2 * SSL_ATTACH_MAX_SYMS];
+	size_t nr;
+};
+
+// Queue prog at file offset off; off 0 is a symbol the file lacks
+static int probe_add(struct probe_set *set, struct bpf_program *prog, size_t off, bool retprobe,
+		     bool required) {
+	size_t i;
+
+	if (!off)
+		return -ENOENT;
+	for (i = 0; i < set->nr && set->progs[i].prog != prog; i++)
+		;
+	if (i == set->nr) {
+		set->progs[set->nr].prog = prog;
+		set->progs[set->nr].retprobe = retprobe;
+		set->progs[set->nr].required = false;
+		set->progs[set->nr++].cnt = 0;
 	}
+	set->progs[i].required |= required;
+	// Symbols aliasing one address share its probe
+	for (size_t j = 0; j < set->progs[i].cnt; j++)
+		if (set->progs[i].offsets[j] == off)
+			return 0;
+	set->progs[i].offsets[set->progs[i].cnt++] = off;
+	return 0;
+}
 
-	pclose(fp);
-	return NULL;
+#define PROBE_PAIR(set, skel, off, enter, exit, required)                   \
+	(probe_add(set, skel->progs.enter, off, false, required) ?:        \
+	 probe_add(set, skel->progs.exit, off, true, required))
+
+// Under --pin-dir the links are pinned rather than kept, so they outlive us
+static int pin_uprobe_multi(struct bpf_program *prog, const char *path,
+			    const unsigned long *offsets, size_t cnt, bool retprobe) {
+	LIBBPF_OPTS(bpf_link_create_opts, opts);
+	int prog_fd = pin_dir_prog_fd(&pins, prog), fd, err;
+
+	if (prog_fd < 0)
+		return -ENOENT;
+	opts.uprobe_multi.path = path;
+	opts.uprobe_multi.offsets = offsets;
+	opts.uprobe_multi.cnt = cnt;
+	opts.uprobe_multi.flags = retprobe ? BPF_F_UPROBE_MULTI_RETURN : 0;
+	opts.uprobe_multi.pid = env.pid == INVALID_PID ? 0 : env.pid;
+	fd = bpf_link_create(prog_fd, -1, BPF_TRACE_UPROBE_MULTI, &opts);
+	if (fd < 0)
+		return -errno;
+	err = pin_dir_link(&pins, fd);
+	close(fd);
+	return err;
 }
 
-// Global buffer allocated once and reused
-static char *event_buf = NULL;
-
-// Function to validate UTF-8 sequence and return its length
-// Returns 0 if invalid, otherwise returns the number of bytes in the sequence
-int validate_utf8_char(const unsigned char *str, size_t remaining) {
-	if (!str || remaining == 0) return 0;
-	
-	unsigned char c = str[0];
-	
-	// ASCII character (0-127)
-	if (c < 0x80) return 1;
-	
-	// Determine the expected length of UTF-8 sequence
-	int expected_len = 0;
-	if ((c & 0xE0) == 0xC0) expected_len = 2;      // 110xxxxx
-	else if ((c & 0xF0) == 0xE0) expected_len = 3; // 1110xxxx
-	else if ((c & 0xF8) == 0xF0) expected_len = 4; // 11110xxx
-	else return 0; // Invalid start byte
-	
-	// Check if we have enough bytes
-	if (remaining < expected_len) return 0;
-	
-	// Create a buffer for mbstowcs
-	char temp[5] = {0};
-	for (int i = 0; i < expected_len && i < 4; i++) {
-		temp[i] = str[i];
-	}
-	
-	// Set locale for UTF-8 (done once in main)
-	wchar_t wc;
-	mbstate_t state;
-	memset(&state, 0, sizeof(state));
-	
-	// Try to convert the sequence
-	size_t result = mbrtowc(&wc, temp, expected_len, &state);
-	
-	// Check for conversion errors
-	if (result == (size_t)-1 || result == (size_t)-2 || result == 0) {
-		return 0; // Invalid sequence
-	}
-	
-	// Additional validation for overlong sequences and valid code points
-	if (expected_len == 2) {
-		unsigned int codepoint = ((c & 0x1F) << 6) | (str[1] & 0x3F);
-		if (codepoint < 0x80) return 0; // Overlong
-	} else if (expected_len == 3) {
-		unsigned int codepoint = ((c & 0x0F) << 12) | ((str[1] & 0x3F) << 6) | (str[2] & 0x3F);
-		if (codepoint < 0x800) return 0; // Overlong
-		if (codepoint >= 0xD800 && codepoint <= 0xDFFF) return 0; // Surrogate
-	} else if (expected_len == 4) {
-		unsigned int codepoint = ((c & 0x07) << 18) | ((str[1] & 0x3F) << 12) | 
-		                        ((str[2] & 0x3F) << 6) | (str[3] & 0x3F);
-		if (codepoint < 0x10000 || codepoint > 0x10FFFF) return 0; // Invalid range
-	}
-	
-	return expected_len;
-}
-
-// Function to print the event from the perf buffer in JSON format
-void print_event(struct probe_SSL_data_t *event, const char *evt) {
-	static unsigned long long start = 0;  // Use static to retain value across function calls
-	unsigned int buf_size;
-
-	// Safety check for global buffer
-	if (!event_buf) {
-		fprintf(stderr, "Error: global buffer not allocated\n");
-		return;
-	}
+static int probe_set_attach(struct probe_set *set, const char *path) {
+	for (size_t i = 0; i < set->nr; i++) {
+		int err = 0;
 
-	// Use the actual bytes copied from eBPF
-	if (event->buf_filled == 1) {
-		buf_size = event->buf_size;
-		// Additional safety check to prevent buffer overflow
-		if (buf_size > MAX_BUF_SIZE) {
-			buf_size = MAX_BUF_SIZE;
-		}
-		if (buf_size > 0) {
-			memcpy(event_buf, event->buf, buf_size);
-			event_buf[buf_size] = '\0';  // Null terminate
+		if (env.pin_dir) {
+			err = pin_uprobe_multi(set->progs[i].prog, path, set->progs[i].offsets,
+					       set->progs[i].cnt, set->progs[i].retprobe);
+		} else if (multi_uprobes) {
+			LIBBPF_OPTS(bpf_uprobe_multi_opts, opts, .offsets = set->progs[i].offsets,
+				    .cnt = set->progs[i].cnt, .retprobe = set->progs[i].retprobe);
+
+			err = keep_link(bpf_program__attach_uprobe_multi(set->progs[i].prog, env.pid, path,
+									 NULL, &opts));
+		} else {
+			LIBBPF_OPTS(bpf_uprobe_opts, opts, .retprobe = set->progs[i].retprobe);
+
+			for (size_t j = 0; j < set->progs[i].cnt && !err; j++)
+				err = keep_link(bpf_program__attach_uprobe_opts(set->progs[i].prog, env.pid, path,
+										set->progs[i].offsets[j], &opts));
 		}
-	} else {
-		buf_size = 0;
+		if (err && set->progs[i].required)
+			return err;
 	}
+	return 0;
+}
 
-	if (env.comm && strcmp(env.comm, event->comm) != 0) {
-		return;
-	}
+static int attach_openssl(struct sslsniff_bpf *skel, const char *lib, const size_t *off) {
+	struct probe_set set = {};
+	int err;
 
-	if (start == 0) {
-		start = event->timestamp_ns;
+	err = PROBE_PAIR(&set, skel, off[SSL_SYM_WRITE], probe_SSL_rw_enter, probe_SSL_write_exit, true) ?:
+	      PROBE_PAIR(&set, skel, off[SSL_SYM_READ], probe_SSL_rw_enter, probe_SSL_read_exit, true);
+	if (err)
+		return err;
+
+	// BoringSSL has no _ex calls, and set_fd/free only feed the fd field
+	PROBE_PAIR(&set, skel, off[SSL_SYM_WRITE_EX], probe_SSL_write_ex_enter, probe_SSL_write_ex_exit,
+		   false);
+	PROBE_PAIR(&set, skel, off[SSL_SYM_READ_EX], probe_SSL_read_ex_enter, probe_SSL_read_ex_exit,
+		   false);
+	PROBE_PAIR(&set, skel, off[SSL_SYM_DO_HANDSHAKE], probe_SSL_do_handshake_enter,
+		   probe_SSL_do_handshake_exit, false);
+	probe_add(&set, skel->progs.probe_SSL_set_fd_enter, off[SSL_SYM_SET_FD], false, false);
+	probe_add(&set, skel->progs.probe_SSL_free_enter, off[SSL_SYM_FREE], false, false);
+
+	return probe_set_attach(&set, lib);
+}
+
+static int attach_gnutls(struct sslsniff_bpf *skel, const char *lib, const size_t *off) {
+	struct probe_set set = {};
+
+	return PROBE_PAIR(&set, skel, off[GNUTLS_SYM_SEND], probe_SSL_rw_enter, probe_SSL_write_exit, true) ?:
+	       PROBE_PAIR(&set, skel, off[GNUTLS_SYM_RECV], probe_SSL_rw_enter, probe_SSL_read_exit, true) ?:
+	       probe_set_attach(&set, lib);
+}
+
+static int attach_nss(struct sslsniff_bpf *skel, const char *lib, const size_t *off) {
+	struct probe_set set = {};
+
+	return PROBE_PAIR(&set, skel, off[NSS_SYM_WRITE], probe_SSL_rw_enter, probe_SSL_write_exit, true) ?:
+	       PROBE_PAIR(&set, skel, off[NSS_SYM_SEND], probe_SSL_rw_enter, probe_SSL_write_exit, true) ?:
+	       PROBE_PAIR(&set, skel, off[NSS_SYM_READ], probe_SSL_rw_enter, probe_SSL_read_exit, true) ?:
+	       PROBE_PAIR(&set, skel, off[NSS_SYM_RECV], probe_SSL_rw_enter, probe_SSL_read_exit, true) ?:
+	       probe_set_attach(&set, lib);
+}
+
+// ssl_attach callback, ctx is the skeleton
+static int attach_library(void *ctx, enum ssl_lib lib, const char *path, const size_t *offsets) {
+	switch (lib) {
+	case SSL_LIB_OPENSSL:
+		return attach_openssl(ctx, path, offsets);
+	case SSL_LIB_GNUTLS:
+		return attach_gnutls(ctx, path, offsets);
+	case SSL_LIB_NSS:
+		return attach_nss(ctx, path, offsets);
+	default:
+		return -EINVAL;
 	}
+}
 
+// Exec records from exec_rb, ctx is the attach manager
+static int handle_exec_event(void *ctx, void *data, size_t data_sz) {
+	if (data_sz >= sizeof(__u32))
+		ssl_attach_exec(ctx, *(__u32 *)data, ring_merge_now_ns());
+	return 0;
+}
+
+// Payload bytes actually present in a record of data_sz bytes, header included
+static unsigned int event_buf_size(const struct probe_SSL_data_t *event, size_t data_sz) {
+	// Use the actual bytes copied from eBPF
+	if (event->buf_filled != 1)
+		return 0;
+	// Never read past the payload actually present in the record
+	if (event->buf_size > data_sz - SSL_DATA_HDR_SIZE)
+		return data_sz - SSL_DATA_HDR_SIZE;
+	return event->buf_size;
+}
+
+// Print one SSL event in JSON or binary. buf holds buf_size of the event's
+// len bytes; a reassembled frame passes its own bytes, len and chunk count
+// with the header of the chunk that completed it.
+static void print_ssl(struct json_writer *w, const struct probe_SSL_data_t *event,
+		      const unsigned char *event_buf, unsigned int buf_size, unsigned int len,
+		      enum ssl_frame frame, unsigned int chunks) {
 	char *rw_event[] = {
 		"READ/RECV",
 		"WRITE/SEND",
 		"HANDSHAKE"
 	};
+	// Records --process-rate dropped before this one, in the extra fields
+	char suppressed[32] = "";
+
+	if (event->suppressed)
+		snprintf(suppressed, sizeof(suppressed), "\"suppressed\":%u", event->suppressed);
+
+	if (w->binary) {
+		// Raw payload bytes, the collector does the escaping it needs
+		bin_event_begin(w, BIN_RECORD_SSL_DATA, event->timestamp_ns, event->pid, event->comm);
+		bin_u8(w, event->rw);
+		bin_u32(w, event->tid);
+		bin_u32(w, event->uid);
+		bin_u32(w, len);
+		bin_u32(w, frame == SSL_FRAME_CHUNK ? event->buf_size : buf_size);
+		bin_u64(w, event->delta_ns);
+		bin_u8(w, event->is_handshake);
+		bin_u64(w, event->ssl);
+		bin_i32(w, event->fd);
+		bin_u8(w, frame);
+		bin_u32(w, chunks);
+		bin_u32(w, buf_size);
+		jw_raw(w, (const char *)event_buf, buf_size);
+		bin_event_end(w, suppressed);
+		return;
+	}
+
+	jw_begin(w);
 
-	// Start JSON object
-	printf("{");
-	
 	// Basic fields - always include all fields
-	printf("\"function\":\"%s\",", rw_event[event->rw]);
-	printf("\"timestamp_ns\":%llu,", event->timestamp_ns);
-	printf("\"comm\":\"%s\",", event->comm);
-	printf("\"pid\":%d,", event->pid);
-	printf("\"len\":%d,", event->len);
-	printf("\"buf_size\":%u,", event->buf_size);
+	jw_field_str(w, "function", rw_event[event->rw]);
+	jw_field_u64(w, "timestamp_ns", event->timestamp_ns);
+	jw_field_interned(w, "comm", event->comm);
+	jw_field_i64(w, "pid", event->pid);
+	jw_field_i64(w, "len", len);
+	jw_field_u64(w, "buf_size", frame == SSL_FRAME_CHUNK ? event->buf_size : buf_size);
 
 	// Always include extra fields (UID, TID)
-	printf("\"uid\":%d,", event->uid);
-	printf("\"tid\":%d,", event->tid);
+	jw_field_i64(w, "uid", event->uid);
+	jw_field_i64(w, "tid", event->tid);
 
 	// Always include latency field
+	jw_key(w, "latency_ms");
 	if (event->delta_ns) {
-		printf("\"latency_ms\":%.3f,", (double)event->delta_ns / 1000000);
+		jw_printf(w, "%.3f", (double)event->delta_ns / 1000000);
 	} else {
-		printf("\"latency_ms\":0,");
+		jw_char(w, '0');
 	}
 
 	// Always include handshake field
-	printf("\"is_handshake\":%s,", event->is_handshake ? "true" : "false");
+	jw_field_bool(w, "is_handshake", event->is_handshake);
+
+	// Connection: the SSL* handle and, when SSL_set_fd() was seen, its socket
+	jw_field_u64(w, "ssl", event->ssl);
+	jw_field_i64(w, "fd", event->fd);
+	if (frame != SSL_FRAME_CHUNK) {
+		jw_field_str(w, "frame", ssl_frame_names[frame]);
+		jw_field_u64(w, "chunks", chunks);
+	}
 
-	// Data field - always include both text and hex
+	// Data field
 	if (buf_size > 0) {
-		// Text data
-		printf("\"data\":\"");
-		for (unsigned int i = 0; i < buf_size; i++) {
-			unsigned char c = event_buf[i];
-			if (c == '"' || c == '\\') {
-				printf("\\%c", c);
-			} else if (c == '\n') {
-				printf("\\n");
-			} else if (c == '\r') {
-				printf("\\r");
-			} else if (c == '\t') {
-				printf("\\t");
-			} else if (c == '\b') {
-				printf("\\b");
-			} else if (c == '\f') {
-				printf("\\f");
-			} else if (c >= 32 && c <= 126) {
-				// ASCII printable characters
-				printf("%c", c);
-			} else if (c >= 128) {
-				// Use our new UTF-8 validation function
-				int utf8_len = validate_utf8_char((unsigned char *)&event_buf[i], buf_size - i);
-				
-				if (utf8_len > 0) {
-					// Output the valid UTF-8 sequence
-					for (int j = 0; j < utf8_len; j++) {
-						printf("%c", event_buf[i + j]);
-					}
-					i += utf8_len - 1; // Skip the continuation bytes
-				} else {
-					// Invalid UTF-8 byte - escape it
-					printf("\\u%04x", c);
-				}
-			} else {
-				// Control characters (0-31, 127)
-				printf("\\u%04x", c);
-			}
-		}
-		printf("\",");
-		
-		
+		jw_key(w, "data");
+		jw_char(w, '"');
+		jw_escaped_utf8(w, (const char *)event_buf, buf_size);
+		jw_char(w, '"');
+
 		// Add truncated info if data was truncated
-		if (buf_size < event->len) {
-			printf("\"truncated\":true,\"bytes_lost\":%d", event->len - buf_size);
-		} else {
-			printf("\"truncated\":false");
-		}
+		jw_field_bool(w, "truncated", buf_size < len);
+		if (buf_size < len)
+			jw_field_i64(w, "bytes_lost", len - buf_size);
+	} else if (len > 0 && !event->is_handshake) {
+		// Nothing copied, by --capture-* or a failed read
+		jw_fields_raw(w, "\"data\":null,\"truncated\":true");
+		jw_field_i64(w, "bytes_lost", len);
 	} else {
-		printf("\"data\":null,\"truncated\":false");
+		jw_fields_raw(w, "\"data\":null,\"truncated\":false");
 	}
+	jw_fields_raw(w, suppressed);
+
+	jw_end(w);
+}
+
+// Function to print the event from the ring buffer in JSON format.
+// data_sz is the size of the variable-length record, header included.
+static void print_event(struct json_writer *w, struct probe_SSL_data_t *event, size_t data_sz,
+			const char *evt) {
+	// PID/comm filters are applied in-kernel, so the payload is printed
+	// straight from the ring buffer record
+	print_ssl(w, event, event->buf, event_buf_size(event, data_sz), event->len,
+		  SSL_FRAME_CHUNK, 1);
+}
+
+/* Fill the in-kernel PID and comm allow-sets from -p/-c */
+static int populate_filter_maps(struct sslsniff_bpf *obj) {
+	__u8 one = 1;
+	int err;
+
+	if (env.pid_count > 1) {
+		int fd = bpf_map__fd(obj->maps.allowed_pids);
+		for (int i = 0; i < env.pid_count; i++) {
+			__u32 pid = env.pids[i];
+			err = bpf_map_update_elem(fd, &pid, &one, BPF_ANY);
+			if (err)
+				return err;
+		}
+	}
+
+	int fd = bpf_map__fd(obj->maps.allowed_comms);
+	for (int i = 0; i < env.comm_count; i++) {
+		char comm[TASK_COMM_LEN] = {};
+		strncpy(comm, env.comms[i], TASK_COMM_LEN - 1);
+		err = bpf_map_update_elem(fd, comm, &one, BPF_ANY);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+/* After a takeover: drop the -p/-c entries of the previous run that this one lacks */
+static void drop_stale_filters(struct sslsniff_bpf *obj) {
+	int pids_fd = bpf_map__fd(obj->maps.allowed_pids);
+	int comms_fd = bpf_map__fd(obj->maps.allowed_comms);
+	char comm[TASK_COMM_LEN], next_comm[TASK_COMM_LEN];
+	__u32 pid, next_pid;
+	bool more, wanted;
+
+	more = bpf_map_get_next_key(pids_fd, NULL, &next_pid) == 0;
+	while (more) {
+		pid = next_pid;
+		more = bpf_map_get_next_key(pids_fd, &pid, &next_pid) == 0;
+		wanted = false;
+		for (int i = 0; i < env.pid_count && env.pid_count > 1 && !wanted; i++)
+			wanted = (__u32)env.pids[i] == pid;
+		if (!wanted)
+			bpf_map_delete_elem(pids_fd, &pid);
+	}
+
+	more = bpf_map_get_next_key(comms_fd, NULL, next_comm) == 0;
+	while (more) {
+		memcpy(comm, next_comm, sizeof(comm));
+		more = bpf_map_get_next_key(comms_fd, comm, next_comm) == 0;
+		wanted = false;
+		for (int i = 0; i < env.comm_count && !wanted; i++)
+			wanted = strncmp(comm, env.comms[i], TASK_COMM_LEN - 1) == 0;
+		if (!wanted)
+			bpf_map_delete_elem(comms_fd, comm);
+	}
+}
+
+/*
+ * Point the skeleton at what an earlier run left under --pin-dir if it was
+ * loaded the same way and follows the same tracked PID map, otherwise clear
+ * the dir for this run to pin its own
+ */
+static int take_over_pins(struct sslsniff_bpf *obj, struct tracer_ctx *ctx) {
+	bool same;
+	int err, fd;
+
+	err = pin_dir_init(&pins, env.pin_dir);
+	if (err)
+		return err;
+	same = pin_dir_match(&pins, obj->skeleton);
+	if (same && env.follow_tracked) {
+		fd = ctx->tracked_pids_fd >= 0 ? ctx->tracked_pids_fd : bpf_obj_get(env.follow_tracked);
+		same = fd >= 0 && pin_dir_same_map(&pins, "tracked_pids", fd);
+		if (fd >= 0 && fd != ctx->tracked_pids_fd)
+			close(fd);
+	}
+	err = same ? pin_dir_reuse(&pins, obj->skeleton) : pin_dir_reset(&pins);
+	if (err)
+		return err;
+
+	known_files_fd = pin_dir_map(&pins, "known_files", BPF_MAP_TYPE_HASH, sizeof(struct known_file),
+				     sizeof(__u32), KNOWN_FILES_MAX_ENTRIES);
+	return known_files_fd < 0 ? known_files_fd : 0;
+}
+
+// ssl_attach hook: keep what was found in each file for the next --pin-dir run
+static void remember_file(void *ctx, __u64 dev, __u64 ino, enum ssl_inode_state state) {
+	struct known_file key = { .dev = dev, .ino = ino };
+	__u32 value = state;
+
+	// past KNOWN_FILES_MAX_ENTRIES the next run looks at the file again,
+	// attaching it a second time if it was attached
+	bpf_map_update_elem(known_files_fd, &key, &value, BPF_ANY);
+}
+
+/* After a takeover: the files earlier runs attached or ruled out, returns how many */
+static int seed_known_files(void) {
+	struct known_file key, next;
+	__u32 state;
+	bool more;
+	int n = 0;
+
+	more = bpf_map_get_next_key(known_files_fd, NULL, &next) == 0;
+	while (more) {
+		key = next;
+		more = bpf_map_get_next_key(known_files_fd, &key, &next) == 0;
+		if (bpf_map_lookup_elem(known_files_fd, &key, &state) ||
+		    state == SSL_INODE_FREE || state > SSL_INODE_FAILED)
+			continue;
+		ssl_attach_set(&attach, key.dev, key.ino, state);
+		n++;
+	}
+	return n;
+}
+
+/* --reassemble: per-connection streams, fed and drained by the main thread */
+static struct ssl_streams streams;
+
+// ctx is the json_writer, s->hdr the header of the chunk that ended the frame
+static void emit_ssl_frame(void *ctx, const struct ssl_stream *s, enum ssl_frame frame,
+			   const char *data, size_t len) {
+	int stage = stats_stage(&stats, STATS_STAGE_FORMAT);
+
+	print_ssl(ctx, s->hdr, (const unsigned char *)data, len, len, frame, s->chunks);
+	stats_stage(&stats, stage);
+}
+
+static void reassemble_event(struct probe_SSL_data_t *e, size_t data_sz) {
+	struct ssl_stream_key key = { .ssl = e->ssl, .pid = e->pid, .rw = e->rw };
+	unsigned int buf_size = event_buf_size(e, data_sz);
 
-	// Close JSON object
-	printf("}\n");
-	fflush(stdout);
+	int stage = stats_stage(&stats, STATS_STAGE_REASSEMBLE);
+
+	ssl_streams_feed(&streams, &key, e, e->timestamp_ns, (const char *)e->buf, buf_size,
+			 e->len - buf_size);
+	stats_stage(&stats, stage);
 }
 
+// ctx is the json_writer to format into
 static int handle_event(void *ctx, void *data, size_t data_sz) {
+	struct json_writer *w = ctx;
 	struct probe_SSL_data_t *e = data;
+	int stage;
+
+	if (data_sz < SSL_DATA_HDR_SIZE) {
+		warn("short SSL record: %zu bytes\n", data_sz);
+		return 0;
+	}
+	if (stats.self && !e->is_handshake && (e->rw == SSL_PROBE_READ || e->rw == SSL_PROBE_WRITE)) {
+		__atomic_fetch_add(&ssl_latency[e->rw].calls, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&ssl_latency[e->rw].ns, e->delta_ns, __ATOMIC_RELAXED);
+	}
+
+	stage = stats_stage(&stats, STATS_STAGE_FORMAT);
 	if (e->is_handshake) {
+		// A handshake starts a new session, even on a reused SSL*
+		if (env.reassemble)
+			ssl_streams_close(&streams, e->pid, e->ssl);
 		if (env.handshake) {
-			print_event(e, "ringbuf_SSL_do_handshake");
+			print_event(w, e, data_sz, "ringbuf_SSL_do_handshake");
 		}
+	} else if (env.reassemble) {
+		reassemble_event(e, data_sz);
 	} else {
-		print_event(e, "ringbuf_SSL_rw");
+		print_event(w, e, data_sz, "ringbuf_SSL_rw");
 	}
+	stats_stage(&stats, stage);
 	return 0;
 }
 
-int main(int argc, char **argv) {
-	LIBBPF_OPTS(bpf_object_open_opts, open_opts);
-	struct sslsniff_bpf *obj = NULL;
-	struct ring_buffer *rb = NULL;
+/*
+ * --ring-cpus: every ring_cpus CPUs submit to their own ring, drained by a
+ * consumer thread pinned to those CPUs that formats the records into a
+ * memory writer. The main thread merges them back into timestamp order,
+ * see ring_merge.h, and does all the writing.
+ */
+
+// Formatted bytes queued in the merge before consumers stop reading
+#define MERGE_MAX_BYTES (64 * 1024 * 1024)
+// Records a consumer formats before handing them to the merge
+#define RING_CONSUMER_BATCH 64
+// Records the main thread writes per ring_merge_pop()
+#define MERGE_POP_BATCH 256
+
+struct ring_consumer {
+	int idx;
+	int first_cpu;
+	int nr_cpus;
+	int ring_fd;
+	struct ring_buffer *rb;
+	struct event_loop loop;
+	int stop_fd;                                   // eventfd, wakes the thread to exit
+	struct json_writer w;                          // memory writer, fd -1
+	struct merge_record *batch[RING_CONSUMER_BATCH];
+	size_t nr;
+	pthread_t thread;
+	bool started;
 	int err;
+};
 
-	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
+static struct ring_consumer *consumers;
+static int nr_consumers;
+static struct ring_merge merge;
+
+static void ring_consumer_flush(struct ring_consumer *c) {
+	if (ring_merge_push(&merge, c->batch, c->nr))
+		warn("ring %d: out of memory, dropped %zu records\n", c->idx, c->nr);
+	c->nr = 0;
+}
+
+static int handle_ring_event(void *ctx, void *data, size_t data_sz) {
+	struct ring_consumer *c = ctx;
+	struct probe_SSL_data_t *e = data;
+	struct merge_record *r;
+
+	handle_event(&c->w, data, data_sz);
+	if (!c->w.len)
+		return 0;
+
+	r = merge_record_new(e->timestamp_ns, c->w.buf, c->w.len);
+	c->w.len = 0;
+	if (!r)
+		return 0;
+	c->batch[c->nr++] = r;
+	if (c->nr == RING_CONSUMER_BATCH)
+		ring_consumer_flush(c);
+	return 0;
+}
+
+static void *ring_consumer_run(void *arg) {
+	struct ring_consumer *c = arg;
+	cpu_set_t cpus;
+
+	// Best effort: the producing CPUs' records are still in their caches
+	CPU_ZERO(&cpus);
+	for (int cpu = c->first_cpu; cpu < c->first_cpu + c->nr_cpus; cpu++)
+		CPU_SET(cpu, &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+	while (!exiting) {
+		int err = event_loop_wait(&c->loop, PERF_POLL_TIMEOUT_MS);
+		if (err >= 0) {
+			stats_stage(&stats, STATS_STAGE_POLL);
+			err = ring_buffer__consume(c->rb);
+			stats_stage(&stats, STATS_STAGE_NONE);
+		}
+		if (err < 0) {
+			warn("error polling ring buffer %d: %s\n", c->idx, strerror(-err));
+			c->err = err;
+			exiting = true;
+			ring_merge_notify(&merge);
+			break;
+		}
+		ring_consumer_flush(c);
+	}
+	ring_consumer_flush(c);
+	return NULL;
+}
+
+/* Size ssl_rings for --ring-cpus before load */
+static int ring_consumers_prepare(struct sslsniff_bpf *obj, int ncpus) {
+	int err;
+
+	nr_consumers = (ncpus + env.ring_cpus - 1) / env.ring_cpus;
+	err = bpf_map__set_max_entries(obj->maps.ssl_rings, nr_consumers);
 	if (err)
 		return err;
+	// The shared ring is unused, keep it at the minimum size
+	return bpf_map__set_max_entries(obj->maps.rb, getpagesize());
+}
 
-	// Set locale for UTF-8 support
-	setlocale(LC_ALL, "");
+/* Create the per-CPU-group rings and plug them into ssl_rings */
+static int ring_consumers_init(struct sslsniff_bpf *obj, int ncpus) {
+	int outer_fd = bpf_map__fd(obj->maps.ssl_rings);
+	int err;
+
+	err = ring_merge_init(&merge, (__u64)env.merge_window_ms * 1000000ULL, MERGE_MAX_BYTES);
+	if (err)
+		return err;
+	consumers = calloc(nr_consumers, sizeof(*consumers));
+	if (!consumers)
+		return -ENOMEM;
+	for (int i = 0; i < nr_consumers; i++) {
+		consumers[i].ring_fd = -1;
+		consumers[i].stop_fd = -1;
+		consumers[i].loop = (struct event_loop){ .epfd = -1, .sigfd = -1, .timerfd = -1 };
+	}
+
+	for (int i = 0; i < nr_consumers; i++) {
+		struct ring_consumer *c = &consumers[i];
+		__u32 key = i;
+
+		c->idx = i;
+		c->first_cpu = i * env.ring_cpus;
+		c->nr_cpus = ncpus - c->first_cpu < (int)env.ring_cpus ?
+			     ncpus - c->first_cpu : (int)env.ring_cpus;
+		c->ring_fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF, "ssl_ring", 0, 0,
+					    RING_BUFFER_SIZE, NULL);
+		if (c->ring_fd < 0)
+			return -errno;
+		if (bpf_map_update_elem(outer_fd, &key, &c->ring_fd, BPF_ANY))
+			return -errno;
+		err = jw_init(&c->w, -1, 0);
+		if (err)
+			return err;
+		c->rb = ring_buffer__new(c->ring_fd, handle_ring_event, c, NULL);
+		if (!c->rb)
+			return -errno;
+
+		c->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (c->stop_fd < 0)
+			return -errno;
+		err = event_loop_init(&c->loop);
+		if (!err)
+			err = event_loop_add(&c->loop, ring_buffer__epoll_fd(c->rb), EVENT_LOOP_RING);
+		if (!err)
+			err = event_loop_add(&c->loop, c->stop_fd, EVENT_LOOP_WAKE);
+		if (!err && env.wakeup_batch_kb)
+			err = event_loop_set_tick(&c->loop, WAKEUP_TICK_MS);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static int ring_consumers_start(void) {
+	for (int i = 0; i < nr_consumers; i++) {
+		struct ring_consumer *c = &consumers[i];
+		int err;
+
+		c->w.binary = out.binary;
+		err = pthread_create(&c->thread, NULL, ring_consumer_run, c);
+		if (err)
+			return -err;
+		c->started = true;
+	}
+	return 0;
+}
+
+/* Write the records the merge has released, oldest first */
+static size_t write_merged(void) {
+	struct merge_record *recs[MERGE_POP_BATCH];
+	size_t n = ring_merge_pop(&merge, recs, MERGE_POP_BATCH);
+
+	for (size_t i = 0; i < n; i++) {
+		jw_append(&out, recs[i]->data, recs[i]->len);
+		free(recs[i]);
+	}
+	return n;
+}
+
+/* Stop the consumers and write out everything they formatted */
+static int ring_consumers_stop(void) {
+	int err = 0;
+
+	if (!consumers)
+		return 0;
+
+	exiting = true;
+	ring_merge_close(&merge);
+	for (int i = 0; i < nr_consumers; i++) {
+		__u64 one = 1;
+
+		if (consumers[i].stop_fd >= 0 && write(consumers[i].stop_fd, &one, sizeof(one)) < 0)
+			warn("failed to wake ring consumer %d: %s\n", i, strerror(errno));
+	}
+	for (int i = 0; i < nr_consumers; i++) {
+		if (consumers[i].started)
+			pthread_join(consumers[i].thread, NULL);
+		if (consumers[i].err && !err)
+			err = consumers[i].err;
+	}
+	while (write_merged())
+		;
+
+	for (int i = 0; i < nr_consumers; i++) {
+		struct ring_consumer *c = &consumers[i];
+
+		event_loop_free(&c->loop);
+		ring_buffer__free(c->rb);
+		if (c->stop_fd >= 0)
+			close(c->stop_fd);
+		jw_free(&c->w);
+		if (c->ring_fd >= 0)
+			close(c->ring_fd);
+	}
+	free(consumers);
+	consumers = NULL;
+	ring_merge_free(&merge);
+	return err;
+}
+
+// Under trace: hand each record to the shared merge, see tracer.h
+static int handle_sink_event(void *ctx, void *data, size_t data_sz) {
+	struct probe_SSL_data_t *e = data;
+
+	handle_event(ctx, data, data_sz);
+	if (data_sz >= SSL_DATA_HDR_SIZE)
+		tracer_sink_take(sink, &out, e->timestamp_ns);
+	return 0;
+}
+
+static int sslsniff_setup(int argc, char **argv, struct tracer_ctx *ctx) {
+	LIBBPF_OPTS(bpf_object_open_opts, open_opts);
+	int err;
+
+	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
+	if (err)
+		return -err;
+	if (env.self_stats && !env.stats_interval)
+		env.stats_interval = SELF_STATS_DEFAULT_INTERVAL;
 
 	libbpf_set_print(libbpf_print_fn);
 
+	sink = ctx->sink;
+	if (sink) {
+		// trace owns the output and merges whole rings, not per-CPU ones
+		if (env.output_socket || env.output_dir || env.flush_ms || env.format != OUTPUT_FORMAT_JSON) {
+			warn("set --format, --output-socket, --output-dir and --flush-ms on trace itself\n");
+			return -EINVAL;
+		}
+		if (env.ring_cpus) {
+			warn("--ring-cpus is not supported under trace\n");
+			return -EINVAL;
+		}
+		// the merge reorders records, a STRING_DEF could end up after its use
+		if (env.intern_strings) {
+			warn("--intern-strings is not supported under trace\n");
+			return -EINVAL;
+		}
+	}
+	// Consumer threads format into writers of their own, merged by timestamp
+	if (env.intern_strings && env.ring_cpus) {
+		warn("--intern-strings cannot be combined with --ring-cpus\n");
+		return -EINVAL;
+	}
+	if (env.output_dir && env.output_socket) {
+		warn("--output-dir cannot be combined with --output-socket\n");
+		return -EINVAL;
+	}
+
 	obj = sslsniff_bpf__open_opts(&open_opts);
 	if (!obj) {
 		warn("failed to open BPF object\n");
-		goto cleanup;
+		return -1;
 	}
 
+	// A single PID is also used to scope the uprobes; larger sets are
+	// checked against the allowed_pids map
+	if (env.pid_count == 1)
+		env.pid = env.pids[0];
 	obj->rodata->targ_uid = env.uid;
 	obj->rodata->targ_pid = env.pid == INVALID_PID ? 0 : env.pid;
+	obj->rodata->filter_pids = env.pid_count > 1;
+	obj->rodata->filter_comms = env.comm_count > 0;
+	obj->rodata->filter_tracked = env.follow_tracked != NULL;
+	obj->rodata->wakeup_bytes = env.wakeup_batch_kb * 1024ULL;
+	obj->rodata->capture_cap[0] = env.capture_cap[0];
+	obj->rodata->capture_cap[1] = env.capture_cap[1];
+	obj->rodata->capture_msg_head = env.capture_head;
+	obj->rodata->capture_conn_rate = env.capture_rate;
+	obj->rodata->histogram_only = env.histogram_interval > 0;
+	obj->rodata->rate_limit[RATE_CLASS_SSL_BYTES] = env.process_rate_kb * 1024ULL;
 
-	err = sslsniff_bpf__load(obj);
-	if (err) {
-		warn("failed to load BPF object: %d\n", err);
-		goto cleanup;
+	// Streams are stitched in the main thread, which only sees one ring
+	if (env.reassemble && env.ring_cpus) {
+		warn("--reassemble cannot be combined with --ring-cpus\n");
+		return -EINVAL;
 	}
+	ssl_streams_init(&streams, SSL_DATA_HDR_SIZE, emit_ssl_frame, &out);
 
-	// Allocate global buffer once
-	event_buf = malloc(MAX_BUF_SIZE + 1);
-	if (!event_buf) {
-		warn("failed to allocate event buffer\n");
-		err = -ENOMEM;
-		goto cleanup;
+	// Past half a ring, a burst would fill it before anyone is woken
+	if (obj->rodata->wakeup_bytes > RING_BUFFER_SIZE / 2) {
+		warn("--wakeup-batch must be at most %d KB\n", RING_BUFFER_SIZE / 2 / 1024);
+		return -EINVAL;
 	}
 
-	if (env.openssl) {
-		char *openssl_path = find_library_path("libssl.so");
-		if (verbose) {
-			fprintf(stderr, "OpenSSL path: %s\n", openssl_path ? openssl_path : "not found");
+	// Under trace, process's own map. Otherwise reuse the map pinned by
+	// process; if it is not there yet libbpf pins ours and process picks
+	// it up when it starts
+	if (env.follow_tracked && ctx->tracked_pids_fd >= 0) {
+		err = bpf_map__reuse_fd(obj->maps.tracked_pids, ctx->tracked_pids_fd);
+		if (err) {
+			warn("failed to share the tracked PID map: %d\n", err);
+			return err;
 		}
-		if (openssl_path) {
-			attach_openssl(obj, openssl_path);
-		} else {
-			warn("OpenSSL library not found\n");
+	} else if (env.follow_tracked) {
+		err = bpf_map__set_pin_path(obj->maps.tracked_pids, env.follow_tracked);
+		if (err) {
+			warn("failed to set tracked PID pin path: %d\n", err);
+			return err;
 		}
 	}
-	if (env.gnutls) {
-		char *gnutls_path = find_library_path("libgnutls.so");
-		if (verbose) {
-			fprintf(stderr, "GnuTLS path: %s\n", gnutls_path ? gnutls_path : "not found");
+
+	// One scratch record per CPU for staging variable-length SSL records
+	int ncpus = libbpf_num_possible_cpus();
+	if (ncpus < 0) {
+		warn("failed to get possible CPU count: %d\n", ncpus);
+		return ncpus;
+	}
+	err = bpf_map__set_max_entries(obj->maps.ssl_scratch, ncpus);
+	if (err) {
+		warn("failed to size scratch map: %d\n", err);
+		return err;
+	}
+
+	if (env.ring_cpus) {
+		obj->rodata->ring_cpus = env.ring_cpus;
+		err = ring_consumers_prepare(obj, ncpus);
+		if (err) {
+			warn("failed to size per-CPU ring buffers: %d\n", err);
+			return err;
 		}
-		if (gnutls_path) {
-			attach_gnutls(obj, gnutls_path);
-		} else {
-			warn("GnuTLS library not found\n");
+	}
+
+	bpf_program__set_autoload(obj->progs.handle_exec, env.auto_attach);
+
+	// The link type is fixed when the programs load, so decide up front
+	multi_uprobes = !env.no_uprobe_multi && probe_uprobe_multi();
+	if (multi_uprobes) {
+		struct bpf_program *prog;
+
+		bpf_object__for_each_program(prog, obj->obj)
+			if (prog != obj->progs.handle_exec)
+				bpf_program__set_expected_attach_type(prog, BPF_TRACE_UPROBE_MULTI);
+	}
+
+	// Links pinned by program fd are uprobe_multi links, see pin_uprobe_multi()
+	if (env.pin_dir) {
+		if (!multi_uprobes || env.ring_cpus) {
+			warn("--pin-dir needs uprobe_multi links (Linux 6.6+) and no --ring-cpus\n");
+			return -EINVAL;
+		}
+		err = take_over_pins(obj, ctx);
+		if (err) {
+			warn("failed to take over BPF object pinned under %s: %s\n", env.pin_dir,
+			     strerror(-err));
+			return err;
 		}
+		if (verbose && pins.reused)
+			warn("took over BPF object pinned under %s\n", env.pin_dir);
 	}
-	if (env.nss) {
-		char *nss_path = find_library_path("libnspr4.so");
-		if (verbose) {
-			fprintf(stderr, "NSS path: %s\n", nss_path ? nss_path : "not found");
+
+	if (!pins.reused) {
+		err = sslsniff_bpf__load(obj);
+		if (err) {
+			warn("failed to load BPF object: %d\n", err);
+			return err;
 		}
-		if (nss_path) {
-			attach_nss(obj, nss_path);
-		} else {
-			warn("NSS library not found\n");
+	}
+
+	err = populate_filter_maps(obj);
+	if (err) {
+		warn("failed to populate filter maps: %d\n", err);
+		return err;
+	}
+	if (pins.reused)
+		drop_stale_filters(obj);
+
+	// The rings must be in place before the probes attach
+	if (env.ring_cpus) {
+		err = ring_consumers_init(obj, ncpus);
+		if (err) {
+			warn("failed to create per-CPU ring buffers: %d\n", err);
+			return err;
 		}
 	}
 
+	err = ssl_attach_init(&attach, env.openssl << SSL_LIB_OPENSSL | env.gnutls << SSL_LIB_GNUTLS |
+				       env.nss << SSL_LIB_NSS, attach_library, obj);
+	if (err) {
+		warn("failed to set up library attach: %d\n", err);
+		return err;
+	}
+	attach.verbose = verbose;
+	if (env.pin_dir) {
+		if (pins.reused && verbose)
+			warn("%d files known from earlier runs\n", seed_known_files());
+		else if (pins.reused)
+			seed_known_files();
+		attach.on_set = remember_file;
+	}
+
+	// Libraries installed on the system, whether or not anything has them mapped
+	for (int lib = 0; lib < SSL_LIB_MAX; lib++) {
+		if (!(attach.libs & (1 << lib)) || !ssl_attach_system(&attach, lib))
+			continue;
+		if (!env.auto_attach || verbose)
+			warn("%s library not found\n", ssl_lib_names[lib]);
+	}
+
 	// Handle custom binary path for statically-linked SSL (e.g., NVM Node.js)
-	if (env.extra_lib) {
-		if (verbose) {
-			fprintf(stderr, "Attaching to binary: %s\n", env.extra_lib);
+	if (env.extra_lib && ssl_attach_path(&attach, env.extra_lib, SSL_LIB_OPENSSL))
+		warn("failed to attach OpenSSL probes to %s\n", env.extra_lib);
+
+	// Whatever running processes have mapped, then every process that execs
+	if (env.auto_attach) {
+		if (env.pid != INVALID_PID)
+			ssl_attach_scan(&attach, env.pid);
+		else if (env.pid_count > 1)
+			for (int i = 0; i < env.pid_count; i++)
+				ssl_attach_scan(&attach, env.pids[i]);
+		else
+			ssl_attach_scan_all(&attach);
+
+		exec_rb = ring_buffer__new(bpf_map__fd(obj->maps.exec_rb), handle_exec_event,
+					   &attach, NULL);
+		// a taken over exec probe is still attached
+		if (!pins.reused)
+			obj->links.handle_exec = bpf_program__attach(obj->progs.handle_exec);
+		if (!exec_rb || (!pins.reused && !obj->links.handle_exec)) {
+			err = -errno;
+			warn("failed to watch execs: %d\n", err);
+			return err;
+		}
+		err = event_loop_add(ctx->loop, ring_buffer__epoll_fd(exec_rb), EVENT_LOOP_RING);
+		if (err) {
+			warn("failed to wait on exec ring buffer: %d\n", err);
+			return err;
 		}
-		// For binaries with statically-linked OpenSSL, try to attach OpenSSL functions
-		attach_openssl(obj, env.extra_lib);
 	}
+	if (env.pin_dir && !pins.reused) {
+		err = pin_dir_save(&pins, obj->skeleton);
+		if (err) {
+			warn("failed to pin BPF object under %s: %s\n", env.pin_dir, strerror(-err));
+			return err;
+		}
+	}
+	if (verbose)
+		fprintf(stderr, "attached to %u files in %.1f ms, %zu %s links\n", attach.attached,
+			attach.attach_ns / 1e6, nr_links, multi_uprobes ? "uprobe_multi" : "uprobe");
 
-	rb = ring_buffer__new(bpf_map__fd(obj->maps.rb), handle_event, NULL, NULL);
-	if (!rb) {
-		err = -errno;
-		warn("failed to open ring buffer: %d\n", err);
-		goto cleanup;
+	if (sink) {
+		// Records are formatted in memory and queued on trace's merge
+		err = jw_init(&out, -1, 0);
+		out.binary = ctx->binary;
+	} else if (env.output_dir) {
+		err = output_open_dir(&out, env.output_dir, env.flush_ms);
+	} else {
+		err = output_open(&out, env.output_socket, env.flush_ms);
+	}
+	if (err) {
+		warn("failed to set up output: %d\n", err);
+		return err;
 	}
 
-	if (signal(SIGINT, sig_int) == SIG_ERR) {
-		warn("can't set signal handler: %s\n", strerror(errno));
-		err = 1;
-		goto cleanup;
+	if (!sink && env.format == OUTPUT_FORMAT_BINARY)
+		bin_stream_start(&out);
+
+	if (env.intern_strings) {
+		err = string_intern_init(&strings, env.intern_strings);
+		if (err) {
+			warn("failed to allocate string intern table: %d\n", err);
+			return err;
+		}
+		out.intern = &strings;
 	}
 
-	while (!exiting) {
-		err = ring_buffer__poll(rb, PERF_POLL_TIMEOUT_MS);
-		if (err < 0 && err != -EINTR) {
-			warn("error polling ring buffer: %s\n", strerror(-err));
-			goto cleanup;
+	// tracer_main() blocked SIGINT/SIGTERM, so the consumers inherit the mask
+	if (env.ring_cpus) {
+		err = event_loop_add(ctx->loop, merge.efd, EVENT_LOOP_WAKE);
+		if (!err)
+			err = ring_consumers_start();
+		if (err) {
+			warn("failed to start ring buffer consumers: %d\n", err);
+			return err;
+		}
+	} else {
+		rb = ring_buffer__new(bpf_map__fd(obj->maps.rb), sink ? handle_sink_event : handle_event,
+				      &out, NULL);
+		if (!rb) {
+			err = -errno;
+			warn("failed to open ring buffer: %d\n", err);
+			return err;
+		}
+		err = event_loop_add(ctx->loop, ring_buffer__epoll_fd(rb), EVENT_LOOP_RING);
+		// Records below the wakeup threshold are collected on the tick
+		if (!err && env.wakeup_batch_kb && ctx->loop->timerfd < 0)
+			err = event_loop_set_tick(ctx->loop, WAKEUP_TICK_MS);
+		if (err) {
+			warn("failed to wait on ring buffer: %d\n", err);
+			return err;
+		}
+	}
+
+	err = stats_reporter_init(&stats, bpf_map__fd(obj->maps.rb_stats),
+				  ssl_probe_names, SSL_PROBE_MAX, "sslsniff", "timestamp_ns", &out,
+				  env.ring_cpus ? RING_BUFFER_SIZE : bpf_map__max_entries(obj->maps.rb),
+				  env.stats_interval);
+	if (err) {
+		warn("failed to set up ring buffer stats: %d\n", err);
+		return err;
+	}
+	if (env.self_stats) {
+		err = stats_reporter_enable_self(&stats, obj->obj, print_ssl_self_stats, NULL);
+		if (err) {
+			warn("failed to enable BPF run time stats: %s\n", strerror(-err));
+			return err;
+		}
+	}
+
+	if (env.histogram_interval) {
+		err = hist_reporter_init(&hist, bpf_map__fd(obj->maps.latency_hist), "sslsniff",
+					 "timestamp_ns", &out, env.histogram_interval);
+		if (err) {
+			warn("failed to set up histograms: %d\n", err);
+			return err;
 		}
-		err = 0;
 	}
+	return 0;
+}
+
+static int sslsniff_timeout_ms(int timeout_ms) {
+	timeout_ms = jw_poll_timeout_ms(&out, timeout_ms);
+	if (consumers)
+		timeout_ms = ring_merge_timeout_ms(&merge, timeout_ms);
+	return ssl_attach_timeout_ms(&attach, ring_merge_now_ns(), timeout_ms);
+}
 
-cleanup:
-	if (event_buf) {
-		free(event_buf);
-		event_buf = NULL;
+static int sslsniff_poll(void) {
+	int err;
+
+	if (exiting)
+		return -EINTR;
+	stats_stage(&stats, STATS_STAGE_POLL);
+	if (consumers)
+		err = write_merged();
+	else
+		err = ring_buffer__consume(rb);
+	stats_stage(&stats, STATS_STAGE_NONE);
+	if (err < 0) {
+		warn("error polling ring buffer: %s\n", strerror(-err));
+		return err;
 	}
+	if (exec_rb && ring_buffer__consume(exec_rb) >= 0)
+		ssl_attach_tick(&attach, ring_merge_now_ns());
+	if (env.reassemble) {
+		stats_stage(&stats, STATS_STAGE_REASSEMBLE);
+		ssl_streams_expire(&streams, ring_merge_now_ns());
+		stats_stage(&stats, STATS_STAGE_NONE);
+	}
+	stats_reporter_tick(&stats);
+	hist_reporter_tick(&hist);
+	tracer_sink_take(sink, &out, stats_now_ns());
+	jw_batch_end(&out);
+	return 0;
+}
+
+// What the last, partial interval collected
+static void sslsniff_finish(void) {
+	hist_reporter_print(&hist, stats_now_ns());
+	tracer_sink_take(sink, &out, stats_now_ns());
+}
+
+static int sslsniff_cleanup(int err) {
 	if (env.extra_lib) {
 		free(env.extra_lib);
 		env.extra_lib = NULL;
 	}
-	if (env.comm) {
-		free(env.comm);
-		env.comm = NULL;
+	for (int i = 0; i < env.comm_count; i++) {
+		free(env.comms[i]);
 	}
+	if (ring_consumers_stop() && !err)
+		err = 1;
+	// Streams still open go out as their last frames
+	ssl_streams_free(&streams);
+	tracer_sink_take(sink, &out, stats_now_ns());
+	stats_reporter_free(&stats);
+	hist_reporter_free(&hist);
+	output_close(&out);
+	string_intern_free(&strings);
 	ring_buffer__free(rb);
+	ring_buffer__free(exec_rb);
+	for (size_t i = 0; i < nr_links; i++)
+		bpf_link__destroy(links[i]);
+	free(links);
+	ssl_attach_free(&attach);
 	sslsniff_bpf__destroy(obj);
+	pin_dir_free(&pins);
+	if (known_files_fd >= 0)
+		close(known_files_fd);
 	return err != 0;
 }
+
+const struct tracer sslsniff_tracer = {
+	.name = "sslsniff",
+	.setup = sslsniff_setup,
+	.timeout_ms = sslsniff_timeout_ms,
+	.poll = sslsniff_poll,
+	.finish = sslsniff_finish,
+	.cleanup = sslsniff_cleanup,
+};
+
+#ifndef TRACER_LIBRARY
+int main(int argc, char **argv) {
+	return tracer_main(&sslsniff_tracer, argc, argv);
+}
+#endif
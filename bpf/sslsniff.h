@@ -8,7 +8,21 @@
 
 #define MAX_BUF_SIZE (512 * 1024)  // 512KB eBPF buffer size (kernel limit)
 #define RING_BUFFER_SIZE (2 * 1024 * 1024)  // 2MB ring buffer
+#define EXEC_RING_SIZE (64 * 1024)  // Ring of exec'd PIDs for the attach manager
 #define TASK_COMM_LEN 16
+#define MAX_FILTER_PIDS 1024  // Entries in the allowed_pids map
+#define MAX_FILTER_COMMS 64   // Entries in the allowed_comms map
+#define MAX_SSL_FDS 16384     // Entries in the ssl_fds map
+#define MAX_SSL_CAPTURE 16384 // Connections tracked by the capture policy
+#define CAPTURE_WINDOW_NS 1000000000ULL  // Window of the per-connection byte cap
+
+// Probe ids for the rb_stats counters, matching the rw field
+enum ssl_probe {
+    SSL_PROBE_READ = 0,
+    SSL_PROBE_WRITE = 1,
+    SSL_PROBE_HANDSHAKE = 2,
+    SSL_PROBE_MAX,
+};
 
 struct probe_SSL_data_t {
     __u64 timestamp_ns;
@@ -20,9 +34,16 @@ struct probe_SSL_data_t {
     __u32 buf_size;         // Actual bytes copied to buf
     int buf_filled;
     int rw;
-    char comm[TASK_COMM_LEN];
-    __u8 buf[MAX_BUF_SIZE];
     int is_handshake;
+    __u64 ssl;              // SSL* (gnutls session, NSPR fd) of the connection
+    int fd;                 // Socket given to SSL_set_fd(), -1 if unknown
+    __u32 suppressed;       // Records the rate limiter dropped before this one
+    char comm[TASK_COMM_LEN];
+    __u8 buf[MAX_BUF_SIZE]; // Must stay last: only buf_size bytes are sent
 };
 
+// Ring buffer records are variable length: the fixed header above followed
+// by buf_size bytes of payload. Handshake records carry the header only.
+#define SSL_DATA_HDR_SIZE offsetof(struct probe_SSL_data_t, buf)
+
 #endif /* __SSLSNIFF_H */
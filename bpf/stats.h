@@ -0,0 +1,557 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __STATS_H
+#define __STATS_H
+
+/*
+ * Ring buffer telemetry shared by the tracers.
+ *
+ * Each tracer keeps one struct probe_stats per probe id in a
+ * BPF_MAP_TYPE_PERCPU_ARRAY. The BPF side bumps it on every submit or
+ * failed reserve and samples the ring fill level (BPF_RB_AVAIL_DATA) every
+ * STATS_SAMPLE_MASK + 1 submits and on every drop. Userspace sums the
+ * per-CPU values and prints a periodic "event":"STATS" JSON line.
+ */
+
+struct probe_stats {
+	__u64 emitted;        /* records submitted to the ring */
+	__u64 dropped;        /* records lost because the ring was full */
+	__u64 bytes;          /* bytes submitted to the ring */
+	__u64 ring_avail;     /* last sampled BPF_RB_AVAIL_DATA */
+	__u64 ring_avail_max; /* highest sampled BPF_RB_AVAIL_DATA */
+};
+
+#define STATS_SAMPLE_MASK 63
+
+#ifdef __bpf__
+
+static __always_inline void stats_sample_ring(struct probe_stats *s, void *ringbuf)
+{
+	__u64 avail = bpf_ringbuf_query(ringbuf, BPF_RB_AVAIL_DATA);
+
+	s->ring_avail = avail;
+	if (avail > s->ring_avail_max)
+		s->ring_avail_max = avail;
+}
+
+/* Account one record of @bytes submitted to @ringbuf by @probe */
+static __always_inline void stats_submit(void *stats_map, void *ringbuf,
+					 __u32 probe, __u64 bytes)
+{
+	struct probe_stats *s = bpf_map_lookup_elem(stats_map, &probe);
+
+	if (!s)
+		return;
+	s->emitted++;
+	s->bytes += bytes;
+	if ((s->emitted & STATS_SAMPLE_MASK) == 0)
+		stats_sample_ring(s, ringbuf);
+}
+
+/* Account one record dropped by @probe because @ringbuf was full */
+static __always_inline void stats_drop(void *stats_map, void *ringbuf, __u32 probe)
+{
+	struct probe_stats *s = bpf_map_lookup_elem(stats_map, &probe);
+
+	if (!s)
+		return;
+	s->dropped++;
+	stats_sample_ring(s, ringbuf);
+}
+
+#else /* !__bpf__ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include "json_writer.h"
+#include "histogram.h"
+
+/*
+ * --self-stats: what the tracer itself costs. The kernel accounts the run
+ * time of every BPF program while a bpf_enable_stats(BPF_STATS_RUN_TIME) fd
+ * is open. In userspace each thread charges the time since its last
+ * stats_stage() call to the stage it was in, so the stages never overlap.
+ */
+enum stats_stage {
+	STATS_STAGE_NONE = -1,
+	STATS_STAGE_POLL,       /* ring_buffer__consume() around the handlers */
+	STATS_STAGE_FILTER,     /* userspace PID tracking and rate limits */
+	STATS_STAGE_DEDUP,      /* FILE_OPEN aggregation */
+	STATS_STAGE_REASSEMBLE, /* --reassemble stream stitching */
+	STATS_STAGE_FORMAT,     /* JSON or binary encoding */
+	STATS_STAGE_WRITE,      /* write(2) of the output buffer */
+	STATS_STAGE_MAX,
+};
+
+static const char *const stats_stage_names[STATS_STAGE_MAX] = {
+	[STATS_STAGE_POLL] = "poll",
+	[STATS_STAGE_FILTER] = "filter",
+	[STATS_STAGE_DEDUP] = "dedup",
+	[STATS_STAGE_REASSEMBLE] = "reassemble",
+	[STATS_STAGE_FORMAT] = "format",
+	[STATS_STAGE_WRITE] = "write",
+};
+
+struct stats_program {
+	struct bpf_program *prog;
+	int fd;
+	__u64 run_cnt;           /* totals at the previous report */
+	__u64 run_time_ns;
+	__u64 delta_cnt;         /* the interval just reported */
+	__u64 delta_ns;
+};
+
+struct stats_reporter;
+
+/* Adds tracer specific fields to a --self-stats STATS line */
+typedef void (*stats_self_fn)(struct stats_reporter *r, struct json_writer *w, void *ctx);
+
+struct stats_reporter {
+	int map_fd;
+	int ncpus;
+	int nr_probes;
+	const char *const *probe_names;
+	const char *tracer;
+	const char *ts_key;          /* timestamp field name used by the tracer */
+	struct json_writer *out;
+	__u64 ring_size;
+	__u64 interval_ns;
+	__u64 last_ns;
+	struct probe_stats *percpu;  /* lookup buffer, one value per CPU */
+	struct probe_stats *prev;    /* totals at the previous report */
+	bool self;                   /* --self-stats */
+	int bpf_stats_fd;            /* keeps BPF_STATS_RUN_TIME enabled */
+	struct stats_program *progs;
+	int nr_progs;
+	__u64 stage_ns[STATS_STAGE_MAX];
+	__u64 prev_stage_ns[STATS_STAGE_MAX];
+	struct rusage prev_usage;
+	stats_self_fn self_fn;
+	void *self_ctx;
+};
+
+/* Nanoseconds since boot, same clock as bpf_ktime_get_ns() */
+static inline __u64 stats_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int stats_reporter_init(struct stats_reporter *r, int map_fd,
+				      const char *const *probe_names, int nr_probes,
+				      const char *tracer, const char *ts_key,
+				      struct json_writer *out,
+				      __u64 ring_size, unsigned int interval_sec)
+{
+	memset(r, 0, sizeof(*r));
+	r->ncpus = libbpf_num_possible_cpus();
+	if (r->ncpus < 0)
+		return r->ncpus;
+
+	r->percpu = calloc(r->ncpus, sizeof(*r->percpu));
+	r->prev = calloc(nr_probes, sizeof(*r->prev));
+	if (!r->percpu || !r->prev) {
+		free(r->percpu);
+		free(r->prev);
+		return -1;
+	}
+
+	r->map_fd = map_fd;
+	r->nr_probes = nr_probes;
+	r->probe_names = probe_names;
+	r->tracer = tracer;
+	r->ts_key = ts_key;
+	r->out = out;
+	r->ring_size = ring_size;
+	r->interval_ns = (__u64)interval_sec * 1000000000ULL;
+	r->last_ns = stats_now_ns();
+	return 0;
+}
+
+static inline void stats_reporter_free(struct stats_reporter *r)
+{
+	if (r->self) {
+		if (r->out->flush_ctx == r)
+			r->out->flush_hook = NULL;
+		close(r->bpf_stats_fd);
+		r->self = false;
+	}
+	free(r->percpu);
+	free(r->prev);
+	free(r->progs);
+	r->percpu = NULL;
+	r->prev = NULL;
+	r->progs = NULL;
+}
+
+/* The stage the calling thread is in and since when */
+static __thread int stats_cur_stage = STATS_STAGE_NONE;
+static __thread __u64 stats_cur_start;
+
+/*
+ * Charge the time since the last switch to the current stage and enter
+ * @stage, returns the stage left so nested code can switch back. A branch
+ * and nothing else without --self-stats.
+ */
+static inline int stats_stage(struct stats_reporter *r, int stage)
+{
+	int prev = stats_cur_stage;
+	__u64 now;
+
+	if (!r->self)
+		return prev;
+	now = stats_now_ns();
+	/* --ring-cpus consumers charge their stages concurrently */
+	if (prev != STATS_STAGE_NONE)
+		__atomic_fetch_add(&r->stage_ns[prev], now - stats_cur_start, __ATOMIC_RELAXED);
+	stats_cur_stage = stage;
+	stats_cur_start = now;
+	return prev;
+}
+
+/* json_writer flush_hook: write(2) time goes to the write stage */
+static inline void stats_flush_hook(void *ctx, bool begin)
+{
+	static __thread int saved = STATS_STAGE_NONE;
+
+	if (begin)
+		saved = stats_stage(ctx, STATS_STAGE_WRITE);
+	else
+		stats_stage(ctx, saved);
+}
+
+static inline int stats_read_program(const struct stats_program *p, __u64 *run_cnt,
+				     __u64 *run_time_ns)
+{
+	struct bpf_prog_info info = {};
+	__u32 len = sizeof(info);
+
+	if (bpf_obj_get_info_by_fd(p->fd, &info, &len))
+		return -errno;
+	*run_cnt = info.run_cnt;
+	*run_time_ns = info.run_time_ns;
+	return 0;
+}
+
+/*
+ * Turn on --self-stats for the loaded programs of @obj, call after
+ * stats_reporter_init(). @fn, if set, adds its own fields to each report.
+ */
+static inline int stats_reporter_enable_self(struct stats_reporter *r, struct bpf_object *obj,
+					     stats_self_fn fn, void *ctx)
+{
+	struct bpf_program *prog;
+	int n = 0, fd;
+
+	fd = bpf_enable_stats(BPF_STATS_RUN_TIME);
+	if (fd < 0)
+		return fd;
+
+	bpf_object__for_each_program(prog, obj)
+		n++;
+	r->progs = calloc(n ? n : 1, sizeof(*r->progs));
+	if (!r->progs) {
+		close(fd);
+		return -ENOMEM;
+	}
+	bpf_object__for_each_program(prog, obj) {
+		struct stats_program *p = &r->progs[r->nr_progs];
+
+		/* not loaded, autoload was turned off */
+		p->fd = bpf_program__fd(prog);
+		if (p->fd < 0)
+			continue;
+		p->prog = prog;
+		stats_read_program(p, &p->run_cnt, &p->run_time_ns);
+		r->nr_progs++;
+	}
+
+	getrusage(RUSAGE_SELF, &r->prev_usage);
+	r->bpf_stats_fd = fd;
+	r->self_fn = fn;
+	r->self_ctx = ctx;
+	r->out->flush_hook = stats_flush_hook;
+	r->out->flush_ctx = r;
+	r->self = true;
+	return 0;
+}
+
+/* Run count and time of program @name in the interval just reported */
+static inline bool stats_program_delta(const struct stats_reporter *r, const char *name,
+				       __u64 *run_cnt, __u64 *run_time_ns)
+{
+	for (int i = 0; i < r->nr_progs; i++) {
+		if (!strcmp(bpf_program__name(r->progs[i].prog), name)) {
+			*run_cnt = r->progs[i].delta_cnt;
+			*run_time_ns = r->progs[i].delta_ns;
+			return true;
+		}
+	}
+	return false;
+}
+
+static inline __u64 stats_timeval_us(const struct timeval *tv)
+{
+	return (__u64)tv->tv_sec * 1000000ULL + tv->tv_usec;
+}
+
+/* The --self-stats fields of a STATS line */
+static inline void stats_print_self(struct stats_reporter *r, struct json_writer *w)
+{
+	__u64 bpf_ns = 0, stage_total = 0;
+	struct rusage usage;
+
+	jw_key(w, "programs");
+	jw_object_begin(w);
+	for (int i = 0; i < r->nr_progs; i++) {
+		struct stats_program *p = &r->progs[i];
+		__u64 cnt = p->run_cnt, ns = p->run_time_ns;
+
+		/* a failed read reports nothing for this interval */
+		stats_read_program(p, &cnt, &ns);
+		p->delta_cnt = cnt - p->run_cnt;
+		p->delta_ns = ns - p->run_time_ns;
+		p->run_cnt = cnt;
+		p->run_time_ns = ns;
+		bpf_ns += p->delta_ns;
+
+		jw_key(w, bpf_program__name(p->prog));
+		jw_object_begin(w);
+		jw_field_u64(w, "run_cnt", p->delta_cnt);
+		jw_field_u64(w, "run_time_ns", p->delta_ns);
+		jw_field_u64(w, "avg_ns", p->delta_cnt ? p->delta_ns / p->delta_cnt : 0);
+		jw_object_end(w);
+	}
+	jw_object_end(w);
+	jw_field_u64(w, "bpf_run_time_ns", bpf_ns);
+
+	jw_key(w, "stages_ns");
+	jw_object_begin(w);
+	for (int i = 0; i < STATS_STAGE_MAX; i++) {
+		__u64 ns = __atomic_load_n(&r->stage_ns[i], __ATOMIC_RELAXED);
+
+		jw_field_u64(w, stats_stage_names[i], ns - r->prev_stage_ns[i]);
+		stage_total += ns - r->prev_stage_ns[i];
+		r->prev_stage_ns[i] = ns;
+	}
+	jw_object_end(w);
+	jw_field_u64(w, "userspace_ns", stage_total);
+
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+		jw_field_u64(w, "user_cpu_us", stats_timeval_us(&usage.ru_utime) -
+					       stats_timeval_us(&r->prev_usage.ru_utime));
+		jw_field_u64(w, "sys_cpu_us", stats_timeval_us(&usage.ru_stime) -
+					      stats_timeval_us(&r->prev_usage.ru_stime));
+		r->prev_usage = usage;
+	}
+
+	if (r->self_fn)
+		r->self_fn(r, w, r->self_ctx);
+}
+
+/* Sum the per-CPU counters of one probe */
+static inline int stats_read_probe(struct stats_reporter *r, __u32 probe,
+				   struct probe_stats *out)
+{
+	memset(out, 0, sizeof(*out));
+	if (bpf_map_lookup_elem(r->map_fd, &probe, r->percpu))
+		return -1;
+
+	for (int cpu = 0; cpu < r->ncpus; cpu++) {
+		const struct probe_stats *s = &r->percpu[cpu];
+
+		out->emitted += s->emitted;
+		out->dropped += s->dropped;
+		out->bytes += s->bytes;
+		if (s->ring_avail > out->ring_avail)
+			out->ring_avail = s->ring_avail;
+		if (s->ring_avail_max > out->ring_avail_max)
+			out->ring_avail_max = s->ring_avail_max;
+	}
+	return 0;
+}
+
+/* Print one STATS line with per-interval deltas and running totals */
+static inline void stats_reporter_print(struct stats_reporter *r, __u64 now_ns)
+{
+	struct json_writer *w = r->out;
+	__u64 emitted = 0, dropped = 0, bytes = 0;
+	__u64 emitted_total = 0, dropped_total = 0;
+	__u64 ring_avail = 0, ring_avail_max = 0;
+
+	jw_begin(w);
+	jw_field_u64(w, r->ts_key, now_ns);
+	jw_field_str(w, "event", "STATS");
+	jw_field_str(w, "tracer", r->tracer);
+	jw_field_str(w, "comm", r->tracer);
+	jw_field_i64(w, "pid", getpid());
+	jw_field_u64(w, "interval_ms", (now_ns - r->last_ns) / 1000000);
+	jw_key(w, "probes");
+	jw_object_begin(w);
+	for (int i = 0; i < r->nr_probes; i++) {
+		struct probe_stats cur;
+
+		if (stats_read_probe(r, i, &cur))
+			cur = r->prev[i];
+
+		struct probe_stats *prev = &r->prev[i];
+		jw_key(w, r->probe_names[i]);
+		jw_object_begin(w);
+		jw_field_u64(w, "emitted", cur.emitted - prev->emitted);
+		jw_field_u64(w, "dropped", cur.dropped - prev->dropped);
+		jw_field_u64(w, "bytes", cur.bytes - prev->bytes);
+		jw_object_end(w);
+
+		emitted += cur.emitted - prev->emitted;
+		dropped += cur.dropped - prev->dropped;
+		bytes += cur.bytes - prev->bytes;
+		emitted_total += cur.emitted;
+		dropped_total += cur.dropped;
+		if (cur.ring_avail > ring_avail)
+			ring_avail = cur.ring_avail;
+		if (cur.ring_avail_max > ring_avail_max)
+			ring_avail_max = cur.ring_avail_max;
+		*prev = cur;
+	}
+	jw_object_end(w);
+	jw_field_u64(w, "emitted", emitted);
+	jw_field_u64(w, "dropped", dropped);
+	jw_field_u64(w, "bytes", bytes);
+	jw_field_u64(w, "emitted_total", emitted_total);
+	jw_field_u64(w, "dropped_total", dropped_total);
+	jw_field_u64(w, "ring_size", r->ring_size);
+	jw_field_u64(w, "ring_avail", ring_avail);
+	jw_field_u64(w, "ring_avail_max", ring_avail_max);
+	jw_field_u64(w, "output_dropped", w->dropped);
+	if (w->intern)
+		jw_field_u64(w, "string_defs", w->intern->defs);
+	if (r->self)
+		stats_print_self(r, w);
+	jw_end(w);
+
+	r->last_ns = now_ns;
+}
+
+/* Print a STATS line if the configured interval has elapsed */
+static inline void stats_reporter_tick(struct stats_reporter *r)
+{
+	__u64 now_ns;
+
+	if (!r->interval_ns)
+		return;
+	now_ns = stats_now_ns();
+	if (now_ns - r->last_ns >= r->interval_ns)
+		stats_reporter_print(r, now_ns);
+}
+
+/*
+ * --histogram: drain the (comm, kind) histograms of histogram.h every
+ * interval. Keys are deleted as they are read, so each line covers one
+ * interval and the map only holds what ran since the previous dump.
+ */
+struct hist_reporter {
+	int map_fd;
+	int ncpus;
+	const char *tracer;
+	const char *ts_key;
+	struct json_writer *out;
+	__u64 interval_ns;
+	__u64 last_ns;
+	struct hist *percpu;         /* lookup buffer, one value per CPU */
+	struct hist_key *keys;       /* HIST_MAX_ENTRIES, collected before deleting */
+};
+
+static inline int hist_reporter_init(struct hist_reporter *r, int map_fd, const char *tracer,
+				     const char *ts_key, struct json_writer *out,
+				     unsigned int interval_sec)
+{
+	memset(r, 0, sizeof(*r));
+	r->ncpus = libbpf_num_possible_cpus();
+	if (r->ncpus < 0)
+		return r->ncpus;
+
+	r->percpu = calloc(r->ncpus, sizeof(*r->percpu));
+	r->keys = calloc(HIST_MAX_ENTRIES, sizeof(*r->keys));
+	if (!r->percpu || !r->keys) {
+		free(r->percpu);
+		free(r->keys);
+		return -ENOMEM;
+	}
+
+	r->map_fd = map_fd;
+	r->tracer = tracer;
+	r->ts_key = ts_key;
+	r->out = out;
+	r->interval_ns = (__u64)interval_sec * 1000000000ULL;
+	r->last_ns = stats_now_ns();
+	return 0;
+}
+
+static inline void hist_reporter_free(struct hist_reporter *r)
+{
+	free(r->percpu);
+	free(r->keys);
+	r->percpu = NULL;
+	r->keys = NULL;
+}
+
+/* Take one key's per-CPU histograms out of the map, summed into @h */
+static inline int hist_reporter_take(struct hist_reporter *r, const struct hist_key *key,
+				     struct hist *h)
+{
+	if (bpf_map_lookup_and_delete_elem(r->map_fd, key, r->percpu)) {
+		/*
+		 * Per-CPU hashes only take lookup-and-delete from 5.14 on;
+		 * before that, counts added between the two calls are lost.
+		 */
+		if (errno == ENOENT || bpf_map_lookup_elem(r->map_fd, key, r->percpu))
+			return -ENOENT;
+		bpf_map_delete_elem(r->map_fd, key);
+	}
+	hist_sum(h, r->percpu, r->ncpus);
+	return 0;
+}
+
+/* Print and reset every histogram in the map */
+static inline void hist_reporter_print(struct hist_reporter *r, __u64 now_ns)
+{
+	size_t n = 0;
+
+	if (!r->keys)
+		return;
+	while (n < HIST_MAX_ENTRIES &&
+	       !bpf_map_get_next_key(r->map_fd, n ? &r->keys[n - 1] : NULL, &r->keys[n]))
+		n++;
+
+	for (size_t i = 0; i < n; i++) {
+		struct hist h;
+
+		if (hist_reporter_take(r, &r->keys[i], &h) || !h.count)
+			continue;
+		hist_print(r->out, r->ts_key, now_ns, r->tracer, now_ns - r->last_ns, &r->keys[i], &h);
+	}
+	r->last_ns = now_ns;
+}
+
+/* Print the histograms if the configured interval has elapsed */
+static inline void hist_reporter_tick(struct hist_reporter *r)
+{
+	__u64 now_ns;
+
+	if (!r->interval_ns)
+		return;
+	now_ns = stats_now_ns();
+	if (now_ns - r->last_ns >= r->interval_ns)
+		hist_reporter_print(r, now_ns);
+}
+
+#endif /* __bpf__ */
+
+#endif /* __STATS_H */
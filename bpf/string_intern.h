@@ -0,0 +1,238 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __STRING_INTERN_H
+#define __STRING_INTERN_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * --intern-strings: the comm, paths and command lines that repeat on every
+ * event are written once as a STRING_DEF record and then referenced by id
+ * (see jw_intern() in json_writer.h for the output side).
+ *
+ * The table holds up to capacity strings in a fixed pool, found through an
+ * open-addressed index on their hash and kept in LRU order. Ids are pool
+ * indices, so they stay below capacity: once the table is full the least
+ * recently used string hands its id to the new one and the reader has to
+ * let a STRING_DEF replace whatever its id stood for before.
+ */
+
+#define STRING_INTERN_DEFAULT_CAPACITY 4096
+#define STRING_INTERN_MAX_CAPACITY (1U << 20)
+#define STRING_INTERN_NONE (-1)
+
+struct string_intern_entry {
+	uint64_t hash;
+	char *str;                   /* NULL while the entry is free */
+	uint32_t len;
+	int32_t lru_prev, lru_next;  /* pool indices, STRING_INTERN_NONE terminated */
+};
+
+struct string_intern {
+	uint32_t capacity;
+	uint32_t index_mask;
+	int32_t *index;                       /* index_mask + 1 slots, pool index or NONE */
+	struct string_intern_entry *entries;  /* capacity entries */
+	uint32_t count;                       /* entries in use, taken in pool order */
+	int32_t lru_head, lru_tail;           /* head is the next to be replaced */
+	uint64_t defs;                        /* strings (re)defined */
+};
+
+/* FNV-1a over @n bytes */
+static inline uint64_t string_intern_hash(const char *s, size_t n)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (n--) {
+		hash ^= (unsigned char)*s++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static inline uint32_t string_intern_home(const struct string_intern *t, uint64_t hash)
+{
+	return (uint32_t)(hash ^ (hash >> 29)) & t->index_mask;
+}
+
+static inline void string_intern_free(struct string_intern *t)
+{
+	for (uint32_t i = 0; t->entries && i < t->count; i++)
+		free(t->entries[i].str);
+	free(t->index);
+	free(t->entries);
+	memset(t, 0, sizeof(*t));
+}
+
+/* Forget every string, so each is defined again on its next use */
+static inline void string_intern_reset(struct string_intern *t)
+{
+	for (uint32_t i = 0; i < t->count; i++) {
+		free(t->entries[i].str);
+		t->entries[i].str = NULL;
+	}
+	for (uint32_t i = 0; i <= t->index_mask; i++)
+		t->index[i] = STRING_INTERN_NONE;
+	t->count = 0;
+	t->lru_head = t->lru_tail = STRING_INTERN_NONE;
+}
+
+/* Allocate a table for @capacity strings, returns 0 or -errno */
+static inline int string_intern_init(struct string_intern *t, uint32_t capacity)
+{
+	uint32_t index_size = 2;
+
+	memset(t, 0, sizeof(*t));
+	if (capacity == 0 || capacity > STRING_INTERN_MAX_CAPACITY)
+		return -EINVAL;
+
+	/* keep the index at most half full so probe chains stay short */
+	while (index_size < capacity * 2)
+		index_size <<= 1;
+
+	t->capacity = capacity;
+	t->index_mask = index_size - 1;
+	t->index = malloc(index_size * sizeof(*t->index));
+	t->entries = calloc(capacity, sizeof(*t->entries));
+	if (!t->index || !t->entries) {
+		string_intern_free(t);
+		return -ENOMEM;
+	}
+	for (uint32_t i = 0; i < index_size; i++)
+		t->index[i] = STRING_INTERN_NONE;
+	t->lru_head = t->lru_tail = STRING_INTERN_NONE;
+	return 0;
+}
+
+/* Index slot holding @s, or the empty slot it would go into */
+static inline uint32_t string_intern_lookup(const struct string_intern *t, const char *s,
+					    size_t n, uint64_t hash)
+{
+	uint32_t slot = string_intern_home(t, hash);
+
+	for (;;) {
+		int32_t idx = t->index[slot];
+		const struct string_intern_entry *e;
+
+		if (idx == STRING_INTERN_NONE)
+			return slot;
+		e = &t->entries[idx];
+		if (e->hash == hash && e->len == n && memcmp(e->str, s, n) == 0)
+			return slot;
+		slot = (slot + 1) & t->index_mask;
+	}
+}
+
+/* Backward-shift deletion, as in file_dedup_index_delete() */
+static inline void string_intern_index_delete(struct string_intern *t, uint32_t hole)
+{
+	uint32_t slot = hole;
+
+	t->index[hole] = STRING_INTERN_NONE;
+	for (;;) {
+		uint32_t want;
+		int32_t idx;
+
+		slot = (slot + 1) & t->index_mask;
+		idx = t->index[slot];
+		if (idx == STRING_INTERN_NONE)
+			return;
+		want = string_intern_home(t, t->entries[idx].hash);
+		/* move it if its home slot is not in (hole, slot] */
+		if (((slot - want) & t->index_mask) >= ((slot - hole) & t->index_mask)) {
+			t->index[hole] = idx;
+			t->index[slot] = STRING_INTERN_NONE;
+			hole = slot;
+		}
+	}
+}
+
+static inline void string_intern_lru_unlink(struct string_intern *t, int32_t idx)
+{
+	struct string_intern_entry *e = &t->entries[idx];
+
+	if (e->lru_prev != STRING_INTERN_NONE)
+		t->entries[e->lru_prev].lru_next = e->lru_next;
+	else
+		t->lru_head = e->lru_next;
+	if (e->lru_next != STRING_INTERN_NONE)
+		t->entries[e->lru_next].lru_prev = e->lru_prev;
+	else
+		t->lru_tail = e->lru_prev;
+}
+
+static inline void string_intern_lru_append(struct string_intern *t, int32_t idx)
+{
+	struct string_intern_entry *e = &t->entries[idx];
+
+	e->lru_prev = t->lru_tail;
+	e->lru_next = STRING_INTERN_NONE;
+	if (t->lru_tail != STRING_INTERN_NONE)
+		t->entries[t->lru_tail].lru_next = idx;
+	else
+		t->lru_head = idx;
+	t->lru_tail = idx;
+}
+
+/*
+ * Id of the @n bytes at @s. *@is_new is set when the id was just assigned
+ * (or taken from the least recently used string), so the reader still needs
+ * its STRING_DEF. STRING_INTERN_NONE if the copy could not be allocated.
+ */
+static inline int32_t string_intern_get(struct string_intern *t, const char *s, size_t n,
+					bool *is_new)
+{
+	uint64_t hash = string_intern_hash(s, n);
+	uint32_t slot = string_intern_lookup(t, s, n, hash);
+	struct string_intern_entry *e;
+	int32_t idx = t->index[slot];
+	char *copy;
+
+	*is_new = false;
+	if (idx != STRING_INTERN_NONE) {
+		string_intern_lru_unlink(t, idx);
+		string_intern_lru_append(t, idx);
+		return idx;
+	}
+
+	copy = malloc(n + 1);
+	if (!copy)
+		return STRING_INTERN_NONE;
+	memcpy(copy, s, n);
+	copy[n] = '\0';
+
+	if (t->count < t->capacity) {
+		idx = t->count++;
+	} else {
+		idx = t->lru_head;
+		e = &t->entries[idx];
+		string_intern_index_delete(t, string_intern_lookup(t, e->str, e->len, e->hash));
+		string_intern_lru_unlink(t, idx);
+		free(e->str);
+		/* the deletion may have shifted our empty slot */
+		slot = string_intern_lookup(t, s, n, hash);
+	}
+
+	e = &t->entries[idx];
+	e->hash = hash;
+	e->str = copy;
+	e->len = n;
+	t->index[slot] = idx;
+	string_intern_lru_append(t, idx);
+	t->defs++;
+	*is_new = true;
+	return idx;
+}
+
+/* String behind @id, NULL if it was never assigned */
+static inline const char *string_intern_str(const struct string_intern *t, int32_t id)
+{
+	if (id < 0 || (uint32_t)id >= t->count)
+		return NULL;
+	return t->entries[id].str;
+}
+
+#endif /* __STRING_INTERN_H */
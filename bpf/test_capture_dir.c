@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "json_writer.h"
+#include "binary_format.h"
+#include "output_transport.h"
+#include "capture_dir.h"
+
+// Test colors for output
+#define RESET   "\033[0m"
+#define RED     "\033[31m"
+#define GREEN   "\033[32m"
+#define YELLOW  "\033[33m"
+#define BLUE    "\033[34m"
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+void test_assert(bool condition, const char *test_name) {
+    if (condition) {
+        printf("[" GREEN "PASS" RESET "] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[" RED "FAIL" RESET "] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+// One line of index.jsonl
+struct frame {
+    char segment[64];
+    uint64_t offset, bytes, raw_bytes, records;
+    uint64_t min_ts, max_ts, min_pid, max_pid;
+};
+
+static int read_index(const char *dir, struct frame *frames, int max) {
+    char path[PATH_MAX], line[1024];
+    int n = 0;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/" CAPTURE_INDEX, dir);
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+    while (n < max && fgets(line, sizeof(line), f)) {
+        struct frame *fr = &frames[n++];
+        size_t len = strlen(line);
+
+        memset(fr, 0, sizeof(*fr));
+        sscanf(line, "{\"segment\":\"%63[^\"]\"", fr->segment);
+        capture_dir_json_u64(line, len, "\"offset\":", &fr->offset);
+        capture_dir_json_u64(line, len, "\"bytes\":", &fr->bytes);
+        capture_dir_json_u64(line, len, "\"raw_bytes\":", &fr->raw_bytes);
+        capture_dir_json_u64(line, len, "\"records\":", &fr->records);
+        capture_dir_json_u64(line, len, "\"min_ts_ns\":", &fr->min_ts);
+        capture_dir_json_u64(line, len, "\"max_ts_ns\":", &fr->max_ts);
+        capture_dir_json_u64(line, len, "\"min_pid\":", &fr->min_pid);
+        capture_dir_json_u64(line, len, "\"max_pid\":", &fr->max_pid);
+    }
+    fclose(f);
+    return n;
+}
+
+static ssize_t read_frame(const char *dir, const struct frame *fr, char **out) {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, fr->segment);
+    return capture_dir_read_frame(path, fr->offset, fr->bytes, out);
+}
+
+static void make_dir(char *dir) {
+    strcpy(dir, "/tmp/test_capture_dir.XXXXXX");
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        exit(1);
+    }
+}
+
+static void remove_dir(const char *dir) {
+    char cmd[PATH_MAX + 16];
+
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    if (system(cmd) != 0)
+        fprintf(stderr, "Failed to remove %s\n", dir);
+}
+
+static void write_json(struct json_writer *w, uint64_t ts, int pid, const char *comm) {
+    jw_begin(w);
+    jw_field_u64(w, "timestamp", ts);
+    jw_field_str(w, "event", "EXEC");
+    jw_field_interned(w, "comm", comm);
+    jw_field_i64(w, "pid", pid);
+    jw_field_str(w, "full_command", "/usr/bin/python3 -m http.server --bind 127.0.0.1 8080");
+    jw_end(w);
+}
+
+void test_json_frames() {
+    struct json_writer w;
+    struct frame frames[8];
+    const char *first = "{\"timestamp\":1000,\"event\":\"EXEC\",\"comm\":\"python3\",\"pid\":42,";
+    char dir[64], *data = NULL;
+    ssize_t len;
+    int n;
+
+    printf("\n" BLUE "Testing JSON frames:" RESET "\n");
+
+    make_dir(dir);
+    test_assert(output_open_dir(&w, dir, 0) == 0, "The directory opens as an output");
+    write_json(&w, 1000, 42, "python3");
+    write_json(&w, 3000, 7, "python3");
+    write_json(&w, 2000, 99, "python3");
+    jw_flush(&w);
+    test_assert(read_index(dir, frames, 8) == 0, "A small batch stays in the open frame");
+    output_close(&w);
+
+    n = read_index(dir, frames, 8);
+    test_assert(n == 1 && strcmp(frames[0].segment, "seg-00000001.jsonl.gz") == 0 &&
+                frames[0].offset == 0 && frames[0].records == 3,
+                "Closing writes the last frame to the first segment");
+    test_assert(frames[0].min_ts == 1000 && frames[0].max_ts == 3000 &&
+                frames[0].min_pid == 7 && frames[0].max_pid == 99,
+                "Its index line covers the timestamps and pids inside");
+    len = read_frame(dir, &frames[0], &data);
+    test_assert(len == (ssize_t)frames[0].raw_bytes && len > (ssize_t)strlen(first) &&
+                memcmp(data, first, strlen(first)) == 0 &&
+                data[len - 1] == '\n',
+                "The frame inflates back to the JSON lines");
+    free(data);
+    remove_dir(dir);
+}
+
+void test_idle_frame() {
+    struct json_writer w;
+    struct capture_dir *c;
+    struct frame frames[8];
+    char dir[64];
+
+    printf("\n" BLUE "Testing idle frames:" RESET "\n");
+
+    make_dir(dir);
+    output_open_dir(&w, dir, 0);
+    c = w.write_ctx;
+    write_json(&w, 1000, 42, "python3");
+    jw_batch_end(&w);
+    jw_batch_end(&w);
+    test_assert(read_index(dir, frames, 8) == 0, "A young frame stays open while idle");
+
+    // Nothing more arrives until the frame is overdue
+    c->frame_start_ns -= CAPTURE_FRAME_MAX_MS * 1000000ULL;
+    jw_batch_end(&w);
+    test_assert(read_index(dir, frames, 8) == 1 && frames[0].records == 1,
+                "An idle poll closes the overdue frame");
+    jw_batch_end(&w);
+    output_close(&w);
+    test_assert(read_index(dir, frames, 8) == 1, "and leaves nothing behind for close");
+    remove_dir(dir);
+}
+
+void test_frame_cut() {
+    struct string_intern strings;
+    struct json_writer w;
+    struct frame frames[16];
+    const char *def = "{\"event\":\"STRING_DEF\",\"id\":0,\"value\":\"python3\"}\n";
+    char dir[64], *data = NULL;
+    bool standalone = true, contiguous = true;
+    uint64_t records = 0;
+    ssize_t len;
+    int n;
+
+    printf("\n" BLUE "Testing frame boundaries:" RESET "\n");
+
+    make_dir(dir);
+    output_open_dir(&w, dir, 0);
+    string_intern_init(&strings, 16);
+    w.intern = &strings;
+    for (int i = 0; i < 30000; i++)
+        write_json(&w, 1000 + i, 100 + i % 50, "python3");
+    output_close(&w);
+
+    n = read_index(dir, frames, 16);
+    test_assert(n >= 2, "A large capture is cut into several frames");
+    for (int i = 0; i < n; i++) {
+        records += frames[i].records;
+        if (i && frames[i].offset != frames[i - 1].offset + frames[i - 1].bytes)
+            contiguous = false;
+        if (i + 1 < n && frames[i].raw_bytes < CAPTURE_FRAME_BYTES)
+            standalone = false;
+    }
+    test_assert(contiguous, "Frames follow each other in the segment");
+    test_assert(standalone && records == 30000 + (uint64_t)n, "Every record, and one STRING_DEF per frame, is indexed once");
+    test_assert(n >= 2 && frames[1].min_ts == frames[0].max_ts + 1, "Frames split at record boundaries");
+
+    len = read_frame(dir, &frames[1], &data);
+    test_assert(len > (ssize_t)strlen(def) && memcmp(data, def, strlen(def)) == 0,
+                "A later frame defines its strings again");
+    free(data);
+    string_intern_free(&strings);
+
+    // A restart in the same directory starts a new segment
+    output_open_dir(&w, dir, 0);
+    write_json(&w, 99999, 1, "bash");
+    output_close(&w);
+    n = read_index(dir, frames, 16);
+    test_assert(n >= 3 && strcmp(frames[n - 1].segment, "seg-00000002.jsonl.gz") == 0 &&
+                frames[n - 1].offset == 0,
+                "A restart continues after the last segment");
+    remove_dir(dir);
+}
+
+void test_binary_frames() {
+    struct json_writer w;
+    struct frame frames[16];
+    char dir[64], *data = NULL;
+    bool headers = true;
+    ssize_t len;
+    int n;
+
+    printf("\n" BLUE "Testing binary frames:" RESET "\n");
+
+    make_dir(dir);
+    output_open_dir(&w, dir, 0);
+    bin_stream_start(&w);
+    for (int i = 0; i < 40000; i++) {
+        bin_event_begin(&w, BIN_RECORD_EXEC, 5000 + i, 300 + i % 10, "bash");
+        bin_u32(&w, 1);
+        bin_str(&w, "/usr/bin/bash");
+        bin_str(&w, "bash -c 'echo running the nightly build and its test suite'");
+        bin_event_end(&w, NULL);
+    }
+    jw_begin(&w);
+    jw_field_u64(&w, "timestamp", 90000);
+    jw_field_i64(&w, "pid", 2);
+    jw_end(&w);
+    output_close(&w);
+
+    n = read_index(dir, frames, 16);
+    test_assert(n >= 2 && strcmp(frames[0].segment, "seg-00000001.agsb.gz") == 0,
+                "Binary output goes to .agsb.gz segments");
+    for (int i = 0; i < n; i++) {
+        len = read_frame(dir, &frames[i], &data);
+        if (len < 8 || memcmp(data, "AGSB\x03", 5) != 0)
+            headers = false;
+        free(data);
+        data = NULL;
+    }
+    test_assert(headers, "Every frame starts with its own stream header");
+    test_assert(frames[0].min_ts == 5000 && frames[0].min_pid == 300 && frames[0].max_pid == 309,
+                "Event records give the timestamps and pids");
+    test_assert(frames[n - 1].max_ts == 90000 && frames[n - 1].min_pid == 2,
+                "as do JSON records inside");
+    remove_dir(dir);
+}
+
+int main() {
+    printf(YELLOW "===== Capture Dir Tests =====" RESET "\n");
+
+    test_json_frames();
+    test_idle_frame();
+    test_frame_cut();
+    test_binary_frames();
+
+    printf("\n" YELLOW "===== Test Summary =====" RESET "\n");
+    printf("Tests passed: " GREEN "%d" RESET "\n", tests_passed);
+    printf("Tests failed: " RED "%d" RESET "\n", tests_failed);
+    printf("Total tests:  %d\n", tests_passed + tests_failed);
+
+    if (tests_failed == 0) {
+        printf(GREEN "All tests passed!" RESET "\n");
+        return 0;
+    } else {
+        printf(RED "Some tests failed!" RESET "\n");
+        return 1;
+    }
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "event_loop.h"
+
+#include <sys/eventfd.h>
+#include <time.h>
+
+// Test colors for output
+#define RESET   "\033[0m"
+#define RED     "\033[31m"
+#define GREEN   "\033[32m"
+#define YELLOW  "\033[33m"
+#define BLUE    "\033[34m"
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+void test_assert(bool condition, const char *test_name) {
+    if (condition) {
+        printf("[" GREEN "PASS" RESET "] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[" RED "FAIL" RESET "] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+void test_timeout_and_wake() {
+    printf("\n" BLUE "Testing timeouts and eventfd wakeups..." RESET "\n");
+
+    struct event_loop l;
+    uint64_t one = 1;
+
+    test_assert(event_loop_init(&l) == 0, "Event loop initialises");
+
+    uint64_t start = now_ms();
+    test_assert(event_loop_wait(&l, 20) == 0, "Nothing fired returns 0");
+    test_assert(now_ms() - start >= 19, "Wait honours the timeout");
+
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    test_assert(event_loop_add(&l, efd, EVENT_LOOP_WAKE) == 0, "eventfd is added");
+    write(efd, &one, sizeof(one));
+    write(efd, &one, sizeof(one));
+    start = now_ms();
+    test_assert(event_loop_wait(&l, 1000) == EVENT_LOOP_WAKE, "eventfd wakes the loop");
+    test_assert(now_ms() - start < 500, "Wakeup does not wait for the timeout");
+    test_assert(event_loop_wait(&l, 0) == 0, "The eventfd count is consumed by the wait");
+
+    // A ring's epoll fd is only reported, consuming it is up to the caller
+    int ring = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    event_loop_add(&l, ring, EVENT_LOOP_RING);
+    write(ring, &one, sizeof(one));
+    write(efd, &one, sizeof(one));
+    test_assert(event_loop_wait(&l, 1000) == (EVENT_LOOP_RING | EVENT_LOOP_WAKE),
+                "Several sources are reported together");
+    test_assert(event_loop_wait(&l, 0) == EVENT_LOOP_RING, "Ring readiness is left to the caller");
+
+    close(ring);
+    close(efd);
+    event_loop_free(&l);
+}
+
+void test_tick() {
+    printf("\n" BLUE "Testing the wakeup tick..." RESET "\n");
+
+    struct event_loop l;
+    int ticks = 0;
+
+    event_loop_init(&l);
+    test_assert(event_loop_set_tick(&l, WAKEUP_TICK_MS) == 0, "Tick timer is set up");
+
+    uint64_t start = now_ms();
+    while (now_ms() - start < 100) {
+        if (event_loop_wait(&l, 100) & EVENT_LOOP_TIMER)
+            ticks++;
+    }
+    test_assert(ticks >= 5 && ticks <= 11, "Tick fires every WAKEUP_TICK_MS");
+
+    event_loop_free(&l);
+    test_assert(l.epfd == -1 && l.timerfd == -1, "Freeing closes every fd");
+}
+
+void test_signals() {
+    printf("\n" BLUE "Testing signal handling..." RESET "\n");
+
+    struct event_loop l;
+
+    event_loop_init(&l);
+    test_assert(event_loop_handle_signals(&l) == 0, "signalfd is set up");
+
+    // Blocked, so this is queued on the signalfd instead of killing us
+    raise(SIGTERM);
+    test_assert(!l.stop, "Nothing stops before the loop runs");
+    test_assert(event_loop_wait(&l, 1000) == EVENT_LOOP_SIGNAL && l.stop, "SIGTERM stops the loop");
+
+    l.stop = false;
+    raise(SIGINT);
+    test_assert(event_loop_wait(&l, 1000) == EVENT_LOOP_SIGNAL && l.stop, "SIGINT stops the loop");
+
+    event_loop_free(&l);
+}
+
+int main() {
+    printf(YELLOW "===== Event Loop Tests =====" RESET "\n");
+
+    test_timeout_and_wake();
+    test_tick();
+    test_signals();
+
+    printf("\n" YELLOW "===== Test Summary =====" RESET "\n");
+    printf("Tests passed: " GREEN "%d" RESET "\n", tests_passed);
+    printf("Tests failed: " RED "%d" RESET "\n", tests_failed);
+    printf("Total tests:  %d\n", tests_passed + tests_failed);
+
+    if (tests_failed == 0) {
+        printf(GREEN "All tests passed!" RESET "\n");
+        return 0;
+    } else {
+        printf(RED "Some tests failed!" RESET "\n");
+        return 1;
+    }
+}
@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "process.h"
+#include "file_dedup.h"
+
+// Test colors for output
+#define RESET   "\033[0m"
+#define RED     "\033[31m"
+#define GREEN   "\033[32m"
+#define YELLOW  "\033[33m"
+#define BLUE    "\033[34m"
+
+#define SEC_NS 1000000000ULL
+#define WINDOW_NS (60 * SEC_NS)
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+void test_assert(bool condition, const char *test_name) {
+    if (condition) {
+        printf("[" GREEN "PASS" RESET "] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[" RED "FAIL" RESET "] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+// Records everything the table reports through its emit callback
+struct emitted {
+    int calls;
+    pid_t last_pid;
+    uint32_t last_count;
+    char last_path[MAX_FILENAME_LEN];
+    char last_extra[64];
+};
+
+static void record_emit(const struct file_dedup_entry *f, uint64_t timestamp_ns,
+                        const char *extra, void *ctx) {
+    struct emitted *out = ctx;
+
+    out->calls++;
+    out->last_pid = f->pid;
+    out->last_count = f->count;
+    snprintf(out->last_path, sizeof(out->last_path), "%s", f->filepath);
+    snprintf(out->last_extra, sizeof(out->last_extra), "%s", extra);
+}
+
+static uint32_t open_file(struct file_dedup *d, pid_t pid, const char *path, uint64_t ts,
+                          struct emitted *out) {
+    return file_dedup_record(d, pid, "test", path, 0, ts, record_emit, out);
+}
+
+void test_init() {
+    printf("\n" BLUE "Testing file_dedup_init:" RESET "\n");
+
+    struct file_dedup d;
+
+    test_assert(file_dedup_init(&d, 0, WINDOW_NS) == -EINVAL, "zero capacity should be rejected");
+    test_assert(file_dedup_init(&d, 100, WINDOW_NS) == 0, "init should succeed");
+    test_assert(d.index_mask + 1 >= 200, "index should be at least twice the capacity");
+    test_assert(((d.index_mask + 1) & d.index_mask) == 0, "index size should be a power of two");
+    test_assert(d.file_count == 0 && d.pid_count == 0, "new table should be empty");
+    file_dedup_free(&d);
+}
+
+void test_record_and_count() {
+    printf("\n" BLUE "Testing file_dedup_record counts:" RESET "\n");
+
+    struct file_dedup d;
+    struct emitted out = {0};
+
+    file_dedup_init(&d, 16, WINDOW_NS);
+    test_assert(open_file(&d, 100, "/etc/passwd", 1 * SEC_NS, &out) == 1, "first open should count 1");
+    test_assert(open_file(&d, 100, "/etc/passwd", 2 * SEC_NS, &out) == 2, "repeat open should count 2");
+    test_assert(open_file(&d, 100, "/etc/passwd", 3 * SEC_NS, &out) == 3, "repeat open should count 3");
+    test_assert(open_file(&d, 200, "/etc/passwd", 3 * SEC_NS, &out) == 1, "same path in another pid is separate");
+    test_assert(open_file(&d, 100, "/etc/hosts", 3 * SEC_NS, &out) == 1, "another path in same pid is separate");
+    test_assert(d.file_count == 3, "three distinct entries");
+    test_assert(d.pid_count == 2, "two pid states");
+    test_assert(out.calls == 0, "nothing should be emitted yet");
+    file_dedup_free(&d);
+}
+
+void test_window_expiry() {
+    printf("\n" BLUE "Testing sliding window expiry:" RESET "\n");
+
+    struct file_dedup d;
+    struct emitted out = {0};
+
+    file_dedup_init(&d, 16, WINDOW_NS);
+    open_file(&d, 100, "/a", 0, &out);
+    open_file(&d, 100, "/a", 10 * SEC_NS, &out);
+    open_file(&d, 100, "/b", 20 * SEC_NS, &out);
+
+    file_dedup_expire(&d, 65 * SEC_NS, record_emit, &out);
+    test_assert(d.file_count == 2, "hit at 10s keeps /a alive at 65s");
+
+    file_dedup_expire(&d, 71 * SEC_NS, record_emit, &out);
+    test_assert(d.file_count == 1, "/a should expire after 60s without opens");
+    test_assert(out.calls == 1 && out.last_count == 2, "expired /a should report its count");
+    test_assert(strcmp(out.last_path, "/a") == 0, "expired entry should be /a");
+    test_assert(strcmp(out.last_extra, "\"window_expired\":true") == 0, "expiry should be marked");
+
+    file_dedup_expire(&d, 81 * SEC_NS, record_emit, &out);
+    test_assert(d.file_count == 0, "/b should expire too");
+    test_assert(out.calls == 1, "single opens should expire silently");
+
+    file_dedup_expire(&d, 0, record_emit, &out);
+    test_assert(open_file(&d, 100, "/a", 90 * SEC_NS, &out) == 1, "expired path should count 1 again");
+    file_dedup_free(&d);
+}
+
+void test_out_of_order_timestamps() {
+    printf("\n" BLUE "Testing out of order timestamps:" RESET "\n");
+
+    struct file_dedup d;
+    struct emitted out = {0};
+
+    file_dedup_init(&d, 16, WINDOW_NS);
+    open_file(&d, 100, "/a", 10 * SEC_NS, &out);
+    file_dedup_expire(&d, 9 * SEC_NS, record_emit, &out);
+    test_assert(d.file_count == 1, "older timestamp should not expire newer entry");
+    open_file(&d, 100, "/a", 5 * SEC_NS, &out);
+    test_assert(d.files[d.lru_head].timestamp_ns == 10 * SEC_NS, "last seen should not move backwards");
+    file_dedup_free(&d);
+}
+
+void test_capacity_eviction() {
+    printf("\n" BLUE "Testing capacity eviction:" RESET "\n");
+
+    struct file_dedup d;
+    struct emitted out = {0};
+    char path[32];
+
+    file_dedup_init(&d, 4, WINDOW_NS);
+    open_file(&d, 100, "/f0", 1, &out);
+    open_file(&d, 100, "/f0", 2, &out);
+    for (int i = 1; i < 4; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        open_file(&d, 100, path, 10 + i, &out);
+    }
+    test_assert(d.file_count == 4, "table should be full");
+
+    test_assert(open_file(&d, 100, "/f4", 20, &out) == 1, "insert into full table should succeed");
+    test_assert(d.file_count == 4, "table should stay at capacity");
+    test_assert(out.calls == 1 && strcmp(out.last_path, "/f0") == 0, "least recently used entry evicted");
+    test_assert(strcmp(out.last_extra, "\"reason\":\"capacity\"") == 0, "eviction should be marked");
+
+    for (int i = 1; i < 5; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        test_assert(open_file(&d, 100, path, 30, &out) == 2, "remaining entries still aggregate");
+    }
+    file_dedup_free(&d);
+}
+
+void test_flush_pid() {
+    printf("\n" BLUE "Testing file_dedup_flush_pid:" RESET "\n");
+
+    struct file_dedup d;
+    struct emitted out = {0};
+
+    file_dedup_init(&d, 16, WINDOW_NS);
+    open_file(&d, 100, "/a", 1, &out);
+    open_file(&d, 100, "/a", 2, &out);
+    open_file(&d, 100, "/b", 3, &out);
+    open_file(&d, 200, "/a", 4, &out);
+    open_file(&d, 200, "/a", 5, &out);
+
+    test_assert(file_dedup_flush_pid(&d, 100, 10, record_emit, &out) == 2, "pid 100 owns two entries");
+    test_assert(out.calls == 1 && out.last_pid == 100 && out.last_count == 2, "only repeats are reported");
+    test_assert(strcmp(out.last_extra, "\"reason\":\"process_exit\"") == 0, "exit flush should be marked");
+    test_assert(file_dedup_pid_find(&d, 100) == NULL, "pid state should be released");
+    test_assert(d.file_count == 1 && d.pid_count == 1, "pid 200 should be untouched");
+    test_assert(open_file(&d, 200, "/a", 6, &out) == 3, "pid 200 keeps aggregating");
+    test_assert(file_dedup_flush_pid(&d, 300, 10, record_emit, &out) == 0, "unknown pid flushes nothing");
+    file_dedup_free(&d);
+}
+
+void test_pid_state() {
+    printf("\n" BLUE "Testing pid state pool:" RESET "\n");
+
+    struct file_dedup d;
+
+    file_dedup_init(&d, 2, WINDOW_NS);
+    struct file_dedup_pid *a = file_dedup_pid_get(&d, 1);
+    struct file_dedup_pid *b = file_dedup_pid_get(&d, 2);
+
+    test_assert(a && b && a != b, "two pids get separate state");
+    test_assert(file_dedup_pid_get(&d, 1) == a, "lookup returns the same state");
+    test_assert(file_dedup_pid_get(&d, 3) == NULL, "exhausted pool returns NULL");
+
+    file_dedup_pid_release(&d, 1);
+    test_assert(file_dedup_pid_find(&d, 1) == NULL, "released pid is gone");
+    struct file_dedup_pid *c = file_dedup_pid_get(&d, 3);
+    test_assert(c == a && c->pid == 3 && c->files == FILE_DEDUP_NONE, "released slot is reused and cleared");
+    test_assert(file_dedup_pid_find(&d, 2) == b, "other pid survives release");
+    file_dedup_free(&d);
+}
+
+void test_pid_state_without_exit() {
+    printf("\n" BLUE "Testing pid states of processes whose EXIT was lost:" RESET "\n");
+
+    struct file_dedup d;
+    struct emitted out = {0};
+
+    // More short-lived pids than the pool holds, none of them ever flushed
+    file_dedup_init(&d, 4, WINDOW_NS);
+    for (int pid = 100; pid < 110; pid++)
+        open_file(&d, pid, "/etc/ld.so.cache", pid, &out);
+    test_assert(d.pid_count == d.file_count && d.pid_count <= d.capacity,
+                "capacity eviction frees the pid of its last entry");
+
+    file_dedup_expire(&d, 200 * SEC_NS, record_emit, &out);
+    test_assert(d.file_count == 0 && d.pid_count == 0, "window expiry frees the pid states");
+
+    for (int pid = 200; pid < 204; pid++)
+        open_file(&d, pid, "/etc/hosts", 201 * SEC_NS, &out);
+    test_assert(open_file(&d, 300, "/etc/hosts", 202 * SEC_NS, &out) == 1 &&
+                open_file(&d, 300, "/etc/hosts", 203 * SEC_NS, &out) == 2,
+                "a new pid still aggregates");
+    test_assert(file_dedup_flush_pid(&d, 300, 204 * SEC_NS, record_emit, &out) == 1 &&
+                file_dedup_pid_find(&d, 300) == NULL && d.pid_count == d.file_count,
+                "flushing a pid still releases it once");
+    file_dedup_free(&d);
+}
+
+void test_churn() {
+    printf("\n" BLUE "Testing index consistency under churn:" RESET "\n");
+
+    struct file_dedup d;
+    struct emitted out = {0};
+    char path[32];
+    bool ok = true;
+
+    // Small table so probe chains wrap and backward shifts happen often
+    file_dedup_init(&d, 64, WINDOW_NS);
+    for (int round = 0; round < 50 && ok; round++) {
+        for (int i = 0; i < 64; i++) {
+            snprintf(path, sizeof(path), "/r%d/f%d", round, i);
+            open_file(&d, 1000 + (i % 7), path, round, &out);
+        }
+        for (int pid = 1000; pid < 1007; pid += 2)
+            file_dedup_flush_pid(&d, pid, round, record_emit, &out);
+        for (int i = 1; i < 64; i += 7) {
+            snprintf(path, sizeof(path), "/r%d/f%d", round, i);
+            if (open_file(&d, 1000 + (i % 7), path, round, &out) != 2)
+                ok = false;
+        }
+    }
+    test_assert(ok, "surviving entries are still found after deletes");
+    test_assert(d.file_count <= d.capacity, "entry count stays within capacity");
+    file_dedup_free(&d);
+}
+
+static int removed_calls = 0;
+
+static void count_remove(const struct file_dedup_entry *f, uint64_t timestamp_ns,
+                         const char *extra, void *ctx) {
+    removed_calls++;
+}
+
+void test_kernel_counts() {
+    printf("\n" BLUE "Testing in-kernel count folding:" RESET "\n");
+
+    struct file_dedup d;
+    struct emitted out = {0};
+
+    file_dedup_init(&d, 16, WINDOW_NS);
+    d.on_remove = count_remove;
+    removed_calls = 0;
+
+    open_file(&d, 100, "/lib/libc.so.6", 1 * SEC_NS, &out);
+    struct file_dedup_entry *f = file_dedup_find_hash(&d, 100, file_dedup_hash_path("/lib/libc.so.6"));
+    test_assert(f != NULL, "entry should be found by hash");
+    test_assert(file_dedup_find_hash(&d, 101, f->path_hash) == NULL, "hash lookup should match the pid");
+
+    file_dedup_add_kernel_count(&d, f, 5, 2 * SEC_NS);
+    test_assert(f->count == 6, "five kernel repeats added to the first open");
+    file_dedup_add_kernel_count(&d, f, 5, 2 * SEC_NS);
+    test_assert(f->count == 6, "draining the same count twice adds nothing");
+    file_dedup_add_kernel_count(&d, f, 8, 30 * SEC_NS);
+    test_assert(f->count == 9, "only the delta since the last drain is added");
+    test_assert(f->timestamp_ns == 30 * SEC_NS, "kernel last open restarts the window");
+    file_dedup_add_kernel_count(&d, f, 2, 31 * SEC_NS);
+    test_assert(f->count == 11, "a reset kernel counter counts from zero");
+
+    file_dedup_expire(&d, 80 * SEC_NS, record_emit, &out);
+    test_assert(d.file_count == 1, "entry kept alive by the kernel timestamp");
+    file_dedup_expire(&d, 92 * SEC_NS, record_emit, &out);
+    test_assert(out.calls == 1 && out.last_count == 11, "expiry reports the folded count");
+    test_assert(removed_calls == 1, "on_remove runs for removed entries");
+
+    open_file(&d, 100, "/once", 100 * SEC_NS, &out);
+    file_dedup_flush_pid(&d, 100, 101 * SEC_NS, record_emit, &out);
+    test_assert(removed_calls == 2 && out.calls == 1, "on_remove also runs for single opens");
+    file_dedup_free(&d);
+}
+
+void print_test_summary() {
+    printf("\n" YELLOW "===== Test Summary =====" RESET "\n");
+    printf("Tests passed: " GREEN "%d" RESET "\n", tests_passed);
+    printf("Tests failed: " RED "%d" RESET "\n", tests_failed);
+    printf("Total tests:  %d\n", tests_passed + tests_failed);
+
+    if (tests_failed == 0) {
+        printf(GREEN "All tests passed!" RESET "\n");
+    } else {
+        printf(RED "Some tests failed!" RESET "\n");
+    }
+}
+
+int main() {
+    printf(BLUE "===== File Dedup Test Suite =====" RESET "\n");
+    printf("Testing functions from file_dedup.h\n");
+
+    test_init();
+    test_record_and_count();
+    test_window_expiry();
+    test_out_of_order_timestamps();
+    test_capacity_eviction();
+    test_flush_pid();
+    test_pid_state();
+    test_pid_state_without_exit();
+    test_churn();
+    test_kernel_counts();
+
+    print_test_summary();
+
+    return (tests_failed > 0) ? 1 : 0;
+}
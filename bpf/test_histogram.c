@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+// Test colors for output
+#define RESET   "\033[0m"
+#define RED     "\033[31m"
+#define GREEN   "\033[32m"
+#define YELLOW  "\033[33m"
+#define BLUE    "\033[34m"
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+void test_assert(bool condition, const char *test_name) {
+    if (condition) {
+        printf("[" GREEN "PASS" RESET "] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[" RED "FAIL" RESET "] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+// What the BPF side does for one value, on one CPU's copy
+static void hist_record(struct hist *h, __u64 value) {
+    h->count++;
+    h->sum += value;
+    if (value > h->max)
+        h->max = value;
+    h->slots[hist_slot(value)]++;
+}
+
+void test_slots() {
+    bool ok = true;
+
+    printf("\n" BLUE "Testing log2 slots:" RESET "\n");
+
+    test_assert(hist_slot(0) == 0, "Zero has its own slot");
+    test_assert(hist_slot(1) == 1, "One is slot 1");
+    test_assert(hist_slot(2) == 2 && hist_slot(3) == 2, "2 and 3 share slot 2");
+    test_assert(hist_slot(1023) == 10 && hist_slot(1024) == 11, "Slot changes at a power of two");
+    test_assert(hist_slot(~0ULL) == HIST_SLOTS - 1, "The largest values land in the last slot");
+
+    for (int bit = 0; bit < 64; bit++) {
+        __u64 v = 1ULL << bit;
+
+        if (hist_log2(v) != (__u32)bit || (v > 2 && hist_log2(v - 1) != (__u32)bit - 1))
+            ok = false;
+    }
+    test_assert(ok, "hist_log2 is floor(log2) around every power of two");
+
+    ok = true;
+    for (__u32 slot = 1; slot < HIST_SLOTS - 1; slot++)
+        if (hist_slot(hist_slot_max(slot)) != slot || hist_slot(hist_slot_max(slot) + 1) != slot + 1)
+            ok = false;
+    test_assert(ok, "hist_slot_max is the last value of each slot");
+    test_assert(hist_slot_max(0) == 0 && hist_slot_max(HIST_SLOTS - 1) == ~0ULL,
+                "First and last slot bounds");
+}
+
+void test_sum_and_percentiles() {
+    struct hist percpu[3] = {}, h;
+
+    printf("\n" BLUE "Testing per-CPU sums and percentiles:" RESET "\n");
+
+    // 90 fast calls of ~1us on two CPUs, 10 slow ones of ~1ms on a third
+    for (int i = 0; i < 45; i++) {
+        hist_record(&percpu[0], 1000);
+        hist_record(&percpu[1], 900);
+    }
+    for (int i = 0; i < 10; i++)
+        hist_record(&percpu[2], 1000000 + i);
+
+    hist_sum(&h, percpu, 3);
+    test_assert(h.count == 100, "Counts add up across CPUs");
+    test_assert(h.sum == 45 * 1000 + 45 * 900 + 10 * 1000000 + 45, "Sums add up across CPUs");
+    test_assert(h.max == 1000009, "Max is the largest of the CPUs");
+    test_assert(h.slots[hist_slot(1000)] == 90, "Slots add up across CPUs");
+
+    test_assert(hist_percentile(&h, 50) == 1023, "p50 is the upper bound of the fast slot");
+    test_assert(hist_percentile(&h, 90) == 1023, "p90 is still in the fast slot");
+    test_assert(hist_percentile(&h, 99) == 1000009, "p99 is in the slow slot, capped at the max");
+
+    memset(&h, 0, sizeof(h));
+    test_assert(hist_percentile(&h, 50) == 0, "Empty histogram has no percentiles");
+    hist_record(&h, 0);
+    test_assert(hist_percentile(&h, 99) == 0, "All zeros give zero percentiles");
+}
+
+void test_print() {
+    struct hist_key key = { .comm = "curl", .kind = HIST_SSL_READ };
+    struct hist h = {};
+    struct json_writer w;
+    const char *expected =
+        "{\"timestamp_ns\":5,\"event\":\"HISTOGRAM\",\"tracer\":\"sslsniff\",\"comm\":\"curl\","
+        "\"kind\":\"ssl_read\",\"interval_ms\":10000,\"count\":3,\"sum_ns\":2003,\"avg_ns\":667,"
+        "\"p50_ns\":3,\"p90_ns\":2000,\"p99_ns\":2000,\"max_ns\":2000,"
+        "\"buckets\":{\"1\":1,\"3\":1,\"2047\":1}}\n";
+
+    printf("\n" BLUE "Testing HISTOGRAM lines:" RESET "\n");
+
+    hist_record(&h, 1);
+    hist_record(&h, 2);
+    hist_record(&h, 2000);
+
+    test_assert(jw_init(&w, -1, 0) == 0, "Writer initialises");
+    hist_print(&w, "timestamp_ns", 5, "sslsniff", 10000000000ULL, &key, &h);
+    test_assert(w.len == strlen(expected) && memcmp(w.buf, expected, w.len) == 0,
+                "Summary fields and the non-empty buckets by upper bound");
+
+    // A comm filling all 16 bytes has no NUL in the key
+    memcpy(key.comm, "0123456789abcdef", HIST_COMM_LEN);
+    key.kind = HIST_PROCESS_LIFETIME;
+    w.len = 0;
+    hist_print(&w, "timestamp", 5, "process", 0, &key, &h);
+    jw_char(&w, '\0');
+    test_assert(strstr(w.buf, "\"comm\":\"0123456789abcdef\",\"kind\":\"process_lifetime\"") != NULL,
+                "Full length comm is terminated, kind is named");
+    w.len = 0;
+    jw_free(&w);
+}
+
+int main() {
+    printf(YELLOW "===== Histogram Tests =====" RESET "\n");
+
+    test_slots();
+    test_sum_and_percentiles();
+    test_print();
+
+    printf("\n" YELLOW "===== Test Summary =====" RESET "\n");
+    printf("Tests passed: " GREEN "%d" RESET "\n", tests_passed);
+    printf("Tests failed: " RED "%d" RESET "\n", tests_failed);
+    printf("Total tests:  %d\n", tests_passed + tests_failed);
+
+    if (tests_failed == 0) {
+        printf(GREEN "All tests passed!" RESET "\n");
+        return 0;
+    } else {
+        printf(RED "Some tests failed!" RESET "\n");
+        return 1;
+    }
+}
@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "json_writer.h"
+#include "binary_format.h"
+#include "output_transport.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Test colors for output
+#define RESET   "\033[0m"
+#define RED     "\033[31m"
+#define GREEN   "\033[32m"
+#define YELLOW  "\033[33m"
+#define BLUE    "\033[34m"
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+void test_assert(bool condition, const char *test_name) {
+    if (condition) {
+        printf("[" GREEN "PASS" RESET "] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[" RED "FAIL" RESET "] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+// Writer that never flushes by itself, output is read back from w->buf
+static void writer_reset(struct json_writer *w) {
+    w->len = 0;
+    w->pending_ns = 0;
+}
+
+static bool writer_is(struct json_writer *w, const char *expected) {
+    return w->len == strlen(expected) && memcmp(w->buf, expected, w->len) == 0;
+}
+
+// Byte-at-a-time reference for jw_escaped_utf8()
+static void reference_escape(struct json_writer *w, const unsigned char *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = p[i];
+        if (c >= 0x80) {
+            size_t len = jw_utf8_seq_len(p + i, n - i);
+            if (len) {
+                jw_raw(w, (const char *)p + i, len);
+                i += len - 1;
+            } else {
+                jw_unicode_escape(w, c);
+            }
+        } else if (jw_escape_table[c] != JW_ESC_NONE) {
+            jw_escape_byte(w, c);
+        } else {
+            jw_char(w, c);
+        }
+    }
+}
+
+void test_fields() {
+    struct json_writer w;
+
+    printf("\n" BLUE "Testing field formatting:" RESET "\n");
+
+    test_assert(jw_init(&w, -1, 0) == 0, "Writer initialises");
+
+    jw_begin(&w);
+    jw_field_u64(&w, "timestamp", 123);
+    jw_field_str(&w, "event", "EXEC");
+    jw_field_i64(&w, "pid", -1);
+    jw_field_bool(&w, "ok", true);
+    jw_end(&w);
+    test_assert(writer_is(&w, "{\"timestamp\":123,\"event\":\"EXEC\",\"pid\":-1,\"ok\":true}\n"),
+                "Fields are comma separated and the record ends with a newline");
+    test_assert(w.pending_ns != 0, "Ending a record starts the flush deadline");
+
+    writer_reset(&w);
+    jw_begin(&w);
+    jw_field_u64(&w, "max", UINT64_MAX);
+    jw_field_i64(&w, "min", INT64_MIN);
+    jw_field_u64(&w, "zero", 0);
+    jw_object_end(&w);
+    test_assert(writer_is(&w, "{\"max\":18446744073709551615,\"min\":-9223372036854775808,\"zero\":0}"),
+                "Integer limits are formatted exactly");
+
+    writer_reset(&w);
+    jw_begin(&w);
+    jw_field_str(&w, "a", "x");
+    jw_key(&w, "probes");
+    jw_begin(&w);
+    jw_field_u64(&w, "n", 1);
+    jw_object_end(&w);
+    jw_fields_raw(&w, "\"reason\":\"capacity\"");
+    jw_fields_raw(&w, "");
+    jw_fields_raw(&w, NULL);
+    jw_printf(&w, ",\"f\":%.3f", 1.5);
+    jw_object_end(&w);
+    test_assert(writer_is(&w, "{\"a\":\"x\",\"probes\":{\"n\":1},\"reason\":\"capacity\",\"f\":1.500}"),
+                "Nested objects, raw fragments and printf fields compose");
+
+    writer_reset(&w);
+    jw_begin(&w);
+    jw_fields_raw(&w, "\"data\":null");
+    jw_object_end(&w);
+    test_assert(writer_is(&w, "{\"data\":null}"), "Raw fragment as first field has no comma");
+
+    jw_free(&w);
+}
+
+void test_escaping() {
+    struct json_writer w;
+
+    printf("\n" BLUE "Testing string escaping:" RESET "\n");
+
+    jw_init(&w, -1, 0);
+
+    jw_escaped(&w, "a\"b\\c\n\t\r\b\f\x01\x7f", 12);
+    test_assert(writer_is(&w, "a\\\"b\\\\c\\n\\t\\r\\b\\f\\u0001\\u007f"),
+                "Quotes, backslashes and control characters are escaped");
+
+    writer_reset(&w);
+    const char text[] = "caf\xc3\xa9 \xe4\xbd\xa0\xe5\xa5\xbd \xf0\x9f\x98\x80";
+    jw_escaped_utf8(&w, text, sizeof(text) - 1);
+    test_assert(writer_is(&w, "caf\xc3\xa9 \xe4\xbd\xa0\xe5\xa5\xbd \xf0\x9f\x98\x80"),
+                "Valid 2, 3 and 4 byte UTF-8 passes through");
+
+    writer_reset(&w);
+    jw_escaped_utf8(&w, "a\xff" "b\xc3", 4);
+    test_assert(writer_is(&w, "a\\u00ffb\\u00c3"), "Invalid and truncated bytes are \\u escaped");
+
+    writer_reset(&w);
+    jw_escaped_utf8(&w, "\xe4\xbd\"\xa0", 4);
+    test_assert(writer_is(&w, "\\u00e4\\u00bd\\\"\\u00a0"),
+                "A sequence interrupted by ASCII is escaped byte by byte");
+
+    writer_reset(&w);
+    jw_escaped_utf8(&w, "x\0y", 3);
+    test_assert(writer_is(&w, "x\\u0000y"), "Embedded NUL is escaped, not a terminator");
+
+    jw_free(&w);
+}
+
+void test_utf8_validation() {
+    printf("\n" BLUE "Testing UTF-8 validation:" RESET "\n");
+
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\xc3\xa9", 2) == 2, "Two byte sequence");
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\xe4\xbd\xa0", 3) == 3, "Three byte sequence");
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\xf0\x9f\x98\x80", 4) == 4, "Four byte sequence");
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\xc0\x80", 2) == 0, "Overlong two byte NUL rejected");
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\xc1\xbf", 2) == 0, "Overlong C1 lead rejected");
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\xe0\x9f\xbf", 3) == 0, "Overlong three byte rejected");
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\xe0\xa0\x80", 3) == 3, "U+0800 accepted");
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\xed\xa0\x80", 3) == 0, "Surrogate rejected");
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\xed\x9f\xbf", 3) == 3, "U+D7FF accepted");
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\xf0\x8f\xbf\xbf", 4) == 0, "Overlong four byte rejected");
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\xf4\x8f\xbf\xbf", 4) == 4, "U+10FFFF accepted");
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\xf4\x90\x80\x80", 4) == 0, "Above U+10FFFF rejected");
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\xf5\x80\x80\x80", 4) == 0, "F5 lead rejected");
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\x80", 1) == 0, "Lone continuation rejected");
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\xe4\xbd", 2) == 0, "Truncated sequence rejected");
+    test_assert(jw_utf8_seq_len((const unsigned char *)"\xe4\xbd\x41", 3) == 0, "Bad continuation rejected");
+}
+
+void test_fast_path_matches_reference() {
+    unsigned char buf[300];
+    struct json_writer fast, ref;
+    bool prefix_ok = true, escape_ok = true;
+    unsigned int seed = 1;
+
+    printf("\n" BLUE "Testing vector fast path against the scalar reference:" RESET "\n");
+
+    jw_init(&fast, -1, 0);
+    jw_init(&ref, -1, 0);
+
+    for (int round = 0; round < 20000; round++) {
+        size_t n = rand_r(&seed) % sizeof(buf);
+        int mode = round % 3;
+
+        for (size_t i = 0; i < n; i++) {
+            unsigned int r = rand_r(&seed);
+            if (mode == 0)
+                buf[i] = r & 0xff;                             // anything
+            else if (mode == 1)
+                buf[i] = (r % 64) ? 'a' + r % 26 : (r >> 8) & 0xff; // mostly clean ASCII
+            else
+                buf[i] = "\xe4\xbd\xa0\xf0\x9f\x98\x80 x\"\n"[r % 12]; // CJK/emoji fragments
+        }
+
+        for (size_t off = 0; off < n && off < 40; off += 7) {
+            if (jw_clean_prefix(buf + off, n - off) != jw_clean_prefix_scalar(buf + off, n - off))
+                prefix_ok = false;
+        }
+
+        writer_reset(&fast);
+        writer_reset(&ref);
+        jw_escaped_utf8(&fast, (const char *)buf, n);
+        reference_escape(&ref, buf, n);
+        if (fast.len != ref.len || memcmp(fast.buf, ref.buf, fast.len) != 0)
+            escape_ok = false;
+    }
+
+    test_assert(prefix_ok, "Vector clean prefix matches scalar scan on random input");
+    test_assert(escape_ok, "Bulk UTF-8 escaping matches byte-at-a-time reference");
+
+    for (int c = 0; c < 256; c++) {
+        unsigned char run[64];
+        memset(run, 'a', sizeof(run));
+        run[37] = c;
+        size_t expect = (c < 0x80 && jw_escape_table[c] == JW_ESC_NONE) ? sizeof(run) : 37;
+        if (jw_clean_prefix(run, sizeof(run)) != expect) {
+            prefix_ok = false;
+            printf("  byte 0x%02x misclassified\n", c);
+        }
+    }
+    test_assert(prefix_ok, "Every byte value is classified like jw_escape_table");
+
+    jw_free(&fast);
+    jw_free(&ref);
+}
+
+void test_buffering() {
+    struct json_writer w;
+    int fds[2];
+    char rd[16];
+
+    printf("\n" BLUE "Testing buffering:" RESET "\n");
+
+    if (pipe(fds) != 0) {
+        test_assert(false, "pipe() for flush tests");
+        return;
+    }
+
+    jw_init(&w, fds[1], 0);
+    jw_begin(&w);
+    jw_field_u64(&w, "i", 7);
+    jw_end(&w);
+    test_assert(w.len == 8, "Small record stays buffered until the batch ends");
+    jw_batch_end(&w);
+    test_assert(w.len == 0 && read(fds[0], rd, sizeof(rd)) == 8 && memcmp(rd, "{\"i\":7}\n", 8) == 0,
+                "flush-ms 0 writes at the end of every batch");
+    jw_free(&w);
+
+    jw_init(&w, fds[1], 60000);
+    jw_begin(&w);
+    jw_end(&w);
+    jw_batch_end(&w);
+    test_assert(w.len == 3, "Output is held back until the flush deadline");
+    test_assert(jw_poll_timeout_ms(&w, 100) == 100, "Poll timeout is unchanged when deadline is longer");
+    jw_flush(&w);
+    test_assert(w.len == 0 && w.pending_ns == 0, "Explicit flush empties the buffer");
+    jw_free(&w);
+
+    jw_init(&w, fds[1], 10);
+    test_assert(jw_poll_timeout_ms(&w, 100) == 10, "Poll timeout is capped at the flush interval");
+    jw_free(&w);
+
+    // Consumer threads format into a memory writer and hand records over
+    struct json_writer mem;
+    jw_init(&mem, -1, 0);
+    char big[1024];
+    memset(big, 'x', sizeof(big));
+    jw_begin(&mem);
+    jw_key(&mem, "data");
+    jw_char(&mem, '"');
+    for (int i = 0; i < 100; i++)
+        jw_raw(&mem, big, sizeof(big));
+    jw_char(&mem, '"');
+    jw_end(&mem);
+    jw_batch_end(&mem);
+    test_assert(mem.len == 100 * 1024 + 12, "Memory writer never flushes past the threshold");
+
+    test_assert(read(fds[0], rd, sizeof(rd)) == 3, "Explicitly flushed output reached the pipe");
+    jw_init(&w, fds[1], 60000);
+    jw_append(&w, "{\"i\":1}\n", 8);
+    test_assert(w.len == 8 && !w.in_record && w.pending_ns != 0, "Appended record is committed");
+    w.max_buffered = 64;
+    jw_append(&w, mem.buf, mem.len);
+    test_assert(w.len == 8 && w.dropped == 1, "Appended records are dropped whole past max_buffered");
+    jw_flush(&w);
+    test_assert(read(fds[0], rd, sizeof(rd)) == 8 && memcmp(rd, "{\"i\":1}\n", 8) == 0,
+                "Appended records are written out verbatim");
+    jw_free(&w);
+    jw_free(&mem);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static uint32_t read_u32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+void test_binary_records() {
+    struct json_writer w;
+
+    printf("\n" BLUE "Testing binary records:" RESET "\n");
+
+    jw_init(&w, -1, 0);
+    bin_stream_start(&w);
+    test_assert(w.binary && w.len == 8 && memcmp(w.buf, "AGSB\x03\0\0\0", 8) == 0,
+                "Stream starts with magic and version");
+
+    writer_reset(&w);
+    bin_event_begin(&w, BIN_RECORD_BASH_READLINE, 0x0102030405060708ULL, 42, "bash");
+    bin_str(&w, "ls -la");
+    bin_event_end(&w, NULL);
+    const char expected[] = "\x07\x06\x05\x04\x03\x02\x01" "\x2a\0\0\0" "\x04\0" "bash"
+                            "\x06\0" "ls -la" "\0\0";
+    test_assert(w.len == 4 + 1 + 1 + sizeof(expected) - 1 && read_u32(w.buf) == w.len - 4,
+                "Length prefix covers kind and body");
+    test_assert(w.buf[4] == BIN_RECORD_BASH_READLINE &&
+                memcmp(w.buf + 5, "\x08", 1) == 0 && memcmp(w.buf + 6, expected, sizeof(expected) - 1) == 0,
+                "Event prefix, string and empty extra are laid out little endian");
+    test_assert(!w.in_record && w.pending_ns != 0, "Closing a record commits it");
+
+    writer_reset(&w);
+    jw_begin(&w);
+    jw_field_str(&w, "event", "STATS");
+    jw_end(&w);
+    test_assert(read_u32(w.buf) == w.len - 4 && w.buf[4] == BIN_RECORD_JSON &&
+                w.len == 5 + strlen("{\"event\":\"STATS\"}") &&
+                memcmp(w.buf + 5, "{\"event\":\"STATS\"}", w.len - 5) == 0,
+                "JSON objects are framed as JSON records without a newline");
+    jw_free(&w);
+
+    // A record larger than the flush threshold must not be split before its length is known
+    FILE *tmp = tmpfile();
+    if (!tmp) {
+        test_assert(false, "tmpfile() for binary flush test");
+        return;
+    }
+    jw_init(&w, fileno(tmp), 0);
+    w.binary = true;
+    char *big = malloc(300 * 1024);
+    memset(big, 'x', 300 * 1024);
+    jw_record_begin(&w, BIN_RECORD_SSL_DATA);
+    for (int i = 0; i < 300; i++)
+        jw_raw(&w, big, 1024);
+    test_assert(w.record_start == 0 && w.len == 5 + 300 * 1024,
+                "Open record is never flushed half written");
+    jw_record_end(&w);
+    test_assert(w.len == 0, "Large record is flushed once complete");
+    char head[5];
+    test_assert(lseek(fileno(tmp), 0, SEEK_END) == 5 + 300 * 1024 &&
+                pread(fileno(tmp), head, sizeof(head), 0) == 5 &&
+                read_u32(head) == 1 + 300 * 1024, "Large record arrives intact");
+    free(big);
+    jw_free(&w);
+    fclose(tmp);
+
+    test_assert(output_format_parse("json") == OUTPUT_FORMAT_JSON &&
+                output_format_parse("binary") == OUTPUT_FORMAT_BINARY &&
+                output_format_parse("xml") < 0, "--format values are parsed");
+}
+
+void test_nonblocking_output() {
+    struct json_writer w;
+    int sv[2];
+
+    printf("\n" BLUE "Testing non-blocking output:" RESET "\n");
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        test_assert(false, "socketpair() for non-blocking tests");
+        return;
+    }
+    int small = 4096;
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+
+    jw_init(&w, sv[0], 0);
+    w.binary = true;
+    w.max_buffered = 512 * 1024;
+
+    // Nobody reads sv[1]: the writer must keep the tail instead of blocking
+    char chunk[1000];
+    memset(chunk, 'y', sizeof(chunk));
+    int written = 0;
+    for (; written < 1000; written++) {
+        jw_record_begin(&w, BIN_RECORD_SSL_DATA);
+        jw_raw(&w, chunk, sizeof(chunk));
+        jw_record_end(&w);
+    }
+    jw_batch_end(&w);
+    test_assert(w.blocked && w.len > 0, "Full socket leaves output buffered, not blocked");
+    test_assert(w.dropped > 0 && w.len <= w.max_buffered,
+                "Records past max_buffered are dropped and counted");
+    test_assert(jw_poll_timeout_ms(&w, 100) == JW_BLOCKED_RETRY_MS,
+                "Poll wakes up early to retry pending output");
+
+    // Drain the reader; every byte that arrives must be whole records
+    uint64_t kept = written - w.dropped;
+    uint64_t received = 0;
+    char rd[65536];
+    for (int spins = 0; spins < 1000 && (w.len || w.blocked); spins++) {
+        ssize_t n;
+        while ((n = recv(sv[1], rd, sizeof(rd), MSG_DONTWAIT)) > 0)
+            received += n;
+        jw_batch_end(&w);
+    }
+    ssize_t n;
+    while ((n = recv(sv[1], rd, sizeof(rd), MSG_DONTWAIT)) > 0)
+        received += n;
+    test_assert(!w.blocked && w.len == 0, "Backlog drains once the reader catches up");
+    test_assert(received == kept * (5 + sizeof(chunk)),
+                "Only whole records reach the reader");
+
+    jw_free(&w);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+void test_output_socket() {
+    struct json_writer w;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    char path[] = "/tmp/test_json_writer.XXXXXX";
+
+    printf("\n" BLUE "Testing output socket:" RESET "\n");
+
+    int tmp = mkstemp(path);
+    if (tmp < 0) {
+        test_assert(false, "mkstemp() for socket path");
+        return;
+    }
+    close(tmp);
+    unlink(path);
+    strcpy(addr.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listener, 1) != 0) {
+        test_assert(false, "listening socket for output tests");
+        return;
+    }
+
+    test_assert(output_open(&w, path, 0) == 0, "Tracer connects to the collector socket");
+    int peer = accept(listener, NULL, NULL);
+    test_assert(w.fd != STDOUT_FILENO && (fcntl(w.fd, F_GETFL) & O_NONBLOCK) &&
+                w.max_buffered == OUTPUT_MAX_BUFFERED, "Socket output is non-blocking with a backlog limit");
+
+    jw_begin(&w);
+    jw_field_u64(&w, "i", 1);
+    jw_end(&w);
+    output_close(&w);
+    char rd[16] = "";
+    test_assert(read(peer, rd, sizeof(rd)) == 8 && memcmp(rd, "{\"i\":1}\n", 8) == 0,
+                "Output is flushed to the socket on close");
+    test_assert(read(peer, rd, sizeof(rd)) == 0, "Closing the writer closes the socket");
+
+    close(peer);
+    close(listener);
+    unlink(path);
+
+    test_assert(output_open(&w, "/nonexistent/agentsight.sock", 0) < 0,
+                "Missing collector socket is an error");
+}
+
+int main() {
+    printf(YELLOW "===== JSON Writer Tests =====" RESET "\n");
+
+    test_fields();
+    test_escaping();
+    test_utf8_validation();
+    test_fast_path_matches_reference();
+    test_buffering();
+    test_binary_records();
+    test_nonblocking_output();
+    test_output_socket();
+
+    printf("\n" YELLOW "===== Test Summary =====" RESET "\n");
+    printf("Tests passed: " GREEN "%d" RESET "\n", tests_passed);
+    printf("Tests failed: " RED "%d" RESET "\n", tests_failed);
+    printf("Total tests:  %d\n", tests_passed + tests_failed);
+
+    if (tests_failed == 0) {
+        printf(GREEN "All tests passed!" RESET "\n");
+        return 0;
+    } else {
+        printf(RED "Some tests failed!" RESET "\n");
+        return 1;
+    }
+}
@@ -50,10 +50,18 @@ void test_pid_hash() {
     unsigned int hash2 = pid_hash(5678);
     unsigned int hash3 = pid_hash(1234); // Same as hash1
 
-    test_assert(hash1 < TRACKED_PIDS_HASH_SIZE, "hash should be within bounds");
-    test_assert(hash2 < TRACKED_PIDS_HASH_SIZE, "hash should be within bounds");
+    test_assert(pid_slot(1234, TRACKED_PIDS_HASH_SIZE) < TRACKED_PIDS_HASH_SIZE, "slot should be within bounds");
+    test_assert(pid_slot(5678, TRACKED_PIDS_HASH_SIZE) < TRACKED_PIDS_HASH_SIZE, "slot should be within bounds");
     test_assert(hash1 == hash3, "same PID should produce same hash");
 
+    // Consecutive PIDs should not all land in consecutive slots (pid & mask did)
+    int adjacent = 0;
+    for (pid_t pid = 1000; pid < 1100; pid++) {
+        if (pid_slot(pid + 1, TRACKED_PIDS_HASH_SIZE) == pid_slot(pid, TRACKED_PIDS_HASH_SIZE) + 1)
+            adjacent++;
+    }
+    test_assert(adjacent < 10, "sequential PIDs should spread over the table");
+
     printf("  hash(1234) = %u\n", hash1);
     printf("  hash(5678) = %u\n", hash2);
 }
@@ -74,13 +82,16 @@ void test_pid_tracker_init() {
 
     // Check that all entries are inactive
     bool all_inactive = true;
-    for (int i = 0; i < TRACKED_PIDS_HASH_SIZE; i++) {
+    for (unsigned int i = 0; i < tracker.capacity; i++) {
         if (tracker.entries[i].is_active) {
             all_inactive = false;
             break;
         }
     }
     test_assert(all_inactive, "all entries should be inactive after init");
+    test_assert(tracker.capacity == TRACKED_PIDS_HASH_SIZE && tracker.count == 0,
+                "table should start at TRACKED_PIDS_HASH_SIZE slots, empty");
+    pid_tracker_free(&tracker);
 }
 
 void test_pid_tracker_add_and_find() {
@@ -114,6 +125,7 @@ void test_pid_tracker_add_and_find() {
     // Test adding duplicate PID
     bool result3 = pid_tracker_add(&tracker, 1234, 1000);
     test_assert(result3, "adding duplicate should return true");
+    pid_tracker_free(&tracker);
 }
 
 void test_pid_tracker_remove() {
@@ -136,6 +148,7 @@ void test_pid_tracker_remove() {
     // Test removing non-existent PID (should not crash)
     pid_tracker_remove(&tracker, 9999);
     test_assert(true, "removing non-existent PID should not crash");
+    pid_tracker_free(&tracker);
 }
 
 void test_pid_tracker_is_tracked() {
@@ -150,6 +163,7 @@ void test_pid_tracker_is_tracked() {
 
     // Test with non-tracked PID
     test_assert(!pid_tracker_is_tracked(&tracker, 9999), "non-tracked PID should return false");
+    pid_tracker_free(&tracker);
 }
 
 void test_command_matches_any_filter() {
@@ -191,6 +205,7 @@ void test_should_track_process_all_mode() {
                 "python should be tracked in ALL mode");
     test_assert(should_track_process(&tracker, "vim", 9999, 1000),
                 "vim should be tracked in ALL mode");
+    pid_tracker_free(&tracker);
 }
 
 void test_should_track_process_proc_mode() {
@@ -205,6 +220,7 @@ void test_should_track_process_proc_mode() {
                 "bash should be tracked in PROC mode");
     test_assert(should_track_process(&tracker, "python", 5678, 1000),
                 "python should be tracked in PROC mode");
+    pid_tracker_free(&tracker);
 }
 
 void test_should_track_process_filter_mode() {
@@ -228,6 +244,7 @@ void test_should_track_process_filter_mode() {
                 "child of tracked parent should be tracked");
     test_assert(!should_track_process(&tracker, "emacs", 3000, 5555),
                 "child of non-tracked parent should not be tracked");
+    pid_tracker_free(&tracker);
 }
 
 void test_should_track_process_target_pid() {
@@ -241,6 +258,7 @@ void test_should_track_process_target_pid() {
                 "target PID should be tracked");
     test_assert(!should_track_process(&tracker, "bash", 5678, 1000),
                 "non-target PID should not be tracked");
+    pid_tracker_free(&tracker);
 }
 
 void test_should_report_file_ops() {
@@ -255,6 +273,7 @@ void test_should_report_file_ops() {
                 "ALL mode should report all file ops");
 
     // Test FILTER_MODE_PROC with tracked PID
+    pid_tracker_free(&tracker);
     pid_tracker_init(&tracker, filters, 1, FILTER_MODE_PROC, 0);
     pid_tracker_add(&tracker, 1234, 1000);
     test_assert(should_report_file_ops(&tracker, 1234),
@@ -263,12 +282,14 @@ void test_should_report_file_ops() {
                 "PROC mode should not report non-tracked PID file ops");
 
     // Test FILTER_MODE_FILTER with tracked PID
+    pid_tracker_free(&tracker);
     pid_tracker_init(&tracker, filters, 1, FILTER_MODE_FILTER, 0);
     pid_tracker_add(&tracker, 1234, 1000);
     test_assert(should_report_file_ops(&tracker, 1234),
                 "FILTER mode should report tracked PID file ops");
     test_assert(!should_report_file_ops(&tracker, 5678),
                 "FILTER mode should not report non-tracked PID file ops");
+    pid_tracker_free(&tracker);
 }
 
 void test_should_report_bash_readline() {
@@ -283,17 +304,20 @@ void test_should_report_bash_readline() {
                 "ALL mode should report all bash readline");
 
     // Test FILTER_MODE_PROC
+    pid_tracker_free(&tracker);
     pid_tracker_init(&tracker, filters, 1, FILTER_MODE_PROC, 0);
     test_assert(should_report_bash_readline(&tracker, 1234),
                 "PROC mode should report all bash readline");
 
     // Test FILTER_MODE_FILTER with tracked PID
+    pid_tracker_free(&tracker);
     pid_tracker_init(&tracker, filters, 1, FILTER_MODE_FILTER, 0);
     pid_tracker_add(&tracker, 1234, 1000);
     test_assert(should_report_bash_readline(&tracker, 1234),
                 "FILTER mode should report tracked PID bash readline");
     test_assert(!should_report_bash_readline(&tracker, 5678),
                 "FILTER mode should not report non-tracked PID bash readline");
+    pid_tracker_free(&tracker);
 }
 
 void test_hash_collision_handling() {
@@ -322,6 +346,97 @@ void test_hash_collision_handling() {
 
     test_assert(found_count == 100, "should find all added PIDs");
     printf("  Added and found %d PIDs successfully\n", found_count);
+    pid_tracker_free(&tracker);
+}
+
+// Largest distance of an entry from its home slot
+static unsigned int max_displacement(struct pid_tracker *tracker) {
+    unsigned int worst = 0;
+
+    for (unsigned int i = 0; i < tracker->capacity; i++) {
+        if (!tracker->entries[i].is_active)
+            continue;
+        unsigned int d = (i - pid_slot(tracker->entries[i].pid, tracker->capacity)) & (tracker->capacity - 1);
+        if (d > worst)
+            worst = d;
+    }
+    return worst;
+}
+
+void test_remove_keeps_probe_chains() {
+    printf("\n" BLUE "Testing removal inside probe chains:" RESET "\n");
+
+    struct pid_tracker tracker;
+    pid_tracker_init(&tracker, NULL, 0, FILTER_MODE_ALL, 0);
+
+    // Four PIDs that share a home slot form one chain
+    pid_t chain[4];
+    int n = 0;
+    unsigned int home = pid_slot(100, tracker.capacity);
+    for (pid_t pid = 100; n < 4; pid++) {
+        if (pid_slot(pid, tracker.capacity) == home)
+            chain[n++] = pid;
+    }
+    for (int i = 0; i < 4; i++)
+        pid_tracker_add(&tracker, chain[i], 1);
+
+    pid_tracker_remove(&tracker, chain[0]);
+    test_assert(!pid_tracker_find(&tracker, chain[0]), "removed PID is gone");
+    test_assert(pid_tracker_find(&tracker, chain[1]) && pid_tracker_find(&tracker, chain[2]) &&
+                pid_tracker_find(&tracker, chain[3]), "PIDs past the removed slot are still found");
+
+    pid_tracker_remove(&tracker, chain[2]);
+    test_assert(pid_tracker_find(&tracker, chain[1]) && pid_tracker_find(&tracker, chain[3]) &&
+                !pid_tracker_find(&tracker, chain[2]), "removing from the middle keeps the chain");
+    test_assert(tracker.count == 2, "count follows removals");
+    test_assert(tracker.entries[home].is_active && tracker.entries[home].pid == chain[1],
+                "entries shift back towards their home slot");
+
+    pid_tracker_remove(&tracker, chain[2]);
+    test_assert(tracker.count == 2, "removing a missing PID changes nothing");
+    pid_tracker_free(&tracker);
+}
+
+void test_growth_and_churn() {
+    printf("\n" BLUE "Testing growth and PID churn:" RESET "\n");
+
+    struct pid_tracker tracker;
+    pid_tracker_init(&tracker, NULL, 0, FILTER_MODE_ALL, 0);
+
+    // Far more PIDs than the initial table holds
+    bool added = true;
+    for (pid_t pid = 1; pid <= 100000; pid++)
+        added &= pid_tracker_add(&tracker, pid, 1);
+    test_assert(added && tracker.count == 100000, "adds 100000 PIDs");
+    test_assert(tracker.capacity > TRACKED_PIDS_HASH_SIZE, "table grew");
+    test_assert((unsigned long long)tracker.count * TRACKED_PIDS_LOAD_DEN <=
+                (unsigned long long)tracker.capacity * TRACKED_PIDS_LOAD_NUM, "stays below the load factor");
+
+    int found = 0;
+    for (pid_t pid = 1; pid <= 100000; pid++)
+        found += pid_tracker_find(&tracker, pid) != NULL;
+    test_assert(found == 100000, "every PID is found after rehashing");
+    test_assert(max_displacement(&tracker) <= TRACKED_PIDS_MAX_PROBE, "no entry is past the probe bound");
+    pid_tracker_free(&tracker);
+
+    // A CI host: PIDs come and go by the hundred thousand, ~1000 alive at once
+    pid_tracker_init(&tracker, NULL, 0, FILTER_MODE_ALL, 0);
+    bool ok = true;
+    for (pid_t pid = 1; pid <= 500000; pid++) {
+        ok &= pid_tracker_add(&tracker, pid, pid - 1);
+        if (pid > 1000)
+            pid_tracker_remove(&tracker, pid - 1000);
+    }
+    test_assert(ok && tracker.count == 1000, "churn leaves only the live PIDs");
+    test_assert(tracker.capacity == TRACKED_PIDS_HASH_SIZE, "churn does not grow the table");
+    found = 0;
+    for (pid_t pid = 499001; pid <= 500000; pid++)
+        found += pid_tracker_is_tracked(&tracker, pid);
+    test_assert(found == 1000, "every live PID is still found");
+    test_assert(!pid_tracker_find(&tracker, 499000) && !pid_tracker_find(&tracker, 1),
+                "exited PIDs are not found");
+    test_assert(max_displacement(&tracker) <= TRACKED_PIDS_MAX_PROBE, "probe chains stay bounded");
+    pid_tracker_free(&tracker);
 }
 
 void test_integration_scenario() {
@@ -367,6 +482,7 @@ void test_integration_scenario() {
                 "bash should still be tracked");
 
     printf("  Integration scenario completed successfully\n");
+    pid_tracker_free(&tracker);
 }
 
 void print_test_summary() {
@@ -399,6 +515,8 @@ int main() {
     test_should_report_file_ops();
     test_should_report_bash_readline();
     test_hash_collision_handling();
+    test_remove_keeps_probe_chains();
+    test_growth_and_churn();
     test_integration_scenario();
 
     print_test_summary();
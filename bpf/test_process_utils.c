@@ -6,6 +6,7 @@
 #include <sys/wait.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/stat.h>
 
 // Include Linux types if available, otherwise define our own
 #ifdef __linux__
@@ -112,6 +113,58 @@ void test_command_matches_filter() {
     test_assert(command_matches_filter("bash", "bas"), "partial match should work");
 }
 
+void test_argv_to_command() {
+    char buf[16];
+
+    printf("\n" BLUE "Testing argv_to_command function:" RESET "\n");
+
+    test_assert(strcmp(argv_to_command(buf, sizeof(buf), "ls\0-la\0/tmp\0", 12), "ls -la /tmp") == 0,
+                "arguments should be joined with spaces");
+    test_assert(strcmp(argv_to_command(buf, sizeof(buf), "node\0-e", 7), "node -e") == 0,
+                "an argv cut mid argument should keep what was read");
+    test_assert(strcmp(argv_to_command(buf, sizeof(buf), "a\0\0b\0\0\0", 7), "a  b") == 0,
+                "empty arguments should stay, trailing NULs should go");
+    test_assert(strcmp(argv_to_command(buf, sizeof(buf), "python3\0-c\0print(1234)\0", 23), "python3 -c prin") == 0,
+                "a command line should be cut to the buffer");
+    test_assert(strcmp(argv_to_command(buf, sizeof(buf), "\0", 1), "") == 0,
+                "an empty argv should give an empty command line");
+}
+
+void test_cwd_prefix_len() {
+    const char *path = "/home/dev/project/config.json";
+
+    printf("\n" BLUE "Testing cwd_prefix_len function:" RESET "\n");
+
+    test_assert(cwd_prefix_len(path, strlen(path) + 1, "config.json", 11, true) == 17,
+                "a plain name should leave the cwd as prefix");
+    test_assert(cwd_prefix_len("/a.txt", 7, "a.txt", 5, true) == 0,
+                "a name in the root should leave an empty prefix");
+    test_assert(cwd_prefix_len(path, strlen(path) + 1, "other.json", 10, true) == -1,
+                "a path not ending in the name should not give a prefix");
+    test_assert(cwd_prefix_len(path, strlen(path) + 1, "project/config.json", 19, true) == -1,
+                "a name with a '/' should not give a prefix");
+    test_assert(cwd_prefix_len("/home/devconfig.json", 21, "config.json", 11, true) == -1,
+                "the name should start after a '/'");
+    test_assert(cwd_prefix_len("x", 2, "x", 1, true) == -1,
+                "a path without room for the '/' should not give a prefix");
+}
+
+void test_cwd_prefix_symlink() {
+    const char *lib = "/opt/pkg/lib", *v2 = "/work/v2";
+
+    printf("\n" BLUE "Testing cwd_prefix_len through symlinks:" RESET "\n");
+
+    // /work/lib -> /opt/pkg/lib: the path ends in the name, but the file's
+    // parent is not the cwd
+    test_assert(cwd_prefix_len(lib, strlen(lib) + 1, "lib", 3, false) == -1,
+                "a symlinked name resolving elsewhere should not give a prefix");
+    // /work/current -> v2: the parent is the cwd, the name is not the file's
+    test_assert(cwd_prefix_len(v2, strlen(v2) + 1, "current", 7, true) == -1,
+                "a symlink to a neighbour should not give a prefix");
+    test_assert(cwd_prefix_len(v2, strlen(v2) + 1, "v2", 2, true) == 5,
+                "its target opened by name should");
+}
+
 void test_count_matching_processes() {
     printf("\n" BLUE "Testing count_matching_processes function:" RESET "\n");
     
@@ -133,6 +186,104 @@ void test_count_matching_processes() {
 
 
 
+void test_proc_parse_stat() {
+    printf("\n" BLUE "Testing proc_parse_stat function:" RESET "\n");
+
+    struct proc_task t;
+    const char *plain = "1234 (bash) S 1000 1234 1234 34816 1234 4194560 ...\n";
+    test_assert(proc_parse_stat(plain, strlen(plain), &t) == 0, "parses a plain stat line");
+    test_assert(t.ppid == 1000 && !strcmp(t.comm, "bash"), "gets ppid and comm");
+
+    const char *tricky = "77 (a) b (c) S 5 77 77 0 -1\n";
+    test_assert(proc_parse_stat(tricky, strlen(tricky), &t) == 0, "parses a comm with spaces and parens");
+    test_assert(t.ppid == 5 && !strcmp(t.comm, "a) b (c"), "comm runs to the last paren");
+
+    const char *init = "1 (systemd) S 0 1 1 0 -1\n";
+    test_assert(proc_parse_stat(init, strlen(init), &t) == 0 && t.ppid == 0, "init has ppid 0");
+
+    const char *longc = "9 (a-very-long-thread-name) R 2 9\n";
+    test_assert(proc_parse_stat(longc, strlen(longc), &t) == 0 &&
+                strlen(t.comm) == TASK_COMM_LEN - 1, "long comm is cut to TASK_COMM_LEN");
+
+    test_assert(proc_parse_stat("12 bash S 1", 11, &t) == -1, "rejects a line without parens");
+    test_assert(proc_parse_stat("12 (bash)", 9, &t) == -1, "rejects a truncated line");
+    test_assert(proc_parse_stat("12 (bash) S x", 13, &t) == -1, "rejects a non-numeric ppid");
+}
+
+struct scan_result {
+    int count;
+    pid_t last_pid;
+    bool ordered;
+    bool found_self;
+    pid_t self_ppid;
+    char self_comm[TASK_COMM_LEN];
+    int bad;
+};
+
+static void collect_task(void *ctx, const struct proc_task *t) {
+    struct scan_result *r = ctx;
+
+    if (t->pid <= r->last_pid)
+        r->ordered = false;
+    r->last_pid = t->pid;
+    r->count++;
+    if (t->pid == getpid()) {
+        r->found_self = true;
+        r->self_ppid = t->ppid;
+        strcpy(r->self_comm, t->comm);
+    }
+    // fake entries: "task <pid>" with ppid pid / 2
+    if (t->ppid != t->pid / 2 && strncmp(t->comm, "task ", 5) == 0)
+        r->bad++;
+}
+
+void test_proc_scan() {
+    printf("\n" BLUE "Testing proc_scan function:" RESET "\n");
+
+    struct scan_result r = { .ordered = true };
+    char comm[TASK_COMM_LEN];
+
+    int n = proc_scan("/proc", 1, collect_task, &r);
+    read_proc_comm(getpid(), comm, sizeof(comm));
+    test_assert(n > 0 && n == r.count, "scans /proc and reports every task read");
+    test_assert(r.found_self, "finds the current process");
+    test_assert(r.ordered, "calls back in PID order");
+    test_assert(r.self_ppid == getppid() && !strcmp(r.self_comm, comm), "reads its ppid and comm");
+    test_assert(proc_scan("/nonexistent", 1, collect_task, &r) == -ENOENT, "missing directory is -ENOENT");
+
+    // A fake /proc big enough to be split over threads
+    char dir[] = "/tmp/test_proc_scan.XXXXXX", path[128];
+    const int nr = 5 * PROC_SCAN_PIDS_PER_THREAD;
+    if (!mkdtemp(dir)) {
+        printf("  mkdtemp failed, skipping threaded scan\n");
+        return;
+    }
+    for (int pid = 1; pid <= nr; pid++) {
+        snprintf(path, sizeof(path), "%s/%d", dir, pid);
+        mkdir(path, 0755);
+        // every tenth task has exited between getdents and the read
+        if (pid % 10 == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%d/stat", dir, pid);
+        FILE *f = fopen(path, "w");
+        fprintf(f, "%d (task %d) S %d 0 0\n", pid, pid, pid / 2);
+        fclose(f);
+    }
+    snprintf(path, sizeof(path), "%s/self", dir);
+    mkdir(path, 0755);
+
+    struct scan_result serial = { .ordered = true }, threaded = { .ordered = true };
+    int n1 = proc_scan(dir, 1, collect_task, &serial);
+    int n4 = proc_scan(dir, 4, collect_task, &threaded);
+    test_assert(n1 == nr - nr / 10 && n4 == n1, "skips non-numeric and vanished entries");
+    test_assert(threaded.count == serial.count && threaded.bad == 0 && serial.bad == 0,
+                "threaded scan reads the same tasks");
+
+    snprintf(path, sizeof(path), "rm -rf %s", dir);
+    if (system(path))
+        printf("  failed to remove %s\n", dir);
+}
+
 void test_integration() {
     printf("\n" BLUE "Testing integration scenario:" RESET "\n");
     
@@ -188,7 +339,12 @@ int main() {
     test_read_proc_comm();
     test_read_proc_ppid();
     test_command_matches_filter();
+    test_argv_to_command();
+    test_cwd_prefix_len();
+    test_cwd_prefix_symlink();
     test_count_matching_processes();
+    test_proc_parse_stat();
+    test_proc_scan();
     test_integration();
     
     print_test_summary();
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rate_limit.h"
+
+// Test colors for output
+#define RESET   "\033[0m"
+#define RED     "\033[31m"
+#define GREEN   "\033[32m"
+#define YELLOW  "\033[33m"
+#define BLUE    "\033[34m"
+
+#define T0 5000000000ULL
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+void test_assert(bool condition, const char *test_name) {
+    if (condition) {
+        printf("[" GREEN "PASS" RESET "] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[" RED "FAIL" RESET "] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+// A bucket as rate_limit_allow() creates it, before its first take
+static struct rate_bucket full_bucket(__u64 rate, __u64 now) {
+    struct rate_bucket b = { .credit = rate * RATE_LIMIT_NS, .last_ns = now };
+
+    return b;
+}
+
+// Records let through out of @n sent @gap_ns apart
+static int take_many(struct rate_bucket *b, int n, __u64 cost, __u64 rate, __u64 *now, __u64 gap_ns) {
+    int allowed = 0;
+
+    for (int i = 0; i < n; i++) {
+        allowed += rate_bucket_take(b, cost, rate, *now);
+        *now += gap_ns;
+    }
+    return allowed;
+}
+
+void test_burst_and_refill() {
+    struct rate_bucket b = full_bucket(30, T0);
+    __u64 now = T0;
+
+    printf("\n" BLUE "Testing records per second:" RESET "\n");
+
+    test_assert(take_many(&b, 100, 1, 30, &now, 0) == 30, "A full bucket lets one second's worth through");
+    test_assert(!rate_bucket_take(&b, 1, 30, now), "An empty bucket drops");
+
+    now += (RATE_LIMIT_NS + 29) / 30;
+    test_assert(rate_bucket_take(&b, 1, 30, now), "One token comes back after 1/rate seconds");
+    test_assert(!rate_bucket_take(&b, 1, 30, now), "and only one");
+
+    // A steady 100/s stream keeps getting 30/s: 1001 records span 10 seconds
+    test_assert(take_many(&b, 1001, 1, 30, &now, RATE_LIMIT_NS / 100) == 300,
+                "A stream over the rate is cut to the rate");
+
+    // Idle for a minute: refill stops at one second's worth
+    now += 60 * RATE_LIMIT_NS;
+    test_assert(take_many(&b, 100, 1, 30, &now, 0) == 30, "Long idle refills one burst, not more");
+}
+
+void test_costs() {
+    struct rate_bucket b = full_bucket(4096, T0);
+    __u64 now = T0;
+
+    printf("\n" BLUE "Testing byte costs:" RESET "\n");
+
+    test_assert(rate_bucket_take(&b, 4000, 4096, now), "A payload under the rate fits");
+    test_assert(!rate_bucket_take(&b, 100, 4096, now), "The next one waits for the refill");
+    test_assert(rate_bucket_take(&b, 0, 4096, now), "Empty payloads are free");
+
+    b = full_bucket(4096, T0);
+    test_assert(rate_bucket_take(&b, 1 << 20, 4096, now), "A payload over one second's worth costs a full bucket");
+    test_assert(b.credit == 0, "and leaves it empty");
+    now += RATE_LIMIT_NS;
+    test_assert(rate_bucket_take(&b, 1 << 20, 4096, now), "so it still goes through once a second");
+}
+
+void test_clock() {
+    struct rate_bucket b = full_bucket(10, T0);
+
+    printf("\n" BLUE "Testing timestamps:" RESET "\n");
+
+    b.credit = 0;
+    test_assert(!rate_bucket_take(&b, 1, 10, T0 - 1000), "A timestamp behind the bucket refills nothing");
+    test_assert(b.last_ns == T0 - 1000, "and becomes its new refill time");
+
+    b = full_bucket(RATE_LIMIT_MAX_RATE, T0);
+    b.credit = 0;
+    test_assert(rate_bucket_take(&b, RATE_LIMIT_MAX_RATE, RATE_LIMIT_MAX_RATE, T0 + 10 * RATE_LIMIT_NS),
+                "The largest rate refills a full bucket without overflowing");
+    test_assert(b.credit == 0, "Exactly one second's worth was added");
+}
+
+int main() {
+    printf(YELLOW "===== Rate Limit Tests =====" RESET "\n");
+
+    test_burst_and_refill();
+    test_costs();
+    test_clock();
+
+    printf("\n" YELLOW "===== Test Summary =====" RESET "\n");
+    printf("Tests passed: " GREEN "%d" RESET "\n", tests_passed);
+    printf("Tests failed: " RED "%d" RESET "\n", tests_failed);
+    printf("Total tests:  %d\n", tests_passed + tests_failed);
+
+    if (tests_failed == 0) {
+        printf(GREEN "All tests passed!" RESET "\n");
+        return 0;
+    } else {
+        printf(RED "Some tests failed!" RESET "\n");
+        return 1;
+    }
+}
@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ring_merge.h"
+
+#include <poll.h>
+
+// Test colors for output
+#define RESET   "\033[0m"
+#define RED     "\033[31m"
+#define GREEN   "\033[32m"
+#define YELLOW  "\033[33m"
+#define BLUE    "\033[34m"
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+void test_assert(bool condition, const char *test_name) {
+    if (condition) {
+        printf("[" GREEN "PASS" RESET "] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[" RED "FAIL" RESET "] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+static struct merge_record *rec(uint64_t ts, const char *s) {
+    return merge_record_new(ts, s, strlen(s));
+}
+
+static bool rec_is(const struct merge_record *r, const char *s) {
+    return r->len == strlen(s) && memcmp(r->data, s, r->len) == 0;
+}
+
+// Pop the way the tracer's main loop does: sleep on the eventfd until the head is due
+static size_t pop_wait(struct ring_merge *m, struct merge_record **out, size_t max, int timeout_ms) {
+    uint64_t deadline = ring_merge_now_ns() + (uint64_t)timeout_ms * 1000000ULL;
+
+    for (;;) {
+        size_t n = ring_merge_pop(m, out, max);
+        uint64_t now = ring_merge_now_ns();
+        struct pollfd pfd = { .fd = m->efd, .events = POLLIN };
+        uint64_t count;
+
+        if (n || now >= deadline)
+            return n;
+        if (poll(&pfd, 1, ring_merge_timeout_ms(m, (deadline - now) / 1000000 + 1)) > 0 &&
+            read(m->efd, &count, sizeof(count)) < 0)
+            return 0;
+    }
+}
+
+static void free_recs(struct merge_record **recs, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        free(recs[i]);
+}
+
+void test_ordering() {
+    printf("\n" BLUE "Testing timestamp ordering..." RESET "\n");
+
+    struct ring_merge m;
+    struct merge_record *out[8];
+    uint64_t now = ring_merge_now_ns();
+
+    ring_merge_init(&m, 0, 0);
+
+    // Two rings, each in order, interleaved in time
+    struct merge_record *a[] = { rec(now - 50, "a1"), rec(now - 30, "a2"), rec(now - 10, "a3") };
+    struct merge_record *b[] = { rec(now - 40, "b1"), rec(now - 20, "b2") };
+    ring_merge_push(&m, a, 3);
+    ring_merge_push(&m, b, 2);
+
+    size_t n = ring_merge_pop(&m, out, 8);
+    test_assert(n == 5, "All due records are popped");
+    test_assert(n == 5 && rec_is(out[0], "a1") && rec_is(out[1], "b1") && rec_is(out[2], "a2") &&
+                rec_is(out[3], "b2") && rec_is(out[4], "a3"),
+                "Records from several rings come out in timestamp order");
+    free_recs(out, n);
+
+    // Equal timestamps keep arrival order
+    struct merge_record *c[] = { rec(now, "first"), rec(now, "second"), rec(now, "third") };
+    ring_merge_push(&m, c, 3);
+    n = ring_merge_pop(&m, out, 8);
+    test_assert(n == 3 && rec_is(out[0], "first") && rec_is(out[1], "second") &&
+                rec_is(out[2], "third"), "Timestamp ties keep arrival order");
+    free_recs(out, n);
+
+    // Popping is bounded by the caller's batch
+    struct merge_record *d[] = { rec(now - 3, "x"), rec(now - 2, "y"), rec(now - 1, "z") };
+    ring_merge_push(&m, d, 3);
+    n = ring_merge_pop(&m, out, 2);
+    test_assert(n == 2 && rec_is(out[0], "x") && rec_is(out[1], "y"), "Pop stops at the batch size");
+    free_recs(out, n);
+    n = ring_merge_pop(&m, out, 2);
+    test_assert(n == 1 && rec_is(out[0], "z"), "The rest is popped next time");
+    free_recs(out, n);
+    test_assert(ring_merge_pop(&m, out, 2) == 0, "Empty merge pops nothing");
+
+    ring_merge_free(&m);
+}
+
+void test_window() {
+    printf("\n" BLUE "Testing the reorder window..." RESET "\n");
+
+    struct ring_merge m;
+    struct merge_record *out[4];
+    uint64_t window = 50 * 1000000ULL;
+
+    ring_merge_init(&m, window, 0);
+
+    uint64_t now = ring_merge_now_ns();
+    struct merge_record *a[] = { rec(now, "late") };
+    ring_merge_push(&m, a, 1);
+    test_assert(ring_merge_pop(&m, out, 4) == 0, "A fresh record is held for the window");
+    int timeout = ring_merge_timeout_ms(&m, 1000);
+    test_assert(timeout > 0 && timeout <= 50, "Timeout runs until the head is due");
+    test_assert(ring_merge_timeout_ms(&m, 5) == 5, "Timeout is capped by the caller");
+
+    uint64_t count = 0;
+    test_assert(read(m.efd, &count, sizeof(count)) == sizeof(count) && count == 1,
+                "A new head signals the eventfd");
+    struct merge_record *later[] = { rec(now + 1000, "later") };
+    ring_merge_push(&m, later, 1);
+    test_assert(read(m.efd, &count, sizeof(count)) < 0, "Records behind the head do not");
+
+    // A slower ring delivers an older record inside the window
+    struct merge_record *b[] = { rec(now - 1000, "early") };
+    ring_merge_push(&m, b, 1);
+
+    size_t n = pop_wait(&m, out, 4, 200);
+    test_assert(n >= 1 && rec_is(out[0], "early"), "A late older record still comes out first");
+    test_assert(ring_merge_now_ns() >= now + window - 1000, "Pop waited for the window");
+    if (n < 3)
+        n += pop_wait(&m, out + n, 4 - n, 200);
+    test_assert(n == 3 && rec_is(out[1], "late") && rec_is(out[2], "later"), "The held records follow");
+    free_recs(out, n);
+
+    // Records older than the window are not held at all
+    struct merge_record *c[] = { rec(ring_merge_now_ns() - 2 * window, "old") };
+    ring_merge_push(&m, c, 1);
+    n = ring_merge_pop(&m, out, 4);
+    test_assert(n == 1 && rec_is(out[0], "old"), "A record older than the window is due at once");
+    free_recs(out, n);
+
+    // Closing releases everything without waiting
+    struct merge_record *d[] = { rec(ring_merge_now_ns() + 10 * window, "future") };
+    ring_merge_push(&m, d, 1);
+    ring_merge_close(&m);
+    n = ring_merge_pop(&m, out, 4);
+    test_assert(n == 1 && rec_is(out[0], "future"), "Close drains held records");
+    free_recs(out, n);
+
+    ring_merge_free(&m);
+}
+
+void test_backpressure() {
+    printf("\n" BLUE "Testing the byte limit..." RESET "\n");
+
+    struct ring_merge m;
+    struct merge_record *out[4];
+    uint64_t now = ring_merge_now_ns();
+
+    // Would hold everything for an hour, but only 8 bytes fit
+    ring_merge_init(&m, 3600ULL * 1000000000ULL, 8);
+
+    struct merge_record *a[] = { rec(now, "1234"), rec(now + 1, "5678"), rec(now + 2, "9") };
+    ring_merge_push(&m, a, 3);
+    test_assert(m.bytes == 9, "Queued bytes are accounted");
+
+    size_t n = ring_merge_pop(&m, out, 4);
+    test_assert(n == 1 && rec_is(out[0], "1234"), "A full merge releases its oldest records early");
+    test_assert(m.bytes == 5, "Released bytes are accounted");
+    free_recs(out, n);
+    test_assert(ring_merge_pop(&m, out, 4) == 0, "Below the limit records are held again");
+
+    ring_merge_free(&m);
+}
+
+// Producer threads, each owning a few "connections" that migrate between them
+#define PRODUCERS 4
+#define CONNS 8
+#define PER_CONN 2000
+
+struct producer {
+    struct ring_merge *m;
+    int idx;
+};
+
+static pthread_mutex_t seq_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t conn_seq[CONNS];   // next event per connection
+static int conn_done;
+
+static void *producer_run(void *arg) {
+    struct producer *p = arg;
+    unsigned int seed = p->idx;
+    struct merge_record *batch[16];
+    size_t nr = 0;
+
+    for (;;) {
+        int conn = rand_r(&seed) % CONNS;
+        char buf[32];
+        uint64_t ts;
+
+        // Take the connection's next event and its timestamp atomically, as
+        // one thread doing sequential SSL calls would
+        pthread_mutex_lock(&seq_lock);
+        if (conn_done == CONNS) {
+            pthread_mutex_unlock(&seq_lock);
+            break;
+        }
+        while (conn_seq[conn] == PER_CONN)
+            conn = (conn + 1) % CONNS;
+        snprintf(buf, sizeof(buf), "%d:%llu", conn, (unsigned long long)conn_seq[conn]);
+        if (++conn_seq[conn] == PER_CONN)
+            conn_done++;
+        ts = ring_merge_now_ns();
+        pthread_mutex_unlock(&seq_lock);
+
+        batch[nr++] = merge_record_new(ts, buf, strlen(buf));
+        if (nr == 16 || rand_r(&seed) % 4 == 0) {
+            ring_merge_push(p->m, batch, nr);
+            nr = 0;
+        }
+    }
+    ring_merge_push(p->m, batch, nr);
+    return NULL;
+}
+
+void test_threaded_producers() {
+    printf("\n" BLUE "Testing concurrent producers..." RESET "\n");
+
+    struct ring_merge m;
+    struct producer producers[PRODUCERS];
+    pthread_t threads[PRODUCERS];
+    uint64_t seen[CONNS] = {0};
+    uint64_t total = 0, last_ts = 0;
+    bool in_order = true, ts_sorted = true;
+    struct merge_record *out[64];
+
+    ring_merge_init(&m, 200 * 1000000ULL, 16 * 1024 * 1024);
+    for (int i = 0; i < PRODUCERS; i++) {
+        producers[i] = (struct producer){ .m = &m, .idx = i };
+        pthread_create(&threads[i], NULL, producer_run, &producers[i]);
+    }
+
+    // Producers may stall, so hold records long enough for any of them to catch up
+    for (int idle = 0; total < CONNS * PER_CONN && idle < 20;) {
+        size_t n = pop_wait(&m, out, 64, 100);
+
+        idle = n ? 0 : idle + 1;
+        for (size_t i = 0; i < n; i++) {
+            int conn;
+            unsigned long long seq;
+
+            sscanf(out[i]->data, "%d:%llu", &conn, &seq);
+            if (seq != seen[conn]++)
+                in_order = false;
+            if (out[i]->ts < last_ts)
+                ts_sorted = false;
+            last_ts = out[i]->ts;
+            free(out[i]);
+            total++;
+        }
+    }
+    for (int i = 0; i < PRODUCERS; i++)
+        pthread_join(threads[i], NULL);
+
+    test_assert(total == CONNS * PER_CONN, "Every record from every producer comes out once");
+    test_assert(in_order, "Per-connection order survives producers migrating between rings");
+    test_assert(ts_sorted, "Merged output is in timestamp order");
+
+    ring_merge_free(&m);
+}
+
+int main() {
+    printf(YELLOW "===== Ring Merge Tests =====" RESET "\n");
+
+    test_ordering();
+    test_window();
+    test_backpressure();
+    test_threaded_producers();
+
+    printf("\n" YELLOW "===== Test Summary =====" RESET "\n");
+    printf("Tests passed: " GREEN "%d" RESET "\n", tests_passed);
+    printf("Tests failed: " RED "%d" RESET "\n", tests_failed);
+    printf("Total tests:  %d\n", tests_passed + tests_failed);
+
+    if (tests_failed == 0) {
+        printf(GREEN "All tests passed!" RESET "\n");
+        return 0;
+    } else {
+        printf(RED "Some tests failed!" RESET "\n");
+        return 1;
+    }
+}
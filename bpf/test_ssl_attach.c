@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "ssl_attach.h"
+
+// Test colors for output
+#define RESET   "\033[0m"
+#define RED     "\033[31m"
+#define GREEN   "\033[32m"
+#define YELLOW  "\033[33m"
+#define BLUE    "\033[34m"
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+void test_assert(bool condition, const char *test_name) {
+    if (condition) {
+        printf("[" GREEN "PASS" RESET "] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[" RED "FAIL" RESET "] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+// This binary "statically links OpenSSL" so the scanner has something to find
+__attribute__((noinline)) int SSL_write(void *ssl, const void *buf, int num) {
+    (void)ssl; (void)buf;
+    return num;
+}
+
+__attribute__((noinline)) int SSL_read(void *ssl, void *buf, int num) {
+    (void)ssl; (void)buf;
+    return num;
+}
+
+// File offset of a function in this binary, from where it is mapped
+static size_t mapped_offset(void *fn) {
+    char line[PATH_MAX + 128];
+    size_t off = 0;
+    FILE *f = fopen("/proc/self/maps", "r");
+
+    while (f && fgets(line, sizeof(line), f)) {
+        unsigned long long start, end, pgoff;
+
+        if (sscanf(line, "%llx-%llx %*4s %llx", &start, &end, &pgoff) == 3 &&
+            (uintptr_t)fn >= start && (uintptr_t)fn < end) {
+            off = (uintptr_t)fn - start + pgoff;
+            break;
+        }
+    }
+    if (f)
+        fclose(f);
+    return off;
+}
+
+static char exe[PATH_MAX];
+static char tmpdir[] = "/tmp/test_ssl_attach.XXXXXX";
+
+struct attached {
+    int calls;
+    enum ssl_lib lib;
+    char path[PATH_MAX + 64];
+    size_t offsets[SSL_ATTACH_MAX_SYMS];
+    int ret;
+};
+
+static int record_attach(void *ctx, enum ssl_lib lib, const char *path, const size_t *offsets) {
+    struct attached *a = ctx;
+
+    a->calls++;
+    a->lib = lib;
+    snprintf(a->path, sizeof(a->path), "%s", path);
+    memcpy(a->offsets, offsets, sizeof(a->offsets));
+    return a->ret;
+}
+
+static void write_file(const char *path, const char *content) {
+    FILE *f = fopen(path, "w");
+
+    fputs(content, f);
+    fclose(f);
+}
+
+static void test_elf_offsets(void) {
+    printf("\n" BLUE "Testing ELF symbol offsets..." RESET "\n");
+
+    const char *names[] = { "SSL_write", "SSL_read", "SSL_no_such_function" };
+    size_t offs[3];
+    char path[PATH_MAX];
+
+    int found = elf_func_offsets(exe, names, 3, offs);
+    test_assert(found == 2, "Finds the functions this binary defines");
+    test_assert(offs[0] == mapped_offset((void *)SSL_write), "SSL_write offset matches where it is mapped");
+    test_assert(offs[1] == mapped_offset((void *)SSL_read), "SSL_read offset matches where it is mapped");
+    test_assert(offs[2] == 0, "Missing symbols get offset 0");
+
+    test_assert(elf_func_offsets("/nonexistent/libssl.so.3", names, 3, offs) == -ENOENT,
+                "Missing file is -ENOENT");
+
+    snprintf(path, sizeof(path), "%s/not-elf", tmpdir);
+    write_file(path, "#!/bin/sh\necho this is not an ELF file, but it is long enough\n");
+    test_assert(elf_func_offsets(path, names, 3, offs) == -ENOEXEC, "Non-ELF file is -ENOEXEC");
+    write_file(path, "");
+    test_assert(elf_func_offsets(path, names, 3, offs) == -ENOEXEC, "Empty file is -ENOEXEC");
+}
+
+static void test_maps_lines(void) {
+    printf("\n" BLUE "Testing /proc/<pid>/maps parsing..." RESET "\n");
+
+    struct maps_entry e;
+    char line[256];
+
+    strcpy(line, "7f1c2a000000-7f1c2a0a0000 r-xp 00022000 fd:01 1835123                    /usr/lib/x86_64-linux-gnu/libssl.so.3\n");
+    test_assert(maps_parse_line(line, &e), "Parses a library mapping");
+    test_assert(e.exec && e.ino == 1835123 && e.dev == makedev(0xfd, 1), "Gets perms, dev and inode");
+    test_assert(!strcmp(e.path, "/usr/lib/x86_64-linux-gnu/libssl.so.3"), "Path without the newline");
+
+    strcpy(line, "7f1c2a0a0000-7f1c2a0b0000 r--p 000c2000 fd:01 1835123 /usr/lib/libssl.so.3\n");
+    test_assert(maps_parse_line(line, &e) && !e.exec, "Read-only mapping is not exec");
+
+    strcpy(line, "7ffd1b1f4000-7ffd1b215000 rw-p 00000000 00:00 0                          [stack]\n");
+    test_assert(!maps_parse_line(line, &e), "Skips [stack]");
+    strcpy(line, "7f1c2a200000-7f1c2a300000 rw-p 00000000 00:00 0 \n");
+    test_assert(!maps_parse_line(line, &e), "Skips anonymous mappings");
+    strcpy(line, "7f1c2a000000-7f1c2a0a0000 r-xp 00000000 08:02 42 /opt/agent/node (deleted)\n");
+    test_assert(!maps_parse_line(line, &e), "Skips deleted files");
+    strcpy(line, "7f1c2a000000-7f1c2a0a0000 r-xp 00000000 08:02 42 /opt/my agent/bin/node\n");
+    test_assert(maps_parse_line(line, &e) && !strcmp(e.path, "/opt/my agent/bin/node"),
+                "Keeps spaces in paths");
+}
+
+static void test_lib_names(void) {
+    printf("\n" BLUE "Testing library names..." RESET "\n");
+
+    test_assert(ssl_lib_by_name("/usr/lib/x86_64-linux-gnu/libssl.so.3") == SSL_LIB_OPENSSL, "libssl.so.3 is OpenSSL");
+    test_assert(ssl_lib_by_name("/venv/lib/python3.12/site-packages/cryptography.libs/libssl-1b2b5ba0.so.3") == SSL_LIB_OPENSSL,
+                "Wheel-vendored libssl-<hash>.so is OpenSSL");
+    test_assert(ssl_lib_by_name("/usr/lib/libgnutls.so.30") == SSL_LIB_GNUTLS, "libgnutls.so.30 is GnuTLS");
+    test_assert(ssl_lib_by_name("/usr/lib64/libnspr4.so") == SSL_LIB_NSS, "libnspr4.so is NSS");
+    test_assert(ssl_lib_by_name("/usr/lib64/libssl3.so") == SSL_LIB_MAX, "NSS's libssl3.so is not OpenSSL");
+    test_assert(ssl_lib_by_name("/usr/lib/libsslfoo.so") == SSL_LIB_MAX, "Other libssl* names are not matched");
+    test_assert(ssl_lib_by_name("/usr/bin/node") == SSL_LIB_MAX, "Executables go by their symbols");
+}
+
+// A fake /proc/<pid> whose root is the real / and whose maps are @maps
+static void fake_proc(pid_t pid, const char *maps) {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%d", tmpdir, pid);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/%d/root", tmpdir, pid);
+    if (symlink("/", path) && errno != EEXIST)
+        perror("symlink");
+    snprintf(path, sizeof(path), "%s/%d/maps", tmpdir, pid);
+    write_file(path, maps);
+}
+
+static void test_scan(void) {
+    printf("\n" BLUE "Testing maps scans and the inode cache..." RESET "\n");
+
+    struct attached a = {};
+    struct ssl_attach m;
+    char maps[5 * PATH_MAX + 512], text[PATH_MAX], expect[PATH_MAX + 64];
+
+    snprintf(text, sizeof(text), "%s/libssl.so.3", tmpdir);
+    write_file(text, "not an ELF file either, but named like one\n");
+    snprintf(maps, sizeof(maps),
+             "00400000-00500000 r--p 00000000 fd:01 11 %s\n"
+             "00500000-00600000 r-xp 00100000 fd:01 11 %s\n"
+             "00600000-00700000 r-xp 00200000 fd:01 11 %s\n"
+             "7f0000000000-7f0000001000 r-xp 00000000 fd:01 12 %s\n"
+             "7f0000100000-7f0000101000 r-xp 00000000 fd:01 13 %s\n"
+             "7ffd1b1f4000-7ffd1b215000 rw-p 00000000 00:00 0 [stack]\n",
+             exe, exe, exe, exe, text);
+    fake_proc(100, maps);
+
+    test_assert(ssl_attach_init(&m, 1 << SSL_LIB_OPENSSL, record_attach, &a) == 0, "Init");
+    m.proc = tmpdir;
+
+    test_assert(ssl_attach_scan(&m, 100) == 4, "Looks at the executable mappings only");
+    test_assert(a.calls == 1, "Attaches the binary with SSL_write exactly once");
+    test_assert(a.lib == SSL_LIB_OPENSSL, "Bundled SSL is attached as OpenSSL");
+    snprintf(expect, sizeof(expect), "%s/100/root%s", tmpdir, exe);
+    test_assert(!strcmp(a.path, expect), "Attaches through the process' root");
+    test_assert(a.offsets[SSL_SYM_WRITE] == mapped_offset((void *)SSL_write) &&
+                a.offsets[SSL_SYM_READ] == mapped_offset((void *)SSL_read) &&
+                a.offsets[SSL_SYM_WRITE_EX] == 0, "Passes the resolved offsets");
+    test_assert(m.attached == 1, "Counts one attached file");
+
+    size_t known = m.nr_inodes;
+    test_assert(ssl_attach_scan(&m, 100) == 4 && a.calls == 1 && m.nr_inodes == known,
+                "A second scan hits the cache");
+    test_assert(ssl_attach_path(&m, exe, SSL_LIB_OPENSSL) == 0 && a.calls == 1,
+                "The same file by path is already attached");
+
+    // The named library is no ELF, so it fails once and is not retried
+    snprintf(maps, sizeof(maps), "00400000-00500000 r-xp 00000000 fd:01 14 %s\n", text);
+    fake_proc(101, maps);
+    ssl_attach_scan(&m, 101);
+    test_assert(a.calls == 1, "A libssl without symbols is not attached");
+    test_assert(ssl_attach_path(&m, text, SSL_LIB_OPENSSL) == -ENOENT, "and reports failure by path");
+    test_assert(ssl_attach_scan(&m, 999) == -ENOENT, "Gone processes are -ENOENT");
+
+    // Many distinct inodes grow the table without losing any
+    for (int i = 0; i < 200; i++)
+        ssl_attach_set(&m, makedev(8, 1), 1000 + i, SSL_INODE_NONE);
+    bool all = true;
+    for (int i = 0; i < 200; i++)
+        all &= ssl_attach_known(&m, makedev(8, 1), 1000 + i);
+    test_assert(all && ssl_attach_known(&m, makedev(0xfd, 1), 11), "Cache survives growing");
+    ssl_attach_free(&m);
+
+    // A failing attach is cached too, and libraries not asked for are skipped
+    a = (struct attached){ .ret = -EINVAL };
+    ssl_attach_init(&m, 1 << SSL_LIB_OPENSSL, record_attach, &a);
+    m.proc = tmpdir;
+    ssl_attach_scan(&m, 100);
+    ssl_attach_scan(&m, 100);
+    test_assert(a.calls == 1 && m.attached == 0, "Failed attach is tried once");
+    ssl_attach_free(&m);
+
+    a = (struct attached){};
+    ssl_attach_init(&m, 1 << SSL_LIB_GNUTLS, record_attach, &a);
+    m.proc = tmpdir;
+    ssl_attach_scan(&m, 100);
+    test_assert(a.calls == 0, "Bundled OpenSSL is ignored without OpenSSL");
+    ssl_attach_free(&m);
+}
+
+// What a restarted sslsniff finds in its pinned map of known files
+static struct ssl_inode saved[16];
+static int nr_saved;
+
+static void save_inode(void *ctx, __u64 dev, __u64 ino, enum ssl_inode_state state) {
+    (void)ctx;
+    if (nr_saved < 16)
+        saved[nr_saved++] = (struct ssl_inode){ .dev = dev, .ino = ino, .state = state };
+}
+
+static void test_restart(void) {
+    printf("\n" BLUE "Testing known files across a restart..." RESET "\n");
+
+    struct attached a = {};
+    struct ssl_attach m;
+
+    // pid 100 still maps the bundled-OpenSSL binary from test_scan()
+    ssl_attach_init(&m, 1 << SSL_LIB_OPENSSL, record_attach, &a);
+    m.proc = tmpdir;
+    m.on_set = save_inode;
+    ssl_attach_scan(&m, 100);
+    test_assert(a.calls == 1 && nr_saved == (int)m.nr_inodes, "Every inode recorded is reported");
+    ssl_attach_free(&m);
+
+    // The next run seeds its cache before scanning, and attaches nothing twice
+    a = (struct attached){};
+    ssl_attach_init(&m, 1 << SSL_LIB_OPENSSL, record_attach, &a);
+    m.proc = tmpdir;
+    for (int i = 0; i < nr_saved; i++)
+        ssl_attach_set(&m, saved[i].dev, saved[i].ino, saved[i].state);
+    ssl_attach_scan(&m, 100);
+    test_assert(a.calls == 0, "Files attached by the previous run are skipped");
+    test_assert(ssl_attach_path(&m, exe, SSL_LIB_OPENSSL) == 0, "and count as attached by path");
+    ssl_attach_free(&m);
+}
+
+static void test_exec_queue(void) {
+    printf("\n" BLUE "Testing scans after exec..." RESET "\n");
+
+    struct attached a = {};
+    struct ssl_attach m;
+    char maps[PATH_MAX + 128];
+    const __u64 ms = 1000000ULL;
+
+    ssl_attach_init(&m, 1 << SSL_LIB_OPENSSL, record_attach, &a);
+    m.proc = tmpdir;
+    fake_proc(200, "");
+
+    test_assert(ssl_attach_timeout_ms(&m, 0, 100) == 100, "Nothing queued, full timeout");
+    ssl_attach_exec(&m, 200, 1000 * ms);
+    ssl_attach_exec(&m, 999, 1005 * ms);
+    test_assert(ssl_attach_timeout_ms(&m, 1000 * ms, 100) == 20, "Wakes up for the first scan");
+
+    ssl_attach_tick(&m, 1010 * ms);
+    test_assert(m.nr_pending == 2, "Nothing is due before SSL_ATTACH_SCAN_NS");
+
+    // The loader has mapped the binary by now
+    snprintf(maps, sizeof(maps), "00500000-00600000 r-xp 00100000 fd:01 21 %s\n", exe);
+    fake_proc(200, maps);
+    ssl_attach_tick(&m, 1030 * ms);
+    test_assert(a.calls == 1, "Scans the process once it is due");
+    test_assert(m.nr_pending == 1 && m.pending[0].pid == 200 && m.pending[0].rescan &&
+                m.pending[0].due_ns == 1500 * ms, "Queues one rescan, none for a gone process");
+    test_assert(ssl_attach_timeout_ms(&m, 1030 * ms, 1000) == 470, "Waits for the rescan");
+
+    ssl_attach_tick(&m, 1600 * ms);
+    test_assert(m.nr_pending == 0 && a.calls == 1, "The rescan is the last one, and cached");
+
+    for (int i = 0; i < SSL_ATTACH_MAX_PENDING + 10; i++)
+        ssl_attach_exec(&m, 300 + i, 2000 * ms);
+    test_assert(m.nr_pending == SSL_ATTACH_MAX_PENDING, "The queue is bounded");
+    ssl_attach_free(&m);
+}
+
+static void remove_tree(const char *dir) {
+    char cmd[PATH_MAX + 16];
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd))
+        perror("rm");
+}
+
+int main() {
+    printf(YELLOW "===== SSL Library Attach Tests =====" RESET "\n");
+
+    ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (n < 0 || !mkdtemp(tmpdir)) {
+        perror("setup");
+        return 1;
+    }
+    exe[n] = '\0';
+
+    test_elf_offsets();
+    test_maps_lines();
+    test_lib_names();
+    test_scan();
+    test_restart();
+    test_exec_queue();
+
+    remove_tree(tmpdir);
+
+    printf("\n" YELLOW "===== Test Summary =====" RESET "\n");
+    printf("Tests passed: " GREEN "%d" RESET "\n", tests_passed);
+    printf("Tests failed: " RED "%d" RESET "\n", tests_failed);
+    printf("Total tests:  %d\n", tests_passed + tests_failed);
+
+    if (tests_failed == 0) {
+        printf(GREEN "All tests passed!" RESET "\n");
+        return 0;
+    } else {
+        printf(RED "Some tests failed!" RESET "\n");
+        return 1;
+    }
+}
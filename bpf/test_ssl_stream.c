@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ssl_stream.h"
+
+// Test colors for output
+#define RESET   "\033[0m"
+#define RED     "\033[31m"
+#define GREEN   "\033[32m"
+#define YELLOW  "\033[33m"
+#define BLUE    "\033[34m"
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+void test_assert(bool condition, const char *test_name) {
+    if (condition) {
+        printf("[" GREEN "PASS" RESET "] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[" RED "FAIL" RESET "] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+// Stand-in for sslsniff's record header
+struct hdr {
+    int seq;
+};
+
+#define MAX_FRAMES 64
+
+struct frame {
+    enum ssl_frame kind;
+    char *data;
+    size_t len;
+    unsigned int chunks;
+    uint64_t first_ts;
+    uint32_t rw;
+    int seq;
+};
+
+static struct frame frames[MAX_FRAMES];
+static int nr_frames;
+
+static void collect(void *ctx, const struct ssl_stream *s, enum ssl_frame kind,
+                    const char *data, size_t len) {
+    (void)ctx;
+    if (nr_frames == MAX_FRAMES)
+        return;
+    struct frame *f = &frames[nr_frames++];
+    f->kind = kind;
+    f->data = malloc(len + 1);
+    memcpy(f->data, data, len);
+    f->data[len] = '\0';
+    f->len = len;
+    f->chunks = s->chunks;
+    f->first_ts = s->first_ts;
+    f->rw = s->key.rw;
+    f->seq = ((const struct hdr *)s->hdr)->seq;
+}
+
+static void reset_frames(void) {
+    for (int i = 0; i < nr_frames; i++)
+        free(frames[i].data);
+    nr_frames = 0;
+}
+
+static bool frame_is(int i, enum ssl_frame kind, const char *data) {
+    return i < nr_frames && frames[i].kind == kind && frames[i].len == strlen(data) &&
+           memcmp(frames[i].data, data, frames[i].len) == 0;
+}
+
+static struct ssl_streams streams;
+static int seq;
+
+static void feed_rw(uint32_t rw, uint64_t ts, const char *data, size_t lost) {
+    struct ssl_stream_key key = { .ssl = 0x1000, .pid = 42, .rw = rw };
+    struct hdr h = { .seq = ++seq };
+
+    ssl_streams_feed(&streams, &key, &h, ts, data, strlen(data), lost);
+}
+
+static void feed(uint64_t ts, const char *data) {
+    feed_rw(0, ts, data, 0);
+}
+
+static void setup(void) {
+    reset_frames();
+    seq = 0;
+    ssl_streams_init(&streams, sizeof(struct hdr), collect, NULL);
+}
+
+void test_http_messages() {
+    printf("\n" BLUE "Testing HTTP message framing..." RESET "\n");
+
+    setup();
+    feed(1, "GET /v1/models HTTP/1.1\r\nHost: api\r\n\r\n");
+    test_assert(frame_is(0, SSL_FRAME_HTTP, "GET /v1/models HTTP/1.1\r\nHost: api\r\n\r\n"),
+                "A request without a body is one frame");
+
+    feed(2, "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n");
+    feed(3, "\r\nhello");
+    test_assert(nr_frames == 1, "Nothing goes out before the body is complete");
+    feed(4, " world");
+    test_assert(frame_is(1, SSL_FRAME_HTTP, "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nhello world"),
+                "Content-Length body is stitched from several chunks");
+    test_assert(frames[1].chunks == 3 && frames[1].first_ts == 2 && frames[1].seq == 4,
+                "The frame counts its chunks, starts at the first and carries the last header");
+
+    feed(5, "POST /a HTTP/1.1\r\ncontent-length: 2\r\n\r\nabPOST /b HTTP/1.1\r\nContent-Length: 1\r\n\r\nc");
+    test_assert(frame_is(2, SSL_FRAME_HTTP, "POST /a HTTP/1.1\r\ncontent-length: 2\r\n\r\nab") &&
+                frame_is(3, SSL_FRAME_HTTP, "POST /b HTTP/1.1\r\nContent-Length: 1\r\n\r\nc"),
+                "Pipelined messages in one chunk are split");
+    test_assert(frames[3].chunks == 1, "A message starting mid-chunk counts that chunk");
+
+    feed(6, "HTTP/1.1 204 No Content\r\nContent-Length: 10\r\n\r\n");
+    test_assert(frame_is(4, SSL_FRAME_HTTP, "HTTP/1.1 204 No Content\r\nContent-Length: 10\r\n\r\n"),
+                "A 204 has no body whatever its headers say");
+
+    // Chunked body cut at awkward places, including inside a size line
+    feed(7, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhel");
+    feed(8, "lo\r\n1");
+    feed(9, "0;ext=1\r\n0123456789abcdef\r\n0\r\n");
+    test_assert(nr_frames == 5, "Chunked body waits for the last chunk");
+    feed(10, "\r\n");
+    test_assert(frame_is(5, SSL_FRAME_HTTP,
+                         "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n10;ext=1\r\n"
+                         "0123456789abcdef\r\n0\r\n\r\n"),
+                "Chunked message goes out whole, framing included");
+
+    feed(11, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n0\r\nX-Trailer: 1\r\n\r\n");
+    test_assert(frame_is(6, SSL_FRAME_HTTP,
+                         "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n0\r\nX-Trailer: 1\r\n\r\n"),
+                "Trailers end at the empty line");
+
+    ssl_streams_free(&streams);
+    test_assert(nr_frames == 7 && streams.nr == 0, "Freeing idle streams emits nothing");
+}
+
+void test_event_stream() {
+    printf("\n" BLUE "Testing SSE event framing..." RESET "\n");
+
+    setup();
+    feed(1, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream; charset=utf-8\r\n"
+            "Transfer-Encoding: chunked\r\n\r\n");
+    test_assert(frame_is(0, SSL_FRAME_HTTP, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream; charset=utf-8\r\n"
+                                            "Transfer-Encoding: chunked\r\n\r\n"),
+                "The head of an event stream goes out at once");
+
+    // One event split over two SSL reads and two HTTP chunks
+    feed(2, "16\r\nevent: ping\ndata: {\"a\"\r\n");
+    test_assert(nr_frames == 1, "An incomplete event is held");
+    feed(3, "4\r\n:1}\n\r\n1");
+    feed(4, "\r\n\n\r\n");
+    test_assert(frame_is(1, SSL_FRAME_SSE, "event: ping\ndata: {\"a\":1}\n\n"),
+                "An event is de-chunked and stitched");
+    test_assert(frames[1].chunks == 3 && frames[1].first_ts == 2, "The event counts its chunks");
+
+    feed(5, "20\r\ndata: one\n\ndata: two\r\n\r\ndata: th\r\n");
+    test_assert(frame_is(2, SSL_FRAME_SSE, "data: one\n\n") &&
+                frame_is(3, SSL_FRAME_SSE, "data: two\r\n\r\n"),
+                "Several events in one chunk go out one by one");
+    test_assert(frames[3].chunks == 1, "Each of them counts the chunk");
+
+    feed(6, "5\r\nree\n\n\r\n0\r\n\r\nGET / HTTP/1.1\r\n\r\n");
+    test_assert(frame_is(4, SSL_FRAME_SSE, "data: three\n\n"), "The last event completes");
+    test_assert(frame_is(5, SSL_FRAME_HTTP, "GET / HTTP/1.1\r\n\r\n"),
+                "The connection goes back to HTTP after the last chunk");
+
+    // Without chunking the stream runs to the end of the connection
+    feed(7, "HTTP/1.0 200 OK\r\nContent-Type: text/event-stream\r\n\r\ndata: x\n\ndata: y");
+    test_assert(frame_is(6, SSL_FRAME_HTTP, "HTTP/1.0 200 OK\r\nContent-Type: text/event-stream\r\n\r\n") &&
+                frame_is(7, SSL_FRAME_SSE, "data: x\n\n") && nr_frames == 8,
+                "An unframed event stream is cut the same way");
+    ssl_streams_expire(&streams, 7 + SSL_STREAM_IDLE_NS);
+    test_assert(frame_is(8, SSL_FRAME_PARTIAL, "data: y"), "A quiet stream hands over its partial event");
+    test_assert(streams.nr == 1, "The stream is kept after handing over");
+
+    ssl_streams_free(&streams);
+    reset_frames();
+}
+
+void test_passthrough() {
+    printf("\n" BLUE "Testing pass-through and resync..." RESET "\n");
+
+    setup();
+    feed(1, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+    feed(2, "\x01\x02 binary frame");
+    test_assert(frame_is(0, SSL_FRAME_CHUNK, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n") &&
+                frame_is(1, SSL_FRAME_CHUNK, "\x01\x02 binary frame"),
+                "Non-HTTP/1 traffic passes through per chunk");
+    test_assert(frames[1].chunks == 1 && frames[1].first_ts == 2, "A passed chunk is its own frame");
+
+    // A capture started mid-message picks up at the next message
+    feed(3, "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok");
+    test_assert(frame_is(2, SSL_FRAME_HTTP, "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok"),
+                "A chunk starting a message resyncs the stream");
+
+    // Too short to tell: held back until the next chunk
+    feed(4, "PO");
+    test_assert(nr_frames == 3, "A possible start line is held back");
+    feed(5, "ST /x HTTP/1.1\r\nContent-Length: 0\r\n\r\n");
+    test_assert(frame_is(3, SSL_FRAME_HTTP, "POST /x HTTP/1.1\r\nContent-Length: 0\r\n\r\n") &&
+                frames[3].chunks == 2, "It joins the message it starts");
+    feed(6, "GE");
+    feed(7, "Xtra");
+    test_assert(frame_is(4, SSL_FRAME_CHUNK, "GEXtra"), "Or goes through with the next chunk");
+
+    // Bytes the probe could not copy
+    feed(8, "POST / HTTP/1.1\r\nContent-Length: 100\r\n\r\npart");
+    feed_rw(0, 9, "more", 96);
+    test_assert(frame_is(5, SSL_FRAME_PARTIAL, "POST / HTTP/1.1\r\nContent-Length: 100\r\n\r\npart") &&
+                frame_is(6, SSL_FRAME_CHUNK, "more"),
+                "A truncated chunk flushes the message and passes through");
+    feed(10, "tail of the lost body");
+    test_assert(frame_is(7, SSL_FRAME_CHUNK, "tail of the lost body"), "The rest passes until a new message");
+
+    // A malformed chunk size gives up on the message
+    feed(11, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n");
+    test_assert(frame_is(8, SSL_FRAME_PARTIAL, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n") &&
+                frame_is(9, SSL_FRAME_CHUNK, "zz\r\n"),
+                "A bad chunk size desyncs the stream");
+
+    ssl_streams_free(&streams);
+    reset_frames();
+}
+
+void test_limits() {
+    printf("\n" BLUE "Testing idle flush and limits..." RESET "\n");
+
+    setup();
+    // No length, no chunking: the body ends with the connection
+    feed(100, "HTTP/1.0 200 OK\r\n\r\nbody");
+    test_assert(nr_frames == 0, "A close-delimited body is held");
+    ssl_streams_expire(&streams, 100 + SSL_STREAM_IDLE_NS - 1);
+    test_assert(nr_frames == 0, "Nothing is flushed before the idle time");
+    ssl_streams_expire(&streams, 100 + SSL_STREAM_IDLE_NS);
+    test_assert(nr_frames == 0, "Sweeps are rate limited");
+    streams.next_sweep = 0;
+    ssl_streams_expire(&streams, 100 + SSL_STREAM_IDLE_NS);
+    test_assert(frame_is(0, SSL_FRAME_HTTP, "HTTP/1.0 200 OK\r\n\r\nbody"), "Going quiet ends it");
+    feed(200, " more");
+    streams.next_sweep = 0;
+    ssl_streams_expire(&streams, 200 + SSL_STREAM_FORGET_NS);
+    test_assert(frame_is(1, SSL_FRAME_PARTIAL, " more"), "Later bytes of it are partial");
+    test_assert(streams.nr == 0, "Long quiet streams are forgotten");
+
+    // Directions are separate streams, a handshake closes both
+    feed_rw(1, 300, "POST / HTTP/1.1\r\nContent-Length: 4\r\n\r\nab", 0);
+    feed_rw(0, 301, "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK\r\nContent-Length: 9\r\n\r\n", 0);
+    test_assert(frame_is(2, SSL_FRAME_HTTP, "HTTP/1.1 100 Continue\r\n\r\n") && frames[2].rw == 0,
+                "Reads are framed on their own");
+    feed_rw(1, 302, "cd", 0);
+    test_assert(frame_is(3, SSL_FRAME_HTTP, "POST / HTTP/1.1\r\nContent-Length: 4\r\n\r\nabcd") &&
+                frames[3].rw == 1, "Writes complete independently");
+    ssl_streams_close(&streams, 42, 0x1000);
+    test_assert(frame_is(4, SSL_FRAME_PARTIAL, "HTTP/1.1 200 OK\r\nContent-Length: 9\r\n\r\n") &&
+                streams.nr == 0, "Closing a connection flushes and drops both directions");
+
+    // A huge body goes out in capped pieces
+    reset_frames();
+    size_t body = SSL_STREAM_MAX_BYTES + 1000;
+    char head[64], *chunk = malloc(512 * 1024 + 1);
+    snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", body);
+    feed(400, head);
+    memset(chunk, 'x', 512 * 1024);
+    chunk[512 * 1024] = '\0';
+    for (size_t sent = 0; sent < body; sent += 512 * 1024) {
+        if (body - sent < 512 * 1024)
+            chunk[body - sent] = '\0';
+        feed(401, chunk);
+    }
+    size_t total = 0;
+    bool capped = true, partial = true;
+    for (int i = 0; i < nr_frames; i++) {
+        total += frames[i].len;
+        capped &= frames[i].len <= SSL_STREAM_MAX_BYTES + 512 * 1024;
+        partial &= frames[i].kind == SSL_FRAME_PARTIAL;
+    }
+    test_assert(nr_frames == 2 && capped, "Buffering stops at SSL_STREAM_MAX_BYTES");
+    test_assert(partial && total == strlen(head) + body, "Every byte goes out as partial frames");
+    free(chunk);
+
+    feed(402, "GET / HTTP/1.1\r\n\r\n");
+    test_assert(frame_is(2, SSL_FRAME_HTTP, "GET / HTTP/1.1\r\n\r\n"), "The next message is whole again");
+
+    ssl_streams_free(&streams);
+    reset_frames();
+}
+
+int main() {
+    printf(YELLOW "===== SSL Stream Reassembly Tests =====" RESET "\n");
+
+    test_http_messages();
+    test_event_stream();
+    test_passthrough();
+    test_limits();
+
+    printf("\n" YELLOW "===== Test Summary =====" RESET "\n");
+    printf("Tests passed: " GREEN "%d" RESET "\n", tests_passed);
+    printf("Tests failed: " RED "%d" RESET "\n", tests_failed);
+    printf("Total tests:  %d\n", tests_passed + tests_failed);
+
+    if (tests_failed == 0) {
+        printf(GREEN "All tests passed!" RESET "\n");
+        return 0;
+    } else {
+        printf(RED "Some tests failed!" RESET "\n");
+        return 1;
+    }
+}
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "json_writer.h"
+#include "binary_format.h"
+#include "string_intern.h"
+
+// Test colors for output
+#define RESET   "\033[0m"
+#define RED     "\033[31m"
+#define GREEN   "\033[32m"
+#define YELLOW  "\033[33m"
+#define BLUE    "\033[34m"
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+void test_assert(bool condition, const char *test_name) {
+    if (condition) {
+        printf("[" GREEN "PASS" RESET "] %s\n", test_name);
+        tests_passed++;
+    } else {
+        printf("[" RED "FAIL" RESET "] %s\n", test_name);
+        tests_failed++;
+    }
+}
+
+static int32_t get(struct string_intern *t, const char *s, bool *is_new) {
+    return string_intern_get(t, s, strlen(s), is_new);
+}
+
+void test_table() {
+    struct string_intern t;
+    bool is_new, all_found = true;
+    char name[32];
+
+    printf("\n" BLUE "Testing the intern table:" RESET "\n");
+
+    test_assert(string_intern_init(&t, 0) == -EINVAL, "An empty table is rejected");
+    test_assert(string_intern_init(&t, 3) == 0, "A table of three strings");
+
+    test_assert(get(&t, "bash", &is_new) == 0 && is_new, "The first string gets id 0 and needs a definition");
+    test_assert(get(&t, "node", &is_new) == 1 && is_new, "The next one gets id 1");
+    test_assert(get(&t, "bash", &is_new) == 0 && !is_new, "A known string keeps its id without a definition");
+    test_assert(get(&t, "python", &is_new) == 2 && is_new && t.count == 3, "The table fills up");
+
+    // LRU order is now node, bash, python
+    test_assert(get(&t, "curl", &is_new) == 1 && is_new, "A new string takes the id of the least recently used");
+    test_assert(string_intern_str(&t, 1) && strcmp(string_intern_str(&t, 1), "curl") == 0,
+                "and the id stands for the new string");
+    test_assert(get(&t, "node", &is_new) == 0 && is_new, "An evicted string is defined again under a new id");
+    test_assert(get(&t, "python", &is_new) == 2 && !is_new, "Strings still in the table are unaffected");
+    test_assert(t.defs == 5, "Every (re)definition is counted");
+    string_intern_free(&t);
+
+    // Many evictions through one index: lookups must survive the backward shifts
+    string_intern_init(&t, 64);
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "/usr/lib/lib%d.so", i);
+        get(&t, name, &is_new);
+    }
+    for (int i = 1000 - 64; i < 1000; i++) {
+        snprintf(name, sizeof(name), "/usr/lib/lib%d.so", i);
+        if (get(&t, name, &is_new) < 0 || is_new)
+            all_found = false;
+    }
+    test_assert(all_found && t.count == 64, "The last 64 of 1000 strings are all still found");
+    snprintf(name, sizeof(name), "/usr/lib/lib%d.so", 0);
+    test_assert(get(&t, name, &is_new) >= 0 && is_new, "An old one is not");
+    string_intern_free(&t);
+}
+
+void test_json_output() {
+    struct string_intern t;
+    struct json_writer w;
+    const char *first =
+        "{\"event\":\"STRING_DEF\",\"id\":0,\"value\":\"bash\"}\n"
+        "{\"event\":\"STRING_DEF\",\"id\":1,\"value\":\"/etc/\\\"hosts\\\"\"}\n"
+        "{\"timestamp\":1,\"comm\":0,\"pid\":7,\"filepath\":1}\n";
+    const char *second = "{\"timestamp\":2,\"comm\":0,\"pid\":7,\"filepath\":1}\n";
+
+    printf("\n" BLUE "Testing interned JSON fields:" RESET "\n");
+
+    jw_init(&w, -1, 0);
+    jw_begin(&w);
+    jw_field_interned(&w, "comm", "bash");
+    jw_end(&w);
+    test_assert(strncmp(w.buf, "{\"comm\":\"bash\"}\n", w.len) == 0, "Without a table strings stay inline");
+
+    w.len = 0;
+    string_intern_init(&t, 16);
+    w.intern = &t;
+    jw_begin(&w);
+    jw_field_u64(&w, "timestamp", 1);
+    jw_field_interned(&w, "comm", "bash");
+    jw_field_i64(&w, "pid", 7);
+    jw_field_interned(&w, "filepath", "/etc/\"hosts\"");
+    jw_end(&w);
+    test_assert(w.len == strlen(first) && memcmp(w.buf, first, w.len) == 0,
+                "Definitions go in front of the record that first uses them");
+
+    w.len = 0;
+    jw_begin(&w);
+    jw_field_u64(&w, "timestamp", 2);
+    jw_field_interned(&w, "comm", "bash");
+    jw_field_i64(&w, "pid", 7);
+    jw_field_interned(&w, "filepath", "/etc/\"hosts\"");
+    jw_end(&w);
+    test_assert(w.len == strlen(second) && memcmp(w.buf, second, w.len) == 0,
+                "Later records only carry the ids");
+
+    // A reader too far behind: the record is dropped, its definition is not
+    w.len = 0;
+    w.max_buffered = 1;
+    jw_begin(&w);
+    jw_field_interned(&w, "comm", "node");
+    jw_end(&w);
+    test_assert(w.dropped == 1 && w.len == strlen("{\"event\":\"STRING_DEF\",\"id\":2,\"value\":\"node\"}\n") &&
+                memcmp(w.buf, "{\"event\":\"STRING_DEF\",\"id\":2,", 28) == 0,
+                "A dropped record leaves its definition behind");
+
+    w.intern = NULL;
+    jw_free(&w);
+    string_intern_free(&t);
+}
+
+static uint32_t read_u32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+void test_binary_output() {
+    struct string_intern t;
+    struct json_writer w;
+    const char def[] = "\x0b\0\0\0" "\x06" "\0\0\0\0" "\x04\0" "bash";
+    const size_t def_len = sizeof(def) - 1;
+
+    printf("\n" BLUE "Testing interned binary strings:" RESET "\n");
+
+    jw_init(&w, -1, 0);
+    w.binary = true;
+    string_intern_init(&t, 16);
+    w.intern = &t;
+
+    bin_event_begin(&w, BIN_RECORD_EXEC, 100, 42, "bash");
+    bin_u32(&w, 1);
+    bin_str_interned(&w, "bash");
+    bin_str(&w, "bash -l");
+    bin_event_end(&w, NULL);
+    test_assert(w.len > def_len && memcmp(w.buf, def, def_len) == 0,
+                "A STRING_DEF record comes first");
+    test_assert(read_u32(w.buf + def_len) == w.len - def_len - 4 && w.buf[def_len + 4] == BIN_RECORD_EXEC,
+                "followed by the event with its length patched in");
+    test_assert(memcmp(w.buf + def_len + 5 + 12, "\xff\xff" "\0\0\0\0", 6) == 0,
+                "whose comm is a reference");
+    test_assert(memcmp(w.buf + def_len + 5 + 18 + 4, "\xff\xff" "\0\0\0\0" "\x07\0" "bash -l", 15) == 0,
+                "as is the interned filename, the inline string is not");
+
+    w.len = 0;
+    bin_event_begin(&w, BIN_RECORD_BASH_READLINE, 200, 42, "bash");
+    bin_str(&w, "ls");
+    bin_event_end(&w, NULL);
+    test_assert(read_u32(w.buf) == w.len - 4 && w.buf[4] == BIN_RECORD_BASH_READLINE,
+                "A known comm needs no definition");
+
+    w.intern = NULL;
+    jw_free(&w);
+    string_intern_free(&t);
+}
+
+int main() {
+    printf(YELLOW "===== String Intern Tests =====" RESET "\n");
+
+    test_table();
+    test_json_output();
+    test_binary_output();
+
+    printf("\n" YELLOW "===== Test Summary =====" RESET "\n");
+    printf("Tests passed: " GREEN "%d" RESET "\n", tests_passed);
+    printf("Tests failed: " RED "%d" RESET "\n", tests_failed);
+    printf("Total tests:  %d\n", tests_passed + tests_failed);
+
+    if (tests_failed == 0) {
+        printf(GREEN "All tests passed!" RESET "\n");
+        return 0;
+    } else {
+        printf(RED "Some tests failed!" RESET "\n");
+        return 1;
+    }
+}
@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+//
+// process and sslsniff in one binary: both skeletons, one event loop and
+// one time-ordered output stream, see tracer.h.
+#include <argp.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_writer.h"
+#include "binary_format.h"
+#include "output_transport.h"
+#include "ring_merge.h"
+#include "event_loop.h"
+#include "tracer.h"
+
+#define DEFAULT_MERGE_WINDOW_MS 10
+
+// Records written per ring_merge_pop()
+#define MERGE_POP_BATCH 256
+
+#define FLUSH_MS_KEY 1001
+#define FORMAT_KEY 1002
+#define OUTPUT_SOCKET_KEY 1003
+#define MERGE_WINDOW_MS_KEY 1004
+#define OUTPUT_DIR_KEY 1005
+
+extern const struct tracer process_tracer;
+extern const struct tracer sslsniff_tracer;
+
+// Tracers in setup order: sslsniff --follow-tracked reuses process's map
+static const struct tracer *const tracers[] = { &process_tracer, &sslsniff_tracer };
+#define NR_TRACERS (sizeof(tracers) / sizeof(tracers[0]))
+
+const char *argp_program_version = "trace 0.1";
+const char *argp_program_bug_address = "https://github.com/iovisor/bcc/tree/master/libbpf-tools";
+static const char argp_program_doc[] =
+	"Run process and sslsniff in one binary with one output stream.\n"
+	"\n"
+	"USAGE: trace [OPTIONS] [--process [PROCESS OPTIONS]] [--sslsniff [SSLSNIFF OPTIONS]]\n"
+	"\n"
+	"Everything after --process or --sslsniff, up to the other one, is passed\n"
+	"to that tracer as its own command line; a tracer that is not named does\n"
+	"not run. With neither, both run with their defaults. Records of both are\n"
+	"written in timestamp order, held up to --merge-window-ms to sort them.\n"
+	"\n"
+	"EXAMPLES:\n"
+	"    ./trace                                 # both tracers, JSON on stdout\n"
+	"    ./trace --format binary --output-socket /run/agentsight.sock\n"
+	"    ./trace --output-dir /var/lib/agentsight/capture # indexed .gz segments\n"
+	"    ./trace --process -c claude --sslsniff --follow-tracked # claude's tree only\n";
+
+static struct env {
+	unsigned int flush_ms;
+	enum output_format format;
+	const char *output_socket;
+	const char *output_dir;
+	unsigned int merge_window_ms;
+} env = {
+	.merge_window_ms = DEFAULT_MERGE_WINDOW_MS,
+};
+
+static const struct argp_option opts[] = {
+	{ "format", FORMAT_KEY, "FORMAT", 0, "Output format: json (default) or binary (length prefixed records for the collector)" },
+	{ "output-socket", OUTPUT_SOCKET_KEY, "PATH", 0, "Write output to the unix socket at PATH instead of stdout, dropping records rather than blocking when the reader falls behind" },
+	{ "output-dir", OUTPUT_DIR_KEY, "DIR", 0, "Write output to compressed segment files in DIR with an index.jsonl of their time and pid ranges instead of stdout" },
+	{ "flush-ms", FLUSH_MS_KEY, "MS", 0, "Buffer output for up to MS ms (default 0 = flush after every poll batch)" },
+	{ "merge-window-ms", MERGE_WINDOW_MS_KEY, "MS", 0, "Hold records up to MS ms to put the tracers' records in timestamp order (default 10)" },
+	{},
+};
+
+static error_t parse_arg(int key, char *arg, struct argp_state *state)
+{
+	switch (key) {
+	case FORMAT_KEY:
+		if (output_format_parse(arg) < 0) {
+			fprintf(stderr, "Invalid format: %s\n", arg);
+			argp_usage(state);
+		}
+		env.format = output_format_parse(arg);
+		break;
+	case OUTPUT_SOCKET_KEY:
+		env.output_socket = arg;
+		break;
+	case OUTPUT_DIR_KEY:
+		env.output_dir = arg;
+		break;
+	case FLUSH_MS_KEY:
+		env.flush_ms = atoi(arg);
+		break;
+	case MERGE_WINDOW_MS_KEY:
+		env.merge_window_ms = atoi(arg);
+		break;
+	case ARGP_KEY_ARG:
+		argp_usage(state);
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static const struct argp argp = {
+	.options = opts,
+	.parser = parse_arg,
+	.doc = argp_program_doc,
+};
+
+// One tracer's slice of the command line
+struct section {
+	bool enabled;
+	int argc;
+	char **argv;   /* argv[0] is the tracer name */
+};
+
+/*
+ * Split @argv at the --process and --sslsniff markers; trace's own options
+ * come first. The markers' slots are reused as each section's argv[0].
+ */
+static int split_args(int argc, char **argv, int *own_argc, struct section *sections)
+{
+	int cur = -1;
+
+	*own_argc = argc;
+	for (int i = 1; i < argc; i++) {
+		int t;
+
+		for (t = 0; t < (int)NR_TRACERS; t++)
+			if (argv[i][0] == '-' && argv[i][1] == '-' &&
+			    strcmp(argv[i] + 2, tracers[t]->name) == 0)
+				break;
+		if (t == (int)NR_TRACERS) {
+			if (cur >= 0)
+				sections[cur].argc++;
+			continue;
+		}
+		if (sections[t].enabled) {
+			fprintf(stderr, "--%s given twice\n", tracers[t]->name);
+			return -EINVAL;
+		}
+		if (cur < 0)
+			*own_argc = i;
+		cur = t;
+		argv[i] = (char *)tracers[t]->name;
+		sections[t].enabled = true;
+		sections[t].argc = 1;
+		sections[t].argv = &argv[i];
+	}
+
+	// with neither section both run with their defaults
+	if (cur < 0) {
+		for (int t = 0; t < (int)NR_TRACERS; t++) {
+			sections[t].enabled = true;
+			sections[t].argc = 1;
+			sections[t].argv = (char **)&tracers[t]->name;
+		}
+	}
+	return 0;
+}
+
+static struct json_writer out;
+static struct ring_merge merge;
+
+/* Write the records the merge has released, oldest first */
+static size_t write_merged(void)
+{
+	struct merge_record *recs[MERGE_POP_BATCH];
+	size_t n = ring_merge_pop(&merge, recs, MERGE_POP_BATCH);
+
+	for (size_t i = 0; i < n; i++) {
+		jw_append(&out, recs[i]->data, recs[i]->len);
+		free(recs[i]);
+	}
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	struct section sections[NR_TRACERS] = {};
+	struct event_loop loop;
+	struct tracer_ctx ctx = { .loop = &loop, .sink = &merge, .tracked_pids_fd = -1 };
+	bool set_up[NR_TRACERS] = {};
+	int own_argc, err, ret = 0;
+
+	err = split_args(argc, argv, &own_argc, sections);
+	if (err)
+		return 1;
+	err = argp_parse(&argp, own_argc, argv, 0, NULL, NULL);
+	if (err)
+		return err;
+	if (env.output_dir && env.output_socket) {
+		fprintf(stderr, "--output-dir cannot be combined with --output-socket\n");
+		return 1;
+	}
+	ctx.binary = env.format == OUTPUT_FORMAT_BINARY;
+
+	/* Ctrl-C and SIGTERM end the loop, blocked before any thread starts */
+	err = event_loop_init(&loop);
+	if (!err)
+		err = event_loop_handle_signals(&loop);
+	if (err) {
+		fprintf(stderr, "Failed to set up event loop: %d\n", err);
+		event_loop_free(&loop);
+		return 1;
+	}
+
+	/* Never full: nothing but this thread pushes, so it must not block */
+	err = ring_merge_init(&merge, (uint64_t)env.merge_window_ms * 1000000ULL, 0);
+	if (err) {
+		fprintf(stderr, "Failed to set up record merge: %d\n", err);
+		event_loop_free(&loop);
+		return 1;
+	}
+
+	if (env.output_dir)
+		err = output_open_dir(&out, env.output_dir, env.flush_ms);
+	else
+		err = output_open(&out, env.output_socket, env.flush_ms);
+	if (err) {
+		fprintf(stderr, "Failed to set up output: %d\n", err);
+		goto cleanup;
+	}
+	if (env.format == OUTPUT_FORMAT_BINARY)
+		bin_stream_start(&out);
+
+	for (size_t t = 0; t < NR_TRACERS && !err; t++) {
+		if (!sections[t].enabled)
+			continue;
+		err = tracers[t]->setup(sections[t].argc, sections[t].argv, &ctx);
+		set_up[t] = true;
+	}
+
+	while (!err && !loop.stop) {
+		int timeout_ms = jw_poll_timeout_ms(&out, TRACER_POLL_TIMEOUT_MS);
+
+		for (size_t t = 0; t < NR_TRACERS; t++)
+			if (set_up[t])
+				timeout_ms = tracers[t]->timeout_ms(timeout_ms);
+		timeout_ms = ring_merge_timeout_ms(&merge, timeout_ms);
+
+		err = event_loop_wait(&loop, timeout_ms);
+		if (err < 0) {
+			fprintf(stderr, "Error waiting for events: %d\n", err);
+			break;
+		}
+		/* also after a signal, so nothing already submitted is lost */
+		for (size_t t = 0; t < NR_TRACERS && err >= 0; t++)
+			if (set_up[t])
+				err = tracers[t]->poll();
+		if (err > 0)
+			err = 0;
+		while (write_merged())
+			;
+		jw_batch_end(&out);
+	}
+
+	if (!err)
+		for (size_t t = 0; t < NR_TRACERS; t++)
+			if (set_up[t])
+				tracers[t]->finish();
+
+cleanup:
+	/* the tracers may still hand over records while they shut down */
+	for (size_t t = 0; t < NR_TRACERS; t++)
+		if (set_up[t] && tracers[t]->cleanup(err))
+			ret = 1;
+	ring_merge_close(&merge);
+	while (write_merged())
+		;
+	output_close(&out);
+	ring_merge_free(&merge);
+	event_loop_free(&loop);
+	return ret || err ? 1 : 0;
+}
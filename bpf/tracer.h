@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __TRACER_H
+#define __TRACER_H
+
+/*
+ * A tracer's main loop, split into steps so the same code runs either as
+ * its own binary (tracer_main() from main) or next to the other tracer in
+ * trace, which loads both skeletons and waits on all their rings in one
+ * event loop (see trace.c).
+ *
+ * On its own a tracer writes to its --output-socket or stdout. Under trace
+ * it formats into a memory writer instead and hands every record to a
+ * shared ring_merge stamped with its timestamp; trace writes the merged,
+ * time-ordered stream. Both tracers take their timestamps from
+ * bpf_ktime_get_ns() and stats_now_ns(), the same CLOCK_MONOTONIC.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "event_loop.h"
+#include "json_writer.h"
+#include "ring_merge.h"
+
+/* What a tracer's setup() gets from the binary running it */
+struct tracer_ctx {
+	struct event_loop *loop;  /* add the rings here */
+	struct ring_merge *sink;  /* under trace: queue formatted records here, else NULL */
+	bool binary;              /* under trace: --format binary */
+	int tracked_pids_fd;      /* process's tracked_pids map once it is set up, else -1 */
+};
+
+struct tracer {
+	const char *name;
+	/* Parse @argv, load and attach, and add the rings to ctx->loop */
+	int (*setup)(int argc, char **argv, struct tracer_ctx *ctx);
+	/* How long the loop may sleep, at most @timeout_ms */
+	int (*timeout_ms)(int timeout_ms);
+	/* Consume the rings and run the periodic work after a wakeup, <0 to stop */
+	int (*poll)(void);
+	/* Print what the last, partial interval collected */
+	void (*finish)(void);
+	/* Free everything setup() got, returns the exit code for @err */
+	int (*cleanup)(int err);
+};
+
+/* Default wait of the tracers' loops */
+#define TRACER_POLL_TIMEOUT_MS 100
+
+/* Under trace, move what @w formatted since the last call to @sink as one record */
+static inline void tracer_sink_take(struct ring_merge *sink, struct json_writer *w, uint64_t ts)
+{
+	struct merge_record *r;
+
+	if (!sink || !w->len)
+		return;
+	r = merge_record_new(ts, w->buf, w->len);
+	w->len = 0;
+	if (r)
+		ring_merge_push(sink, &r, 1);
+}
+
+/* main() of a tracer binary: its own loop, output and signal handling */
+static inline int tracer_main(const struct tracer *t, int argc, char **argv)
+{
+	struct event_loop loop;
+	struct tracer_ctx ctx = { .loop = &loop, .tracked_pids_fd = -1 };
+	int err;
+
+	/* Ctrl-C and SIGTERM end the loop, blocked before any thread starts */
+	err = event_loop_init(&loop);
+	if (!err)
+		err = event_loop_handle_signals(&loop);
+	if (err) {
+		fprintf(stderr, "%s: failed to set up event loop: %d\n", t->name, err);
+		event_loop_free(&loop);
+		return 1;
+	}
+
+	err = t->setup(argc, argv, &ctx);
+	while (!err && !loop.stop) {
+		err = event_loop_wait(&loop, t->timeout_ms(TRACER_POLL_TIMEOUT_MS));
+		if (err < 0) {
+			fprintf(stderr, "%s: error waiting for events: %d\n", t->name, err);
+			break;
+		}
+		/* also after a signal, so nothing already submitted is lost */
+		err = t->poll();
+		if (err > 0)
+			err = 0;
+	}
+	if (!err)
+		t->finish();
+	err = t->cleanup(err);
+	event_loop_free(&loop);
+	return err;
+}
+
+#endif /* __TRACER_H */
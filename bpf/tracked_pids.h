@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __TRACKED_PIDS_H
+#define __TRACKED_PIDS_H
+
+/*
+ * Set of tgids that belong to the traced process tree.
+ *
+ * process maintains it in FILTER mode: seeded from /proc at startup, then
+ * extended on fork/exec when the parent is tracked (the same rule as
+ * should_track_process) and trimmed on exit. Its probes consult the set
+ * before reserving ring buffer space, so untracked processes cost one hash
+ * lookup. process can pin the map with --pin-tracked and sslsniff can then
+ * follow the same tree with --follow-tracked. Both objects declare the map
+ * identically so libbpf can reuse the pinned instance.
+ */
+
+#define TRACKED_PIDS_MAX_ENTRIES 16384
+#define TRACKED_PIDS_PIN_PATH "/sys/fs/bpf/agentsight_tracked_pids"
+
+#ifdef __bpf__
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, TRACKED_PIDS_MAX_ENTRIES);
+	__type(key, __u32);
+	__type(value, __u8);
+} tracked_pids SEC(".maps");
+
+static __always_inline bool tgid_is_tracked(__u32 tgid)
+{
+	return bpf_map_lookup_elem(&tracked_pids, &tgid) != NULL;
+}
+
+static __always_inline void tgid_track(__u32 tgid)
+{
+	__u8 one = 1;
+
+	bpf_map_update_elem(&tracked_pids, &tgid, &one, BPF_ANY);
+}
+
+static __always_inline void tgid_untrack(__u32 tgid)
+{
+	bpf_map_delete_elem(&tracked_pids, &tgid);
+}
+
+#else /* !__bpf__ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <bpf/bpf.h>
+
+/* Drop every entry, used before re-seeding a map left pinned by an old run */
+static inline void tracked_pids_clear(int map_fd)
+{
+	__u32 key;
+
+	while (bpf_map_get_next_key(map_fd, NULL, &key) == 0)
+		bpf_map_delete_elem(map_fd, &key);
+}
+
+static inline int tracked_pids_add(int map_fd, __u32 tgid)
+{
+	__u8 one = 1;
+
+	return bpf_map_update_elem(map_fd, &tgid, &one, BPF_ANY);
+}
+
+/* Add @nr tgids in one syscall, one by one on kernels without batch ops */
+static inline int tracked_pids_add_batch(int map_fd, const __u32 *tgids, __u32 nr)
+{
+	__u8 *ones;
+	__u32 count = nr;
+	int err;
+
+	if (!nr)
+		return 0;
+	ones = malloc(nr);
+	if (!ones)
+		return -ENOMEM;
+	memset(ones, 1, nr);
+	err = bpf_map_update_batch(map_fd, tgids, ones, &count, NULL);
+	free(ones);
+	if (err != -EINVAL && err != -ENOTSUP && err != -EOPNOTSUPP)
+		return err;
+
+	for (__u32 i = 0; i < nr; i++) {
+		err = tracked_pids_add(map_fd, tgids[i]);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+#endif /* __bpf__ */
+
+#endif /* __TRACKED_PIDS_H */
@@ -222,8 +222,15 @@ impl HTTPParser {
             None => return Some(event),
         };
 
+        // sslsniff --reassemble has already framed the stream: "http" is one
+        // whole message, "sse" an event for the SSEProcessor
+        let frame = ssl_data.get("frame").and_then(|v| v.as_str());
+        if frame == Some("sse") {
+            return Some(event);
+        }
+
         // Only process if it's HTTP data AND can be parsed as a complete HTTP message
-        if Self::is_http_data(data_str) {
+        if frame == Some("http") || Self::is_http_data(data_str) {
             if let Some(parsed_message) = Self::parse_http_message(data_str) {
                 let tid = ssl_data.get("tid").and_then(|v| v.as_u64()).unwrap_or(0);
                 return Some(Self::create_http_event(tid, parsed_message, &event, include_raw_data));
@@ -183,14 +183,36 @@ impl SSEProcessor {
         content_parts.join("\n")
     }
 
+    /// Parse the SSE events of one sslsniff record. A `--reassemble` frame
+    /// is exactly one de-chunked event; anything else is raw SSL data.
+    pub fn parse_record_events(event: &Event, data: &str) -> Vec<SSEEvent> {
+        match event.data.get("frame").and_then(|v| v.as_str()) {
+            Some("sse") => Self::parse_sse_events_from_chunk(data),
+            _ => Self::parse_sse_events(data),
+        }
+    }
+
+    /// The connection an event belongs to: its SSL* handle when sslsniff
+    /// reports one, otherwise the thread that made the call
+    fn connection_prefix(event: &Event) -> String {
+        let pid = event.data.get("pid").and_then(|v| v.as_u64()).unwrap_or(0);
+
+        match event.data.get("ssl").and_then(|v| v.as_u64()) {
+            Some(ssl) if ssl != 0 => format!("{}:ssl{:x}", pid, ssl),
+            _ => {
+                let tid = event.data.get("tid").and_then(|v| v.as_u64()).unwrap_or(0);
+                format!("{}:{}", pid, tid)
+            }
+        }
+    }
+
     /// Generate a connection ID from event data and SSE events
     fn generate_connection_id(event: &Event, sse_events: &[SSEEvent]) -> String {
-        let pid = event.data.get("pid").and_then(|v| v.as_u64()).unwrap_or(0);
-        let tid = event.data.get("tid").and_then(|v| v.as_u64()).unwrap_or(0);
+        let prefix = Self::connection_prefix(event);
         
         // First, try to extract message ID from the SSE events
         if let Some(message_id) = Self::extract_message_id(sse_events) {
-            return format!("{}:{}:{}", pid, tid, message_id);
+            return format!("{}:{}", prefix, message_id);
         }
         
         // If no message ID, use a persistent connection identifier
@@ -198,7 +220,7 @@ impl SSEProcessor {
         // This ensures that streaming responses don't get fragmented
         let timestamp = event.timestamp;
         let window = timestamp / 600_000_000_000; // Convert to 10-minute windows
-        format!("{}:{}:{}", pid, tid, window)
+        format!("{}:{}", prefix, window)
     }
 
     /// Extract message ID from SSE events - matches ssl_log_analyzer.py logic
@@ -443,13 +465,20 @@ impl Analyzer for SSEProcessor {
                     None => return Some(event),
                 };
 
+                // Reassembled by sslsniff: whole HTTP messages and event
+                // stream heads carry no events, SSE frames always do
+                let frame = event.data.get("frame").and_then(|v| v.as_str());
+                if frame == Some("http") {
+                    return Some(event);
+                }
+
                 // Check if this is SSE data
-                if !Self::is_sse_data(data_str) {
+                if frame != Some("sse") && !Self::is_sse_data(data_str) {
                     return Some(event);
                 }
 
                 // Parse SSE events from this data
-                let sse_events = Self::parse_sse_events(data_str);
+                let sse_events = Self::parse_record_events(&event, data_str);
                 if sse_events.is_empty() {
                     return Some(event); // Pass through if no SSE events found
                 }
@@ -519,15 +548,11 @@ impl Analyzer for SSEProcessor {
                 
                 // If we have a message_start event, use its message ID as the definitive connection ID
                 if let Some(message_id) = Self::extract_message_id(&sse_events) {
-                    let pid = event.data.get("pid").and_then(|v| v.as_u64()).unwrap_or(0);
-                    let tid = event.data.get("tid").and_then(|v| v.as_u64()).unwrap_or(0);
-                    final_connection_id = format!("{}:{}:{}", pid, tid, message_id);
+                    final_connection_id = format!("{}:{}", Self::connection_prefix(&event), message_id);
                 } else {
                     // For events without message_start, try to find an existing accumulator
-                    // with the same pid/tid that doesn't have a message_stop yet
-                    let pid = event.data.get("pid").and_then(|v| v.as_u64()).unwrap_or(0);
-                    let tid = event.data.get("tid").and_then(|v| v.as_u64()).unwrap_or(0);
-                    let conn_prefix = format!("{}:{}:", pid, tid);
+                    // for the same connection that doesn't have a message_stop yet
+                    let conn_prefix = format!("{}:", Self::connection_prefix(&event));
                     
                     for (existing_id, accumulator) in buffers_lock.iter() {
                         if existing_id.starts_with(&conn_prefix) && !accumulator.is_complete {
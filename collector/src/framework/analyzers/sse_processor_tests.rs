@@ -266,4 +266,52 @@ mod sse_processor_tests {
         // Check for either sse_processor event or pass-through ssl event
         assert!(collected.iter().any(|e| e.source == "ssl" || e.source == "sse_processor"));
     }
-}
\ No newline at end of file
+
+    #[tokio::test]
+    async fn test_sse_processor_reassembled_frames() {
+        // sslsniff --reassemble: one de-chunked event per record, tagged with
+        // the connection, while the reading thread changes under it
+        let mut processor = SSEProcessor::new();
+        let frames = [
+            "event: message_start\ndata: {\"type\":\"message_start\",\"message\":{\"id\":\"msg_1\"}}\n\n",
+            "event: content_block_delta\ndata: {\"type\":\"content_block_delta\",\"delta\":{\"type\":\"text_delta\",\"text\":\"Hello \"}}\n\n",
+            "event: content_block_delta\ndata: {\"type\":\"content_block_delta\",\"delta\":{\"type\":\"text_delta\",\"text\":\"World!\"}}\n\n",
+            "event: message_stop\ndata: {\"type\":\"message_stop\"}\n\n",
+        ];
+        let mut events: Vec<Event> = frames.iter().enumerate().map(|(i, frame)| {
+            Event::new("ssl".to_string(), 1234, "claude".to_string(), json!({
+                "comm": "claude",
+                "data": frame,
+                "function": "READ/RECV",
+                "pid": 1234,
+                "tid": 2000 + i,
+                "ssl": 140000000000u64,
+                "fd": 7,
+                "frame": "sse",
+                "chunks": 1,
+                "timestamp_ns": 1000000000 + i as u64 * 100
+            }))
+        }).collect();
+        // The response head is left to the HTTP parser
+        events.insert(0, Event::new("ssl".to_string(), 1234, "claude".to_string(), json!({
+            "data": "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n\r\n",
+            "function": "READ/RECV",
+            "pid": 1234,
+            "tid": 2000,
+            "ssl": 140000000000u64,
+            "frame": "http",
+            "timestamp_ns": 999999999
+        })));
+
+        let input_stream: EventStream = Box::pin(stream::iter(events));
+        let output_stream = processor.process(input_stream).await.unwrap();
+        let collected: Vec<_> = output_stream.collect().await;
+
+        assert_eq!(collected.len(), 2);
+        assert_eq!(collected[0].source, "ssl");
+        assert_eq!(collected[1].source, "sse_processor");
+        assert_eq!(collected[1].data["text_content"], json!("Hello World!"));
+        assert_eq!(collected[1].data["event_count"], json!(4));
+        assert_eq!(collected[1].data["connection_id"], json!("1234:ssl2098a67800:msg_1"));
+    }
+}
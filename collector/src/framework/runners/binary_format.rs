@@ -0,0 +1,477 @@
+//! Decoder for the tracers' `--format=binary` output.
+//!
+//! Mirrors `bpf/binary_format.h`: an 8 byte stream header, then records of
+//! `u32 length | u8 kind | body`, all integers little endian. Each record is
+//! turned into the same `serde_json::Value` the JSON output would parse to,
+//! so runners and analyzers do not care which format the tracer used.
+//! `--intern-strings` references are resolved on the way, see `string_table`.
+
+use super::string_table::StringTable;
+use serde_json::{Map, Value, json};
+
+/// Stream header magic
+pub const MAGIC: &[u8; 4] = b"AGSB";
+/// Layout version, must match `BIN_VERSION`
+pub const VERSION: u8 = 3;
+/// Size of the stream header
+pub const HEADER_LEN: usize = 8;
+/// Size of the length prefix in front of every record
+pub const LEN_PREFIX: usize = 4;
+/// Largest record accepted, anything bigger means the stream is out of sync
+pub const MAX_RECORD_LEN: usize = 16 * 1024 * 1024;
+
+/// Command-line flag that selects the binary format
+pub const FORMAT_FLAG: &str = "--format=binary";
+
+const RECORD_JSON: u8 = 0;
+const RECORD_EXEC: u8 = 1;
+const RECORD_EXIT: u8 = 2;
+const RECORD_BASH_READLINE: u8 = 3;
+const RECORD_FILE_OPEN: u8 = 4;
+const RECORD_SSL_DATA: u8 = 5;
+const RECORD_STRING_DEF: u8 = 6;
+
+/// String length that marks a u32 id of an interned string instead
+const STR_REF: u16 = u16::MAX;
+
+const SSL_FUNCTIONS: [&str; 3] = ["READ/RECV", "WRITE/SEND", "HANDSHAKE"];
+/// `enum ssl_frame` in bpf/ssl_stream.h, 0 is a single SSL call
+const SSL_FRAMES: [&str; 4] = ["chunk", "http", "sse", "partial"];
+
+/// Check whether tracer arguments ask for binary output
+pub fn is_binary_format(args: &[String]) -> bool {
+    args.iter().enumerate().any(|(i, arg)| {
+        arg == FORMAT_FLAG
+            || (arg == "--format" && args.get(i + 1).map(String::as_str) == Some("binary"))
+    })
+}
+
+/// Validate the stream header
+pub fn check_header(header: &[u8]) -> Result<(), String> {
+    if header.len() < HEADER_LEN || &header[..4] != MAGIC {
+        return Err("not a binary tracer stream (bad magic)".to_string());
+    }
+    if header[4] != VERSION {
+        return Err(format!(
+            "unsupported binary stream version {} (expected {})",
+            header[4], VERSION
+        ));
+    }
+    Ok(())
+}
+
+/// Bounds-checked little endian reader over one record body
+struct Reader<'a> {
+    buf: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Reader<'a> {
+    fn new(buf: &'a [u8]) -> Self {
+        Self { buf, pos: 0 }
+    }
+
+    fn take(&mut self, n: usize) -> Result<&'a [u8], String> {
+        let end = self
+            .pos
+            .checked_add(n)
+            .filter(|&end| end <= self.buf.len())
+            .ok_or_else(|| format!("record truncated at offset {}", self.pos))?;
+        let bytes = &self.buf[self.pos..end];
+        self.pos = end;
+        Ok(bytes)
+    }
+
+    fn u8(&mut self) -> Result<u8, String> {
+        Ok(self.take(1)?[0])
+    }
+
+    fn u16(&mut self) -> Result<u16, String> {
+        Ok(u16::from_le_bytes(self.take(2)?.try_into().unwrap()))
+    }
+
+    fn u32(&mut self) -> Result<u32, String> {
+        Ok(u32::from_le_bytes(self.take(4)?.try_into().unwrap()))
+    }
+
+    fn i32(&mut self) -> Result<i32, String> {
+        Ok(i32::from_le_bytes(self.take(4)?.try_into().unwrap()))
+    }
+
+    fn u64(&mut self) -> Result<u64, String> {
+        Ok(u64::from_le_bytes(self.take(8)?.try_into().unwrap()))
+    }
+
+    fn bytes16(&mut self) -> Result<&'a [u8], String> {
+        let n = self.u16()? as usize;
+        self.take(n)
+    }
+
+    fn str16(&mut self) -> Result<String, String> {
+        Ok(String::from_utf8_lossy(self.bytes16()?).into_owned())
+    }
+
+    /// A string that may be a reference to an earlier `STRING_DEF`
+    fn string(&mut self, strings: &StringTable) -> Result<String, String> {
+        let n = self.u16()?;
+        if n == STR_REF {
+            return strings.get(self.u32()?).map(str::to_string);
+        }
+        Ok(String::from_utf8_lossy(self.take(n as usize)?).into_owned())
+    }
+}
+
+/// Same text the JSON path produces for a payload: valid UTF-8 is kept and
+/// every other byte becomes U+00XX, as sslsniff's `\u00XX` escape does
+fn payload_to_string(mut bytes: &[u8]) -> String {
+    let mut out = String::with_capacity(bytes.len());
+
+    loop {
+        match std::str::from_utf8(bytes) {
+            Ok(valid) => {
+                out.push_str(valid);
+                return out;
+            }
+            Err(e) => {
+                let (valid, rest) = bytes.split_at(e.valid_up_to());
+                // SAFETY: from_utf8 just validated this prefix
+                out.push_str(unsafe { std::str::from_utf8_unchecked(valid) });
+                let bad = e.error_len().unwrap_or(rest.len());
+                out.extend(rest[..bad].iter().map(|&b| char::from(b)));
+                bytes = &rest[bad..];
+            }
+        }
+    }
+}
+
+/// `printf("%.3f")` of the latency, parsed back the way serde_json would
+fn latency_ms(delta_ns: u64) -> Value {
+    if delta_ns == 0 {
+        return json!(0);
+    }
+    let formatted = format!("{:.3}", delta_ns as f64 / 1_000_000.0);
+    formatted.parse::<f64>().map(Value::from).unwrap_or(Value::Null)
+}
+
+/// Merge the trailing `"key":value,...` fragment into the event
+fn merge_extra(event: &mut Map<String, Value>, extra: &[u8]) -> Result<(), String> {
+    if extra.is_empty() {
+        return Ok(());
+    }
+    let text = std::str::from_utf8(extra).map_err(|e| format!("extra fields: {}", e))?;
+    let fields: Map<String, Value> = serde_json::from_str(&format!("{{{}}}", text))
+        .map_err(|e| format!("extra fields: {}", e))?;
+    event.extend(fields);
+    Ok(())
+}
+
+/// Decode one record body (kind byte onwards, without the length prefix).
+/// `None` for a `STRING_DEF`, which only updates `strings`.
+pub fn decode_record(body: &[u8], strings: &mut StringTable) -> Result<Option<Value>, String> {
+    let mut r = Reader::new(body);
+    let kind = r.u8()?;
+
+    if kind == RECORD_JSON {
+        return serde_json::from_slice::<Value>(&body[1..])
+            .map(Some)
+            .map_err(|e| format!("JSON record: {}", e));
+    }
+    if kind == RECORD_STRING_DEF {
+        let id = r.u32()?;
+        strings.define(id, r.str16()?);
+        return Ok(None);
+    }
+
+    let timestamp_ns = r.u64()?;
+    let pid = r.u32()?;
+    let comm = r.string(strings)?;
+    let mut event = Map::new();
+
+    match kind {
+        RECORD_EXEC => {
+            let ppid = r.u32()?;
+            event.insert("timestamp".into(), json!(timestamp_ns));
+            event.insert("event".into(), json!("EXEC"));
+            event.insert("comm".into(), json!(comm));
+            event.insert("pid".into(), json!(pid));
+            event.insert("ppid".into(), json!(ppid));
+            event.insert("filename".into(), json!(r.string(strings)?));
+            event.insert("full_command".into(), json!(r.string(strings)?));
+        }
+        RECORD_EXIT => {
+            let ppid = r.u32()?;
+            let exit_code = r.u32()?;
+            let duration_ns = r.u64()?;
+            event.insert("timestamp".into(), json!(timestamp_ns));
+            event.insert("event".into(), json!("EXIT"));
+            event.insert("comm".into(), json!(comm));
+            event.insert("pid".into(), json!(pid));
+            event.insert("ppid".into(), json!(ppid));
+            event.insert("exit_code".into(), json!(exit_code));
+            if duration_ns != 0 {
+                event.insert("duration_ms".into(), json!(duration_ns / 1_000_000));
+            }
+        }
+        RECORD_BASH_READLINE => {
+            event.insert("timestamp".into(), json!(timestamp_ns));
+            event.insert("event".into(), json!("BASH_READLINE"));
+            event.insert("comm".into(), json!(comm));
+            event.insert("pid".into(), json!(pid));
+            event.insert("command".into(), json!(r.str16()?));
+        }
+        RECORD_FILE_OPEN => {
+            let count = r.u32()?;
+            let flags = r.i32()?;
+            event.insert("timestamp".into(), json!(timestamp_ns));
+            event.insert("event".into(), json!("FILE_OPEN"));
+            event.insert("comm".into(), json!(comm));
+            event.insert("pid".into(), json!(pid));
+            event.insert("count".into(), json!(count));
+            event.insert("filepath".into(), json!(r.string(strings)?));
+            event.insert("flags".into(), json!(flags));
+        }
+        RECORD_SSL_DATA => {
+            let function = r.u8()? as usize;
+            let tid = r.u32()?;
+            let uid = r.u32()?;
+            let len = r.u32()?;
+            let buf_size = r.u32()?;
+            let delta_ns = r.u64()?;
+            let is_handshake = r.u8()? != 0;
+            let ssl = r.u64()?;
+            let fd = r.i32()?;
+            let frame = r.u8()? as usize;
+            let chunks = r.u32()?;
+            let data_len = r.u32()? as usize;
+            let data = r.take(data_len)?;
+
+            let function = SSL_FUNCTIONS
+                .get(function)
+                .ok_or_else(|| format!("unknown SSL function {}", function))?;
+            event.insert("function".into(), json!(function));
+            event.insert("timestamp_ns".into(), json!(timestamp_ns));
+            event.insert("comm".into(), json!(comm));
+            event.insert("pid".into(), json!(pid));
+            event.insert("len".into(), json!(len));
+            event.insert("buf_size".into(), json!(buf_size));
+            event.insert("uid".into(), json!(uid));
+            event.insert("tid".into(), json!(tid));
+            event.insert("latency_ms".into(), latency_ms(delta_ns));
+            event.insert("is_handshake".into(), json!(is_handshake));
+            event.insert("ssl".into(), json!(ssl));
+            event.insert("fd".into(), json!(fd));
+            if frame != 0 {
+                let frame = SSL_FRAMES
+                    .get(frame)
+                    .ok_or_else(|| format!("unknown SSL frame {}", frame))?;
+                event.insert("frame".into(), json!(frame));
+                event.insert("chunks".into(), json!(chunks));
+            }
+            if data.is_empty() {
+                // Nothing copied: a handshake, or a call left out by --capture-*
+                let lost = if is_handshake { 0 } else { len as u64 };
+                event.insert("data".into(), Value::Null);
+                event.insert("truncated".into(), json!(lost > 0));
+                if lost > 0 {
+                    event.insert("bytes_lost".into(), json!(lost));
+                }
+            } else {
+                event.insert("data".into(), json!(payload_to_string(data)));
+                let captured = data.len() as u64;
+                let truncated = captured < len as u64;
+                event.insert("truncated".into(), json!(truncated));
+                if truncated {
+                    event.insert("bytes_lost".into(), json!(len as u64 - captured));
+                }
+            }
+        }
+        _ => return Err(format!("unknown record kind {}", kind)),
+    }
+
+    merge_extra(&mut event, r.bytes16()?)?;
+    Ok(Some(Value::Object(event)))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// A record of a stream without interned strings
+    fn decode_plain(body: &[u8]) -> Result<Value, String> {
+        decode_record(body, &mut StringTable::default())
+            .map(|event| event.expect("not a STRING_DEF"))
+    }
+
+    /// Minimal encoder matching bpf/binary_format.h
+    struct Encoder(Vec<u8>);
+
+    impl Encoder {
+        fn event(kind: u8, timestamp_ns: u64, pid: u32, comm: &str) -> Self {
+            let mut e = Encoder(vec![kind]);
+            e.u64(timestamp_ns).u32(pid).str(comm);
+            e
+        }
+        fn u8(&mut self, v: u8) -> &mut Self { self.0.push(v); self }
+        fn u32(&mut self, v: u32) -> &mut Self { self.0.extend(v.to_le_bytes()); self }
+        fn i32(&mut self, v: i32) -> &mut Self { self.0.extend(v.to_le_bytes()); self }
+        fn u64(&mut self, v: u64) -> &mut Self { self.0.extend(v.to_le_bytes()); self }
+        fn bytes(&mut self, b: &[u8]) -> &mut Self { self.0.extend(b); self }
+        fn str(&mut self, s: &str) -> &mut Self {
+            self.0.extend((s.len() as u16).to_le_bytes());
+            self.bytes(s.as_bytes())
+        }
+    }
+
+    #[test]
+    fn test_header_and_flag() {
+        assert!(check_header(b"AGSB\x03\0\0\0").is_ok());
+        assert!(check_header(b"AGSB\x02\0\0\0").is_err());
+        assert!(check_header(b"{\"times").is_err());
+
+        assert!(is_binary_format(&["-c".into(), "python".into(), "--format=binary".into()]));
+        assert!(is_binary_format(&["--format".into(), "binary".into()]));
+        assert!(!is_binary_format(&["--format=json".into()]));
+        assert!(!is_binary_format(&[]));
+    }
+
+    #[test]
+    fn test_process_records_match_json_output() {
+        let mut e = Encoder::event(RECORD_EXEC, 100, 42, "bash");
+        e.u32(1).str("/usr/bin/ls").str("ls \"-la\"").str("");
+        assert_eq!(
+            decode_plain(&e.0).unwrap(),
+            json!({"timestamp": 100, "event": "EXEC", "comm": "bash", "pid": 42, "ppid": 1,
+                   "filename": "/usr/bin/ls", "full_command": "ls \"-la\""})
+        );
+
+        let mut e = Encoder::event(RECORD_EXIT, 200, 42, "bash");
+        e.u32(1).u32(2).u64(3_500_000).str("\"rate_limit_warning\":\"Process had 10+ file ops per second\"");
+        assert_eq!(
+            decode_plain(&e.0).unwrap(),
+            json!({"timestamp": 200, "event": "EXIT", "comm": "bash", "pid": 42, "ppid": 1,
+                   "exit_code": 2, "duration_ms": 3,
+                   "rate_limit_warning": "Process had 10+ file ops per second"})
+        );
+
+        let mut e = Encoder::event(RECORD_EXIT, 200, 42, "bash");
+        e.u32(1).u32(0).u64(0).str("");
+        assert!(decode_plain(&e.0).unwrap().get("duration_ms").is_none());
+
+        let mut e = Encoder::event(RECORD_FILE_OPEN, 300, 7, "python");
+        e.u32(5).i32(-1).str("/etc/hosts").str("\"window_expired\":true");
+        assert_eq!(
+            decode_plain(&e.0).unwrap(),
+            json!({"timestamp": 300, "event": "FILE_OPEN", "comm": "python", "pid": 7,
+                   "count": 5, "filepath": "/etc/hosts", "flags": -1, "window_expired": true})
+        );
+
+        let mut e = Encoder::event(RECORD_BASH_READLINE, 400, 8, "bash");
+        e.str("echo hi").str("");
+        assert_eq!(decode_plain(&e.0).unwrap()["command"], json!("echo hi"));
+    }
+
+    #[test]
+    fn test_interned_strings() {
+        let mut strings = StringTable::default();
+        let mut def = Encoder(vec![RECORD_STRING_DEF]);
+        def.u32(0).str("bash");
+        assert_eq!(decode_record(&def.0, &mut strings).unwrap(), None);
+
+        // comm and filename refer to id 0, the command line is inline
+        let mut e = Encoder(vec![RECORD_EXEC]);
+        e.u64(100).u32(42).bytes(&STR_REF.to_le_bytes()).u32(0).u32(1)
+            .bytes(&STR_REF.to_le_bytes()).u32(0).str("bash -l").str("");
+        assert_eq!(
+            decode_record(&e.0, &mut strings).unwrap(),
+            Some(json!({"timestamp": 100, "event": "EXEC", "comm": "bash", "pid": 42, "ppid": 1,
+                        "filename": "bash", "full_command": "bash -l"}))
+        );
+
+        // A later definition replaces what the id stands for
+        let mut def = Encoder(vec![RECORD_STRING_DEF]);
+        def.u32(0).str("node");
+        decode_record(&def.0, &mut strings).unwrap();
+        assert_eq!(decode_record(&e.0, &mut strings).unwrap().unwrap()["comm"], json!("node"));
+
+        assert!(decode_record(&e.0, &mut StringTable::default()).is_err(),
+                "an undefined id must not decode");
+    }
+
+    #[test]
+    fn test_ssl_record_matches_json_output() {
+        let payload = b"data: {\"text\":\"\xe4\xbd\xa0\xe5\xa5\xbd\"}\n\xff";
+        let mut e = Encoder::event(RECORD_SSL_DATA, 500, 9, "node");
+        e.u8(0).u32(10).u32(1000).u32(100).u32(payload.len() as u32)
+            .u64(1_234_567).u8(0).u64(0x7f00_1000).i32(5).u8(0).u32(1)
+            .u32(payload.len() as u32).bytes(payload).str("");
+        let event = decode_plain(&e.0).unwrap();
+
+        // What serde_json makes of sslsniff's escaped JSON line
+        let json_line = format!(
+            "{{\"function\":\"READ/RECV\",\"timestamp_ns\":500,\"comm\":\"node\",\"pid\":9,\"len\":100,\
+             \"buf_size\":{},\"uid\":1000,\"tid\":10,\"latency_ms\":1.235,\"is_handshake\":false,\
+             \"ssl\":2130710528,\"fd\":5,\"data\":\"data: {{\\\"text\\\":\\\"你好\\\"}}\\n\\u00ff\",\"truncated\":true,\"bytes_lost\":{}}}",
+            payload.len(), 100 - payload.len()
+        );
+        let expected: Value = serde_json::from_str(&json_line).unwrap();
+        assert_eq!(event, expected);
+
+        let mut e = Encoder::event(RECORD_SSL_DATA, 600, 9, "node");
+        e.u8(2).u32(10).u32(0).u32(0).u32(0).u64(0).u8(1).u64(0x10).i32(-1).u8(0).u32(1)
+            .u32(0).str("");
+        let event = decode_plain(&e.0).unwrap();
+        assert_eq!(event["function"], json!("HANDSHAKE"));
+        assert_eq!(event["latency_ms"], json!(0));
+        assert_eq!(event["data"], Value::Null);
+        assert_eq!(event["truncated"], json!(false));
+        assert_eq!(event["fd"], json!(-1));
+        assert!(event.get("frame").is_none());
+
+        // A write --capture-* copied none of still reports the bytes it left out
+        let mut e = Encoder::event(RECORD_SSL_DATA, 650, 9, "node");
+        e.u8(1).u32(10).u32(0).u32(4096).u32(0).u64(0).u8(0).u64(0x10).i32(-1).u8(0).u32(1)
+            .u32(0).str("");
+        let event = decode_plain(&e.0).unwrap();
+        assert_eq!(event["data"], Value::Null);
+        assert_eq!(event["truncated"], json!(true));
+        assert_eq!(event["bytes_lost"], json!(4096));
+
+        // A --reassemble frame: the whole message, with the chunks it took
+        let message = b"event: ping\ndata: {}\n\n";
+        let mut e = Encoder::event(RECORD_SSL_DATA, 700, 9, "node");
+        e.u8(0).u32(10).u32(0).u32(message.len() as u32).u32(message.len() as u32).u64(0).u8(0)
+            .u64(0x10).i32(7).u8(2).u32(3).u32(message.len() as u32).bytes(message).str("");
+        let event = decode_plain(&e.0).unwrap();
+        assert_eq!(event["frame"], json!("sse"));
+        assert_eq!(event["chunks"], json!(3));
+        assert_eq!(event["data"], json!("event: ping\ndata: {}\n\n"));
+        assert_eq!(event["truncated"], json!(false));
+
+        let mut e = Encoder::event(RECORD_SSL_DATA, 700, 9, "node");
+        e.u8(0).u32(10).u32(0).u32(0).u32(0).u64(0).u8(0).u64(0).i32(0).u8(9).u32(1).u32(0).str("");
+        assert!(decode_plain(&e.0).is_err());
+    }
+
+    #[test]
+    fn test_payload_escaping() {
+        assert_eq!(payload_to_string(b"plain"), "plain");
+        assert_eq!(payload_to_string(b"caf\xc3\xa9"), "café");
+        assert_eq!(payload_to_string(b"a\xe4\xbdA"), "a\u{e4}\u{bd}A");
+        assert_eq!(payload_to_string(b"\xed\xa0\x80"), "\u{ed}\u{a0}\u{80}");
+        assert_eq!(payload_to_string(b"end\xf0\x9f"), "end\u{f0}\u{9f}");
+    }
+
+    #[test]
+    fn test_json_and_bad_records() {
+        let mut body = vec![RECORD_JSON];
+        body.extend(b"{\"event\":\"STATS\",\"dropped\":3}");
+        assert_eq!(decode_plain(&body).unwrap(), json!({"event": "STATS", "dropped": 3}));
+
+        assert!(decode_plain(&[]).is_err());
+        assert!(decode_plain(&[99, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0]).is_err());
+
+        let mut e = Encoder::event(RECORD_EXEC, 1, 1, "x");
+        e.u32(1).str("/bin/x");
+        assert!(decode_plain(&e.0).is_err(), "missing fields must not decode");
+    }
+}
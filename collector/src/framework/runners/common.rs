@@ -1,8 +1,12 @@
 use crate::framework::analyzers::Analyzer;
 use super::{EventStream, RunnerError};
+use super::binary_format;
+use super::string_table::StringTable;
 use std::process::Stdio;
-use tokio::io::{AsyncBufReadExt, BufReader};
-use tokio::process::Command as TokioCommand;
+use std::path::PathBuf;
+use tokio::io::{AsyncBufReadExt, AsyncRead, AsyncReadExt, BufReader};
+use tokio::net::UnixListener;
+use tokio::process::{Child, ChildStdout, Command as TokioCommand};
 use log::debug;
 use futures::stream::Stream;
 use std::pin::Pin;
@@ -12,11 +16,29 @@ use std::pin::Pin;
 /// Type alias for JSON stream
 pub type JsonStream = Pin<Box<dyn Stream<Item = serde_json::Value> + Send>>;
 
+/// Event source used for tracer self-telemetry (`--stats-interval`)
+pub const STATS_SOURCE: &str = "stats";
+
+/// Check whether a tracer line is a periodic `"event":"STATS"` record
+/// (ring buffer emit/drop counters) rather than captured data
+pub fn is_stats_event(json_value: &serde_json::Value) -> bool {
+    json_value.get("event").and_then(|v| v.as_str()) == Some("STATS")
+}
+
+/// Where a `--format=binary` tracer's records arrive
+enum BinarySource {
+    /// The tracer's stdout pipe
+    Stdout(ChildStdout),
+    /// A unix socket the tracer connects to with `--output-socket`
+    Socket(UnixListener, PathBuf),
+}
+
 /// Common binary executor for runners - now supports streaming
 pub struct BinaryExecutor {
     binary_path: String,
     additional_args: Vec<String>,
     runner_name: Option<String>,
+    socket_transport: bool,
 }
 
 impl BinaryExecutor {
@@ -25,9 +47,19 @@ impl BinaryExecutor {
             binary_path,
             additional_args: Vec::new(),
             runner_name: None,
+            socket_transport: false,
         }
     }
 
+    /// Receive `--format=binary` output over a unix socket instead of stdout.
+    /// The tracer then never blocks on a slow collector; it buffers and, past
+    /// its backlog limit, drops records (reported as `output_dropped` in STATS)
+    /// instead of letting the BPF ring buffer overflow
+    pub fn with_socket_transport(mut self, enabled: bool) -> Self {
+        self.socket_transport = enabled;
+        self
+    }
+
     /// Add additional command-line arguments
     pub fn with_args(mut self, args: &[String]) -> Self {
         self.additional_args = args.to_vec();
@@ -49,8 +81,22 @@ impl BinaryExecutor {
             log::info!("Executing binary: {} {}", self.binary_path, self.additional_args.join(" "));
         }
         
+        let binary_output = binary_format::is_binary_format(&self.additional_args);
+        let socket = if binary_output && self.socket_transport {
+            let path = std::env::temp_dir()
+                .join(format!("agentsight-{}.sock", uuid::Uuid::new_v4().simple()));
+            let listener = UnixListener::bind(&path)
+                .map_err(|e| Box::new(std::io::Error::new(
+                    std::io::ErrorKind::Other,
+                    format!("Failed to listen on {}: {}", path.display(), e)
+                )) as RunnerError)?;
+            Some((listener, path))
+        } else {
+            None
+        };
+
         let mut cmd = TokioCommand::new(&self.binary_path);
-        cmd.stdout(Stdio::piped())
+        cmd.stdout(if socket.is_some() { Stdio::null() } else { Stdio::piped() })
            .stderr(Stdio::piped());
         
         // Add additional arguments if any
@@ -58,6 +104,10 @@ impl BinaryExecutor {
             cmd.args(&self.additional_args);
             debug!("Added arguments: {:?}", self.additional_args);
         }
+        if let Some((_, path)) = &socket {
+            cmd.arg("--output-socket").arg(path);
+            debug!("Receiving output on {}", path.display());
+        }
         
         let mut child = cmd.spawn()
             .map_err(|e| Box::new(std::io::Error::new(
@@ -65,11 +115,14 @@ impl BinaryExecutor {
                 format!("Failed to start binary: {}", e)
             )) as RunnerError)?;
             
-        let stdout = child.stdout.take()
-            .ok_or_else(|| Box::new(std::io::Error::new(
-                std::io::ErrorKind::Other, 
-                "Failed to get stdout"
-            )) as RunnerError)?;
+        let source = match socket {
+            Some((listener, path)) => BinarySource::Socket(listener, path),
+            None => BinarySource::Stdout(child.stdout.take()
+                .ok_or_else(|| Box::new(std::io::Error::new(
+                    std::io::ErrorKind::Other, 
+                    "Failed to get stdout"
+                )) as RunnerError)?),
+        };
         
         let stderr = child.stderr.take()
             .ok_or_else(|| Box::new(std::io::Error::new(
@@ -133,10 +186,27 @@ impl BinaryExecutor {
             }
         });
 
+        if binary_output {
+            let runner_info = runner_name.as_ref()
+                .map(|name| format!("[{}] ", name))
+                .unwrap_or_else(|| format!("[{}] ",
+                    std::path::Path::new(&binary_path)
+                        .file_name()
+                        .and_then(|n| n.to_str())
+                        .unwrap_or("unknown")
+                ));
+            return Ok(Self::binary_stream(child, source, runner_info));
+        }
+
+        let BinarySource::Stdout(stdout) = source else {
+            unreachable!("the socket transport is only used with --format=binary");
+        };
+
         let stream = async_stream::stream! {
             let mut reader = BufReader::new(stdout);
             let mut line = String::new();
             let mut line_count = 0;
+            let mut strings = StringTable::default();
             
             debug!("Reading from binary stdout");
             
@@ -166,7 +236,9 @@ impl BinaryExecutor {
                                 match serde_json::from_str::<serde_json::Value>(trimmed) {
                                     Ok(json_value) => {
                                         debug!("Parsed JSON value");
-                                        yield json_value;
+                                        if let Some(json_value) = strings.resolve_json(json_value) {
+                                            yield json_value;
+                                        }
                                     }
                                     Err(e) => {
                                         log::warn!("Failed to parse JSON from line {}: {} - Line: {}", 
@@ -232,7 +304,9 @@ impl BinaryExecutor {
                                         // Try to parse the valid portion
                                         if let Ok(json_value) = serde_json::from_str::<serde_json::Value>(valid_str.trim()) {
                                             log::info!("Successfully recovered partial JSON despite UTF-8 error");
-                                            yield json_value;
+                                            if let Some(json_value) = strings.resolve_json(json_value) {
+                                                yield json_value;
+                                            }
                                             continue;
                                         }
                                     }
@@ -263,7 +337,9 @@ impl BinaryExecutor {
                                     match serde_json::from_str::<serde_json::Value>(trimmed) {
                                         Ok(json_value) => {
                                             log::debug!("Parsed final JSON line at EOF");
-                                            yield json_value;
+                                            if let Some(json_value) = strings.resolve_json(json_value) {
+                                                yield json_value;
+                                            }
                                         }
                                         Err(e) => {
                                             log::warn!("Failed to parse final line at EOF: {}", e);
@@ -285,29 +361,122 @@ impl BinaryExecutor {
                 }
             }
             
-            log::info!("Terminating binary process");
-            
-            // Terminate the child process
-            if let Err(e) = child.kill().await {
-                log::warn!("Failed to kill binary process: {}", e);
-            }
-            
-            // Wait for process to finish
-            match child.wait().await {
-                Ok(status) => {
-                    debug!("Binary process terminated with status: {}", status);
-                }
-                Err(e) => {
-                    log::warn!("Error waiting for binary process: {}", e);
-                }
-            }
+            terminate_child(child).await;
         };
         
         Ok(Box::pin(stream))
     }
 
+    /// Decode `--format=binary` records straight into JSON values, skipping
+    /// the text round trip (see `binary_format`)
+    fn binary_stream(mut child: Child, source: BinarySource, runner_info: String) -> JsonStream {
+        let stream = async_stream::stream! {
+            let input: Option<Box<dyn AsyncRead + Send + Unpin>> = match source {
+                BinarySource::Stdout(stdout) => Some(Box::new(stdout)),
+                BinarySource::Socket(listener, path) => {
+                    // The tracer connects once its output is set up; give up if it exits first
+                    let accepted = tokio::select! {
+                        accepted = listener.accept() => Some(accepted),
+                        status = child.wait() => {
+                            log::error!("{}Binary exited before connecting to {}: {:?}",
+                                runner_info, path.display(), status);
+                            None
+                        }
+                    };
+                    // The connection keeps working without the path
+                    let _ = std::fs::remove_file(&path);
+                    match accepted {
+                        Some(Ok((socket, _))) => {
+                            debug!("Binary connected to {}", path.display());
+                            Some(Box::new(socket))
+                        }
+                        Some(Err(e)) => {
+                            log::error!("{}Failed to accept output connection: {}", runner_info, e);
+                            None
+                        }
+                        None => None,
+                    }
+                }
+            };
+
+            if let Some(input) = input {
+                let mut reader = BufReader::with_capacity(256 * 1024, input);
+                let mut header = [0u8; binary_format::HEADER_LEN];
+                let mut body = Vec::new();
+                let mut record_count = 0u64;
+                let mut strings = StringTable::default();
+
+                debug!("Reading binary records from binary output");
+
+                match reader.read_exact(&mut header).await {
+                    Ok(_) => match binary_format::check_header(&header) {
+                        Ok(()) => loop {
+                            let mut len_buf = [0u8; binary_format::LEN_PREFIX];
+                            if let Err(e) = reader.read_exact(&mut len_buf).await {
+                                if e.kind() != std::io::ErrorKind::UnexpectedEof {
+                                    log::warn!("{}Error reading from binary: {}", runner_info, e);
+                                }
+                                debug!("Binary output closed (EOF)");
+                                break;
+                            }
+
+                            // A bad length means we lost framing, there is no resync point
+                            let len = u32::from_le_bytes(len_buf) as usize;
+                            if len == 0 || len > binary_format::MAX_RECORD_LEN {
+                                log::error!("{}Invalid binary record length {} after {} records, stopping",
+                                    runner_info, len, record_count);
+                                break;
+                            }
+
+                            body.resize(len, 0);
+                            if let Err(e) = reader.read_exact(&mut body).await {
+                                log::warn!("{}Truncated binary record at EOF: {}", runner_info, e);
+                                break;
+                            }
+                            record_count += 1;
+
+                            match binary_format::decode_record(&body, &mut strings) {
+                                Ok(Some(json_value)) => {
+                                    yield json_value;
+                                }
+                                Ok(None) => {}
+                                Err(e) => {
+                                    log::warn!("{}Skipping binary record {}: {}",
+                                        runner_info, record_count, e);
+                                }
+                            }
+                        },
+                        Err(e) => log::error!("{}{}", runner_info, e),
+                    },
+                    Err(e) => debug!("Binary output closed before the stream header: {}", e),
+                }
+            }
+
+            terminate_child(child).await;
+        };
 
+        Box::pin(stream)
+    }
+}
 
+/// Kill a tracer once its output stream ends and reap it
+async fn terminate_child(mut child: Child) {
+    log::info!("Terminating binary process");
+    
+    // Terminate the child process
+    if let Err(e) = child.kill().await {
+        log::warn!("Failed to kill binary process: {}", e);
+    }
+    
+    // Wait for process to finish
+    match child.wait().await {
+        Ok(status) => {
+            debug!("Binary process terminated with status: {}", status);
+        }
+        Err(e) => {
+            log::warn!("Error waiting for binary process: {}", e);
+        }
+    }
 }
 
 /// Common analyzer processor for runners
@@ -326,4 +495,22 @@ impl AnalyzerProcessor {
         
         Ok(stream)
     }
-} 
\ No newline at end of file
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use serde_json::json;
+
+    #[test]
+    fn test_is_stats_event() {
+        let stats = json!({"timestamp_ns": 1, "event": "STATS", "pid": 1, "comm": "sslsniff", "dropped": 3});
+        assert!(is_stats_event(&stats));
+
+        let ssl = json!({"timestamp_ns": 1, "function": "READ/RECV", "pid": 1, "comm": "curl"});
+        assert!(!is_stats_event(&ssl));
+
+        let exec = json!({"timestamp": 1, "event": "EXEC", "pid": 1, "comm": "bash"});
+        assert!(!is_stats_event(&exec));
+    }
+}
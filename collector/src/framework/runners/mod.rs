@@ -63,6 +63,8 @@ impl Default for ProcessConfig {
 }
 
 pub mod common;
+pub mod binary_format;
+pub mod string_table;
 pub mod ssl;
 pub mod process;
 pub mod fake; // Add fake runner for testing
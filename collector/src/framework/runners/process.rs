@@ -1,5 +1,5 @@
 use super::{Runner, ProcessConfig, EventStream, RunnerError};
-use super::common::{BinaryExecutor, AnalyzerProcessor};
+use super::common::{BinaryExecutor, AnalyzerProcessor, is_stats_event, STATS_SOURCE};
 use crate::framework::core::Event;
 use crate::framework::analyzers::Analyzer;
 use async_trait::async_trait;
@@ -39,6 +39,12 @@ impl ProcessRunner {
         self
     }
 
+    /// Take `--format=binary` output over a unix socket instead of stdout
+    pub fn with_socket_transport(mut self, enabled: bool) -> Self {
+        self.executor = self.executor.with_socket_transport(enabled);
+        self
+    }
+
     /// Set the PID to monitor
     #[allow(dead_code)]
     pub fn pid(mut self, pid: u32) -> Self {
@@ -85,9 +91,12 @@ impl Runner for ProcessRunner {
                 })
                 .to_string();
             
+            // Ring buffer telemetry gets its own source so payload analyzers skip it
+            let source = if is_stats_event(&json_value) { STATS_SOURCE } else { "process" };
+
             Event::new_with_timestamp(
                 timestamp,
-                "process".to_string(), // source is runner name
+                source.to_string(),
                 pid,
                 comm,
                 json_value,
@@ -1,5 +1,5 @@
 use super::{Runner, SslConfig, EventStream, RunnerError};
-use super::common::{BinaryExecutor, AnalyzerProcessor};
+use super::common::{BinaryExecutor, AnalyzerProcessor, is_stats_event, STATS_SOURCE};
 use crate::framework::core::Event;
 use crate::framework::analyzers::Analyzer;
 use async_trait::async_trait;
@@ -39,6 +39,12 @@ impl SslRunner {
         self
     }
 
+    /// Take `--format=binary` output over a unix socket instead of stdout
+    pub fn with_socket_transport(mut self, enabled: bool) -> Self {
+        self.executor = self.executor.with_socket_transport(enabled);
+        self
+    }
+
     /// Set the TLS version filter
     #[allow(dead_code)]
     pub fn tls_version(mut self, version: String) -> Self {
@@ -78,9 +84,12 @@ impl Runner for SslRunner {
                 })
                 .to_string();
             
+            // Ring buffer telemetry gets its own source so payload analyzers skip it
+            let source = if is_stats_event(&json_value) { STATS_SOURCE } else { "ssl" };
+
             Event::new_with_timestamp(
                 timestamp,
-                "ssl".to_string(), // source is runner name
+                source.to_string(),
                 pid,
                 comm,
                 json_value,
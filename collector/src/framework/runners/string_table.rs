@@ -0,0 +1,92 @@
+//! Resolver for the tracers' `--intern-strings` output.
+//!
+//! With `--intern-strings` a tracer writes each comm, filename, path and
+//! command line once as a `STRING_DEF` and from then on only its id: an
+//! integer in place of the string in JSON lines, a `BIN_STR_REF` reference
+//! in binary records (see `bpf/string_intern.h`). Ids are reused once the
+//! tracer's table is full, so a later `STRING_DEF` replaces what an id
+//! stood for. Resolving here keeps analyzers and the frontend unaware of it.
+
+use serde_json::Value;
+use std::collections::HashMap;
+
+/// Event name of a definition
+pub const STRING_DEF: &str = "STRING_DEF";
+
+/// JSON fields that carry an id when the tracer interns strings
+const INTERNED_FIELDS: [&str; 4] = ["comm", "filename", "filepath", "full_command"];
+
+/// What each id of one tracer's output stands for
+#[derive(Debug, Default)]
+pub struct StringTable {
+    strings: HashMap<u32, String>,
+}
+
+impl StringTable {
+    /// Apply a definition, replacing what `id` stood for before
+    pub fn define(&mut self, id: u32, value: String) {
+        self.strings.insert(id, value);
+    }
+
+    /// The string behind `id`
+    pub fn get(&self, id: u32) -> Result<&str, String> {
+        self.strings
+            .get(&id)
+            .map(String::as_str)
+            .ok_or_else(|| format!("undefined string id {}", id))
+    }
+
+    /// Resolve one parsed JSON line; `None` for a `STRING_DEF`, which only
+    /// updates the table. Ids defined nowhere are left as they are.
+    pub fn resolve_json(&mut self, mut value: Value) -> Option<Value> {
+        if value.get("event").and_then(Value::as_str) == Some(STRING_DEF) {
+            if let (Some(id), Some(s)) = (value["id"].as_u64(), value["value"].as_str()) {
+                self.define(id as u32, s.to_string());
+            }
+            return None;
+        }
+        if let Some(event) = value.as_object_mut() {
+            for field in INTERNED_FIELDS {
+                let Some(id) = event.get(field).and_then(Value::as_u64) else {
+                    continue;
+                };
+                if let Ok(s) = self.get(id as u32) {
+                    event.insert(field.to_string(), Value::String(s.to_string()));
+                }
+            }
+        }
+        Some(value)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use serde_json::json;
+
+    #[test]
+    fn test_resolve_json() {
+        let mut table = StringTable::default();
+
+        assert!(table
+            .resolve_json(json!({"event": "STRING_DEF", "id": 0, "value": "bash"}))
+            .is_none());
+        assert!(table
+            .resolve_json(json!({"event": "STRING_DEF", "id": 1, "value": "/etc/hosts"}))
+            .is_none());
+        assert_eq!(
+            table.resolve_json(json!({"event": "FILE_OPEN", "comm": 0, "pid": 7, "filepath": 1})),
+            Some(json!({"event": "FILE_OPEN", "comm": "bash", "pid": 7, "filepath": "/etc/hosts"}))
+        );
+
+        // A handed over id means the new string from its definition on
+        table.resolve_json(json!({"event": "STRING_DEF", "id": 0, "value": "node"}));
+        assert_eq!(table.resolve_json(json!({"comm": 0})), Some(json!({"comm": "node"})));
+
+        // Plain output passes through untouched
+        let plain = json!({"event": "EXEC", "comm": "ls", "pid": 3, "full_command": "ls -la"});
+        assert_eq!(table.resolve_json(plain.clone()), Some(plain));
+        assert_eq!(table.resolve_json(json!({"comm": 9})), Some(json!({"comm": 9})));
+        assert!(table.get(9).is_err());
+    }
+}
@@ -9,7 +9,7 @@ mod server;
 
 use framework::{
     binary_extractor::BinaryExtractor,
-    runners::{SslRunner, ProcessRunner, AgentRunner, SystemRunner, RunnerError, Runner},
+    runners::{SslRunner, ProcessRunner, AgentRunner, SystemRunner, RunnerError, Runner, binary_format},
     analyzers::{OutputAnalyzer, FileLogger, SSEProcessor, HTTPParser, HTTPFilter, AuthHeaderRemover, SSLFilter, TimestampNormalizer, print_global_http_filter_metrics, print_global_ssl_filter_metrics}
 };
 
@@ -491,9 +491,10 @@ async fn run_trace(
         if let Some(path) = binary_path {
             ssl_args.extend(["--binary-path".to_string(), path.to_string()]);
         }
-        if !ssl_args.is_empty() {
-            ssl_runner = ssl_runner.with_args(&ssl_args);
-        }
+        // Nobody reads the tracer's stdout here, so skip the JSON round trip
+        // and keep a slow pipeline from stalling the tracer
+        ssl_args.push(binary_format::FORMAT_FLAG.to_string());
+        ssl_runner = ssl_runner.with_args(&ssl_args).with_socket_transport(true);
 
         // Add TimestampNormalizer first
         ssl_runner = ssl_runner.add_analyzer(Box::new(TimestampNormalizer::new()));
@@ -548,9 +549,8 @@ async fn run_trace(
         if let Some(mode_filter) = mode {
             process_args.extend(["-m".to_string(), mode_filter.to_string()]);
         }
-        if !process_args.is_empty() {
-            process_runner = process_runner.with_args(&process_args);
-        }
+        process_args.push(binary_format::FORMAT_FLAG.to_string());
+        process_runner = process_runner.with_args(&process_args).with_socket_transport(true);
 
         // Add TimestampNormalizer first
         process_runner = process_runner.add_analyzer(Box::new(TimestampNormalizer::new()));
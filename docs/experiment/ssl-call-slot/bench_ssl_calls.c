@@ -0,0 +1,230 @@
+// Times the per-call map work of sslsniff's SSL_read/SSL_write probes: the
+// bufs + start_ns (+ readbytes_ptrs) hashes from before the ssl_calls slot
+// against the slot itself. Each path, entry and uretprobe back to back, is
+// hand-assembled into a socket filter and run with BPF_PROG_TEST_RUN, which
+// needs no clang or libbpf. The kernel's BPF_STATS_RUN_TIME counters, the
+// ones sslsniff --self-stats reports, are read back as well.
+//
+// gcc -O2 -o bench_ssl_calls bench_ssl_calls.c && sudo ./bench_ssl_calls [IN_FLIGHT]
+#include <errno.h>
+#include <linux/bpf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define INSN(c, d, s, o, i) ((struct bpf_insn){ .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+#define MOV_IMM(d, i)   INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define MOV_REG(d, s)   INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define ADD_IMM(d, i)   INSN(BPF_ALU64 | BPF_ADD | BPF_K, d, 0, 0, i)
+#define SUB_REG(d, s)   INSN(BPF_ALU64 | BPF_SUB | BPF_X, d, s, 0, 0)
+#define STX(sz, d, s, o) INSN(BPF_STX | BPF_MEM | (sz), d, s, o, 0)
+#define ST(sz, d, o, i) INSN(BPF_ST | BPF_MEM | (sz), d, 0, o, i)
+#define LDX(sz, d, s, o) INSN(BPF_LDX | BPF_MEM | (sz), d, s, o, 0)
+#define CALL(f)         INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define JEQ0(r, o)      INSN(BPF_JMP | BPF_JEQ | BPF_K, r, 0, o, 0)
+#define EXIT()          INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+static struct bpf_insn prog[512];
+static int n, fixups[64], nfix;
+
+static void emit(struct bpf_insn i) { prog[n++] = i; }
+static void map_fd(int reg, int fd) {
+    emit(INSN(BPF_LD | BPF_DW | BPF_IMM, reg, BPF_PSEUDO_MAP_FD, 0, fd));
+    emit(INSN(0, 0, 0, 0, 0));
+}
+static void key_call(int fd, int func, int val_off) {
+    map_fd(1, fd);
+    emit(MOV_REG(2, 10)); emit(ADD_IMM(2, -4));
+    if (func == BPF_FUNC_map_update_elem) {
+        emit(MOV_REG(3, 10)); emit(ADD_IMM(3, val_off));
+        emit(MOV_IMM(4, 0));
+    }
+    emit(CALL(func));
+}
+static void jump_out_if_null(int r) { fixups[nfix++] = n; emit(JEQ0(r, 0)); }
+static void finish(void) {
+    emit(MOV_IMM(0, 0));
+    for (int i = 0; i < nfix; i++)
+        prog[fixups[i]].off = n - 1 - fixups[i];
+    emit(EXIT());
+}
+
+static long sys_bpf(int cmd, union bpf_attr *a) { return syscall(__NR_bpf, cmd, a, sizeof(*a)); }
+
+static int map_create(int type, int key, int val, int entries) {
+    union bpf_attr a = { .map_type = type, .key_size = key, .value_size = val, .max_entries = entries };
+    int fd = sys_bpf(BPF_MAP_CREATE, &a);
+
+    if (fd < 0) { perror("map"); exit(1); }
+    return fd;
+}
+
+static int load(void) {
+    static char log[65536];
+    union bpf_attr a = {
+        .prog_type = BPF_PROG_TYPE_SOCKET_FILTER, .insns = (uintptr_t)prog, .insn_cnt = n,
+        .license = (uintptr_t)"GPL", .log_buf = (uintptr_t)log, .log_size = sizeof(log), .log_level = 1,
+    };
+    int fd = sys_bpf(BPF_PROG_LOAD, &a);
+
+    if (fd < 0) { fprintf(stderr, "load: %s\n%s\n", strerror(errno), log); exit(1); }
+    return fd;
+}
+
+static double run(int fd, int repeat) {
+    char pkt[64] = {0};
+    union bpf_attr a = { .test = { .prog_fd = fd, .data_in = (uintptr_t)pkt, .data_size_in = sizeof(pkt), .repeat = repeat } };
+
+    if (sys_bpf(BPF_PROG_TEST_RUN, &a)) { perror("test_run"); exit(1); }
+    return a.test.duration;
+}
+
+// Stack: fp-4 tid, fp-40..-8 call value (start, buf, ssl, readbytes), fp-48 ts
+static void enter_common(int tid) {
+    emit(ST(BPF_W, 10, -4, tid));
+    emit(CALL(BPF_FUNC_ktime_get_ns)); emit(MOV_REG(6, 0));
+    emit(STX(BPF_DW, 10, 6, -48));
+    emit(ST(BPF_DW, 10, -32, 0x1000)); emit(ST(BPF_DW, 10, -24, 0x2000)); emit(ST(BPF_DW, 10, -16, 0x3000));
+}
+
+static int build_old(int bufs, int start, int rb, int tid, int ex) {
+    n = nfix = 0;
+    enter_common(tid);
+    key_call(bufs, BPF_FUNC_map_update_elem, -32);   // {buf, ssl}
+    key_call(start, BPF_FUNC_map_update_elem, -48);
+    if (ex) key_call(rb, BPF_FUNC_map_update_elem, -16);
+    // uretprobe
+    if (ex) {
+        key_call(rb, BPF_FUNC_map_lookup_elem, 0); jump_out_if_null(0);
+        emit(LDX(BPF_DW, 8, 0, 0));
+        key_call(rb, BPF_FUNC_map_delete_elem, 0);
+    }
+    key_call(bufs, BPF_FUNC_map_lookup_elem, 0); jump_out_if_null(0);
+    emit(LDX(BPF_DW, 7, 0, 0)); emit(LDX(BPF_DW, 8, 0, 8));
+    key_call(start, BPF_FUNC_map_lookup_elem, 0); jump_out_if_null(0);
+    emit(LDX(BPF_DW, 7, 0, 0));
+    emit(CALL(BPF_FUNC_ktime_get_ns)); emit(SUB_REG(0, 7));
+    key_call(bufs, BPF_FUNC_map_delete_elem, 0);
+    key_call(start, BPF_FUNC_map_delete_elem, 0);
+    finish();
+    return load();
+}
+
+static int build_new(int calls, int tid) {
+    int skip;
+
+    n = nfix = 0;
+    enter_common(tid);
+    key_call(calls, BPF_FUNC_map_lookup_elem, 0);
+    skip = n; emit(JEQ0(0, 0));
+    emit(STX(BPF_DW, 0, 6, 0));
+    emit(ST(BPF_DW, 0, 8, 0x1000)); emit(ST(BPF_DW, 0, 16, 0x2000)); emit(ST(BPF_DW, 0, 24, 0x3000));
+    fixups[nfix++] = n; emit(INSN(BPF_JMP | BPF_JA, 0, 0, 0, 0));  // patched below
+    prog[skip].off = n - 1 - skip;
+    emit(STX(BPF_DW, 10, 6, -40));
+    key_call(calls, BPF_FUNC_map_update_elem, -40);
+    // uretprobe: prog[fixups[0]] jumps here
+    prog[fixups[0]].off = n - 1 - fixups[0]; nfix = 0;
+    key_call(calls, BPF_FUNC_map_lookup_elem, 0); jump_out_if_null(0);
+    emit(LDX(BPF_DW, 7, 0, 0)); jump_out_if_null(7);
+    emit(LDX(BPF_DW, 8, 0, 8)); emit(STX(BPF_DW, 10, 8, -32));
+    emit(LDX(BPF_DW, 8, 0, 16)); emit(STX(BPF_DW, 10, 8, -24));
+    emit(LDX(BPF_DW, 8, 0, 24)); emit(STX(BPF_DW, 10, 8, -16));
+    emit(ST(BPF_DW, 0, 0, 0));
+    emit(CALL(BPF_FUNC_ktime_get_ns)); emit(SUB_REG(0, 7));
+    finish();
+    return load();
+}
+
+static int build_base(int tid) {
+    n = nfix = 0;
+    enter_common(tid);
+    emit(CALL(BPF_FUNC_ktime_get_ns));
+    finish();
+    return load();
+}
+
+static void stats_avg(int fd, double *avg) {
+    struct bpf_prog_info info = {0};
+    union bpf_attr a = { .info = { .bpf_fd = fd, .info_len = sizeof(info), .info = (uintptr_t)&info } };
+
+    *avg = 0;
+    if (!sys_bpf(BPF_OBJ_GET_INFO_BY_FD, &a) && info.run_cnt)
+        *avg = (double)info.run_time_ns / info.run_cnt;
+}
+
+static int cmp(const void *a, const void *b) { double x = *(double *)a, y = *(double *)b; return x < y ? -1 : x > y; }
+
+static void measure(const char *name, int fd, double base) {
+    double r[15], avg;
+
+    run(fd, 100000);
+    for (int i = 0; i < 15; i++)
+        r[i] = run(fd, 1000000);
+    qsort(r, 15, sizeof(r[0]), cmp);
+    stats_avg(fd, &avg);
+    printf("%-28s median %6.1f ns  min %6.1f  max %6.1f  map work %6.1f  run_time avg %6.1f\n",
+           name, r[7], r[0], r[14], r[7] - base, avg);
+}
+
+int main(int argc, char **argv) {
+    int entries = 10240, call_sz = 32, live = argc > 1 ? atoi(argv[1]) : 0;
+    int bufs = map_create(BPF_MAP_TYPE_HASH, 4, 16, entries);
+    int start = map_create(BPF_MAP_TYPE_HASH, 4, 8, entries);
+    int rb = map_create(BPF_MAP_TYPE_HASH, 4, 8, entries);
+    int calls = map_create(BPF_MAP_TYPE_LRU_HASH, 4, call_sz, entries);
+    int base_fd, old_fd, old_ex_fd, new_fd, tid = 4242;
+    double br[15];
+    union bpf_attr st = { .enable_stats = { .type = BPF_STATS_RUN_TIME } };
+
+    if (sys_bpf(BPF_ENABLE_STATS, &st) < 0)
+        perror("BPF_ENABLE_STATS, run_time avg will read 0");
+
+    // Other threads' calls in flight, so the old maps are not empty
+    for (int i = 0; i < live; i++) {
+        uint32_t k = 100000 + i;
+        uint64_t v[4] = {1, 2, 3, 4};
+        union bpf_attr a = { .map_fd = bufs, .key = (uintptr_t)&k, .value = (uintptr_t)v };
+
+        sys_bpf(BPF_MAP_UPDATE_ELEM, &a);
+        a.map_fd = start; sys_bpf(BPF_MAP_UPDATE_ELEM, &a);
+        a.map_fd = calls; sys_bpf(BPF_MAP_UPDATE_ELEM, &a);
+    }
+
+    base_fd = build_base(tid);
+    old_fd = build_old(bufs, start, rb, tid, 0);
+    old_ex_fd = build_old(bufs, start, rb, tid, 1);
+    new_fd = build_new(calls, tid);
+
+    run(base_fd, 100000);
+    for (int i = 0; i < 15; i++)
+        br[i] = run(base_fd, 1000000);
+    qsort(br, 15, sizeof(br[0]), cmp);
+    printf("in flight on other threads: %d\n", live);
+    printf("%-28s median %6.1f ns\n", "base (2x ktime)", br[7]);
+    measure("old SSL_read/SSL_write", old_fd, br[7]);
+    measure("old SSL_read_ex/_write_ex", old_ex_fd, br[7]);
+    measure("new ssl_calls slot", new_fd, br[7]);
+    // Every path must have found and cleared its own state
+    {
+        uint32_t k = tid;
+        uint64_t v[4];
+        union bpf_attr a = { .map_fd = calls, .key = (uintptr_t)&k, .value = (uintptr_t)v };
+
+        if (sys_bpf(BPF_MAP_LOOKUP_ELEM, &a) || v[0] || v[1] != 0x1000 || v[3] != 0x3000) {
+            fprintf(stderr, "ssl_calls slot not taken as expected\n");
+            return 1;
+        }
+        for (int i = 0; i < 3; i++) {
+            a.map_fd = (int[]){bufs, start, rb}[i];
+            if (!sys_bpf(BPF_MAP_LOOKUP_ELEM, &a)) {
+                fprintf(stderr, "old map entry left behind\n");
+                return 1;
+            }
+        }
+    }
+    return 0;
+}